@@ -32,6 +32,7 @@
 #include <stdexcept>
 #include <set>
 #include <map>
+#include <thread>
 
 #include "../include/ZeroTierOne.h"
 #include "../node/Constants.hpp"
@@ -55,8 +56,11 @@ using json = nlohmann::json;
 // Number of requests to remember in member history
 #define ZT_NETCONF_DB_MEMBER_HISTORY_LENGTH 2
 
-// Min duration between requests for an address/nwid combo to prevent floods
-#define ZT_NETCONF_MIN_REQUEST_PERIOD 1000
+// Default number of members per page when listing members with pagination
+#define ZT_NETCONF_MEMBER_LIST_DEFAULT_LIMIT 1000
+
+// Maximum members read per acquisition of the DB lock when listing members
+#define ZT_NETCONF_MEMBER_LIST_PAGE_SIZE 256
 
 // Nodes are considered active if they've queried in less than this long
 #define ZT_NETCONF_NODE_ACTIVE_THRESHOLD (ZT_NETWORK_AUTOCONF_DELAY * 2)
@@ -241,6 +245,23 @@ static json _renderRule(ZT_VirtualNetworkRule &rule)
 	return r;
 }
 
+// Gets IPs that count as allocated for a member (only authorized members hold IPs)
+static void _getMemberAllocatedIps(const json &member,std::vector<InetAddress> &ips)
+{
+	if ((!member.is_object())||(!member.count("authorized"))||(!member.count("ipAssignments")))
+		return;
+	if (!OSUtils::jsonBool(member["authorized"],false))
+		return;
+	const json &mips = member["ipAssignments"];
+	if (mips.is_array()) {
+		for(unsigned long i=0;i<mips.size();++i) {
+			InetAddress mip(OSUtils::jsonString(mips[i],""));
+			if ((mip.ss_family == AF_INET)||(mip.ss_family == AF_INET6))
+				ips.push_back(mip);
+		}
+	}
+}
+
 static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 {
 	if (!r.is_object())
@@ -428,10 +449,21 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 	return false;
 }
 
-EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath) :
+static unsigned int _workerThreadCount(unsigned int threadCount)
+{
+	if (!threadCount) {
+		threadCount = (unsigned int)std::thread::hardware_concurrency();
+		if (threadCount < ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT)
+			threadCount = ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT;
+	}
+	return std::min(threadCount,(unsigned int)ZT_EMBEDDEDNETWORKCONTROLLER_MAX_BACKGROUND_THREAD_COUNT);
+}
+
+EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath,unsigned int threadCount,bool syncDbWrites) :
 	_startTime(OSUtils::now()),
+	_threadCount(_workerThreadCount(threadCount)),
 	_threadsStarted(false),
-	_db(dbPath),
+	_db(dbPath,syncDbWrites),
 	_node(node)
 {
 }
@@ -440,10 +472,10 @@ EmbeddedNetworkController::~EmbeddedNetworkController()
 {
 	Mutex::Lock _l(_threads_m);
 	if (_threadsStarted) {
-		for(int i=0;i<(ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT*2);++i)
+		for(unsigned int i=0;i<(_threadCount*2);++i)
 			_queue.post((_RQEntry *)0);
-		for(int i=0;i<ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT;++i)
-			Thread::join(_threads[i]);
+		for(std::vector<Thread>::iterator t(_threads.begin());t!=_threads.end();++t)
+			Thread::join(*t);
 	}
 }
 
@@ -466,7 +498,11 @@ void EmbeddedNetworkController::request(
 	{
 		Mutex::Lock _l(_threads_m);
 		if (!_threadsStarted) {
-			for(int i=0;i<ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT;++i)
+			// All workers take from one queue, so an idle worker always picks up the
+			// next request and requests for different networks run in parallel.
+			// Thread is not safe to relocate, so size the vector once and assign in place
+			_threads.resize(_threadCount);
+			for(unsigned int i=0;i<_threadCount;++i)
 				_threads[i] = Thread::start(this);
 		}
 		_threadsStarted = true;
@@ -526,18 +562,77 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 						return 200;
 					} else {
 
-						Mutex::Lock _l(_db_m);
+						// With no arguments this returns the legacy { id: revision } object. If cursor, limit,
+						// or fields is given it returns a page of member objects and a cursor for the next page.
+						// Either way members are read a page at a time so _db_m is not held for the whole dump.
+						const std::string pfx(std::string("network/") + nwids + "/member/");
+						const bool paged = ((urlArgs.count("cursor") > 0)||(urlArgs.count("limit") > 0)||(urlArgs.count("fields") > 0));
+
+						std::string cursor;
+						std::map<std::string,std::string>::const_iterator a(urlArgs.find("cursor"));
+						if ((a != urlArgs.end())&&(a->second.length() > 0))
+							cursor = pfx + Address(Utils::hexStrToU64(a->second.c_str())).toString();
+
+						unsigned long limit = 0xffffffffUL;
+						a = urlArgs.find("limit");
+						if (a != urlArgs.end()) {
+							limit = (unsigned long)Utils::strToU64(a->second.c_str());
+							if (!limit)
+								limit = ZT_NETCONF_MEMBER_LIST_DEFAULT_LIMIT;
+						} else if (paged) {
+							limit = ZT_NETCONF_MEMBER_LIST_DEFAULT_LIMIT;
+						}
+
+						std::vector<std::string> fields;
+						a = urlArgs.find("fields");
+						if (a != urlArgs.end())
+							fields = OSUtils::split(a->second.c_str(),",","","");
 
-						responseBody = "{";
-						_db.filter((std::string("network/") + nwids + "/member/"),[&responseBody](const std::string &n,const json &member) {
-							if ((member.is_object())&&(member.size() > 0)) {
-								responseBody.append((responseBody.length() == 1) ? "\"" : ",\"");
-								responseBody.append(OSUtils::jsonString(member["id"],"0"));
-								responseBody.append("\":");
-								responseBody.append(OSUtils::jsonString(member["revision"],"0"));
+						const uint64_t now = OSUtils::now();
+						unsigned long count = 0,emitted = 0;
+						responseBody = (paged) ? "{\"members\":[" : "{";
+						do {
+							Mutex::Lock _l(_db_m);
+							cursor = _db.page(pfx,cursor,std::min(limit - count,(unsigned long)ZT_NETCONF_MEMBER_LIST_PAGE_SIZE),[this,&responseBody,&count,&emitted,&fields,&paged,&now](const std::string &n,const json &member) {
+								if ((member.is_object())&&(member.size() > 0)) {
+									if (paged) {
+										if (emitted)
+											responseBody.push_back(',');
+										json m(member);
+										_addMemberNonPersistedFields(m,now);
+										if (fields.empty()) {
+											responseBody.append(m.dump());
+										} else {
+											json pm = json::object();
+											for(std::vector<std::string>::const_iterator f(fields.begin());f!=fields.end();++f) {
+												json::const_iterator fv(m.find(*f));
+												if (fv != m.end())
+													pm[*f] = *fv;
+											}
+											responseBody.append(pm.dump());
+										}
+									} else {
+										responseBody.append((emitted) ? ",\"" : "\"");
+										responseBody.append(OSUtils::jsonString(member["id"],"0"));
+										responseBody.append("\":");
+										responseBody.append(OSUtils::jsonString(member["revision"],"0"));
+									}
+									++emitted;
+								}
+								++count;
+							});
+						} while ((cursor.length() > 0)&&(count < limit));
+
+						if (paged) {
+							responseBody.append("],\"nextCursor\":");
+							if (cursor.length() > pfx.length()) {
+								responseBody.push_back('"');
+								responseBody.append(cursor.substr(pfx.length()));
+								responseBody.push_back('"');
+							} else {
+								responseBody.append("null");
 							}
-							return true; // never delete
-						});
+						}
 						responseBody.push_back('}');
 						responseContentType = "application/json";
 
@@ -738,7 +833,9 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 						{
 							Mutex::Lock _l(_db_m);
 							_db.put("network",nwids,"member",Address(address).toString(),member);
+							_updateIpAllocations(nwid,origMember,member);
 						}
+						_clearConfigCache(nwid,address);
 						_pushMemberUpdate(now,nwid,member);
 					}
 
@@ -1048,6 +1145,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 						Mutex::Lock _l(_db_m);
 						_db.put("network",nwids,network);
 					}
+					_clearConfigCache(nwid,0);
 
 					// Send an update to all members of the network
 					_db.filter((std::string("network/") + nwids + "/member/"),[this,&now,&nwid](const std::string &n,const json &obj) {
@@ -1117,6 +1215,8 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 
 					json member = _db.get("network",nwids,"member",Address(address).toString());
 					_db.erase("network",nwids,"member",Address(address).toString());
+					_updateIpAllocations(nwid,member,json());
+					_clearConfigCache(nwid,address);
 
 					if (!member.size())
 						return 404;
@@ -1133,8 +1233,8 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 					return false; // delete
 				});
 
-				Mutex::Lock _l2(_nmiCache_m);
-				_nmiCache.erase(nwid);
+				Mutex::Lock _l2(_networkStates_m);
+				_networkStates.erase(nwid);
 
 				responseBody = OSUtils::jsonDump(network);
 				responseContentType = "application/json";
@@ -1405,6 +1505,7 @@ void EmbeddedNetworkController::_request(
 			member["lastModified"] = now;
 			Mutex::Lock _l(_db_m);
 			_db.put("network",nwids,"member",identity.address().toString(),member);
+			_updateIpAllocations(nwid,origMember,member);
 		}
 		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_ACCESS_DENIED);
 		return;
@@ -1431,204 +1532,172 @@ void EmbeddedNetworkController::_request(
 		}
 	}
 
-	nc.networkId = nwid;
-	nc.type = OSUtils::jsonBool(network["private"],true) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
+	const SharedPtr<_NetworkState> ns(_getNetworkState(nwid,true));
+	const SharedPtr<_CompiledNetwork> cn(_getCompiledNetwork(ns,nwid,network));
+
+	nc = cn->base;
 	nc.timestamp = now;
 	nc.credentialTimeMaxDelta = credentialtmd;
-	nc.revision = OSUtils::jsonInt(network["revision"],0ULL);
 	nc.issuedTo = identity.address();
-	if (OSUtils::jsonBool(network["enableBroadcast"],true)) nc.flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
-	if (OSUtils::jsonBool(network["allowPassiveBridging"],false)) nc.flags |= ZT_NETWORKCONFIG_FLAG_ALLOW_PASSIVE_BRIDGING;
-	Utils::scopy(nc.name,sizeof(nc.name),OSUtils::jsonString(network["name"],"").c_str());
-	nc.multicastLimit = (unsigned int)OSUtils::jsonInt(network["multicastLimit"],32ULL);
 
 	for(std::set<Address>::const_iterator ab(nmi.activeBridges.begin());ab!=nmi.activeBridges.end();++ab) {
 		nc.addSpecialist(*ab,ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
 	}
 
-	json &v4AssignMode = network["v4AssignMode"];
-	json &v6AssignMode = network["v6AssignMode"];
-	json &ipAssignmentPools = network["ipAssignmentPools"];
-	json &routes = network["routes"];
-	json &rules = network["rules"];
-	json &capabilities = network["capabilities"];
-	json &tags = network["tags"];
-	json &memberCapabilities = member["capabilities"];
-	json &memberTags = member["tags"];
-
-	if (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0) <= 0) {
+	const bool legacyRules = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0) <= 0);
+	if (legacyRules) {
 		// Old versions with no rules engine support get an allow everything rule.
 		// Since rules are enforced bidirectionally, newer versions *will* still
 		// enforce rules on the inbound side.
 		nc.ruleCount = 1;
+		memset(&(nc.rules[0]),0,sizeof(ZT_VirtualNetworkRule));
 		nc.rules[0].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
-	} else {
-		if (rules.is_array()) {
-			for(unsigned long i=0;i<rules.size();++i) {
-				if (nc.ruleCount >= ZT_MAX_NETWORK_RULES)
-					break;
-				if (_parseRule(rules[i],nc.rules[nc.ruleCount]))
-					++nc.ruleCount;
+	}
+
+	// Re-use this member's signed credentials if nothing about the member or network
+	// has changed and they are young enough to stay within the credential max delta
+	// of peers' configs for a while longer.
+	const uint64_t memberRevision = OSUtils::jsonInt(member["revision"],0ULL);
+	bool haveCachedMemberConfig = false;
+	{
+		Mutex::Lock _l(ns->config_m);
+		std::map< uint64_t,_MemberConfig >::iterator mc(ns->memberConfigs.find(identity.address().toInt()));
+		if (mc != ns->memberConfigs.end()) {
+			const _MemberConfig &c = mc->second;
+			if ( (c.networkRevision == cn->revision) && (c.memberRevision == memberRevision) && (c.legacyRules == legacyRules) && (now >= c.timestamp) && ((now - c.timestamp) < (credentialtmd / 4)) ) {
+				nc.flags |= c.flags;
+				for(std::vector<Capability>::const_iterator cap(c.capabilities.begin());cap!=c.capabilities.end();++cap)
+					nc.capabilities[nc.capabilityCount++] = *cap;
+				for(std::vector<Tag>::const_iterator t(c.tags.begin());t!=c.tags.end();++t)
+					nc.tags[nc.tagCount++] = *t;
+				for(std::vector<InetAddress>::const_iterator ip(c.staticIps.begin());ip!=c.staticIps.end();++ip)
+					nc.staticIps[nc.staticIpCount++] = *ip;
+				if (nc.staticIpCount) {
+					nc.certificatesOfOwnership[0] = c.coo;
+					nc.certificateOfOwnershipCount = 1;
+				}
+				haveCachedMemberConfig = true;
+			} else {
+				ns->memberConfigs.erase(mc);
 			}
 		}
+	}
 
-		std::map< uint64_t,json * > capsById;
-		if (!memberCapabilities.is_array())
-			memberCapabilities = json::array();
-		if (capabilities.is_array()) {
-			for(unsigned long i=0;i<capabilities.size();++i) {
-				json &cap = capabilities[i];
-				if (cap.is_object()) {
-					const uint64_t id = OSUtils::jsonInt(cap["id"],0ULL) & 0xffffffffULL;
-					capsById[id] = &cap;
-					if ((newMember)&&(OSUtils::jsonBool(cap["default"],false))) {
+	if (!haveCachedMemberConfig) {
+		json &memberCapabilities = member["capabilities"];
+		json &memberTags = member["tags"];
+
+		if (!legacyRules) {
+			if (!memberCapabilities.is_array())
+				memberCapabilities = json::array();
+			if (newMember) {
+				for(std::map< uint32_t,_CompiledNetwork::_Capability >::const_iterator cap(cn->capabilities.begin());cap!=cn->capabilities.end();++cap) {
+					if (cap->second.dflt) {
 						bool have = false;
 						for(unsigned long i=0;i<memberCapabilities.size();++i) {
-							if (id == (OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL)) {
+							if (cap->first == (uint32_t)(OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL)) {
 								have = true;
 								break;
 							}
 						}
 						if (!have)
-							memberCapabilities.push_back(id);
+							memberCapabilities.push_back(cap->first);
 					}
 				}
 			}
-		}
-		for(unsigned long i=0;i<memberCapabilities.size();++i) {
-			const uint64_t capId = OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL;
-			std::map< uint64_t,json * >::const_iterator ctmp = capsById.find(capId);
-			if (ctmp != capsById.end()) {
-				json *cap = ctmp->second;
-				if ((cap)&&(cap->is_object())&&(cap->size() > 0)) {
-					ZT_VirtualNetworkRule capr[ZT_MAX_CAPABILITY_RULES];
-					unsigned int caprc = 0;
-					json &caprj = (*cap)["rules"];
-					if ((caprj.is_array())&&(caprj.size() > 0)) {
-						for(unsigned long j=0;j<caprj.size();++j) {
-							if (caprc >= ZT_MAX_CAPABILITY_RULES)
-								break;
-							if (_parseRule(caprj[j],capr[caprc]))
-								++caprc;
-						}
-					}
-					nc.capabilities[nc.capabilityCount] = Capability((uint32_t)capId,nwid,now,1,capr,caprc);
+			for(unsigned long i=0;i<memberCapabilities.size();++i) {
+				const uint32_t capId = (uint32_t)(OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL);
+				std::map< uint32_t,_CompiledNetwork::_Capability >::const_iterator cap(cn->capabilities.find(capId));
+				if (cap != cn->capabilities.end()) {
+					nc.capabilities[nc.capabilityCount] = Capability(capId,nwid,now,1,cap->second.rules,cap->second.ruleCount);
 					if (nc.capabilities[nc.capabilityCount].sign(_signingId,identity.address()))
 						++nc.capabilityCount;
 					if (nc.capabilityCount >= ZT_MAX_NETWORK_CAPABILITIES)
 						break;
 				}
 			}
-		}
 
-		std::map< uint32_t,uint32_t > memberTagsById;
-		if (memberTags.is_array()) {
-			for(unsigned long i=0;i<memberTags.size();++i) {
-				json &t = memberTags[i];
-				if ((t.is_array())&&(t.size() == 2))
-					memberTagsById[(uint32_t)(OSUtils::jsonInt(t[0],0ULL) & 0xffffffffULL)] = (uint32_t)(OSUtils::jsonInt(t[1],0ULL) & 0xffffffffULL);
-			}
-		}
-		if (tags.is_array()) { // check network tags array for defaults that are not present in member tags
-			for(unsigned long i=0;i<tags.size();++i) {
-				json &t = tags[i];
-				if (t.is_object()) {
-					const uint32_t id = (uint32_t)(OSUtils::jsonInt(t["id"],0) & 0xffffffffULL);
-					json &dfl = t["default"];
-					if ((dfl.is_number())&&(memberTagsById.find(id) == memberTagsById.end())) {
-						memberTagsById[id] = (uint32_t)(OSUtils::jsonInt(dfl,0) & 0xffffffffULL);
-						json mt = json::array();
-						mt.push_back(id);
-						mt.push_back(dfl);
-						memberTags.push_back(mt); // add default to member tags if not present
-					}
+			std::map< uint32_t,uint32_t > memberTagsById;
+			if (memberTags.is_array()) {
+				for(unsigned long i=0;i<memberTags.size();++i) {
+					json &t = memberTags[i];
+					if ((t.is_array())&&(t.size() == 2))
+						memberTagsById[(uint32_t)(OSUtils::jsonInt(t[0],0ULL) & 0xffffffffULL)] = (uint32_t)(OSUtils::jsonInt(t[1],0ULL) & 0xffffffffULL);
 				}
 			}
-		}
-		for(std::map< uint32_t,uint32_t >::const_iterator t(memberTagsById.begin());t!=memberTagsById.end();++t) {
-			if (nc.tagCount >= ZT_MAX_NETWORK_TAGS)
-				break;
-			nc.tags[nc.tagCount] = Tag(nwid,now,identity.address(),t->first,t->second);
-			if (nc.tags[nc.tagCount].sign(_signingId))
-				++nc.tagCount;
-		}
-	}
-
-	if (routes.is_array()) {
-		for(unsigned long i=0;i<routes.size();++i) {
-			if (nc.routeCount >= ZT_MAX_NETWORK_ROUTES)
-				break;
-			json &route = routes[i];
-			json &target = route["target"];
-			json &via = route["via"];
-			if (target.is_string()) {
-				const InetAddress t(target.get<std::string>());
-				InetAddress v;
-				if (via.is_string()) v.fromString(via.get<std::string>());
-				if ((t.ss_family == AF_INET)||(t.ss_family == AF_INET6)) {
-					ZT_VirtualNetworkRoute *r = &(nc.routes[nc.routeCount]);
-					*(reinterpret_cast<InetAddress *>(&(r->target))) = t;
-					if (v.ss_family == t.ss_family)
-						*(reinterpret_cast<InetAddress *>(&(r->via))) = v;
-					++nc.routeCount;
+			for(std::map< uint32_t,uint32_t >::const_iterator t(cn->tagDefaults.begin());t!=cn->tagDefaults.end();++t) {
+				if (memberTagsById.find(t->first) == memberTagsById.end()) {
+					memberTagsById[t->first] = t->second;
+					json mt = json::array();
+					mt.push_back(t->first);
+					mt.push_back(t->second);
+					memberTags.push_back(mt); // add default to member tags if not present
 				}
 			}
+			for(std::map< uint32_t,uint32_t >::const_iterator t(memberTagsById.begin());t!=memberTagsById.end();++t) {
+				if (nc.tagCount >= ZT_MAX_NETWORK_TAGS)
+					break;
+				nc.tags[nc.tagCount] = Tag(nwid,now,identity.address(),t->first,t->second);
+				if (nc.tags[nc.tagCount].sign(_signingId))
+					++nc.tagCount;
+			}
 		}
-	}
 
-	const bool noAutoAssignIps = OSUtils::jsonBool(member["noAutoAssignIps"],false);
-
-	if ((v6AssignMode.is_object())&&(!noAutoAssignIps)) {
-		if ((OSUtils::jsonBool(v6AssignMode["rfc4193"],false))&&(nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
-			nc.staticIps[nc.staticIpCount++] = InetAddress::makeIpv6rfc4193(nwid,identity.address().toInt());
-			nc.flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION;
-		}
-		if ((OSUtils::jsonBool(v6AssignMode["6plane"],false))&&(nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
-			nc.staticIps[nc.staticIpCount++] = InetAddress::makeIpv66plane(nwid,identity.address().toInt());
-			nc.flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION;
-		}
-	}
+		const bool noAutoAssignIps = OSUtils::jsonBool(member["noAutoAssignIps"],false);
+		uint64_t memberFlags = 0;
 
-	bool haveManagedIpv4AutoAssignment = false;
-	bool haveManagedIpv6AutoAssignment = false; // "special" NDP-emulated address types do not count
-	json ipAssignments = member["ipAssignments"]; // we want to make a copy
-	if (ipAssignments.is_array()) {
-		for(unsigned long i=0;i<ipAssignments.size();++i) {
-			if (!ipAssignments[i].is_string())
-				continue;
-			std::string ips = ipAssignments[i];
-			InetAddress ip(ips);
-
-			// IP assignments are only pushed if there is a corresponding local route. We also now get the netmask bits from
-			// this route, ignoring the netmask bits field of the assigned IP itself. Using that was worthless and a source
-			// of user error / poor UX.
-			int routedNetmaskBits = 0;
-			for(unsigned int rk=0;rk<nc.routeCount;++rk) {
-				if ( (!nc.routes[rk].via.ss_family) && (reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->containsAddress(ip)) )
-					routedNetmaskBits = reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->netmaskBits();
+		if (!noAutoAssignIps) {
+			if ((cn->v6AssignRfc4193)&&(nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
+				nc.staticIps[nc.staticIpCount++] = InetAddress::makeIpv6rfc4193(nwid,identity.address().toInt());
+				memberFlags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION;
+			}
+			if ((cn->v6Assign6plane)&&(nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
+				nc.staticIps[nc.staticIpCount++] = InetAddress::makeIpv66plane(nwid,identity.address().toInt());
+				memberFlags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION;
 			}
+		}
+		nc.flags |= memberFlags;
+
+		bool haveManagedIpv4AutoAssignment = false;
+		bool haveManagedIpv6AutoAssignment = false; // "special" NDP-emulated address types do not count
+		json ipAssignments = member["ipAssignments"]; // we want to make a copy
+		if (ipAssignments.is_array()) {
+			for(unsigned long i=0;i<ipAssignments.size();++i) {
+				if (!ipAssignments[i].is_string())
+					continue;
+				std::string ips = ipAssignments[i];
+				InetAddress ip(ips);
+
+				// IP assignments are only pushed if there is a corresponding local route. We also now get the netmask bits from
+				// this route, ignoring the netmask bits field of the assigned IP itself. Using that was worthless and a source
+				// of user error / poor UX.
+				int routedNetmaskBits = 0;
+				for(unsigned int rk=0;rk<nc.routeCount;++rk) {
+					if ( (!nc.routes[rk].via.ss_family) && (reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->containsAddress(ip)) )
+						routedNetmaskBits = reinterpret_cast<const InetAddress *>(&(nc.routes[rk].target))->netmaskBits();
+				}
 
-			if (routedNetmaskBits > 0) {
-				if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
-					ip.setPort(routedNetmaskBits);
-					nc.staticIps[nc.staticIpCount++] = ip;
+				if (routedNetmaskBits > 0) {
+					if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
+						ip.setPort(routedNetmaskBits);
+						nc.staticIps[nc.staticIpCount++] = ip;
+					}
+					if (ip.ss_family == AF_INET)
+						haveManagedIpv4AutoAssignment = true;
+					else if (ip.ss_family == AF_INET6)
+						haveManagedIpv6AutoAssignment = true;
 				}
-				if (ip.ss_family == AF_INET)
-					haveManagedIpv4AutoAssignment = true;
-				else if (ip.ss_family == AF_INET6)
-					haveManagedIpv6AutoAssignment = true;
 			}
+		} else {
+			ipAssignments = json::array();
 		}
-	} else {
-		ipAssignments = json::array();
-	}
 
-	if ( (ipAssignmentPools.is_array()) && ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false))) && (!haveManagedIpv6AutoAssignment) && (!noAutoAssignIps) ) {
-		for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv6AutoAssignment));++p) {
-			json &pool = ipAssignmentPools[p];
-			if (pool.is_object()) {
-				InetAddress ipRangeStart(OSUtils::jsonString(pool["ipRangeStart"],""));
-				InetAddress ipRangeEnd(OSUtils::jsonString(pool["ipRangeEnd"],""));
+		if ( (cn->v6AssignZt) && (!haveManagedIpv6AutoAssignment) && (!noAutoAssignIps) ) {
+			Mutex::Lock _l(ns->allocatedIps_m);
+			IpAllocationMap &allocatedIps = ns->allocatedIps;
+			for(std::vector< std::pair<InetAddress,InetAddress> >::const_iterator pool(cn->ipAssignmentPools.begin());((pool!=cn->ipAssignmentPools.end())&&(!haveManagedIpv6AutoAssignment));++pool) {
+				const InetAddress &ipRangeStart = pool->first;
+				const InetAddress &ipRangeEnd = pool->second;
 				if ( (ipRangeStart.ss_family == AF_INET6) && (ipRangeEnd.ss_family == AF_INET6) ) {
 					uint64_t s[2],e[2],x[2],xx[2];
 					memcpy(s,ipRangeStart.rawIpData(),16);
@@ -1668,41 +1737,52 @@ void EmbeddedNetworkController::_request(
 						}
 
 						// If it's routed, then try to claim and assign it and if successful end loop
-						if ((routedNetmaskBits > 0)&&(!nmi.allocatedIps.count(ip6))) {
+						if ((routedNetmaskBits > 0)&&(!allocatedIps.has(ip6))) {
+							allocatedIps.add(ip6);
 							ipAssignments.push_back(ip6.toIpString());
 							member["ipAssignments"] = ipAssignments;
 							ip6.setPort((unsigned int)routedNetmaskBits);
 							if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)
 								nc.staticIps[nc.staticIpCount++] = ip6;
 							haveManagedIpv6AutoAssignment = true;
-							_clearNetworkMemberInfoCache(nwid); // clear cache to prevent IP assignment duplication on many rapid assigns
 							break;
 						}
 					}
 				}
 			}
 		}
-	}
 
-	if ( (ipAssignmentPools.is_array()) && ((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false))) && (!haveManagedIpv4AutoAssignment) && (!noAutoAssignIps) ) {
-		for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv4AutoAssignment));++p) {
-			json &pool = ipAssignmentPools[p];
-			if (pool.is_object()) {
-				InetAddress ipRangeStartIA(OSUtils::jsonString(pool["ipRangeStart"],""));
-				InetAddress ipRangeEndIA(OSUtils::jsonString(pool["ipRangeEnd"],""));
+		if ( (cn->v4AssignZt) && (!haveManagedIpv4AutoAssignment) && (!noAutoAssignIps) ) {
+			Mutex::Lock _l(ns->allocatedIps_m);
+			IpAllocationMap &allocatedIps = ns->allocatedIps;
+			for(std::vector< std::pair<InetAddress,InetAddress> >::const_iterator pool(cn->ipAssignmentPools.begin());((pool!=cn->ipAssignmentPools.end())&&(!haveManagedIpv4AutoAssignment));++pool) {
+				const InetAddress &ipRangeStartIA = pool->first;
+				const InetAddress &ipRangeEndIA = pool->second;
 				if ( (ipRangeStartIA.ss_family == AF_INET) && (ipRangeEndIA.ss_family == AF_INET) ) {
-					uint32_t ipRangeStart = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeStartIA)->sin_addr.s_addr));
-					uint32_t ipRangeEnd = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeEndIA)->sin_addr.s_addr));
+					uint32_t ipRangeStart = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ipRangeStartIA)->sin_addr.s_addr));
+					uint32_t ipRangeEnd = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ipRangeEndIA)->sin_addr.s_addr));
 					if ((ipRangeEnd < ipRangeStart)||(ipRangeStart == 0))
 						continue;
 					uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
 
-					// Start with the LSB of the member's address
-					uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
+					// Start with the LSB of the member's address, then take free addresses from the
+					// allocation map up to the end of the pool and wrap around to the start once.
+					const uint32_t ipHint = (ipRangeLen > 0) ? (ipRangeStart + ((uint32_t)(identity.address().toInt() & 0xffffffff) % ipRangeLen)) : ipRangeStart;
+					uint64_t nextTrial = ipHint;
+					bool wrapped = false;
+
+					for(unsigned int trialCount=0;trialCount<1000;++trialCount) {
+						const uint32_t segmentEnd = (wrapped) ? (ipHint - 1) : ipRangeEnd;
+						uint32_t ip = 0;
+						if ((nextTrial > (uint64_t)segmentEnd)||(!allocatedIps.nextFreeV4((uint32_t)nextTrial,segmentEnd,ip))) {
+							if ((wrapped)||(ipHint == ipRangeStart))
+								break; // no free addresses left in this pool
+							wrapped = true;
+							nextTrial = ipRangeStart;
+							continue;
+						}
+						nextTrial = (uint64_t)ip + 1;
 
-					for(uint32_t k=ipRangeStart,trialCount=0;((k<=ipRangeEnd)&&(trialCount < 1000));++k,++trialCount) {
-						uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
-						++ipTrialCounter;
 						if ((ip & 0x000000ff) == 0x000000ff)
 							continue; // don't allow addresses that end in .255
 
@@ -1719,9 +1799,10 @@ void EmbeddedNetworkController::_request(
 							}
 						}
 
-						// If it's routed, then try to claim and assign it and if successful end loop
-						const InetAddress ip4(Utils::hton(ip),0);
-						if ((routedNetmaskBits > 0)&&(!nmi.allocatedIps.count(ip4))) {
+						// If it's routed, then claim and assign it and end loop
+						if (routedNetmaskBits > 0) {
+							allocatedIps.addV4(ip);
+							const InetAddress ip4(Utils::hton(ip),0);
 							ipAssignments.push_back(ip4.toIpString());
 							member["ipAssignments"] = ipAssignments;
 							if (nc.staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
@@ -1731,22 +1812,34 @@ void EmbeddedNetworkController::_request(
 								v4ip->sin_addr.s_addr = Utils::hton(ip);
 							}
 							haveManagedIpv4AutoAssignment = true;
-							_clearNetworkMemberInfoCache(nwid); // clear cache to prevent IP assignment duplication on many rapid assigns
 							break;
 						}
 					}
 				}
 			}
 		}
-	}
 
-	// Issue a certificate of ownership for all static IPs
-	if (nc.staticIpCount) {
-		nc.certificatesOfOwnership[0] = CertificateOfOwnership(nwid,now,identity.address(),1);
-		for(unsigned int i=0;i<nc.staticIpCount;++i)
-			nc.certificatesOfOwnership[0].addThing(nc.staticIps[i]);
-		nc.certificatesOfOwnership[0].sign(_signingId);
-		nc.certificateOfOwnershipCount = 1;
+		// Issue a certificate of ownership for all static IPs
+		if (nc.staticIpCount) {
+			nc.certificatesOfOwnership[0] = CertificateOfOwnership(nwid,now,identity.address(),1);
+			for(unsigned int i=0;i<nc.staticIpCount;++i)
+				nc.certificatesOfOwnership[0].addThing(nc.staticIps[i]);
+			nc.certificatesOfOwnership[0].sign(_signingId);
+			nc.certificateOfOwnershipCount = 1;
+		}
+
+		Mutex::Lock _l(ns->config_m);
+		_MemberConfig &c = ns->memberConfigs[identity.address().toInt()];
+		c.timestamp = now;
+		c.networkRevision = cn->revision;
+		c.memberRevision = memberRevision;
+		c.legacyRules = legacyRules;
+		c.flags = memberFlags;
+		c.capabilities.assign(nc.capabilities,nc.capabilities + nc.capabilityCount);
+		c.tags.assign(nc.tags,nc.tags + nc.tagCount);
+		c.staticIps.assign(nc.staticIps,nc.staticIps + nc.staticIpCount);
+		if (nc.certificateOfOwnershipCount)
+			c.coo = nc.certificatesOfOwnership[0];
 	}
 
 	CertificateOfMembership com(now,credentialtmd,nwid,identity.address());
@@ -1761,9 +1854,10 @@ void EmbeddedNetworkController::_request(
 		member["lastModified"] = now;
 		Mutex::Lock _l(_db_m);
 		_db.put("network",nwids,"member",identity.address().toString(),member);
+		_updateIpAllocations(nwid,origMember,member);
 	}
 
-	_sender->ncSendConfig(nwid,requestPacketId,identity.address(),nc,metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	_sender->ncSendConfig(nwid,requestPacketId,identity.address(),nc,(unsigned int)metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0));
 }
 
 void EmbeddedNetworkController::_getNetworkMemberInfo(uint64_t now,uint64_t nwid,_NetworkMemberInfo &nmi)
@@ -1771,18 +1865,18 @@ void EmbeddedNetworkController::_getNetworkMemberInfo(uint64_t now,uint64_t nwid
 	char pfx[256];
 	Utils::snprintf(pfx,sizeof(pfx),"network/%.16llx/member",nwid);
 
-	{
-		Mutex::Lock _l(_nmiCache_m);
-		std::map<uint64_t,_NetworkMemberInfo>::iterator c(_nmiCache.find(nwid));
-		if ((c != _nmiCache.end())&&((now - c->second.nmiTimestamp) < 1000)) { // a short duration cache but limits CPU use on big networks
-			nmi = c->second;
-			return;
-		}
+	const SharedPtr<_NetworkState> ns(_getNetworkState(nwid,true));
+	Mutex::Lock _nl(ns->nmi_m);
+	if ((ns->nmiValid)&&((now <= ns->nmi.nmiTimestamp)||((now - ns->nmi.nmiTimestamp) < 1000))) { // a short duration cache but limits CPU use on big networks
+		nmi = ns->nmi;
+		return;
 	}
 
 	{
 		Mutex::Lock _l(_db_m);
-		_db.filter(pfx,[&nmi,&now](const std::string &n,const json &member) {
+		IpAllocationMap allocatedIps;
+		std::vector<InetAddress> mips;
+		_db.filter(pfx,[&nmi,&now,&allocatedIps,&mips](const std::string &n,const json &member) {
 			try {
 				if (OSUtils::jsonBool(member["authorized"],false)) {
 					++nmi.authorizedMemberCount;
@@ -1802,29 +1896,211 @@ void EmbeddedNetworkController::_getNetworkMemberInfo(uint64_t now,uint64_t nwid
 						nmi.activeBridges.insert(Address(Utils::hexStrToU64(OSUtils::jsonString(member["id"],"0000000000").c_str())));
 					}
 
-					if (member.count("ipAssignments")) {
-						const json &mips = member["ipAssignments"];
-						if (mips.is_array()) {
-							for(unsigned long i=0;i<mips.size();++i) {
-								InetAddress mip(OSUtils::jsonString(mips[i],""));
-								if ((mip.ss_family == AF_INET)||(mip.ss_family == AF_INET6))
-									nmi.allocatedIps.insert(mip);
-							}
-						}
-					}
+					mips.clear();
+					_getMemberAllocatedIps(member,mips);
+					for(std::vector<InetAddress>::const_iterator mip(mips.begin());mip!=mips.end();++mip)
+						allocatedIps.add(*mip);
 				} else {
 					nmi.mostRecentDeauthTime = std::max(nmi.mostRecentDeauthTime,OSUtils::jsonInt(member["lastDeauthorizedTime"],0ULL));
 				}
 			} catch ( ... ) {}
 			return true;
 		});
+
+		// The allocation map is long-lived and kept current by _updateIpAllocations(), so
+		// only install a freshly scanned one if this network doesn't have one yet.
+		Mutex::Lock _l2(ns->allocatedIps_m);
+		if (!ns->allocatedIpsValid) {
+			ns->allocatedIps = allocatedIps;
+			ns->allocatedIpsValid = true;
+		}
 	}
 	nmi.nmiTimestamp = now;
 
 	{
-		Mutex::Lock _l(_nmiCache_m);
-		_nmiCache[nwid] = nmi;
+		// Drop member configs that could not be re-used anyway to bound memory use
+		Mutex::Lock _l(ns->config_m);
+		for(std::map< uint64_t,_MemberConfig >::iterator mc(ns->memberConfigs.begin());mc!=ns->memberConfigs.end();) {
+			if ((now < mc->second.timestamp)||((now - mc->second.timestamp) >= (ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA / 4)))
+				ns->memberConfigs.erase(mc++);
+			else ++mc;
+		}
+	}
+
+	ns->nmi = nmi;
+	ns->nmiValid = true;
+}
+
+void EmbeddedNetworkController::_clearNetworkMemberInfoCache(const uint64_t nwid)
+{
+	const SharedPtr<_NetworkState> ns(_getNetworkState(nwid,false));
+	if (ns) {
+		Mutex::Lock _l(ns->nmi_m);
+		ns->nmiValid = false;
+	}
+}
+
+SharedPtr<EmbeddedNetworkController::_NetworkState> EmbeddedNetworkController::_getNetworkState(const uint64_t nwid,const bool create)
+{
+	Mutex::Lock _l(_networkStates_m);
+	std::map< uint64_t,SharedPtr<_NetworkState> >::iterator ns(_networkStates.find(nwid));
+	if (ns != _networkStates.end())
+		return ns->second;
+	if (!create)
+		return SharedPtr<_NetworkState>();
+	SharedPtr<_NetworkState> &nns = _networkStates[nwid];
+	nns = new _NetworkState();
+	return nns;
+}
+
+SharedPtr<EmbeddedNetworkController::_CompiledNetwork> EmbeddedNetworkController::_getCompiledNetwork(const SharedPtr<_NetworkState> &ns,uint64_t nwid,nlohmann::json &network)
+{
+	const uint64_t revision = OSUtils::jsonInt(network["revision"],0ULL);
+	{
+		Mutex::Lock _l(ns->config_m);
+		if ((ns->compiledNetwork)&&(ns->compiledNetwork->revision == revision))
+			return ns->compiledNetwork;
+	}
+
+	// Compile outside the lock; if two threads race here both results are identical
+	SharedPtr<_CompiledNetwork> cn(new _CompiledNetwork());
+	cn->revision = revision;
+
+	NetworkConfig &nc = cn->base;
+	nc.networkId = nwid;
+	nc.type = OSUtils::jsonBool(network["private"],true) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
+	nc.revision = revision;
+	if (OSUtils::jsonBool(network["enableBroadcast"],true)) nc.flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
+	if (OSUtils::jsonBool(network["allowPassiveBridging"],false)) nc.flags |= ZT_NETWORKCONFIG_FLAG_ALLOW_PASSIVE_BRIDGING;
+	Utils::scopy(nc.name,sizeof(nc.name),OSUtils::jsonString(network["name"],"").c_str());
+	nc.multicastLimit = (unsigned int)OSUtils::jsonInt(network["multicastLimit"],32ULL);
+
+	json &rules = network["rules"];
+	if (rules.is_array()) {
+		for(unsigned long i=0;i<rules.size();++i) {
+			if (nc.ruleCount >= ZT_MAX_NETWORK_RULES)
+				break;
+			if (_parseRule(rules[i],nc.rules[nc.ruleCount]))
+				++nc.ruleCount;
+		}
+	}
+
+	json &routes = network["routes"];
+	if (routes.is_array()) {
+		for(unsigned long i=0;i<routes.size();++i) {
+			if (nc.routeCount >= ZT_MAX_NETWORK_ROUTES)
+				break;
+			json &route = routes[i];
+			json &target = route["target"];
+			json &via = route["via"];
+			if (target.is_string()) {
+				const InetAddress t(target.get<std::string>());
+				InetAddress v;
+				if (via.is_string()) v.fromString(via.get<std::string>());
+				if ((t.ss_family == AF_INET)||(t.ss_family == AF_INET6)) {
+					ZT_VirtualNetworkRoute *r = &(nc.routes[nc.routeCount]);
+					*(reinterpret_cast<InetAddress *>(&(r->target))) = t;
+					if (v.ss_family == t.ss_family)
+						*(reinterpret_cast<InetAddress *>(&(r->via))) = v;
+					++nc.routeCount;
+				}
+			}
+		}
 	}
+
+	json &v4AssignMode = network["v4AssignMode"];
+	json &v6AssignMode = network["v6AssignMode"];
+	cn->v4AssignZt = ((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false)));
+	cn->v6AssignZt = ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false)));
+	cn->v6AssignRfc4193 = ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["rfc4193"],false)));
+	cn->v6Assign6plane = ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["6plane"],false)));
+
+	json &ipAssignmentPools = network["ipAssignmentPools"];
+	if (ipAssignmentPools.is_array()) {
+		for(unsigned long p=0;p<ipAssignmentPools.size();++p) {
+			json &pool = ipAssignmentPools[p];
+			if (pool.is_object()) {
+				const InetAddress ipRangeStart(OSUtils::jsonString(pool["ipRangeStart"],""));
+				const InetAddress ipRangeEnd(OSUtils::jsonString(pool["ipRangeEnd"],""));
+				if ((ipRangeStart.ss_family == ipRangeEnd.ss_family)&&((ipRangeStart.ss_family == AF_INET)||(ipRangeStart.ss_family == AF_INET6)))
+					cn->ipAssignmentPools.push_back(std::pair<InetAddress,InetAddress>(ipRangeStart,ipRangeEnd));
+			}
+		}
+	}
+
+	json &capabilities = network["capabilities"];
+	if (capabilities.is_array()) {
+		for(unsigned long i=0;i<capabilities.size();++i) {
+			json &cap = capabilities[i];
+			if (cap.is_object()) {
+				_CompiledNetwork::_Capability &c = cn->capabilities[(uint32_t)(OSUtils::jsonInt(cap["id"],0ULL) & 0xffffffffULL)];
+				c.dflt = OSUtils::jsonBool(cap["default"],false);
+				c.ruleCount = 0;
+				json &caprj = cap["rules"];
+				if (caprj.is_array()) {
+					for(unsigned long j=0;j<caprj.size();++j) {
+						if (c.ruleCount >= ZT_MAX_CAPABILITY_RULES)
+							break;
+						if (_parseRule(caprj[j],c.rules[c.ruleCount]))
+							++c.ruleCount;
+					}
+				}
+			}
+		}
+	}
+
+	json &tags = network["tags"];
+	if (tags.is_array()) {
+		for(unsigned long i=0;i<tags.size();++i) {
+			json &t = tags[i];
+			if (t.is_object()) {
+				json &dfl = t["default"];
+				if (dfl.is_number())
+					cn->tagDefaults[(uint32_t)(OSUtils::jsonInt(t["id"],0ULL) & 0xffffffffULL)] = (uint32_t)(OSUtils::jsonInt(dfl,0ULL) & 0xffffffffULL);
+			}
+		}
+	}
+
+	Mutex::Lock _l(ns->config_m);
+	if ((!ns->compiledNetwork)||(ns->compiledNetwork->revision < revision)) {
+		ns->compiledNetwork = cn;
+		ns->memberConfigs.clear(); // all were issued under another network revision
+	}
+	return cn;
+}
+
+void EmbeddedNetworkController::_clearConfigCache(const uint64_t nwid,const uint64_t address)
+{
+	const SharedPtr<_NetworkState> ns(_getNetworkState(nwid,false));
+	if (ns) {
+		Mutex::Lock _l(ns->config_m);
+		if (address) {
+			ns->memberConfigs.erase(address);
+		} else {
+			ns->compiledNetwork.zero();
+			ns->memberConfigs.clear();
+		}
+	}
+}
+
+void EmbeddedNetworkController::_updateIpAllocations(uint64_t nwid,const nlohmann::json &oldMember,const nlohmann::json &newMember)
+{
+	std::vector<InetAddress> oldIps,newIps;
+	_getMemberAllocatedIps(oldMember,oldIps);
+	_getMemberAllocatedIps(newMember,newIps);
+	if ((oldIps.empty())&&(newIps.empty()))
+		return;
+
+	const SharedPtr<_NetworkState> ns(_getNetworkState(nwid,false));
+	if (!ns)
+		return;
+	Mutex::Lock _l(ns->allocatedIps_m);
+	if (!ns->allocatedIpsValid)
+		return; // will be built from member records on next scan
+	for(std::vector<InetAddress>::const_iterator ip(oldIps.begin());ip!=oldIps.end();++ip)
+		ns->allocatedIps.remove(*ip);
+	for(std::vector<InetAddress>::const_iterator ip(newIps.begin());ip!=newIps.end();++ip)
+		ns->allocatedIps.add(*ip);
 }
 
 void EmbeddedNetworkController::_pushMemberUpdate(uint64_t now,uint64_t nwid,const nlohmann::json &member)
@@ -31,9 +31,15 @@
 
 #include "../node/NetworkController.hpp"
 #include "../node/Mutex.hpp"
+#include "../node/SharedPtr.hpp"
+#include "../node/AtomicCounter.hpp"
 #include "../node/Utils.hpp"
 #include "../node/Address.hpp"
 #include "../node/InetAddress.hpp"
+#include "../node/NetworkConfig.hpp"
+#include "../node/Capability.hpp"
+#include "../node/Tag.hpp"
+#include "../node/CertificateOfOwnership.hpp"
 
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Thread.hpp"
@@ -42,13 +48,20 @@
 #include "../ext/json/json.hpp"
 
 #include "JSONDB.hpp"
+#include "IpAllocationMap.hpp"
 
-// Number of background threads to start -- not actually started until needed
+// Minimum number of background threads to start -- not actually started until needed
 #define ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT 4
 
+// Maximum number of background threads regardless of core count or configuration
+#define ZT_EMBEDDEDNETWORKCONTROLLER_MAX_BACKGROUND_THREAD_COUNT 128
+
 // TTL for circuit tests
 #define ZT_EMBEDDEDNETWORKCONTROLLER_CIRCUIT_TEST_EXPIRATION 120000
 
+// Min duration between requests for an address/nwid combo to prevent floods
+#define ZT_NETCONF_MIN_REQUEST_PERIOD 1000
+
 namespace ZeroTier {
 
 class Node;
@@ -59,8 +72,10 @@ public:
 	/**
 	 * @param node Parent node
 	 * @param dbPath Path to store data
+	 * @param threadCount Number of worker threads or 0 for one per core (minimum ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT)
+	 * @param syncDbWrites If true, sync database writes to disk (they are always done in the background)
 	 */
-	EmbeddedNetworkController(Node *node,const char *dbPath);
+	EmbeddedNetworkController(Node *node,const char *dbPath,unsigned int threadCount = 0,bool syncDbWrites = false);
 	virtual ~EmbeddedNetworkController();
 
 	virtual void init(const Identity &signingId,Sender *sender);
@@ -112,7 +127,6 @@ private:
 	{
 		_NetworkMemberInfo() : authorizedMemberCount(0),activeMemberCount(0),totalMemberCount(0),mostRecentDeauthTime(0) {}
 		std::set<Address> activeBridges;
-		std::set<InetAddress> allocatedIps;
 		unsigned long authorizedMemberCount;
 		unsigned long activeMemberCount;
 		unsigned long totalMemberCount;
@@ -120,12 +134,85 @@ private:
 		uint64_t nmiTimestamp; // time this NMI structure was computed
 	};
 
+	// Network-wide part of a network config, compiled once per network revision
+	// from the network's JSON record. These are immutable once built and are
+	// replaced (not modified) when the network changes.
+	struct _CompiledNetwork
+	{
+		struct _Capability
+		{
+			bool dflt;
+			unsigned int ruleCount;
+			ZT_VirtualNetworkRule rules[ZT_MAX_CAPABILITY_RULES];
+		};
+
+		uint64_t revision;
+		NetworkConfig base; // everything that is not member-specific; copied into each response
+		bool v4AssignZt;
+		bool v6AssignZt;
+		bool v6AssignRfc4193;
+		bool v6Assign6plane;
+		std::vector< std::pair<InetAddress,InetAddress> > ipAssignmentPools;
+		std::map< uint32_t,_Capability > capabilities;
+		std::map< uint32_t,uint32_t > tagDefaults;
+
+		AtomicCounter __refCount;
+	};
+
+	// Member-specific results of a config request: signed credentials and static IPs.
+	// Credentials are re-sent as-is while still well within the credential time
+	// max delta, so repeat requests only cost one signature (the COM).
+	struct _MemberConfig
+	{
+		uint64_t timestamp; // timestamp of credentials
+		uint64_t networkRevision;
+		uint64_t memberRevision;
+		bool legacyRules;
+		uint64_t flags;
+		std::vector<Capability> capabilities;
+		std::vector<Tag> tags;
+		std::vector<InetAddress> staticIps;
+		CertificateOfOwnership coo;
+	};
+
+	// Per-network state so that requests for different networks do not contend.
+	// Lock order is nmi_m -> _db_m -> allocatedIps_m, and _networkStates_m and
+	// config_m are never held while acquiring any other lock.
+	struct _NetworkState
+	{
+		_NetworkState() : nmiValid(false),allocatedIpsValid(false) {}
+
+		// Held while member info is recomputed so only one thread scans a given
+		// network at a time; others wait and then use its result.
+		Mutex nmi_m;
+		_NetworkMemberInfo nmi;
+		bool nmiValid;
+
+		// IP allocations are built on first scan of a network, then kept up to date
+		Mutex allocatedIps_m;
+		IpAllocationMap allocatedIps;
+		bool allocatedIpsValid;
+
+		// Compiled network and cached member credentials (see _request())
+		Mutex config_m;
+		SharedPtr<_CompiledNetwork> compiledNetwork;
+		std::map< uint64_t,_MemberConfig > memberConfigs;
+
+		AtomicCounter __refCount;
+	};
+
 	static void _circuitTestCallback(ZT_Node *node,ZT_CircuitTest *test,const ZT_CircuitTestReport *report);
 	void _request(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData);
 	void _getNetworkMemberInfo(uint64_t now,uint64_t nwid,_NetworkMemberInfo &nmi);
-	inline void _clearNetworkMemberInfoCache(const uint64_t nwid) { Mutex::Lock _l(_nmiCache_m); _nmiCache.erase(nwid); }
+	void _clearNetworkMemberInfoCache(const uint64_t nwid);
+	SharedPtr<_NetworkState> _getNetworkState(const uint64_t nwid,const bool create);
+	SharedPtr<_CompiledNetwork> _getCompiledNetwork(const SharedPtr<_NetworkState> &ns,uint64_t nwid,nlohmann::json &network);
+	void _clearConfigCache(const uint64_t nwid,const uint64_t address); // address 0 clears whole network
 	void _pushMemberUpdate(uint64_t now,uint64_t nwid,const nlohmann::json &member);
 
+	// Must be called with _db_m held whenever a member record is put or erased
+	void _updateIpAllocations(uint64_t nwid,const nlohmann::json &oldMember,const nlohmann::json &newMember);
+
 	// These init objects with default and static/informational fields
 	inline void _initMember(nlohmann::json &member)
 	{
@@ -182,12 +269,13 @@ private:
 	const uint64_t _startTime;
 
 	BlockingQueue<_RQEntry *> _queue;
-	Thread _threads[ZT_EMBEDDEDNETWORKCONTROLLER_BACKGROUND_THREAD_COUNT];
+	std::vector<Thread> _threads;
+	const unsigned int _threadCount;
 	bool _threadsStarted;
 	Mutex _threads_m;
 
-	std::map<uint64_t,_NetworkMemberInfo> _nmiCache;
-	Mutex _nmiCache_m;
+	std::map< uint64_t,SharedPtr<_NetworkState> > _networkStates;
+	Mutex _networkStates_m;
 
 	JSONDB _db;
 	Mutex _db_m;
@@ -0,0 +1,222 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2015  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_IPALLOCATIONMAP_HPP
+#define ZT_IPALLOCATIONMAP_HPP
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+
+#include "../node/Constants.hpp"
+#include "../node/Utils.hpp"
+#include "../node/InetAddress.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Tracks IP addresses allocated to members of a network
+ *
+ * IPv4 addresses are stored as a set of disjoint, non-adjacent runs of
+ * allocated addresses keyed by first address (an interval tree). Finding
+ * the next free address in a pool is therefore O(log n) no matter how full
+ * the pool is, since entire allocated runs are skipped in one step. IPv6
+ * assignment is sparse (random or address-derived) so IPv6 addresses are
+ * simply kept in a set for conflict checks.
+ *
+ * Addresses are not reference counted. If the same IP is (manually) given
+ * to two members, releasing it from one frees it.
+ *
+ * This class is not thread safe.
+ */
+class IpAllocationMap
+{
+public:
+	IpAllocationMap() : _v4Count(0) {}
+
+	/**
+	 * @param ip IPv4 or IPv6 address to mark allocated (port/netmask is ignored)
+	 */
+	inline void add(const InetAddress &ip)
+	{
+		if (ip.ss_family == AF_INET) {
+			addV4(Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr)));
+		} else if (ip.ss_family == AF_INET6) {
+			_v6.insert(ip.ipOnly());
+		}
+	}
+
+	/**
+	 * @param ip IPv4 or IPv6 address to release (port/netmask is ignored)
+	 */
+	inline void remove(const InetAddress &ip)
+	{
+		if (ip.ss_family == AF_INET) {
+			removeV4(Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr)));
+		} else if (ip.ss_family == AF_INET6) {
+			_v6.erase(ip.ipOnly());
+		}
+	}
+
+	/**
+	 * @param ip IPv4 or IPv6 address (port/netmask is ignored)
+	 * @return True if address is allocated
+	 */
+	inline bool has(const InetAddress &ip) const
+	{
+		if (ip.ss_family == AF_INET) {
+			return hasV4(Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr)));
+		} else if (ip.ss_family == AF_INET6) {
+			return (_v6.count(ip.ipOnly()) > 0);
+		}
+		return false;
+	}
+
+	/**
+	 * @param ip IPv4 address in host byte order
+	 */
+	inline void addV4(const uint32_t ip)
+	{
+		if (hasV4(ip))
+			return;
+		++_v4Count;
+
+		uint32_t start = ip;
+		uint32_t end = ip;
+
+		// Merge with following run if it starts right after this IP
+		if (ip != 0xffffffff) {
+			std::map<uint32_t,uint32_t>::iterator next(_v4.find(ip + 1));
+			if (next != _v4.end()) {
+				end = next->second;
+				_v4.erase(next);
+			}
+		}
+
+		// Merge with preceding run if it ends right before this IP
+		std::map<uint32_t,uint32_t>::iterator prev(_v4.lower_bound(ip));
+		if ((ip != 0)&&(prev != _v4.begin())) {
+			--prev;
+			if (prev->second == (ip - 1)) {
+				prev->second = end;
+				return;
+			}
+		}
+
+		_v4[start] = end;
+	}
+
+	/**
+	 * @param ip IPv4 address in host byte order
+	 */
+	inline void removeV4(const uint32_t ip)
+	{
+		std::map<uint32_t,uint32_t>::iterator r(_findV4(ip));
+		if (r == _v4.end())
+			return;
+		--_v4Count;
+
+		const uint32_t start = r->first;
+		const uint32_t end = r->second;
+		_v4.erase(r);
+		if (start < ip)
+			_v4[start] = ip - 1;
+		if (end > ip)
+			_v4[ip + 1] = end;
+	}
+
+	/**
+	 * @param ip IPv4 address in host byte order
+	 * @return True if address is allocated
+	 */
+	inline bool hasV4(const uint32_t ip) const
+	{
+		std::map<uint32_t,uint32_t>::const_iterator r(_v4.upper_bound(ip));
+		if (r == _v4.begin())
+			return false;
+		--r;
+		return (r->second >= ip);
+	}
+
+	/**
+	 * Find the first unallocated IPv4 address in [from,last]
+	 *
+	 * @param from First address to consider (host byte order)
+	 * @param last Last address to consider, inclusive (host byte order)
+	 * @param ip Set to free address if one was found
+	 * @return True if a free address was found
+	 */
+	inline bool nextFreeV4(uint32_t from,const uint32_t last,uint32_t &ip) const
+	{
+		if (from > last)
+			return false;
+		std::map<uint32_t,uint32_t>::const_iterator r(_v4.upper_bound(from));
+		if (r != _v4.begin()) {
+			--r;
+			if (r->second >= from) {
+				// Runs are never adjacent, so the address right after a run is free
+				if ((r->second == 0xffffffff)||(r->second >= last))
+					return false;
+				from = r->second + 1;
+			}
+		}
+		ip = from;
+		return true;
+	}
+
+	/**
+	 * @return Number of allocated IPv4 addresses
+	 */
+	inline unsigned long v4Count() const { return _v4Count; }
+
+	/**
+	 * @return Number of allocated IPv6 addresses
+	 */
+	inline unsigned long v6Count() const { return (unsigned long)_v6.size(); }
+
+	/**
+	 * @return Number of runs in IPv4 interval tree (for diagnostics)
+	 */
+	inline unsigned long v4Runs() const { return (unsigned long)_v4.size(); }
+
+	inline void clear()
+	{
+		_v4.clear();
+		_v6.clear();
+		_v4Count = 0;
+	}
+
+private:
+	inline std::map<uint32_t,uint32_t>::iterator _findV4(const uint32_t ip)
+	{
+		std::map<uint32_t,uint32_t>::iterator r(_v4.upper_bound(ip));
+		if (r == _v4.begin())
+			return _v4.end();
+		--r;
+		return ((r->second >= ip) ? r : _v4.end());
+	}
+
+	std::map<uint32_t,uint32_t> _v4; // first address -> last address, host byte order, inclusive
+	std::set<InetAddress> _v6;
+	unsigned long _v4Count;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -16,6 +16,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __WINDOWS__
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "JSONDB.hpp"
 
 #define ZT_JSONDB_HTTP_TIMEOUT 60000
@@ -25,9 +31,12 @@ namespace ZeroTier {
 static const nlohmann::json _EMPTY_JSON(nlohmann::json::object());
 static const std::map<std::string,std::string> _ZT_JSONDB_GET_HEADERS;
 
-JSONDB::JSONDB(const std::string &basePath) :
+JSONDB::JSONDB(const std::string &basePath,bool syncWrites) :
 	_basePath(basePath),
-	_ready(false)
+	_ready(false),
+	_syncWrites(syncWrites),
+	_run(true),
+	_writes(0)
 {
 	if ((_basePath.length() > 7)&&(_basePath.substr(0,7) == "http://")) {
 		// TODO: this doesn't yet support IPv6 since bracketed address notiation isn't supported.
@@ -51,12 +60,41 @@ JSONDB::JSONDB(const std::string &basePath) :
 		OSUtils::lockDownFile(_basePath.c_str(),true); // networks might contain auth tokens, etc., so restrict directory permissions
 	}
 	_ready = _reload(_basePath,std::string());
+	_writer = Thread::start(this);
+}
+
+JSONDB::~JSONDB()
+{
+	_run = false;
+	_wake.post(false);
+	Thread::join(_writer);
 }
 
 bool JSONDB::writeRaw(const std::string &n,const std::string &obj)
 {
 	if (!_isValidObjectName(n))
 		return false;
+	return _write(n,obj);
+}
+
+bool JSONDB::put(const std::string &n,const nlohmann::json &obj)
+{
+	if (!_isValidObjectName(n))
+		return false;
+	_db[n].obj = obj;
+	bool wake;
+	{
+		Mutex::Lock _l(_writeQueue_m);
+		wake = _writeQueue.empty();
+		_writeQueue[n] = obj;
+	}
+	if (wake)
+		_wake.post(true);
+	return true;
+}
+
+bool JSONDB::_write(const std::string &n,const std::string &obj)
+{
 	if (_httpAddr) {
 		std::map<std::string,std::string> headers;
 		std::string body;
@@ -71,15 +109,44 @@ bool JSONDB::writeRaw(const std::string &n,const std::string &obj)
 		const std::string path(_genPath(n,true));
 		if (!path.length())
 			return false;
-		return OSUtils::writeFile(path.c_str(),obj);
+		if (!_syncWrites)
+			return OSUtils::writeFile(path.c_str(),obj);
+		FILE *f = fopen(path.c_str(),"wb");
+		if (!f)
+			return false;
+		bool ok = (fwrite(obj.data(),1,obj.length(),f) == obj.length());
+		ok &= (fflush(f) == 0);
+#ifdef __WINDOWS__
+		ok &= (_commit(_fileno(f)) == 0);
+#else
+		ok &= (fsync(fileno(f)) == 0);
+#endif
+		fclose(f);
+		return ok;
 	}
 }
 
-bool JSONDB::put(const std::string &n,const nlohmann::json &obj)
+bool JSONDB::flush()
 {
-	const bool r = writeRaw(n,OSUtils::jsonDump(obj));
-	_db[n].obj = obj;
-	return r;
+	const bool ok = _writeQueued(true);
+	if (!ok)
+		_wake.post(true); // failed writes were requeued, so let the writer retry them
+	return ok;
+}
+
+void JSONDB::threadMain()
+	throw()
+{
+	while (_wake.get()) {
+		// Give repeated puts of busy objects a chance to coalesce into one write
+		Thread::sleep(ZT_JSONDB_WRITE_BEHIND_DELAY);
+		while ((_run)&&(!_writeQueued(true))) {
+			// Don't hammer a full disk or a down HTTP backend, but notice shutdown
+			for(unsigned long t=0;((_run)&&(t<ZT_JSONDB_WRITE_RETRY_DELAY));t+=ZT_JSONDB_WRITE_BEHIND_DELAY)
+				Thread::sleep(ZT_JSONDB_WRITE_BEHIND_DELAY);
+		}
+	}
+	_writeQueued(false);
 }
 
 const nlohmann::json &JSONDB::get(const std::string &n)
@@ -88,7 +155,11 @@ const nlohmann::json &JSONDB::get(const std::string &n)
 		Thread::sleep(250);
 		_ready = _reload(_basePath,std::string());
 	}
+	return _get(n);
+}
 
+const nlohmann::json &JSONDB::_get(const std::string &n)
+{
 	if (!_isValidObjectName(n))
 		return _EMPTY_JSON;
 	std::map<std::string,_E>::iterator e(_db.find(n));
@@ -124,6 +195,13 @@ void JSONDB::erase(const std::string &n)
 	if (!_isValidObjectName(n))
 		return;
 
+	// Wait for any batch being written, then drop any queued write so it can't recreate the object
+	Mutex::Lock _l(_commit_m);
+	{
+		Mutex::Lock _l2(_writeQueue_m);
+		_writeQueue.erase(n);
+	}
+
 	if (_httpAddr) {
 		std::string body;
 		std::map<std::string,std::string> headers;
@@ -164,7 +242,7 @@ bool JSONDB::_reload(const std::string &p,const std::string &b)
 		std::vector<std::string> dl(OSUtils::listDirectory(p.c_str(),true));
 		for(std::vector<std::string>::const_iterator di(dl.begin());di!=dl.end();++di) {
 			if ((di->length() > 5)&&(di->substr(di->length() - 5) == ".json")) {
-				this->get(b + di->substr(0,di->length() - 5));
+				this->_get(b + di->substr(0,di->length() - 5)); // not get(), which would wait on _ready and recurse
 			} else {
 				this->_reload((p + ZT_PATH_SEPARATOR + *di),(b + *di + ZT_PATH_SEPARATOR));
 			}
@@ -173,6 +251,31 @@ bool JSONDB::_reload(const std::string &p,const std::string &b)
 	}
 }
 
+bool JSONDB::_writeQueued(bool retry)
+{
+	Mutex::Lock _l(_commit_m);
+	std::map<std::string,nlohmann::json> batch;
+	{
+		Mutex::Lock _l2(_writeQueue_m);
+		batch.swap(_writeQueue);
+	}
+	bool ok = true;
+	for(std::map<std::string,nlohmann::json>::const_iterator i(batch.begin());i!=batch.end();++i) {
+		if (_write(i->first,OSUtils::jsonDump(i->second))) {
+			++_writes;
+		} else {
+			ok = false;
+			fprintf(stderr,"WARNING: JSONDB: unable to write %s%s" ZT_EOL_S,i->first.c_str(),(retry) ? ", will retry" : "");
+			if (retry) {
+				// Requeue unless a newer put has already replaced it
+				Mutex::Lock _l2(_writeQueue_m);
+				_writeQueue.insert(*i);
+			}
+		}
+	}
+	return ok;
+}
+
 bool JSONDB::_isValidObjectName(const std::string &n)
 {
 	if (n.length() == 0)
@@ -37,19 +37,48 @@
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Http.hpp"
 #include "../osdep/Thread.hpp"
+#include "../osdep/BlockingQueue.hpp"
+
+// How long puts are allowed to accumulate before a batch is committed (ms)
+#define ZT_JSONDB_WRITE_BEHIND_DELAY 100
+
+// How long to wait before retrying writes that failed (ms)
+#define ZT_JSONDB_WRITE_RETRY_DELAY 5000
 
 namespace ZeroTier {
 
 /**
  * Hierarchical JSON store that persists into the filesystem or via HTTP
+ *
+ * Objects are cached in memory and writes are committed by a background
+ * thread. Repeated puts of the same object before it is committed result in
+ * only one write. Like reads, puts and erases must be externally serialized;
+ * only the write queue is internally locked.
+ *
+ * Writes that fail are logged to stderr and retried until they succeed or
+ * are superseded by a newer put or an erase.
  */
 class JSONDB
 {
 public:
-	JSONDB(const std::string &basePath);
+	/**
+	 * @param basePath Directory or http:// URL of database
+	 * @param syncWrites If true, sync each file in a batch to disk before the batch is complete
+	 */
+	JSONDB(const std::string &basePath,bool syncWrites = false);
+	~JSONDB();
 
 	bool writeRaw(const std::string &n,const std::string &obj);
 
+	/**
+	 * Put an object
+	 *
+	 * The object is visible to get() immediately and is queued to be written
+	 * in the background, so this never waits on I/O. A true result therefore
+	 * does not mean the object has been stored; use flush() for that.
+	 *
+	 * @return False if object name is invalid
+	 */
 	bool put(const std::string &n,const nlohmann::json &obj);
 
 	inline bool put(const std::string &n1,const std::string &n2,const nlohmann::json &obj) { return this->put((n1 + "/" + n2),obj); }
@@ -90,11 +119,61 @@ public:
 		}
 	}
 
+	/**
+	 * Visit up to maxCount objects whose names begin with prefix, in name order
+	 *
+	 * This is read-only and visits a bounded number of objects, so callers can
+	 * walk a large prefix one page at a time and release any lock between pages.
+	 *
+	 * @param prefix Name prefix
+	 * @param after Start with the first object named after this, or empty to start at beginning of prefix
+	 * @param maxCount Maximum number of objects to visit
+	 * @param func Function called with (name,object) for each object
+	 * @return Name of last object visited if more follow, or empty string if the end of prefix was reached
+	 */
+	template<typename F>
+	inline std::string page(const std::string &prefix,const std::string &after,unsigned long maxCount,F func)
+	{
+		while (!_ready) {
+			Thread::sleep(250);
+			_ready = _reload(_basePath,std::string());
+		}
+
+		std::map<std::string,_E>::iterator i(((after.length() > 0)&&(after > prefix)) ? _db.upper_bound(after) : _db.lower_bound(prefix));
+		std::string last;
+		for(unsigned long n=0;n<maxCount;++n,++i) {
+			if ((i == _db.end())||(!_hasPrefix(i->first,prefix)))
+				return std::string();
+			func(i->first,i->second.obj);
+			last = i->first;
+		}
+		return (((i != _db.end())&&(_hasPrefix(i->first,prefix))) ? last : std::string());
+	}
+
+	/**
+	 * Commit all queued writes now, blocking until done
+	 *
+	 * @return True if every queued write succeeded (failed writes stay queued for retry)
+	 */
+	bool flush();
+
+	/**
+	 * @return Number of objects successfully written to storage so far
+	 */
+	inline unsigned long writes() const { return _writes; }
+
+	void threadMain()
+		throw();
+
 	inline bool operator==(const JSONDB &db) const { return ((_basePath == db._basePath)&&(_db == db._db)); }
 	inline bool operator!=(const JSONDB &db) const { return (!(*this == db)); }
 
 private:
+	static inline bool _hasPrefix(const std::string &n,const std::string &prefix) { return ((n.length() >= prefix.length())&&(!memcmp(n.data(),prefix.data(),prefix.length()))); }
+	const nlohmann::json &_get(const std::string &n);
 	bool _reload(const std::string &p,const std::string &b);
+	bool _write(const std::string &n,const std::string &obj);
+	bool _writeQueued(bool retry);
 	bool _isValidObjectName(const std::string &n);
 	std::string _genPath(const std::string &n,bool create);
 
@@ -109,6 +188,15 @@ private:
 	std::string _basePath;
 	std::map<std::string,_E> _db;
 	volatile bool _ready;
+
+	const bool _syncWrites;
+	std::map<std::string,nlohmann::json> _writeQueue; // latest not yet written value of each dirty object
+	Mutex _writeQueue_m;
+	BlockingQueue<bool> _wake; // true when _writeQueue becomes non-empty, false to stop the writer
+	Mutex _commit_m; // held while a batch is written so erase() cannot race with it
+	Thread _writer;
+	volatile bool _run;
+	volatile unsigned long _writes;
 };
 
 } // namespace ZeroTier
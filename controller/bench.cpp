@@ -0,0 +1,409 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2015  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline load generator and latency benchmark for EmbeddedNetworkController
+ *
+ * Seeds a temporary JSONDB with networks and authorized members, starts a
+ * controller on it, and drives request() with synthetic member identities
+ * through a stub Sender. Reports startup (database load) time, throughput,
+ * and request latency percentiles.
+ *
+ * Build with "make controller-bench" and run ./zerotier-controller-bench -h
+ * for options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "../node/Constants.hpp"
+#include "../node/Identity.hpp"
+#include "../node/InetAddress.hpp"
+#include "../node/Utils.hpp"
+#include "../node/Dictionary.hpp"
+#include "../node/NetworkConfig.hpp"
+#include "../node/NetworkController.hpp"
+#include "../node/Packet.hpp"
+#include "../osdep/OSUtils.hpp"
+#include "../osdep/Thread.hpp"
+#include "../version.h"
+
+#include "JSONDB.hpp"
+#include "EmbeddedNetworkController.hpp"
+
+using json = nlohmann::json;
+
+using namespace ZeroTier;
+
+// Requests from the same member to the same network closer together than this are ignored by the controller,
+// plus a little slack for timer granularity
+#define ZT_CONTROLLER_BENCH_MIN_REQUEST_SPACING (ZT_NETCONF_MIN_REQUEST_PERIOD + 10)
+
+// How long to wait for outstanding replies before counting them as lost
+#define ZT_CONTROLLER_BENCH_DRAIN_TIMEOUT 30000
+
+static inline uint64_t usnow()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class BenchSender : public NetworkController::Sender
+{
+public:
+	BenchSender(unsigned long requestCount,bool serialize) :
+		configs(0),
+		errors(0),
+		revocations(0),
+		pushes(0),
+		doneAt(requestCount,0),
+		_serialize(serialize),
+		_completed(0) {}
+
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,unsigned int remoteConfigVersion)
+	{
+		if (_serialize) {
+			// Node::ncSendConfig() does this on the controller thread, so include it in the cost
+			if (remoteConfigVersion >= ZT_NETWORKCONFIG_VERSION_BINARY) {
+				Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *const b = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+				nc.toBinary(*b);
+				delete b;
+			} else {
+				Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *const d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+				nc.toDictionary(*d,(remoteConfigVersion < 6));
+				delete d;
+			}
+		}
+		++configs;
+		_complete(requestPacketId);
+	}
+
+	virtual void ncSendRevocation(const Address &destination,const Revocation &rev)
+	{
+		++revocations;
+	}
+
+	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode)
+	{
+		++errors;
+		_complete(requestPacketId);
+	}
+
+	inline unsigned long completed() const { return _completed; }
+
+	// Wait until at most maxOutstanding of the first 'issued' requests are outstanding, or until timeout
+	inline bool waitOutstanding(unsigned long issued,unsigned long maxOutstanding,unsigned long timeoutMs)
+	{
+		std::unique_lock<std::mutex> l(_lock);
+		return _cond.wait_for(l,std::chrono::milliseconds(timeoutMs),[this,issued,maxOutstanding]() { return ((issued - _completed) <= maxOutstanding); });
+	}
+
+	// Wait for a specific request to complete
+	inline bool waitFor(unsigned long idx,unsigned long timeoutMs)
+	{
+		std::unique_lock<std::mutex> l(_lock);
+		return _cond.wait_for(l,std::chrono::milliseconds(timeoutMs),[this,idx]() { return (doneAt[idx] != 0); });
+	}
+
+	std::atomic<unsigned long> configs;
+	std::atomic<unsigned long> errors;
+	std::atomic<unsigned long> revocations;
+	std::atomic<unsigned long> pushes;
+	std::vector<uint64_t> doneAt; // completion time by request index, 0 if not complete
+
+private:
+	inline void _complete(uint64_t requestPacketId)
+	{
+		if ((!requestPacketId)||(requestPacketId > (uint64_t)doneAt.size())) {
+			++pushes;
+			return;
+		}
+		const uint64_t t = usnow();
+		{
+			std::lock_guard<std::mutex> l(_lock);
+			doneAt[(unsigned long)(requestPacketId - 1)] = t;
+			++_completed;
+		}
+		_cond.notify_all();
+	}
+
+	const bool _serialize;
+	unsigned long _completed;
+	std::mutex _lock;
+	std::condition_variable _cond;
+};
+
+static Identity makeSyntheticIdentity()
+{
+	// The controller trusts the node to have validated identities, so a random
+	// address and public key are enough and avoid the cost of real generation.
+	uint64_t a = 0;
+	unsigned char pub[ZT_C25519_PUBLIC_KEY_LEN];
+	do {
+		Utils::getSecureRandom(&a,sizeof(a));
+		a &= 0xffffffffffULL;
+	} while (Address(a).isReserved());
+	Utils::getSecureRandom(pub,sizeof(pub));
+	char tmp[256];
+	Utils::snprintf(tmp,sizeof(tmp),"%.10llx:0:%s",(unsigned long long)a,Utils::hex(pub,sizeof(pub)).c_str());
+	return Identity(tmp);
+}
+
+static void printHelp(const char *pn)
+{
+	printf("Usage: %s [-options]" ZT_EOL_S,pn);
+	printf("Options:" ZT_EOL_S);
+	printf("  -n <networks>  - Number of networks (default: 4)" ZT_EOL_S);
+	printf("  -m <members>   - Members per network (default: 1000)" ZT_EOL_S);
+	printf("  -r <requests>  - Number of requests to issue (default: 20000)" ZT_EOL_S);
+	printf("  -t <threads>   - Controller worker threads, 0 for auto (default: 0)" ZT_EOL_S);
+	printf("  -w <window>    - Max requests outstanding at once (default: 64)" ZT_EOL_S);
+	printf("  -d <path>      - Database path (default: new temporary directory)" ZT_EOL_S);
+	printf("  -k             - Keep database after run" ZT_EOL_S);
+	printf("  -s             - Do not serialize configs in stub sender" ZT_EOL_S);
+	printf("  -f             - Sync database writes to disk" ZT_EOL_S);
+	printf("  -h             - Display this help" ZT_EOL_S);
+}
+
+int main(int argc,char **argv)
+{
+	unsigned long networkCount = 4;
+	unsigned long membersPerNetwork = 1000;
+	unsigned long requestCount = 20000;
+	unsigned int threadCount = 0;
+	unsigned long window = 64;
+	std::string dbPath;
+	bool keepDb = false;
+	bool serialize = true;
+	bool syncDbWrites = false;
+
+	for(int i=1;i<argc;++i) {
+		const char *const a = argv[i];
+		if ((a[0] != '-')||(!a[1])||(a[2])) {
+			printHelp(argv[0]);
+			return 1;
+		}
+		switch(a[1]) {
+			case 'k': keepDb = true; continue;
+			case 's': serialize = false; continue;
+			case 'f': syncDbWrites = true; continue;
+			case 'h': printHelp(argv[0]); return 0;
+			default: break;
+		}
+		if ((i + 1) >= argc) {
+			printHelp(argv[0]);
+			return 1;
+		}
+		const char *const v = argv[++i];
+		switch(a[1]) {
+			case 'n': networkCount = strtoul(v,(char **)0,10); break;
+			case 'm': membersPerNetwork = strtoul(v,(char **)0,10); break;
+			case 'r': requestCount = strtoul(v,(char **)0,10); break;
+			case 't': threadCount = (unsigned int)strtoul(v,(char **)0,10); break;
+			case 'w': window = strtoul(v,(char **)0,10); break;
+			case 'd': dbPath = v; break;
+			default:
+				printHelp(argv[0]);
+				return 1;
+		}
+	}
+	if ((networkCount < 1)||(networkCount > 0xffffff)||(membersPerNetwork < 1)||(requestCount < 1)||(window < 1)) {
+		printHelp(argv[0]);
+		return 1;
+	}
+
+	if (!dbPath.length()) {
+		char tmpl[64];
+		Utils::scopy(tmpl,sizeof(tmpl),"/tmp/zt-controller-bench-XXXXXX");
+		if (!mkdtemp(tmpl)) {
+			fprintf(stderr,"FATAL: unable to create temporary directory" ZT_EOL_S);
+			return 1;
+		}
+		dbPath = tmpl;
+	}
+
+	printf("Generating controller identity... "); fflush(stdout);
+	Identity signingId;
+	signingId.generate();
+	printf("%s" ZT_EOL_S,signingId.address().toString().c_str());
+
+	printf("Seeding %lu networks with %lu members each in %s... ",networkCount,membersPerNetwork,dbPath.c_str()); fflush(stdout);
+	std::vector<uint64_t> nwids;
+	std::vector<Identity> members;
+	{
+		JSONDB db(dbPath);
+		for(unsigned long n=0;n<networkCount;++n) {
+			const uint64_t nwid = (signingId.address().toInt() << 24) | (uint64_t)((n + 1) & 0xffffff);
+			char nwidStr[24],pool[64];
+			Utils::snprintf(nwidStr,sizeof(nwidStr),"%.16llx",(unsigned long long)nwid);
+			json network;
+			network["id"] = nwidStr;
+			network["nwid"] = nwidStr;
+			network["objtype"] = "network";
+			network["private"] = true;
+			network["creationTime"] = OSUtils::now();
+			network["revision"] = 1ULL;
+			network["name"] = std::string("bench-") + nwidStr;
+			network["multicastLimit"] = 32ULL;
+			network["enableBroadcast"] = true;
+			network["authTokens"] = json::array();
+			network["v4AssignMode"] = {{"zt",true}};
+			network["v6AssignMode"] = {{"rfc4193",true},{"zt",false},{"6plane",false}};
+			json p = json::object();
+			Utils::snprintf(pool,sizeof(pool),"10.%lu.0.1",(n & 0xff));
+			p["ipRangeStart"] = pool;
+			Utils::snprintf(pool,sizeof(pool),"10.%lu.255.254",(n & 0xff));
+			p["ipRangeEnd"] = pool;
+			network["ipAssignmentPools"] = json::array({p});
+			json r = json::object();
+			Utils::snprintf(pool,sizeof(pool),"10.%lu.0.0/16",(n & 0xff));
+			r["target"] = pool;
+			network["routes"] = json::array({r});
+			network["rules"] = json::array({{{"not",false},{"or",false},{"type","ACTION_ACCEPT"}}});
+			network["tags"] = json::array();
+			network["capabilities"] = json::array();
+			db.put("network",nwidStr,network);
+			nwids.push_back(nwid);
+
+			for(unsigned long m=0;m<membersPerNetwork;++m) {
+				const Identity id(makeSyntheticIdentity());
+				const std::string addrs(id.address().toString());
+				json member;
+				member["id"] = addrs;
+				member["address"] = addrs;
+				member["nwid"] = nwidStr;
+				member["objtype"] = "member";
+				member["authorized"] = true;
+				member["authHistory"] = json::array();
+				member["identity"] = id.toString(false);
+				member["ipAssignments"] = json::array();
+				member["recentLog"] = json::array();
+				member["activeBridge"] = false;
+				member["tags"] = json::array();
+				member["capabilities"] = json::array();
+				member["creationTime"] = OSUtils::now();
+				member["noAutoAssignIps"] = false;
+				member["revision"] = 1ULL;
+				member["lastDeauthorizedTime"] = 0ULL;
+				member["lastAuthorizedTime"] = OSUtils::now();
+				db.put("network",nwidStr,"member",addrs,member);
+				members.push_back(id);
+			}
+		}
+	}
+	printf("done" ZT_EOL_S);
+
+	BenchSender sender(requestCount,serialize);
+
+	const uint64_t loadStart = usnow();
+	EmbeddedNetworkController *const controller = new EmbeddedNetworkController((Node *)0,dbPath.c_str(),threadCount,syncDbWrites);
+	const uint64_t loadTime = usnow() - loadStart;
+	controller->init(signingId,&sender);
+
+	Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> rmd;
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,(uint64_t)ZT_NETWORKCONFIG_VERSION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_VENDOR,(uint64_t)ZT_VENDOR_ZEROTIER);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_PROTOCOL_VERSION,(uint64_t)ZT_PROTO_VERSION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MAJOR_VERSION,(uint64_t)ZEROTIER_ONE_VERSION_MAJOR);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MINOR_VERSION,(uint64_t)ZEROTIER_ONE_VERSION_MINOR);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_REVISION,(uint64_t)ZEROTIER_ONE_VERSION_REVISION);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_RULES,(uint64_t)ZT_MAX_NETWORK_RULES);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_CAPABILITIES,(uint64_t)ZT_MAX_NETWORK_CAPABILITIES);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_CAPABILITY_RULES,(uint64_t)ZT_MAX_CAPABILITY_RULES);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_TAGS,(uint64_t)ZT_MAX_NETWORK_TAGS);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)0);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+
+	printf("Issuing %lu requests (window %lu)... ",requestCount,window); fflush(stdout);
+
+	// Walk members in order so each (member,network) pair is revisited as late as possible
+	const unsigned long pairCount = (unsigned long)members.size();
+	std::vector<long> lastRequest(pairCount,-1);
+	std::vector<uint64_t> sentAt(requestCount,0);
+	unsigned long throttled = 0;
+	const InetAddress fromAddr("127.0.0.1/9993");
+	const uint64_t runStart = usnow();
+	for(unsigned long i=0;i<requestCount;++i) {
+		const unsigned long pair = i % pairCount;
+		if (lastRequest[pair] >= 0) {
+			const unsigned long prev = (unsigned long)lastRequest[pair];
+			if (sender.waitFor(prev,ZT_CONTROLLER_BENCH_DRAIN_TIMEOUT)) {
+				const uint64_t earliest = sender.doneAt[prev] + (ZT_CONTROLLER_BENCH_MIN_REQUEST_SPACING * 1000ULL);
+				const uint64_t t = usnow();
+				if (t < earliest) {
+					++throttled;
+					Thread::sleep((unsigned long)((earliest - t) / 1000ULL) + 1);
+				}
+			}
+		}
+		sender.waitOutstanding(i,window - 1,ZT_CONTROLLER_BENCH_DRAIN_TIMEOUT);
+
+		lastRequest[pair] = (long)i;
+		sentAt[i] = usnow();
+		controller->request(nwids[pair / membersPerNetwork],fromAddr,(uint64_t)(i + 1),members[pair],rmd);
+	}
+	sender.waitOutstanding(requestCount,0,ZT_CONTROLLER_BENCH_DRAIN_TIMEOUT);
+	printf("done" ZT_EOL_S ZT_EOL_S);
+
+	std::vector<uint64_t> latencies;
+	latencies.reserve(requestCount);
+	uint64_t runEnd = runStart;
+	for(unsigned long i=0;i<requestCount;++i) {
+		if (sender.doneAt[i]) {
+			latencies.push_back(sender.doneAt[i] - sentAt[i]);
+			runEnd = std::max(runEnd,sender.doneAt[i]);
+		}
+	}
+	std::sort(latencies.begin(),latencies.end());
+
+	const unsigned long completed = (unsigned long)latencies.size();
+	const double runSeconds = (double)(runEnd - runStart) / 1000000.0;
+	uint64_t latencySum = 0;
+	for(std::vector<uint64_t>::const_iterator l(latencies.begin());l!=latencies.end();++l)
+		latencySum += *l;
+
+	printf("networks:            %lu" ZT_EOL_S,networkCount);
+	printf("members:             %lu" ZT_EOL_S,(unsigned long)members.size());
+	printf("startup (db load):   %.3f ms" ZT_EOL_S,(double)loadTime / 1000.0);
+	printf("requests:            %lu issued, %lu completed, %lu lost" ZT_EOL_S,requestCount,completed,requestCount - completed);
+	printf("replies:             %lu configs, %lu errors" ZT_EOL_S,(unsigned long)sender.configs,(unsigned long)sender.errors);
+	printf("throttled:           %lu (member re-requested within %d ms)" ZT_EOL_S,throttled,ZT_CONTROLLER_BENCH_MIN_REQUEST_SPACING);
+	if (completed) {
+		printf("throughput:          %.1f requests/sec" ZT_EOL_S,(runSeconds > 0.0) ? ((double)completed / runSeconds) : 0.0);
+		printf("latency mean:        %.3f ms" ZT_EOL_S,((double)latencySum / (double)completed) / 1000.0);
+		printf("latency p50:         %.3f ms" ZT_EOL_S,(double)latencies[completed / 2] / 1000.0);
+		printf("latency p99:         %.3f ms" ZT_EOL_S,(double)latencies[std::min(completed - 1,(completed * 99) / 100)] / 1000.0);
+		printf("latency max:         %.3f ms" ZT_EOL_S,(double)latencies[completed - 1] / 1000.0);
+	}
+
+	delete controller;
+
+	if (!keepDb)
+		OSUtils::rmDashRf(dbPath.c_str());
+
+	return ((completed == requestCount) ? 0 : 1);
+}
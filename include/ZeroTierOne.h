@@ -73,8 +73,16 @@ extern "C" {
  *
  * We use 2800, which leaves some room for other payload in other types of
  * messages such as multicast propagation or future support for bridging.
+ *
+ * Datacenter deployments on jumbo frame networks can build with a larger
+ * value (e.g. -DZT_MAX_MTU=9000, or ZT_JUMBO=1 with make on Linux). Every
+ * member of a network must then be built the same way, since other nodes
+ * will drop packets with more fragments than they support. Path MTU
+ * discovery keeps the number of fragments actually sent low.
  */
+#ifndef ZT_MAX_MTU
 #define ZT_MAX_MTU 2800
+#endif
 
 /**
  * Maximum length of network short name
@@ -452,6 +460,267 @@ typedef struct
 	unsigned int length;
 } ZT_UserMessage;
 
+/**
+ * Number of per-verb slots in ZT_Metrics (verbs are 5 bits on the wire)
+ */
+#define ZT_METRICS_VERB_COUNT 32
+
+/**
+ * Number of buckets in the ZT_Metrics crypto time histogram
+ *
+ * Bucket i counts operations that took at most 2^(i+8) nanoseconds, so the
+ * histogram covers 256ns to ~8.4ms. Slower operations are only counted in
+ * cryptoTimeCount and cryptoTimeSum.
+ */
+#define ZT_METRICS_CRYPTO_TIME_BUCKETS 16
+
+/**
+ * Reasons an inbound packet can be dropped, indexes into ZT_Metrics::drops
+ */
+enum ZT_MetricsDropReason
+{
+	/**
+	 * MAC authentication failed
+	 */
+	ZT_METRICS_DROP_MAC_FAILED = 0,
+
+	/**
+	 * Compressed payload could not be decompressed
+	 */
+	ZT_METRICS_DROP_DECOMPRESS_FAILED = 1,
+
+	/**
+	 * Packet was malformed or handler threw an exception
+	 */
+	ZT_METRICS_DROP_MALFORMED = 2,
+
+	/**
+	 * A per-peer or per-path rate limit circuit breaker tripped
+	 */
+	ZT_METRICS_DROP_RATE_LIMITED = 3,
+
+	/**
+	 * Inbound frame was rejected by the network's rules engine
+	 */
+	ZT_METRICS_DROP_FILTER = 4,
+
+	/**
+	 * Trusted path cipher used on a path that is not trusted
+	 */
+	ZT_METRICS_DROP_UNTRUSTED_PATH = 5,
+
+	/**
+	 * Packet to be relayed exceeded maximum hop count
+	 */
+	ZT_METRICS_DROP_MAX_HOPS = 6,
+
+	/**
+	 * Frame was a duplicate sent over more than one path
+	 */
+	ZT_METRICS_DROP_DUPLICATE = 7
+};
+
+/**
+ * Number of drop reasons in ZT_MetricsDropReason
+ */
+#define ZT_METRICS_DROP_REASON_COUNT 8
+
+/**
+ * Final rules engine verdicts, indexes into ZT_Metrics::ruleVerdicts
+ */
+enum ZT_MetricsRuleVerdict
+{
+	ZT_METRICS_RULE_VERDICT_ACCEPT = 0,
+	ZT_METRICS_RULE_VERDICT_DROP = 1,
+	ZT_METRICS_RULE_VERDICT_REDIRECT = 2,
+	ZT_METRICS_RULE_VERDICT_TEE = 3
+};
+
+/**
+ * Number of verdicts in ZT_MetricsRuleVerdict
+ */
+#define ZT_METRICS_RULE_VERDICT_COUNT 4
+
+/**
+ * Snapshot of node data plane counters and gauges
+ *
+ * Counters are monotonic since node startup. Reads are not atomic across
+ * fields, so a snapshot taken under load may be very slightly inconsistent.
+ */
+typedef struct
+{
+	/**
+	 * Authenticated inbound packets by verb
+	 */
+	uint64_t rxPackets[ZT_METRICS_VERB_COUNT];
+
+	/**
+	 * Authenticated inbound bytes (after decompression) by verb
+	 */
+	uint64_t rxBytes[ZT_METRICS_VERB_COUNT];
+
+	/**
+	 * Inbound drops by ZT_MetricsDropReason
+	 */
+	uint64_t drops[ZT_METRICS_DROP_REASON_COUNT];
+
+	/**
+	 * Packets and fragments relayed on behalf of other peers
+	 */
+	uint64_t relayedPackets;
+
+	/**
+	 * Bytes relayed on behalf of other peers
+	 */
+	uint64_t relayedBytes;
+
+	/**
+	 * Rules engine verdicts by ZT_MetricsRuleVerdict, [0] inbound and [1] outbound
+	 */
+	uint64_t ruleVerdicts[2][ZT_METRICS_RULE_VERDICT_COUNT];
+
+	/**
+	 * Packet authentication/decryption time histogram (non-cumulative buckets)
+	 */
+	uint64_t cryptoTimeBuckets[ZT_METRICS_CRYPTO_TIME_BUCKETS];
+
+	/**
+	 * Total packet authentication/decryption time in nanoseconds
+	 */
+	uint64_t cryptoTimeSum;
+
+	/**
+	 * Number of timed packet authentication/decryption operations
+	 */
+	uint64_t cryptoTimeCount;
+
+	/**
+	 * Credential signatures checked with a full Ed25519 verification
+	 */
+	uint64_t credentialVerifications;
+
+	/**
+	 * Credential signatures accepted from the verification cache (verifications saved)
+	 */
+	uint64_t credentialVerificationsCached;
+
+	/**
+	 * Number of addresses with outstanding WHOIS requests
+	 */
+	unsigned int whoisQueueDepth;
+
+	/**
+	 * Number of live entries in the fragment reassembly / pending decode queue
+	 */
+	unsigned int rxQueueOccupancy;
+
+	/**
+	 * Capacity of the fragment reassembly / pending decode queue
+	 */
+	unsigned int rxQueueCapacity;
+} ZT_Metrics;
+
+/**
+ * Default packet trace sample rate (one in this many packets is traced)
+ */
+#define ZT_TRACE_DEFAULT_SAMPLE_RATE 16
+
+/**
+ * Packet processing stages recorded by the packet trace ring
+ */
+enum ZT_TraceStage
+{
+	/**
+	 * Packet or fragment arrived from the wire (arg: length)
+	 */
+	ZT_TRACE_STAGE_RX_WIRE = 0,
+
+	/**
+	 * Decode of a complete packet started (arg: length)
+	 */
+	ZT_TRACE_STAGE_RX_DECODE = 1,
+
+	/**
+	 * Packet authenticated, decrypted, and decompressed (arg: verb)
+	 */
+	ZT_TRACE_STAGE_RX_AUTHENTICATED = 2,
+
+	/**
+	 * Inbound frame passed through the rules engine (arg: 0 drop, 1 accept, 2 super-accept)
+	 */
+	ZT_TRACE_STAGE_RX_FILTERED = 3,
+
+	/**
+	 * Inbound frame handed to the virtual network port (arg: frame length)
+	 */
+	ZT_TRACE_STAGE_RX_TAP = 4,
+
+	/**
+	 * Outbound frame arrived from the virtual network port (arg: frame length)
+	 */
+	ZT_TRACE_STAGE_TX_TAP = 5,
+
+	/**
+	 * Outbound frame passed through the rules engine (arg: always 1, drops are not traced)
+	 */
+	ZT_TRACE_STAGE_TX_FILTERED = 6,
+
+	/**
+	 * Outbound packet authenticated and encrypted (arg: length)
+	 */
+	ZT_TRACE_STAGE_TX_ARMORED = 7,
+
+	/**
+	 * Outbound packet and any fragments sent to the wire (arg: length)
+	 */
+	ZT_TRACE_STAGE_TX_WIRE = 8
+};
+
+/**
+ * A single packet trace event
+ */
+typedef struct
+{
+	/**
+	 * Packet ID with its least significant 3 bits (the send counter) masked off
+	 */
+	uint64_t packetId;
+
+	/**
+	 * Monotonic timestamp in nanoseconds (arbitrary epoch)
+	 */
+	uint64_t timestamp;
+
+	/**
+	 * Stage (see ZT_TraceStage)
+	 */
+	unsigned int stage;
+
+	/**
+	 * Stage-specific argument
+	 */
+	unsigned int arg;
+} ZT_TraceEvent;
+
+/**
+ * Packet trace events in timestamp order
+ */
+typedef struct
+{
+	/**
+	 * Current sample rate (0 if tracing is disabled)
+	 */
+	unsigned int sampleRate;
+
+	/**
+	 * Total events recorded since startup (including those overwritten), modulo 2^32
+	 */
+	uint64_t totalEvents;
+
+	ZT_TraceEvent *events;
+	unsigned long eventCount;
+} ZT_TraceEventList;
+
 /**
  * Current node status
  */
@@ -842,6 +1111,33 @@ enum ZT_VirtualNetworkConfigOperation
 	ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY = 4
 };
 
+/**
+ * How traffic to a peer is spread over its physical paths
+ */
+enum ZT_MultipathMode
+{
+	/**
+	 * Send everything over the single best path (default)
+	 */
+	ZT_MULTIPATH_NONE = 0,
+
+	/**
+	 * Spread flows over all live paths, favoring paths with lower latency and loss
+	 *
+	 * Flows (IP protocol, addresses, and ports) are hashed onto paths, so the
+	 * packets of one flow stay on one path and are not reordered.
+	 */
+	ZT_MULTIPATH_BALANCE = 1,
+
+	/**
+	 * Like ZT_MULTIPATH_BALANCE, but send latency-critical packets over every live path
+	 *
+	 * IP packets marked with DSCP EF (expedited forwarding) are duplicated.
+	 * Receivers drop the extra copies.
+	 */
+	ZT_MULTIPATH_BALANCE_DUPLICATE_EF = 2
+};
+
 /**
  * What trust hierarchy role does this peer have?
  */
@@ -1055,6 +1351,36 @@ typedef struct
 	 * Is path preferred?
 	 */
 	int preferred;
+
+	/**
+	 * Smoothed round trip time in milliseconds or zero if not yet measured
+	 */
+	unsigned int latency;
+
+	/**
+	 * Round trip time variation in milliseconds
+	 */
+	unsigned int jitter;
+
+	/**
+	 * Estimated probe loss in thousandths (0 to 1000)
+	 */
+	unsigned int packetLoss;
+
+	/**
+	 * Bytes per second sent over this path during the last metering interval
+	 */
+	uint64_t txThroughput;
+
+	/**
+	 * Bytes per second received over this path during the last metering interval
+	 */
+	uint64_t rxThroughput;
+
+	/**
+	 * Largest UDP payload known to reach the peer unfragmented over this path
+	 */
+	unsigned int mtu;
 } ZT_PeerPhysicalPath;
 
 /**
@@ -1505,6 +1831,29 @@ typedef int (*ZT_DataStorePutFunction)(
 	unsigned long,
 	int);
 
+/**
+ * Function to start an asynchronous get of an object from the data store
+ *
+ * Parameters: (1) node, (2) user ptr, (3) thread ptr, (4) object name,
+ * (5) request ID.
+ *
+ * This is an optional alternative to the get function for lookups made
+ * during packet processing, such as loading a peer's cached identity.
+ * It must not block. If it returns zero the request has been accepted and
+ * the result must later be passed to ZT_Node_dataStoreGetResult() along
+ * with the same request ID, from any thread. Packets waiting on the result
+ * are held until it arrives. A nonzero return causes the node to fall back
+ * to the synchronous get function for this request.
+ *
+ * Name semantics are the same as the get function.
+ */
+typedef int (*ZT_DataStoreGetAsyncFunction)(
+	ZT_Node *,                             /* Node */
+	void *,                                /* User ptr */
+	void *,                                /* Thread ptr */
+	const char *,                          /* Object name */
+	uint64_t);                             /* Request ID */
+
 /**
  * Function to send a ZeroTier packet out over the wire
  *
@@ -1606,7 +1955,7 @@ typedef int (*ZT_PathLookupFunction)(
 struct ZT_Node_Callbacks
 {
 	/**
-	 * Struct version -- must currently be 0
+	 * Struct version -- 0, 1 or 2 (version 0 ends at pathLookupFunction, version 1 at dataStoreGetAsyncFunction)
 	 */
 	long version;
 
@@ -1649,6 +1998,20 @@ struct ZT_Node_Callbacks
 	 * OPTIONAL: Function to get hints to physical paths to ZeroTier addresses
 	 */
 	ZT_PathLookupFunction pathLookupFunction;
+
+	/**
+	 * OPTIONAL (version 1 and later): Function to get objects from persistent storage asynchronously
+	 */
+	ZT_DataStoreGetAsyncFunction dataStoreGetAsyncFunction;
+
+	/**
+	 * OPTIONAL (version 2 and later): Function to send packets with the IP don't fragment flag set
+	 *
+	 * This is used only for path MTU discovery probes and takes the same
+	 * arguments as wirePacketSendFunction. Path MTU discovery is disabled
+	 * without it and packets are fragmented to ZT_UDP_DEFAULT_PAYLOAD_MTU.
+	 */
+	ZT_WirePacketSendFunction wirePacketSendDontFragmentFunction;
 };
 
 /**
@@ -1731,6 +2094,29 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	unsigned int frameLength,
 	volatile uint64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Deliver the result of an asynchronous data store get
+ *
+ * Results for request IDs that are unknown or have timed out are ignored.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param requestId Request ID passed to the async get function
+ * @param data Object data or NULL if not found
+ * @param len Length of object data or -1 if not found
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+enum ZT_ResultCode ZT_Node_dataStoreGetResult(
+	ZT_Node *node,
+	void *tptr,
+	uint64_t now,
+	uint64_t requestId,
+	const void *data,
+	long len,
+	volatile uint64_t *nextBackgroundTaskDeadline);
+
 /**
  * Perform periodic background operations
  *
@@ -1861,6 +2247,49 @@ uint64_t ZT_Node_address(ZT_Node *node);
  */
 void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status);
 
+/**
+ * Get a snapshot of data plane counters and gauges
+ *
+ * This is cheap and may be called from any thread.
+ *
+ * @param node Node instance
+ * @param metrics Buffer to fill with current metrics
+ */
+void ZT_Node_metrics(ZT_Node *node,ZT_Metrics *metrics);
+
+/**
+ * Get the events currently held in the packet trace ring
+ *
+ * The pointer returned here must be freed with freeQueryResult()
+ * when you are done with it.
+ *
+ * @param node Node instance
+ * @return Trace events or NULL on failure
+ */
+ZT_TraceEventList *ZT_Node_traceEvents(ZT_Node *node);
+
+/**
+ * Set packet trace sample rate
+ *
+ * Packets are sampled by packet ID so every stage of a sampled packet is
+ * recorded. The rate is rounded up to a power of two.
+ *
+ * @param node Node instance
+ * @param sampleRate Trace one in this many packets, 1 to trace all, 0 to disable
+ */
+void ZT_Node_setTraceSampleRate(ZT_Node *node,unsigned int sampleRate);
+
+/**
+ * Set how traffic to peers with more than one live path is sent
+ *
+ * This only affects what this node sends. Both sides of a link should
+ * usually be set the same way.
+ *
+ * @param node Node instance
+ * @param mode Multipath mode
+ */
+void ZT_Node_setMultipathMode(ZT_Node *node,enum ZT_MultipathMode mode);
+
 /**
  * Get a list of known peer nodes
  *
@@ -415,7 +415,6 @@ static inline void fe25519_pack(unsigned char r[32], const fe25519 *x)
     r[i] = y.v[i];
 }
 
-#if 0
 static int fe25519_iszero(const fe25519 *x)
 {
   int i;
@@ -427,7 +426,6 @@ static int fe25519_iszero(const fe25519 *x)
     r &= equal(t.v[i],0);
   return r;
 }
-#endif
 
 static inline int fe25519_iseq_vartime(const fe25519 *x, const fe25519 *y)
 {
@@ -908,10 +906,9 @@ static inline void sc25519_window3(signed char r[85], const sc25519 *s)
   r[84] += carry;
 }
 
-#if 0
 static void sc25519_window5(signed char r[51], const sc25519 *s)
 {
-  char carry;
+  signed char carry;
   int i;
   for(i=0;i<6;i++)
   {
@@ -945,7 +942,6 @@ static void sc25519_window5(signed char r[51], const sc25519 *s)
   }
   r[50] += carry;
 }
-#endif
 
 static inline void sc25519_2interleave2(unsigned char r[127], const sc25519 *s1, const sc25519 *s2)
 {
@@ -2054,7 +2050,6 @@ static inline void ge25519_pack(unsigned char r[32], const ge25519_p3 *p)
   r[31] ^= fe25519_getparity(&tx) << 7;
 }
 
-#if 0
 static int ge25519_isneutral_vartime(const ge25519_p3 *p)
 {
   int ret = 1;
@@ -2062,7 +2057,6 @@ static int ge25519_isneutral_vartime(const ge25519_p3 *p)
   if(!fe25519_iseq_vartime(&p->y, &p->z)) ret = 0;
   return ret;
 }
-#endif
 
 /* computes [s1]p1 + [s2]p2 */
 static void ge25519_double_scalarmult_vartime(ge25519_p3 *r, const ge25519_p3 *p1, const sc25519 *s1, const ge25519_p3 *p2, const sc25519 *s2)
@@ -2127,6 +2121,70 @@ static inline void ge25519_scalarmult_base(ge25519_p3 *r, const sc25519 *s)
   }
 }
 
+/* 1 if the y coordinate of a packed point is not reduced mod 2^255-19 */
+static inline int ge25519_noncanonical_y(const unsigned char p[32])
+{
+  int i;
+  if ((p[31] & 0x7f) != 0x7f) return 0;
+  for(i=30;i>0;i--)
+    if (p[i] != 0xff) return 0;
+  return (p[0] >= 0xed);
+}
+
+/* computes [s[0]]p[0] + ... + [s[n-1]]p[n-1], pre must have room for 16*n points */
+static void ge25519_multi_scalarmult_vartime(ge25519_p3 *r, const ge25519_p3 *p, const sc25519 *s, unsigned int n, ge25519_p3 *pre, signed char (*w)[51])
+{
+  ge25519_p1p1 t;
+  ge25519_p3 neg;
+  unsigned int i,k;
+  int j;
+  signed char d;
+
+  /* pre[16*i+k] = (k+1)p[i] */
+  for(i=0;i<n;i++)
+  {
+    pre[16*i] = p[i];
+    dbl_p1p1(&t, (const ge25519_p2 *)&p[i]);
+    p1p1_to_p3(&pre[16*i+1], &t);
+    for(k=2;k<16;k++)
+    {
+      add_p1p1(&t, &pre[16*i+k-1], &p[i]);
+      p1p1_to_p3(&pre[16*i+k], &t);
+    }
+    sc25519_window5(w[i], &s[i]);
+  }
+
+  setneutral(r);
+  for(j=50;j>=0;j--)
+  {
+    if (j != 50)
+    {
+      for(k=0;k<4;k++)
+      {
+        dbl_p1p1(&t, (ge25519_p2 *)r);
+        p1p1_to_p2((ge25519_p2 *)r, &t);
+      }
+      dbl_p1p1(&t, (ge25519_p2 *)r);
+      p1p1_to_p3(r, &t);
+    }
+    for(i=0;i<n;i++)
+    {
+      d = w[i][j];
+      if (d > 0)
+        add_p1p1(&t, r, &pre[16*i+d-1]);
+      else if (d < 0)
+      {
+        neg = pre[16*i-d-1];
+        fe25519_neg(&neg.x, &neg.x);
+        fe25519_neg(&neg.t, &neg.t);
+        add_p1p1(&t, r, &neg);
+      }
+      else continue;
+      p1p1_to_p3(r, &t);
+    }
+  }
+}
+
 static inline void get_hram(unsigned char *hram, const unsigned char *sm, const unsigned char *pk, unsigned char *playground, unsigned long long smlen)
 {
   unsigned long long i;
@@ -2176,7 +2234,6 @@ static int crypto_sign(
     )
 {
   sc25519 sck, scs, scsk;
-  ge25519 ger;
   unsigned char r[32];
   unsigned char s[32];
   unsigned char extsk[64];
@@ -2267,13 +2324,671 @@ static int crypto_sign_open(
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+// 64-bit field arithmetic in radix 2^51 for compilers with a 128-bit integer
+// type. Each multiply is 25 64x64->128 products instead of the 1024 small
+// ones above. Limbs are kept below about 2^51 + 2^18 between operations.
+
+#if defined(__SIZEOF_INT128__) && !defined(ZT_C25519_NO_FE51)
+#define ZT_C25519_FE51 1
+
+typedef unsigned __int128 fe51_uint128;
+
+typedef struct
+{
+  crypto_uint64 v[5];
+}
+fe51;
+
+#define FE51_MASK 0x7ffffffffffffULL
+
+static const fe51 fe51_d = {{0x34dca135978a3ULL, 0x1a8283b156ebdULL, 0x5e7a26001c029ULL, 0x739c663a03cbbULL, 0x52036cee2b6ffULL}};
+static const fe51 fe51_2d = {{0x69b9426b2f159ULL, 0x35050762add7aULL, 0x3cf44c0038052ULL, 0x6738cc7407977ULL, 0x2406d9dc56dffULL}};
+static const fe51 fe51_sqrtm1 = {{0x61b274a0ea0b0ULL, 0x0d5a5fc8f189dULL, 0x7ef5e9cbd0c60ULL, 0x78595a6804c9eULL, 0x2b8324804fc1dULL}};
+
+static inline void fe51_setzero(fe51 *r)
+{
+  r->v[0] = 0; r->v[1] = 0; r->v[2] = 0; r->v[3] = 0; r->v[4] = 0;
+}
+
+static inline void fe51_setone(fe51 *r)
+{
+  r->v[0] = 1; r->v[1] = 0; r->v[2] = 0; r->v[3] = 0; r->v[4] = 0;
+}
+
+static inline void fe51_carry(fe51 *r)
+{
+  crypto_uint64 c;
+  c = r->v[0] >> 51; r->v[0] &= FE51_MASK; r->v[1] += c;
+  c = r->v[1] >> 51; r->v[1] &= FE51_MASK; r->v[2] += c;
+  c = r->v[2] >> 51; r->v[2] &= FE51_MASK; r->v[3] += c;
+  c = r->v[3] >> 51; r->v[3] &= FE51_MASK; r->v[4] += c;
+  c = r->v[4] >> 51; r->v[4] &= FE51_MASK; r->v[0] += c * 19;
+}
+
+/* bit 255 is ignored like fe25519_unpack() */
+static inline void fe51_frombytes(fe51 *r, const unsigned char s[32])
+{
+  crypto_uint64 w[4];
+  int i,j;
+  for(i=0;i<4;i++)
+  {
+    w[i] = 0;
+    for(j=7;j>=0;j--)
+      w[i] = (w[i] << 8) | (crypto_uint64)s[(8*i)+j];
+  }
+  r->v[0] = w[0] & FE51_MASK;
+  r->v[1] = ((w[0] >> 51) | (w[1] << 13)) & FE51_MASK;
+  r->v[2] = ((w[1] >> 38) | (w[2] << 26)) & FE51_MASK;
+  r->v[3] = ((w[2] >> 25) | (w[3] << 39)) & FE51_MASK;
+  r->v[4] = (w[3] >> 12) & FE51_MASK;
+}
+
+/* fully reduced */
+static inline void fe51_tobytes(unsigned char s[32], const fe51 *x)
+{
+  fe51 t = *x;
+  crypto_uint64 q,w[4];
+  int i,j;
+
+  fe51_carry(&t);
+  fe51_carry(&t);
+
+  /* q is 1 if t >= p */
+  q = (t.v[0] + 19) >> 51;
+  q = (t.v[1] + q) >> 51;
+  q = (t.v[2] + q) >> 51;
+  q = (t.v[3] + q) >> 51;
+  q = (t.v[4] + q) >> 51;
+
+  t.v[0] += 19 * q;
+  t.v[1] += t.v[0] >> 51; t.v[0] &= FE51_MASK;
+  t.v[2] += t.v[1] >> 51; t.v[1] &= FE51_MASK;
+  t.v[3] += t.v[2] >> 51; t.v[2] &= FE51_MASK;
+  t.v[4] += t.v[3] >> 51; t.v[3] &= FE51_MASK;
+  t.v[4] &= FE51_MASK;
+
+  w[0] = t.v[0] | (t.v[1] << 51);
+  w[1] = (t.v[1] >> 13) | (t.v[2] << 38);
+  w[2] = (t.v[2] >> 26) | (t.v[3] << 25);
+  w[3] = (t.v[3] >> 39) | (t.v[4] << 12);
+  for(i=0;i<4;i++)
+    for(j=0;j<8;j++)
+      s[(8*i)+j] = (unsigned char)(w[i] >> (8*j));
+}
+
+static inline void fe51_add(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  r->v[0] = x->v[0] + y->v[0];
+  r->v[1] = x->v[1] + y->v[1];
+  r->v[2] = x->v[2] + y->v[2];
+  r->v[3] = x->v[3] + y->v[3];
+  r->v[4] = x->v[4] + y->v[4];
+  fe51_carry(r);
+}
+
+/* adds 4p so the limbs can't go negative */
+static inline void fe51_sub(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  r->v[0] = (x->v[0] + 0x1fffffffffffb4ULL) - y->v[0];
+  r->v[1] = (x->v[1] + 0x1ffffffffffffcULL) - y->v[1];
+  r->v[2] = (x->v[2] + 0x1ffffffffffffcULL) - y->v[2];
+  r->v[3] = (x->v[3] + 0x1ffffffffffffcULL) - y->v[3];
+  r->v[4] = (x->v[4] + 0x1ffffffffffffcULL) - y->v[4];
+  fe51_carry(r);
+}
+
+static inline void fe51_neg(fe51 *r, const fe51 *x)
+{
+  fe51 z;
+  fe51_setzero(&z);
+  fe51_sub(r, &z, x);
+}
+
+static inline void fe51_reduce128(fe51 *r, fe51_uint128 t0, fe51_uint128 t1, fe51_uint128 t2, fe51_uint128 t3, fe51_uint128 t4)
+{
+  crypto_uint64 c;
+  t1 += t0 >> 51;
+  t2 += t1 >> 51;
+  t3 += t2 >> 51;
+  t4 += t3 >> 51;
+  r->v[0] = (crypto_uint64)t0 & FE51_MASK;
+  r->v[1] = (crypto_uint64)t1 & FE51_MASK;
+  r->v[2] = (crypto_uint64)t2 & FE51_MASK;
+  r->v[3] = (crypto_uint64)t3 & FE51_MASK;
+  r->v[4] = (crypto_uint64)t4 & FE51_MASK;
+  t0 = (fe51_uint128)r->v[0] + ((t4 >> 51) * 19);
+  r->v[0] = (crypto_uint64)t0 & FE51_MASK;
+  c = (crypto_uint64)(t0 >> 51);
+  r->v[1] += c;
+}
+
+static inline void fe51_mul(fe51 *r, const fe51 *x, const fe51 *y)
+{
+  const crypto_uint64 x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3], x4 = x->v[4];
+  const crypto_uint64 y0 = y->v[0], y1 = y->v[1], y2 = y->v[2], y3 = y->v[3], y4 = y->v[4];
+  const crypto_uint64 y1_19 = y1 * 19, y2_19 = y2 * 19, y3_19 = y3 * 19, y4_19 = y4 * 19;
+  fe51_reduce128(r,
+    ((fe51_uint128)x0 * y0) + ((fe51_uint128)x1 * y4_19) + ((fe51_uint128)x2 * y3_19) + ((fe51_uint128)x3 * y2_19) + ((fe51_uint128)x4 * y1_19),
+    ((fe51_uint128)x0 * y1) + ((fe51_uint128)x1 * y0) + ((fe51_uint128)x2 * y4_19) + ((fe51_uint128)x3 * y3_19) + ((fe51_uint128)x4 * y2_19),
+    ((fe51_uint128)x0 * y2) + ((fe51_uint128)x1 * y1) + ((fe51_uint128)x2 * y0) + ((fe51_uint128)x3 * y4_19) + ((fe51_uint128)x4 * y3_19),
+    ((fe51_uint128)x0 * y3) + ((fe51_uint128)x1 * y2) + ((fe51_uint128)x2 * y1) + ((fe51_uint128)x3 * y0) + ((fe51_uint128)x4 * y4_19),
+    ((fe51_uint128)x0 * y4) + ((fe51_uint128)x1 * y3) + ((fe51_uint128)x2 * y2) + ((fe51_uint128)x3 * y1) + ((fe51_uint128)x4 * y0));
+}
+
+static inline void fe51_square(fe51 *r, const fe51 *x)
+{
+  const crypto_uint64 x0 = x->v[0], x1 = x->v[1], x2 = x->v[2], x3 = x->v[3], x4 = x->v[4];
+  const crypto_uint64 x0_2 = x0 * 2, x1_2 = x1 * 2, x2_2 = x2 * 2;
+  const crypto_uint64 x3_19 = x3 * 19, x4_19 = x4 * 19;
+  fe51_reduce128(r,
+    ((fe51_uint128)x0 * x0) + ((fe51_uint128)x1_2 * x4_19) + ((fe51_uint128)x2_2 * x3_19),
+    ((fe51_uint128)x0_2 * x1) + ((fe51_uint128)x2_2 * x4_19) + ((fe51_uint128)x3 * x3_19),
+    ((fe51_uint128)x0_2 * x2) + ((fe51_uint128)x1 * x1) + ((fe51_uint128)(x3 * 2) * x4_19),
+    ((fe51_uint128)x0_2 * x3) + ((fe51_uint128)x1_2 * x2) + ((fe51_uint128)x4 * x4_19),
+    ((fe51_uint128)x0_2 * x4) + ((fe51_uint128)x1_2 * x3) + ((fe51_uint128)x2 * x2));
+}
+
+static inline void fe51_square_times(fe51 *r, const fe51 *x, int n)
+{
+  fe51_square(r, x);
+  while (--n > 0)
+    fe51_square(r, r);
+}
+
+static inline void fe51_mul121665(fe51 *r, const fe51 *x)
+{
+  fe51_reduce128(r,
+    (fe51_uint128)x->v[0] * 121665,
+    (fe51_uint128)x->v[1] * 121665,
+    (fe51_uint128)x->v[2] * 121665,
+    (fe51_uint128)x->v[3] * 121665,
+    (fe51_uint128)x->v[4] * 121665);
+}
+
+/* z11 = x^11, z2_250_0 = x^(2^250 - 1) */
+static void fe51_pow22501(fe51 *z11, fe51 *z2_250_0, const fe51 *x)
+{
+  fe51 z2, z9, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+  fe51_square(&z2, x);
+  fe51_square_times(&t, &z2, 2);
+  fe51_mul(&z9, &t, x);
+  fe51_mul(z11, &z9, &z2);
+  fe51_square(&t, z11);
+  fe51_mul(&z2_5_0, &t, &z9);
+  fe51_square_times(&t, &z2_5_0, 5);
+  fe51_mul(&z2_10_0, &t, &z2_5_0);
+  fe51_square_times(&t, &z2_10_0, 10);
+  fe51_mul(&z2_20_0, &t, &z2_10_0);
+  fe51_square_times(&t, &z2_20_0, 20);
+  fe51_mul(&t, &t, &z2_20_0);
+  fe51_square_times(&t, &t, 10);
+  fe51_mul(&z2_50_0, &t, &z2_10_0);
+  fe51_square_times(&t, &z2_50_0, 50);
+  fe51_mul(&z2_100_0, &t, &z2_50_0);
+  fe51_square_times(&t, &z2_100_0, 100);
+  fe51_mul(&t, &t, &z2_100_0);
+  fe51_square_times(&t, &t, 50);
+  fe51_mul(z2_250_0, &t, &z2_50_0);
+}
+
+/* x^(p-2) */
+static void fe51_invert(fe51 *r, const fe51 *x)
+{
+  fe51 z11, t;
+  fe51_pow22501(&z11, &t, x);
+  fe51_square_times(&t, &t, 5);
+  fe51_mul(r, &t, &z11);
+}
+
+/* x^((p-5)/8) */
+static void fe51_pow2523(fe51 *r, const fe51 *x)
+{
+  fe51 z11, t;
+  fe51_pow22501(&z11, &t, x);
+  fe51_square_times(&t, &t, 2);
+  fe51_mul(r, &t, x);
+}
+
+static inline void fe51_cswap(fe51 *x, fe51 *y, crypto_uint64 b)
+{
+  const crypto_uint64 mask = (crypto_uint64)0 - b;
+  crypto_uint64 t;
+  int i;
+  for(i=0;i<5;i++)
+  {
+    t = mask & (x->v[i] ^ y->v[i]);
+    x->v[i] ^= t;
+    y->v[i] ^= t;
+  }
+}
+
+static inline void fe51_cmov(fe51 *r, const fe51 *x, crypto_uint64 b)
+{
+  const crypto_uint64 mask = (crypto_uint64)0 - b;
+  int i;
+  for(i=0;i<5;i++)
+    r->v[i] ^= mask & (x->v[i] ^ r->v[i]);
+}
+
+static inline int fe51_iszero(const fe51 *x)
+{
+  unsigned char s[32];
+  unsigned char r = 0;
+  int i;
+  fe51_tobytes(s, x);
+  for(i=0;i<32;i++)
+    r |= s[i];
+  return (r == 0);
+}
+
+static inline int fe51_iseq_vartime(const fe51 *x, const fe51 *y)
+{
+  fe51 t;
+  fe51_sub(&t, x, y);
+  return fe51_iszero(&t);
+}
+
+static inline unsigned char fe51_getparity(const fe51 *x)
+{
+  unsigned char s[32];
+  fe51_tobytes(s, x);
+  return s[0] & 1;
+}
+
+/* RFC 7748 Montgomery ladder, same results as crypto_scalarmult() */
+static void crypto_scalarmult_fe51(unsigned char *q, const unsigned char *n, const unsigned char *p)
+{
+  unsigned char e[32];
+  fe51 x1, x2, z2, x3, z3, a, aa, b, bb, c, d, da, cb, ee;
+  crypto_uint64 swap = 0, bit;
+  int i;
+
+  for(i=0;i<32;i++) e[i] = n[i];
+  e[0] &= 248;
+  e[31] &= 127;
+  e[31] |= 64;
+
+  fe51_frombytes(&x1, p);
+  x1.v[0] += 19 * (crypto_uint64)(p[31] >> 7); /* crypto_scalarmult() reads all 256 bits */
+  fe51_setone(&x2);
+  fe51_setzero(&z2);
+  x3 = x1;
+  fe51_setone(&z3);
+
+  for(i=254;i>=0;i--)
+  {
+    bit = (e[i >> 3] >> (i & 7)) & 1;
+    swap ^= bit;
+    fe51_cswap(&x2, &x3, swap);
+    fe51_cswap(&z2, &z3, swap);
+    swap = bit;
+
+    fe51_add(&a, &x2, &z2);
+    fe51_square(&aa, &a);
+    fe51_sub(&b, &x2, &z2);
+    fe51_square(&bb, &b);
+    fe51_sub(&ee, &aa, &bb);
+    fe51_add(&c, &x3, &z3);
+    fe51_sub(&d, &x3, &z3);
+    fe51_mul(&da, &d, &a);
+    fe51_mul(&cb, &c, &b);
+    fe51_add(&x3, &da, &cb);
+    fe51_square(&x3, &x3);
+    fe51_sub(&z3, &da, &cb);
+    fe51_square(&z3, &z3);
+    fe51_mul(&z3, &z3, &x1);
+    fe51_mul(&x2, &aa, &bb);
+    fe51_mul121665(&z2, &ee);
+    fe51_add(&z2, &z2, &aa);
+    fe51_mul(&z2, &z2, &ee);
+  }
+  fe51_cswap(&x2, &x3, swap);
+  fe51_cswap(&z2, &z3, swap);
+
+  fe51_invert(&z2, &z2);
+  fe51_mul(&x2, &x2, &z2);
+  fe51_tobytes(q, &x2);
+}
+
+typedef struct
+{
+  fe51 x;
+  fe51 y;
+  fe51 z;
+  fe51 t;
+} ge51;
+
+static const ge51 ge51_base = {
+  {{0x62d608f25d51aULL, 0x412a4b4f6592aULL, 0x75b7171a4b31dULL, 0x1ff60527118feULL, 0x216936d3cd6e5ULL}},
+  {{0x6666666666658ULL, 0x4ccccccccccccULL, 0x1999999999999ULL, 0x3333333333333ULL, 0x6666666666666ULL}},
+  {{1ULL, 0ULL, 0ULL, 0ULL, 0ULL}},
+  {{0x68ab3a5b7dda3ULL, 0x00eea2a5eadbbULL, 0x2af8df483c27eULL, 0x332b375274732ULL, 0x67875f0fd78b7ULL}}
+};
+
+static inline void ge51_setneutral(ge51 *r)
+{
+  fe51_setzero(&r->x);
+  fe51_setone(&r->y);
+  fe51_setone(&r->z);
+  fe51_setzero(&r->t);
+}
+
+/* r = p + q, complete for a = -1 twisted Edwards curves (add-2008-hwcd-3) */
+static inline void ge51_add(ge51 *r, const ge51 *p, const ge51 *q)
+{
+  fe51 a, b, c, d, e, f, g, h, t;
+  fe51_sub(&a, &p->y, &p->x);
+  fe51_sub(&t, &q->y, &q->x);
+  fe51_mul(&a, &a, &t);
+  fe51_add(&b, &p->y, &p->x);
+  fe51_add(&t, &q->y, &q->x);
+  fe51_mul(&b, &b, &t);
+  fe51_mul(&c, &p->t, &q->t);
+  fe51_mul(&c, &c, &fe51_2d);
+  fe51_mul(&d, &p->z, &q->z);
+  fe51_add(&d, &d, &d);
+  fe51_sub(&e, &b, &a);
+  fe51_sub(&f, &d, &c);
+  fe51_add(&g, &d, &c);
+  fe51_add(&h, &b, &a);
+  fe51_mul(&r->x, &e, &f);
+  fe51_mul(&r->y, &g, &h);
+  fe51_mul(&r->t, &e, &h);
+  fe51_mul(&r->z, &f, &g);
+}
+
+/* r = 2p (dbl-2008-hwcd), r->t is only computed if witht is set */
+static inline void ge51_dbl(ge51 *r, const ge51 *p, int witht)
+{
+  fe51 a, b, c, e, f, g, h;
+  fe51_square(&a, &p->x);
+  fe51_square(&b, &p->y);
+  fe51_square(&c, &p->z);
+  fe51_add(&c, &c, &c);
+  fe51_add(&e, &p->x, &p->y);
+  fe51_square(&e, &e);
+  fe51_sub(&e, &e, &a);
+  fe51_sub(&e, &e, &b);
+  fe51_sub(&g, &b, &a); /* g = d + b with d = -a */
+  fe51_sub(&f, &g, &c);
+  fe51_add(&h, &a, &b);
+  fe51_neg(&h, &h); /* h = d - b */
+  fe51_mul(&r->x, &e, &f);
+  fe51_mul(&r->y, &g, &h);
+  fe51_mul(&r->z, &f, &g);
+  if (witht)
+    fe51_mul(&r->t, &e, &h);
+}
+
+static inline void ge51_neg(ge51 *r, const ge51 *p)
+{
+  r->y = p->y;
+  r->z = p->z;
+  fe51_neg(&r->x, &p->x);
+  fe51_neg(&r->t, &p->t);
+}
+
+static inline void ge51_pack(unsigned char r[32], const ge51 *p)
+{
+  fe51 tx, ty, zi;
+  fe51_invert(&zi, &p->z);
+  fe51_mul(&tx, &p->x, &zi);
+  fe51_mul(&ty, &p->y, &zi);
+  fe51_tobytes(r, &ty);
+  r[31] ^= fe51_getparity(&tx) << 7;
+}
+
+/* same as ge25519_unpackneg_vartime(), return 0 on success, -1 otherwise */
+static int ge51_unpackneg_vartime(ge51 *r, const unsigned char p[32])
+{
+  unsigned char par;
+  fe51 t, chk, num, den, den2, den4, den6;
+  fe51_setone(&r->z);
+  par = p[31] >> 7;
+  fe51_frombytes(&r->y, p);
+  fe51_square(&num, &r->y); /* x = y^2 */
+  fe51_mul(&den, &num, &fe51_d); /* den = dy^2 */
+  fe51_sub(&num, &num, &r->z); /* x = y^2-1 */
+  fe51_add(&den, &r->z, &den); /* den = dy^2+1 */
+
+  /* Computation of sqrt(num/den) */
+  /* 1.: computation of num^((p-5)/8)*den^((7p-35)/8) = (num*den^7)^((p-5)/8) */
+  fe51_square(&den2, &den);
+  fe51_square(&den4, &den2);
+  fe51_mul(&den6, &den4, &den2);
+  fe51_mul(&t, &den6, &num);
+  fe51_mul(&t, &t, &den);
+
+  fe51_pow2523(&t, &t);
+  /* 2. computation of r->x = t * num * den^3 */
+  fe51_mul(&t, &t, &num);
+  fe51_mul(&t, &t, &den);
+  fe51_mul(&t, &t, &den);
+  fe51_mul(&r->x, &t, &den);
+
+  /* 3. Check whether sqrt computation gave correct result, multiply by sqrt(-1) if not: */
+  fe51_square(&chk, &r->x);
+  fe51_mul(&chk, &chk, &den);
+  if (!fe51_iseq_vartime(&chk, &num))
+    fe51_mul(&r->x, &r->x, &fe51_sqrtm1);
+
+  /* 4. Now we have one of the two square roots, except if input was not a square */
+  fe51_square(&chk, &r->x);
+  fe51_mul(&chk, &chk, &den);
+  if (!fe51_iseq_vartime(&chk, &num))
+    return -1;
+
+  /* 5. Choose the desired square root according to parity: */
+  if(fe51_getparity(&r->x) != (1-par))
+    fe51_neg(&r->x, &r->x);
+
+  fe51_mul(&r->t, &r->x, &r->y);
+  return 0;
+}
+
+static inline void ge51_cmov(ge51 *r, const ge51 *p, crypto_uint64 b)
+{
+  fe51_cmov(&r->x, &p->x, b);
+  fe51_cmov(&r->y, &p->y, b);
+  fe51_cmov(&r->z, &p->z, b);
+  fe51_cmov(&r->t, &p->t, b);
+}
+
+/* constant time, signed 4-bit windows over a table of B..8B */
+static void ge51_scalarmult_base(ge51 *r, const sc25519 *s)
+{
+  ge51 pre[8], t, tn;
+  unsigned char a[32];
+  signed char e[64];
+  signed char carry;
+  crypto_uint64 neg, babs;
+  int i, k;
+
+  pre[0] = ge51_base;
+  ge51_dbl(&pre[1], &ge51_base, 1);
+  for(i=2;i<8;i++)
+    ge51_add(&pre[i], &pre[i-1], &ge51_base);
+
+  sc25519_to32bytes(a, s);
+  for(i=0;i<32;i++)
+  {
+    e[2*i] = a[i] & 15;
+    e[(2*i)+1] = (a[i] >> 4) & 15;
+  }
+  carry = 0;
+  for(i=0;i<63;i++)
+  {
+    e[i] += carry;
+    carry = (e[i] + 8) >> 4;
+    e[i] -= carry << 4;
+  }
+  e[63] += carry;
+
+  ge51_setneutral(r);
+  for(i=63;i>=0;i--)
+  {
+    if (i != 63)
+    {
+      ge51_dbl(r, r, 0);
+      ge51_dbl(r, r, 0);
+      ge51_dbl(r, r, 0);
+      ge51_dbl(r, r, 1);
+    }
+    neg = ((crypto_uint64)(crypto_int64)e[i]) >> 63;
+    babs = (crypto_uint64)(e[i] - (((-neg) & (crypto_uint64)e[i]) << 1));
+    ge51_setneutral(&t);
+    for(k=0;k<8;k++)
+      ge51_cmov(&t, &pre[k], (crypto_uint64)equal((crypto_uint32)babs, (crypto_uint32)(k + 1)));
+    ge51_neg(&tn, &t);
+    ge51_cmov(&t, &tn, neg);
+    ge51_add(r, r, &t);
+  }
+}
+
+/* computes [s[0]]p[0] + ... + [s[n-1]]p[n-1], pre must have room for 16*n points */
+static void ge51_multi_scalarmult_vartime(ge51 *r, const ge51 *p, const sc25519 *s, unsigned int n, ge51 *pre, signed char (*w)[51])
+{
+  ge51 neg;
+  unsigned int i,k;
+  int j;
+  signed char d;
+
+  /* pre[16*i+k] = (k+1)p[i] */
+  for(i=0;i<n;i++)
+  {
+    pre[16*i] = p[i];
+    ge51_dbl(&pre[16*i+1], &p[i], 1);
+    for(k=2;k<16;k++)
+      ge51_add(&pre[16*i+k], &pre[16*i+k-1], &p[i]);
+    sc25519_window5(w[i], &s[i]);
+  }
+
+  ge51_setneutral(r);
+  for(j=50;j>=0;j--)
+  {
+    if (j != 50)
+    {
+      for(k=0;k<4;k++)
+        ge51_dbl(r, r, 0);
+      ge51_dbl(r, r, 1);
+    }
+    for(i=0;i<n;i++)
+    {
+      d = w[i][j];
+      if (d > 0)
+        ge51_add(r, r, &pre[16*i+d-1]);
+      else if (d < 0)
+      {
+        ge51_neg(&neg, &pre[16*i-d-1]);
+        ge51_add(r, r, &neg);
+      }
+    }
+  }
+}
+
+#endif // __SIZEOF_INT128__
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+// Point arithmetic backends for the Ed25519 code below
+
+struct ed25519_ref
+{
+  typedef ge25519_p3 point;
+  static inline int unpackneg(point *r, const unsigned char p[32]) { return ge25519_unpackneg_vartime(r, p); }
+  static inline void pack(unsigned char r[32], const point *p) { ge25519_pack(r, p); }
+  static inline void base(point *r) { *r = ge25519_base; }
+  static inline bool isneutral(const point *p) { return (ge25519_isneutral_vartime(p) != 0); }
+  static inline bool xiszero(const point *p) { return (fe25519_iszero(&p->x) != 0); }
+  static inline void scalarmult_base(point *r, const sc25519 *s) { ge25519_scalarmult_base(r, s); }
+  static inline void double_scalarmult(point *r, const point *p, const sc25519 *s1, const sc25519 *s2) { ge25519_double_scalarmult_vartime(r, p, s1, &ge25519_base, s2); }
+  static inline void multi_scalarmult(point *r, const point *p, const sc25519 *s, unsigned int n, point *pre, signed char (*w)[51]) { ge25519_multi_scalarmult_vartime(r, p, s, n, pre, w); }
+};
+
+#ifdef ZT_C25519_FE51
+struct ed25519_fe51
+{
+  typedef ge51 point;
+  static inline int unpackneg(point *r, const unsigned char p[32]) { return ge51_unpackneg_vartime(r, p); }
+  static inline void pack(unsigned char r[32], const point *p) { ge51_pack(r, p); }
+  static inline void base(point *r) { *r = ge51_base; }
+  static inline bool isneutral(const point *p) { return ((fe51_iszero(&p->x))&&(fe51_iseq_vartime(&p->y, &p->z))); }
+  static inline bool xiszero(const point *p) { return (fe51_iszero(&p->x) != 0); }
+  static inline void scalarmult_base(point *r, const sc25519 *s) { ge51_scalarmult_base(r, s); }
+  static inline void double_scalarmult(point *r, const point *p, const sc25519 *s1, const sc25519 *s2)
+  {
+    point pts[2], pre[32];
+    sc25519 sc[2];
+    signed char w[2][51];
+    pts[0] = *p;
+    pts[1] = ge51_base;
+    sc[0] = *s1;
+    sc[1] = *s2;
+    ge51_multi_scalarmult_vartime(r, pts, sc, 2, pre, w);
+  }
+  static inline void multi_scalarmult(point *r, const point *p, const sc25519 *s, unsigned int n, point *pre, signed char (*w)[51]) { ge51_multi_scalarmult_vartime(r, p, s, n, pre, w); }
+};
+
+static bool c25519_reference = false;
+#else
+static bool c25519_reference = true;
+#endif
+
+/* pk = pack([s]B) */
+template<typename E>
+static inline void ed25519_scalarmult_base_pack(unsigned char pk[32], const sc25519 *s)
+{
+  typename E::point p;
+  E::scalarmult_base(&p, s);
+  E::pack(pk, &p);
+}
+
+/* r = pack([h](-A) + [s]B), returns false if pk isn't a valid point */
+template<typename E>
+static inline bool ed25519_verify_r(unsigned char r[32], const unsigned char pk[32], const sc25519 *h, const sc25519 *s)
+{
+  typename E::point a, t;
+  if (E::unpackneg(&a, pk))
+    return false;
+  E::double_scalarmult(&t, &a, h, s);
+  E::pack(r, &t);
+  return true;
+}
+
+static inline void c25519_scalarmult_base_pack(unsigned char pk[32], const sc25519 *s)
+{
+#ifdef ZT_C25519_FE51
+  if (!c25519_reference) {
+    ed25519_scalarmult_base_pack<ed25519_fe51>(pk, s);
+    return;
+  }
+#endif
+  ed25519_scalarmult_base_pack<ed25519_ref>(pk, s);
+}
+
+static inline int c25519_scalarmult(unsigned char *q, const unsigned char *n, const unsigned char *p)
+{
+#ifdef ZT_C25519_FE51
+  if (!c25519_reference) {
+    crypto_scalarmult_fe51(q, n, p);
+    return 0;
+  }
+#endif
+  return crypto_scalarmult(q, n, p);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
 void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void *keybuf,unsigned int keylen)
   throw()
 {
 	unsigned char rawkey[32];
 	unsigned char digest[64];
 
-	crypto_scalarmult(rawkey,mine.data,their.data);
+	c25519_scalarmult(rawkey,mine.data,their.data);
 	SHA512::hash(digest,rawkey,32);
 	for(unsigned int i=0,k=0;i<keylen;) {
 		if (k == 64) {
@@ -2288,7 +3003,6 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
   throw()
 {
   sc25519 sck, scs, scsk;
-  ge25519 ger;
   unsigned char r[32];
   unsigned char s[32];
   unsigned char extsk[64];
@@ -2314,8 +3028,7 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 
   /* Computation of R */
   sc25519_from64bytes(&sck, hmg);
-  ge25519_scalarmult_base(&ger, &sck);
-  ge25519_pack(r, &ger);
+  c25519_scalarmult_base_pack(r, &sck);
   
   /* Computation of s */
   for(unsigned int i=0;i<32;i++)
@@ -2338,7 +3051,6 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   throw()
 {
   unsigned char t2[32];
-  ge25519 get1, get2;
   sc25519 schram, scs;
   unsigned char hram[crypto_hash_sha512_BYTES];
   unsigned char m[96];
@@ -2350,27 +3062,150 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
   if (!Utils::secureEq(sig + 64,digest,32))
     return false;
 
-  if (ge25519_unpackneg_vartime(&get1,their.data + 32))
-    return false;
-
   get_hram(hram,sig,their.data + 32,m,96);
 
   sc25519_from64bytes(&schram, hram);
 
   sc25519_from32bytes(&scs, sig+32);
 
-  ge25519_double_scalarmult_vartime(&get2, &get1, &schram, &ge25519_base, &scs);
-  ge25519_pack(t2, &get2);
+#ifdef ZT_C25519_FE51
+  if (!c25519_reference) {
+    if (!ed25519_verify_r<ed25519_fe51>(t2,their.data + 32,&schram,&scs))
+      return false;
+  } else
+#endif
+  if (!ed25519_verify_r<ed25519_ref>(t2,their.data + 32,&schram,&scs))
+    return false;
 
   return Utils::secureEq(sig,t2,32);
 }
 
+/*
+ * Batch verification checks that the sum over all signatures of
+ * z_i(s_i B - h_i A_i - R_i) is the neutral element for random 128-bit z_i,
+ * so a forged signature gets through with probability about 2^-128. The
+ * combined check is cofactorless like verify(), but unlike verify() it can
+ * accept a signature whose error term has small order (and be rejected by
+ * verify()). Only the holder of the signing key can make such a signature,
+ * so this does not let anyone else forge one.
+ */
+
+// Signatures checked per multi-scalar multiplication (precomputation is 8KiB per point)
+#define ZT_C25519_BATCH_CHUNK 16
+
+// Below this many signatures it's faster to just check them one at a time
+#define ZT_C25519_BATCH_MIN 4
+
+template<typename E>
+static bool ed25519_verify_batch(C25519::BatchEntry *e,unsigned int count)
+{
+  unsigned char hram[crypto_hash_sha512_BYTES];
+  unsigned char m[96];
+  unsigned char digest[64];
+  unsigned char z[32];
+  unsigned char rnd[16 * ZT_C25519_BATCH_CHUNK];
+  typename E::point p[(2 * ZT_C25519_BATCH_CHUNK) + 1];
+  sc25519 s[(2 * ZT_C25519_BATCH_CHUNK) + 1];
+  signed char w[(2 * ZT_C25519_BATCH_CHUNK) + 1][51];
+  unsigned int idx[ZT_C25519_BATCH_CHUNK];
+  typename E::point acc;
+  sc25519 t;
+  bool all = true;
+
+  typename E::point *const pre = (count >= ZT_C25519_BATCH_MIN) ? (typename E::point *)::malloc(sizeof(typename E::point) * 16 * ((2 * ZT_C25519_BATCH_CHUNK) + 1)) : (typename E::point *)0;
+  if (!pre) {
+    for(unsigned int i=0;i<count;++i) {
+      e[i].valid = C25519::verify(*(e[i].their),e[i].msg,e[i].len,e[i].signature);
+      all &= e[i].valid;
+    }
+    return all;
+  }
+
+  memset(z,0,sizeof(z));
+  for(unsigned int c=0;c<count;c+=ZT_C25519_BATCH_CHUNK) {
+    const unsigned int n = ((count - c) < ZT_C25519_BATCH_CHUNK) ? (count - c) : ZT_C25519_BATCH_CHUNK;
+    unsigned int np = 1,nb = 0;
+
+    Utils::getSecureRandom(rnd,16 * n);
+    memset(&(s[0]),0,sizeof(sc25519)); // sum of z_i * s_i, multiplies the base point
+
+    for(unsigned int k=0;k<n;++k) {
+      C25519::BatchEntry &b = e[c + k];
+      const unsigned char *const sig = (const unsigned char *)b.signature;
+      b.valid = false;
+
+      SHA512::hash(digest,b.msg,b.len);
+      if (!Utils::secureEq(sig + 64,digest,32))
+        continue;
+      if (E::unpackneg(&(p[np]),b.their->data + 32)) // -A
+        continue;
+      if (E::unpackneg(&(p[np + 1]),sig)) // -R
+        continue;
+      if ((ge25519_noncanonical_y(sig))||((E::xiszero(&(p[np + 1])))&&((sig[31] & 0x80) != 0))) {
+        // verify() rejects these by comparing encodings, so leave them to it
+        b.valid = C25519::verify(*(b.their),b.msg,b.len,sig);
+        continue;
+      }
+
+      memcpy(z,rnd + (16 * k),16);
+      sc25519_from32bytes(&(s[np + 1]),z);
+      get_hram(hram,sig,b.their->data + 32,m,96);
+      sc25519_from64bytes(&t,hram);
+      sc25519_mul(&(s[np]),&t,&(s[np + 1]));
+      sc25519_from32bytes(&t,sig + 32);
+      sc25519_mul(&t,&t,&(s[np + 1]));
+      sc25519_add(&(s[0]),&(s[0]),&t);
+
+      idx[nb++] = c + k;
+      np += 2;
+    }
+
+    bool ok = false;
+    if (nb >= ZT_C25519_BATCH_MIN) {
+      E::base(&(p[0]));
+      E::multi_scalarmult(&acc,p,s,np,pre,w);
+      ok = E::isneutral(&acc);
+    }
+    for(unsigned int k=0;k<nb;++k) {
+      C25519::BatchEntry &b = e[idx[k]];
+      b.valid = (ok) ? true : C25519::verify(*(b.their),b.msg,b.len,b.signature);
+    }
+  }
+
+  ::free(pre);
+
+  for(unsigned int i=0;i<count;++i)
+    all &= e[i].valid;
+  return all;
+}
+
+bool C25519::verifyBatch(C25519::BatchEntry *e,unsigned int count)
+  throw()
+{
+#ifdef ZT_C25519_FE51
+  if (!c25519_reference)
+    return ed25519_verify_batch<ed25519_fe51>(e,count);
+#endif
+  return ed25519_verify_batch<ed25519_ref>(e,count);
+}
+
+bool C25519::useReferenceImplementation(bool ref)
+  throw()
+{
+#ifdef ZT_C25519_FE51
+  c25519_reference = ref;
+  return true;
+#else
+  return false;
+#endif
+}
+
 void C25519::_calcPubDH(C25519::Pair &kp)
   throw()
 {
   // First 32 bytes of pub and priv are the keys for ECDH key
   // agreement. This generates the public portion from the private.
-  crypto_scalarmult_base(kp.pub.data,kp.priv.data);
+  c25519_scalarmult(kp.pub.data,kp.priv.data,base);
 }
 
 void C25519::_calcPubED(C25519::Pair &kp)
@@ -2378,7 +3213,6 @@ void C25519::_calcPubED(C25519::Pair &kp)
 {
   unsigned char extsk[64];
   sc25519 scsk;
-  ge25519 gepk;
 
   // Second 32 bytes of pub and priv are the keys for ed25519
   // signing and verification.
@@ -2387,8 +3221,7 @@ void C25519::_calcPubED(C25519::Pair &kp)
   extsk[31] &= 127;
   extsk[31] |= 64;
   sc25519_from32bytes(&scsk,extsk);
-  ge25519_scalarmult_base(&gepk,&scsk);
-  ge25519_pack(kp.pub.data + 32,&gepk);
+  c25519_scalarmult_base_pack(kp.pub.data + 32,&scsk);
   // In NaCl, the public key is crammed into the next 32 bytes
   // of the private key for signing since both keys are required
   // to sign. In this version we just get it from kp.pub, so we
@@ -196,6 +196,49 @@ public:
 		return verify(their,msg,len,signature.data);
 	}
 
+	/**
+	 * A signature to check with verifyBatch()
+	 */
+	struct BatchEntry
+	{
+		const Public *their; // public key to verify against
+		const void *msg;
+		unsigned int len;
+		const void *signature; // 96-byte signature
+		bool valid; // set by verifyBatch()
+	};
+
+	/**
+	 * Verify many signatures at once
+	 *
+	 * Signatures are checked together with one randomized multi-scalar
+	 * multiplication, which costs much less per signature than verify()
+	 * once there are more than a few. If the combined check fails each
+	 * signature in the failing group is checked with verify() to find the
+	 * bad ones, so a batch with one bad signature costs a bit more than
+	 * checking each one separately.
+	 *
+	 * @param e Signatures to check (valid is set in each)
+	 * @param count Number of signatures
+	 * @return True if all signatures are valid
+	 */
+	static bool verifyBatch(BatchEntry *e,unsigned int count)
+		throw();
+
+	/**
+	 * Select the portable reference implementation instead of the 64-bit one
+	 *
+	 * Where the compiler has a 128-bit integer type a faster radix 2^51
+	 * implementation is used by default. This switch is for testing and
+	 * benchmarking and should not be used while other threads are using
+	 * this class.
+	 *
+	 * @param ref If true use the reference implementation
+	 * @return True if the 64-bit implementation is built in
+	 */
+	static bool useReferenceImplementation(bool ref)
+		throw();
+
 private:
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
@@ -22,10 +22,11 @@
 #include "Topology.hpp"
 #include "Switch.hpp"
 #include "Network.hpp"
+#include "CredentialCache.hpp"
 
 namespace ZeroTier {
 
-int Capability::verify(const RuntimeEnvironment *RR,void *tPtr) const
+int Capability::verify(const RuntimeEnvironment *RR,void *tPtr,CredentialBatch *batch) const
 {
 	try {
 		// There must be at least one entry, and sanity check for bad chain max length
@@ -48,7 +49,7 @@ int Capability::verify(const RuntimeEnvironment *RR,void *tPtr) const
 
 			const Identity id(RR->topology->getIdentity(tPtr,_custody[c].from));
 			if (id) {
-				if (!id.verify(tmp.data(),tmp.size(),_custody[c].signature))
+				if (!RR->credentialCache->verify(id,tmp.data(),tmp.size(),_custody[c].signature,batch))
 					return -1;
 			} else {
 				RR->sw->requestWhois(tPtr,_custody[c].from);
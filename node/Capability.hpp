@@ -35,6 +35,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class CredentialBatch;
 
 /**
  * A set of grouped and signed network flow rules
@@ -162,9 +163,10 @@ public:
 	 * Verify this capability's chain of custody and signatures
 	 *
 	 * @param RR Runtime environment to provide for peer lookup, etc.
+	 * @param batch If non-NULL queue signatures here to be checked later instead of checking them now
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or chain
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,CredentialBatch *batch = (CredentialBatch *)0) const;
 
 	template<unsigned int C>
 	static inline void serializeRules(Buffer<C> &b,const ZT_VirtualNetworkRule *rules,unsigned int ruleCount)
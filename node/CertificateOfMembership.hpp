@@ -42,6 +42,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class CredentialBatch;
 
 /**
  * Certificate of network membership
@@ -259,9 +260,10 @@ public:
 	 *
 	 * @param RR Runtime environment for looking up peers
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL queue signatures here to be checked later instead of checking them now
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or credential
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,CredentialBatch *batch = (CredentialBatch *)0) const;
 
 	/**
 	 * @return True if signed
@@ -42,6 +42,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class CredentialBatch;
 
 /**
  * Certificate indicating ownership of a network identifier
@@ -141,9 +142,10 @@ public:
 	/**
 	 * @param RR Runtime environment to allow identity lookup for signedBy
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL queue signatures here to be checked later instead of checking them now
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,CredentialBatch *batch = (CredentialBatch *)0) const;
 
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
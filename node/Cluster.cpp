@@ -58,6 +58,16 @@ static inline double _dist3d(int x1,int y1,int z1,int x2,int y2,int z2)
 	return sqrt((dx * dx) + (dy * dy) + (dz * dz));
 }
 
+// Hash for ring points and peer addresses; must be the same on all members
+static inline uint64_t _ringHash(uint64_t x)
+	throw()
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (x ^ (x >> 31));
+}
+
 // An entry in _ClusterSendQueue
 struct _ClusterSendQueueEntry
 {
@@ -210,6 +220,7 @@ Cluster::Cluster(
 	_id(id),
 	_zeroTierPhysicalEndpoints(zeroTierPhysicalEndpoints),
 	_members(new _Member[ZT_CLUSTER_MAX_MEMBERS]),
+	_ring((const ClusterRing *)0),
 	_lastFlushed(0),
 	_lastCleanedRemotePeers(0),
 	_lastCleanedQueue(0)
@@ -226,6 +237,9 @@ Cluster::Cluster(
 	SHA512::hash(stmp,stmp,sizeof(stmp));
 	memcpy(_key,stmp,sizeof(_key));
 	Utils::burn(stmp,sizeof(stmp));
+
+	// Until other members check in, we own everything
+	_updateRing(std::vector<uint16_t>(1,id));
 }
 
 Cluster::~Cluster()
@@ -234,6 +248,9 @@ Cluster::~Cluster()
 	Utils::burn(_key,sizeof(_key));
 	delete [] _members;
 	delete _sendQueue;
+	delete (const ClusterRing *)_ring;
+	for(std::vector< std::pair<uint64_t,const ClusterRing *> >::iterator r(_retiredRings.begin());r!=_retiredRings.end();++r)
+		delete r->second;
 }
 
 void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
@@ -249,7 +266,7 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 		memcpy(keytmp,_key,32);
 		for(int i=0;i<8;++i)
 			keytmp[i] ^= reinterpret_cast<const char *>(msg)[i];
-		Salsa20 s20(keytmp,256,reinterpret_cast<const char *>(msg) + 8);
+		Salsa20 s20(keytmp,reinterpret_cast<const char *>(msg) + 8);
 		Utils::burn(keytmp,sizeof(keytmp));
 
 		// One-time-use Poly1305 key from first 32 bytes of Salsa20 keystream (as per DJB/NaCl "standard")
@@ -343,22 +360,49 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 						ptr += id.deserialize(dmsg,ptr);
 						if (id) {
 							{
-								Mutex::Lock _l(_remotePeers_m);
-								_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(id.address(),(unsigned int)fromMemberId)];
+								_RemotePeerShard &s = _remotePeerShard(id.address());
+								Mutex::Lock _l(s.lock);
+								_RemotePeer &rp = s.peers[id.address()];
 								if (!rp.lastHavePeerReceived) {
 									RR->topology->saveIdentity((void *)0,id);
 									RR->identity.agree(id,rp.key,ZT_PEER_SECRET_KEY_LENGTH);
 								}
 								rp.lastHavePeerReceived = RR->node->now();
+								rp.askedOwner = 0;
+								rp.memberId = (int)fromMemberId;
 							}
+							TRACE("[%u] has %s",(unsigned int)fromMemberId,id.address().toString().c_str());
+							_remotePeerFound(id.address());
+						}
+					}	break;
 
-							_ClusterSendQueueEntry *q[16384]; // 16384 is "tons"
-							unsigned int qc = _sendQueue->getByDest(id.address(),q,16384);
-							for(unsigned int i=0;i<qc;++i)
-								this->relayViaCluster(q[i]->fromPeerAddress,q[i]->toPeerAddress,q[i]->data,q[i]->len,q[i]->unite);
-							_sendQueue->returnToPool(q,qc);
-
-							TRACE("[%u] has %s (retried %u queued sends)",(unsigned int)fromMemberId,id.address().toString().c_str(),qc);
+					case CLUSTER_MESSAGE_HAVE_PEERS: {
+						const uint64_t now = RR->node->now();
+						const unsigned int count = dmsg.at<uint16_t>(ptr); ptr += 2;
+						Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> unknown;
+						for(unsigned int i=0;i<count;++i) {
+							const Address zeroTierAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+							bool known = false;
+							{
+								_RemotePeerShard &s = _remotePeerShard(zeroTierAddress);
+								Mutex::Lock _l(s.lock);
+								_RemotePeer *const rp = s.peers.get(zeroTierAddress);
+								if ((rp)&&(rp->lastHavePeerReceived)) {
+									rp->lastHavePeerReceived = now;
+									rp->askedOwner = 0;
+									rp->memberId = (int)fromMemberId;
+									known = true;
+								}
+							}
+							if (known)
+								_remotePeerFound(zeroTierAddress);
+							else zeroTierAddress.appendTo(unknown);
+						}
+						if (unknown.size() > 0) {
+							// We don't have these peers' identities (any more), so ask for them
+							Mutex::Lock _l2(_members[fromMemberId].lock);
+							for(unsigned int i=0;i<unknown.size();i+=ZT_ADDRESS_LENGTH)
+								_send(fromMemberId,CLUSTER_MESSAGE_WANT_PEER,unknown.field(i,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
 						}
 					}	break;
 
@@ -369,6 +413,7 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 							Buffer<1024> buf;
 							peer->identity().serialize(buf);
 							Mutex::Lock _l2(_members[fromMemberId].lock);
+							_members[fromMemberId].announced.set(zeroTierAddress,RR->node->now());
 							_send(fromMemberId,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
 						}
 					}	break;
@@ -498,12 +543,21 @@ void Cluster::handleIncomingStateMessage(const void *msg,unsigned int len)
 
 void Cluster::broadcastHavePeer(const Identity &id)
 {
+	const uint64_t now = RR->node->now();
 	Buffer<1024> buf;
 	id.serialize(buf);
 	Mutex::Lock _l(_memberIds_m);
 	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-		Mutex::Lock _l2(_members[*mid].lock);
-		_send(*mid,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
+		_Member &m = _members[*mid];
+		Mutex::Lock _l2(m.lock);
+		uint64_t &lastAnnounced = m.announced[id.address()];
+		if ((now - lastAnnounced) < ZT_PEER_ACTIVITY_TIMEOUT) {
+			// Member already has this identity, so just send the address with the next flush
+			m.havePeers.push_back(id.address());
+		} else {
+			_send(*mid,CLUSTER_MESSAGE_HAVE_PEER,buf.data(),buf.size());
+		}
+		lastAnnounced = now;
 	}
 }
 
@@ -518,53 +572,7 @@ void Cluster::broadcastNetworkConfigChunk(const void *chunk,unsigned int len)
 
 int Cluster::checkSendViaCluster(const Address &toPeerAddress,uint64_t &mostRecentTs,void *peerSecret)
 {
-	const uint64_t now = RR->node->now();
-	mostRecentTs = 0;
-	int mostRecentMemberId = -1;
-	{
-		Mutex::Lock _l2(_remotePeers_m);
-		std::map< std::pair<Address,unsigned int>,_RemotePeer >::const_iterator rpe(_remotePeers.lower_bound(std::pair<Address,unsigned int>(toPeerAddress,0)));
-		for(;;) {
-			if ((rpe == _remotePeers.end())||(rpe->first.first != toPeerAddress))
-				break;
-			else if (rpe->second.lastHavePeerReceived > mostRecentTs) {
-				mostRecentTs = rpe->second.lastHavePeerReceived;
-				memcpy(peerSecret,rpe->second.key,ZT_PEER_SECRET_KEY_LENGTH);
-				mostRecentMemberId = (int)rpe->first.second;
-			}
-			++rpe;
-		}
-	}
-
-	const uint64_t ageOfMostRecentHavePeerAnnouncement = now - mostRecentTs;
-	if (ageOfMostRecentHavePeerAnnouncement >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
-		if (ageOfMostRecentHavePeerAnnouncement >= ZT_PEER_ACTIVITY_TIMEOUT)
-			mostRecentMemberId = -1;
-
-		bool sendWantPeer = true;
-		{
-			Mutex::Lock _l(_remotePeers_m);
-			_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(toPeerAddress,(unsigned int)_id)];
-			if ((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) {
-				rp.lastSentWantPeer = now;
-			} else {
-				sendWantPeer = false; // don't flood WANT_PEER
-			}
-		}
-		if (sendWantPeer) {
-			char tmp[ZT_ADDRESS_LENGTH];
-			toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
-			{
-				Mutex::Lock _l(_memberIds_m);
-				for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-					Mutex::Lock _l2(_members[*mid].lock);
-					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
-				}
-			}
-		}
-	}
-
-	return mostRecentMemberId;
+	return _findRemotePeer(toPeerAddress,RR->node->now(),mostRecentTs,peerSecret);
 }
 
 bool Cluster::sendViaCluster(int mostRecentMemberId,const Address &toPeerAddress,const void *data,unsigned int len)
@@ -592,60 +600,17 @@ void Cluster::relayViaCluster(const Address &fromPeerAddress,const Address &toPe
 	const uint64_t now = RR->node->now();
 
 	uint64_t mostRecentTs = 0;
-	int mostRecentMemberId = -1;
-	{
-		Mutex::Lock _l2(_remotePeers_m);
-		std::map< std::pair<Address,unsigned int>,_RemotePeer >::const_iterator rpe(_remotePeers.lower_bound(std::pair<Address,unsigned int>(toPeerAddress,0)));
-		for(;;) {
-			if ((rpe == _remotePeers.end())||(rpe->first.first != toPeerAddress))
-				break;
-			else if (rpe->second.lastHavePeerReceived > mostRecentTs) {
-				mostRecentTs = rpe->second.lastHavePeerReceived;
-				mostRecentMemberId = (int)rpe->first.second;
-			}
-			++rpe;
-		}
-	}
-
-	const uint64_t ageOfMostRecentHavePeerAnnouncement = now - mostRecentTs;
-	if (ageOfMostRecentHavePeerAnnouncement >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
-		// Enqueue and wait if peer seems alive, but do WANT_PEER to refresh homing
-		const bool enqueueAndWait = ((ageOfMostRecentHavePeerAnnouncement >= ZT_PEER_ACTIVITY_TIMEOUT)||(mostRecentMemberId < 0));
-
-		// Poll everyone with WANT_PEER if the age of our most recent entry is
-		// approaching expiration (or has expired, or does not exist).
-		bool sendWantPeer = true;
-		{
-			Mutex::Lock _l(_remotePeers_m);
-			_RemotePeer &rp = _remotePeers[std::pair<Address,unsigned int>(toPeerAddress,(unsigned int)_id)];
-			if ((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) {
-				rp.lastSentWantPeer = now;
-			} else {
-				sendWantPeer = false; // don't flood WANT_PEER
-			}
-		}
-		if (sendWantPeer) {
-			char tmp[ZT_ADDRESS_LENGTH];
-			toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
-			{
-				Mutex::Lock _l(_memberIds_m);
-				for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-					Mutex::Lock _l2(_members[*mid].lock);
-					_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
-				}
-			}
-		}
+	const int mostRecentMemberId = _findRemotePeer(toPeerAddress,now,mostRecentTs,(void *)0);
 
-		// If there isn't a good place to send via, then enqueue this for retrying
-		// later and return after having broadcasted a WANT_PEER.
-		if (enqueueAndWait) {
-			TRACE("relayViaCluster %s -> %s enqueueing to wait for HAVE_PEER",fromPeerAddress.toString().c_str(),toPeerAddress.toString().c_str());
-			_sendQueue->enqueue(now,fromPeerAddress,toPeerAddress,data,len,unite);
-			return;
-		}
+	// If there isn't a good place to send via, then enqueue this for retrying
+	// later. _findRemotePeer() will have sent a WANT_PEER.
+	if (mostRecentMemberId < 0) {
+		TRACE("relayViaCluster %s -> %s enqueueing to wait for HAVE_PEER",fromPeerAddress.toString().c_str(),toPeerAddress.toString().c_str());
+		_sendQueue->enqueue(now,fromPeerAddress,toPeerAddress,data,len,unite);
+		return;
 	}
 
-	if (mostRecentMemberId >= 0) {
+	{
 		Buffer<1024> buf;
 		if (unite) {
 			InetAddress v4,v6;
@@ -710,9 +675,21 @@ void Cluster::doPeriodicTasks()
 		_lastFlushed = now;
 
 		Mutex::Lock _l(_memberIds_m);
-		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+
+		// Get IVs for this whole pass at once instead of once per member
+		char ivs[16 * ZT_CLUSTER_MAX_MEMBERS];
+		Utils::getSecureRandom(ivs,16 * (unsigned int)_memberIds.size());
+		const char *iv = ivs;
+
+		std::vector<uint16_t> ringMembers;
+		ringMembers.push_back(_id);
+
+		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid,iv+=16) {
 			Mutex::Lock _l2(_members[*mid].lock);
 
+			if (((now - _members[*mid].lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT)&&(_members[*mid].zeroTierPhysicalEndpoints.size() > 0))
+				ringMembers.push_back(*mid);
+
 			if ((now - _members[*mid].lastAnnouncedAliveTo) >= ((ZT_CLUSTER_TIMEOUT / 2) - 1000)) {
 				_members[*mid].lastAnnouncedAliveTo = now;
 
@@ -740,18 +717,38 @@ void Cluster::doPeriodicTasks()
 				_send(*mid,CLUSTER_MESSAGE_ALIVE,alive.data(),alive.size());
 			}
 
-			_flush(*mid);
+			_sendHavePeers(*mid);
+			_flush(*mid,iv);
 		}
+
+		std::sort(ringMembers.begin(),ringMembers.end());
+		_updateRing(ringMembers);
 	}
 
 	if ((now - _lastCleanedRemotePeers) >= (ZT_PEER_ACTIVITY_TIMEOUT * 2)) {
 		_lastCleanedRemotePeers = now;
 
-		Mutex::Lock _l(_remotePeers_m);
-		for(std::map< std::pair<Address,unsigned int>,_RemotePeer >::iterator rp(_remotePeers.begin());rp!=_remotePeers.end();) {
-			if ((now - rp->second.lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT)
-				_remotePeers.erase(rp++);
-			else ++rp;
+		for(unsigned int si=0;si<ZT_CLUSTER_REMOTE_PEER_SHARDS;++si) {
+			Mutex::Lock _l(_remotePeers[si].lock);
+			Hashtable< Address,_RemotePeer >::Iterator i(_remotePeers[si].peers);
+			Address *a = (Address *)0;
+			_RemotePeer *rp = (_RemotePeer *)0;
+			while (i.next(a,rp)) {
+				if (((now - rp->lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT)&&((now - rp->lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY))
+					_remotePeers[si].peers.erase(*a);
+			}
+		}
+
+		Mutex::Lock _l(_memberIds_m);
+		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+			Mutex::Lock _l2(_members[*mid].lock);
+			Hashtable< Address,uint64_t >::Iterator i(_members[*mid].announced);
+			Address *a = (Address *)0;
+			uint64_t *ts = (uint64_t *)0;
+			while (i.next(a,ts)) {
+				if ((now - *ts) >= ZT_PEER_ACTIVITY_TIMEOUT)
+					_members[*mid].announced.erase(*a);
+			}
 		}
 	}
 
@@ -810,56 +807,72 @@ void Cluster::removeMember(uint16_t memberId)
 
 bool Cluster::findBetterEndpoint(InetAddress &redirectTo,const Address &peerAddress,const InetAddress &peerPhysicalAddress,bool offload)
 {
-	if (_addressToLocationFunction) {
-		// Pick based on location if it can be determined
-		int px = 0,py = 0,pz = 0;
-		if (_addressToLocationFunction(_addressToLocationFunctionArg,reinterpret_cast<const struct sockaddr_storage *>(&peerPhysicalAddress),&px,&py,&pz) == 0) {
-			TRACE("no geolocation data for %s",peerPhysicalAddress.toIpString().c_str());
-			return false;
-		}
+	const uint64_t now = RR->node->now();
 
-		// Find member closest to this peer
-		const uint64_t now = RR->node->now();
-		std::vector<InetAddress> best;
-		const double currentDistance = _dist3d(_x,_y,_z,px,py,pz);
-		double bestDistance = (offload ? 2147483648.0 : currentDistance);
-#ifdef ZT_TRACE
-		unsigned int bestMember = _id;
-#endif
-		{
-			Mutex::Lock _l(_memberIds_m);
-			for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
-				_Member &m = _members[*mid];
-				Mutex::Lock _ml(m.lock);
-
-				// Consider member if it's alive and has sent us a location and one or more physical endpoints to send peers to
-				if ( ((now - m.lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT) && ((m.x != 0)||(m.y != 0)||(m.z != 0)) && (m.zeroTierPhysicalEndpoints.size() > 0) ) {
-					const double mdist = _dist3d(m.x,m.y,m.z,px,py,pz);
-					if (mdist < bestDistance) {
-						bestDistance = mdist;
-#ifdef ZT_TRACE
-						bestMember = *mid;
-#endif
-						best = m.zeroTierPhysicalEndpoints;
-					}
-				}
+	int px = 0,py = 0,pz = 0;
+	const bool located = ((_addressToLocationFunction)&&(_addressToLocationFunction(_addressToLocationFunctionArg,reinterpret_cast<const struct sockaddr_storage *>(&peerPhysicalAddress),&px,&py,&pz) != 0));
+	if ((_addressToLocationFunction)&&(!located)) {
+		TRACE("no geolocation data for %s, using hash ring only",peerPhysicalAddress.toIpString().c_str());
+	}
+
+	// Find members that could take this peer and, if we know where it is,
+	// how far each of them is from it
+	bool eligible[ZT_CLUSTER_MAX_MEMBERS];
+	double distance[ZT_CLUSTER_MAX_MEMBERS];
+	memset(eligible,0,sizeof(eligible));
+	const double currentDistance = (located) ? _dist3d(_x,_y,_z,px,py,pz) : 0.0;
+	double bestDistance = (offload ? 2147483648.0 : currentDistance);
+	eligible[_id] = !offload;
+	distance[_id] = currentDistance;
+	{
+		Mutex::Lock _l(_memberIds_m);
+		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+			_Member &m = _members[*mid];
+			Mutex::Lock _ml(m.lock);
+
+			// Consider member if it's alive and has one or more physical endpoints to send peers to (and a location if we're going by location)
+			if ( ((now - m.lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT) && (m.zeroTierPhysicalEndpoints.size() > 0) && ((!located)||(m.x != 0)||(m.y != 0)||(m.z != 0)) ) {
+				const double mdist = (located) ? _dist3d(m.x,m.y,m.z,px,py,pz) : 0.0;
+				eligible[*mid] = true;
+				distance[*mid] = mdist;
+				if (mdist < bestDistance)
+					bestDistance = mdist;
 			}
 		}
+	}
 
-		// Redirect to a closer member if it has a ZeroTier endpoint address in the same ss_family
-		for(std::vector<InetAddress>::const_iterator a(best.begin());a!=best.end();++a) {
-			if (a->ss_family == peerPhysicalAddress.ss_family) {
-				TRACE("%s at [%d,%d,%d] is %f from us but %f from %u, can redirect to %s",peerAddress.toString().c_str(),px,py,pz,currentDistance,bestDistance,bestMember,a->toString().c_str());
-				redirectTo = *a;
-				return true;
-			}
+	// Geo affinity: only members about as close as the closest one qualify,
+	// and the hash ring picks among them. If the plain ring owner is close
+	// enough it wins, which is what other members will guess.
+	if (located) {
+		for(unsigned int i=0;i<ZT_CLUSTER_MAX_MEMBERS;++i) {
+			if ((eligible[i])&&(distance[i] > (bestDistance + ZT_CLUSTER_GEO_AFFINITY_SLACK)))
+				eligible[i] = false;
 		}
+	}
+
+	const int owner = _ringOwner(peerAddress,eligible);
+	if ((owner < 0)||(owner == (int)_id)) {
 		TRACE("%s at [%d,%d,%d] is %f from us, no better endpoints found",peerAddress.toString().c_str(),px,py,pz,currentDistance);
 		return false;
-	} else {
-		// TODO: pick based on load if no location info?
-		return false;
 	}
+
+	std::vector<InetAddress> best;
+	{
+		Mutex::Lock _ml(_members[owner].lock);
+		best = _members[owner].zeroTierPhysicalEndpoints;
+	}
+
+	// Redirect to the owner if it has a ZeroTier endpoint address in the same ss_family
+	for(std::vector<InetAddress>::const_iterator a(best.begin());a!=best.end();++a) {
+		if (a->ss_family == peerPhysicalAddress.ss_family) {
+			TRACE("%s at [%d,%d,%d] is %f from us but %f from owner %u, can redirect to %s",peerAddress.toString().c_str(),px,py,pz,currentDistance,distance[owner],(unsigned int)owner,a->toString().c_str());
+			redirectTo = *a;
+			return true;
+		}
+	}
+	TRACE("%s is owned by %u but it has no endpoints in the same address family",peerAddress.toString().c_str(),(unsigned int)owner);
+	return false;
 }
 
 bool Cluster::isClusterPeerFrontplane(const InetAddress &ip) const
@@ -925,6 +938,180 @@ void Cluster::status(ZT_ClusterStatus &status) const
 	}
 }
 
+int Cluster::_findRemotePeer(const Address &peerAddress,const uint64_t now,uint64_t &mostRecentTs,void *peerSecret)
+{
+	int mostRecentMemberId = -1;
+	bool guessed = false;
+	int sendWantPeerTo = -2; // -2 for none, -1 for everyone
+	{
+		_RemotePeerShard &s = _remotePeerShard(peerAddress);
+		Mutex::Lock _l(s.lock);
+		_RemotePeer *rp = s.peers.get(peerAddress);
+		if ((rp)&&(rp->lastHavePeerReceived)) {
+			mostRecentTs = rp->lastHavePeerReceived;
+			mostRecentMemberId = rp->memberId;
+			if (peerSecret)
+				memcpy(peerSecret,rp->key,ZT_PEER_SECRET_KEY_LENGTH);
+		} else {
+			mostRecentTs = 0;
+		}
+
+		// Poll with WANT_PEER if the age of our most recent entry is approaching
+		// expiration (or has expired, or does not exist). Ask only the member
+		// we expect to have the peer first, and everyone if it doesn't answer.
+		const uint64_t ageOfMostRecentHavePeerAnnouncement = now - mostRecentTs;
+		if (ageOfMostRecentHavePeerAnnouncement >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)) {
+			if (ageOfMostRecentHavePeerAnnouncement >= ZT_PEER_ACTIVITY_TIMEOUT)
+				mostRecentMemberId = -1;
+
+			// With no current HAVE_PEER, guess at the member the ring says
+			// should own this peer, unless that's us (in which case we'd have
+			// it if it were around)
+			int owner = -1;
+			if (mostRecentMemberId < 0) {
+				owner = _ringOwner(peerAddress,(const bool *)0);
+				if (owner == (int)_id)
+					owner = -1;
+			}
+
+			if (!rp)
+				rp = &(s.peers[peerAddress]);
+			if ((now - rp->lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY) { // don't flood WANT_PEER
+				rp->lastSentWantPeer = now;
+				const int expected = (mostRecentMemberId >= 0) ? mostRecentMemberId : owner;
+				if ((expected >= 0)&&(!rp->askedOwner)) {
+					rp->askedOwner = now;
+					sendWantPeerTo = expected;
+				} else {
+					sendWantPeerTo = -1;
+				}
+			}
+
+			// Send via the ring owner without waiting for HAVE_PEER, at least
+			// until it's had time to tell us whether it has the peer
+			if ((mostRecentMemberId < 0)&&(owner >= 0)&&((!rp->askedOwner)||((now - rp->askedOwner) < ZT_CLUSTER_WANT_PEER_EVERY))) {
+				mostRecentMemberId = owner;
+				guessed = (rp->lastHavePeerReceived == 0); // if non-zero we already copied the key above
+			}
+		}
+	}
+
+	// A guess needs the peer's key if we're sending as ourselves
+	if ((guessed)&&(peerSecret)) {
+		const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(peerAddress));
+		if (peer)
+			memcpy(peerSecret,peer->key(),ZT_PEER_SECRET_KEY_LENGTH);
+		else mostRecentMemberId = -1;
+	}
+
+	if (sendWantPeerTo >= 0) {
+		char tmp[ZT_ADDRESS_LENGTH];
+		peerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
+		Mutex::Lock _l(_members[sendWantPeerTo].lock);
+		_send((uint16_t)sendWantPeerTo,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
+	} else if (sendWantPeerTo == -1) {
+		char tmp[ZT_ADDRESS_LENGTH];
+		peerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
+		Mutex::Lock _l(_memberIds_m);
+		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+			Mutex::Lock _l2(_members[*mid].lock);
+			_send(*mid,CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH);
+		}
+	}
+
+	return mostRecentMemberId;
+}
+
+void Cluster::_updateRing(const std::vector<uint16_t> &ringMembers)
+{
+	const uint64_t now = RR->node->now();
+	Mutex::Lock _l(_ring_m);
+
+	if (!_retiredRings.empty()) {
+		std::vector< std::pair<uint64_t,const ClusterRing *> > stillRetired;
+		for(std::vector< std::pair<uint64_t,const ClusterRing *> >::const_iterator r(_retiredRings.begin());r!=_retiredRings.end();++r) {
+			if ((now - r->first) >= ZT_CLUSTER_RING_RETIRE_AFTER)
+				delete r->second;
+			else stillRetired.push_back(*r);
+		}
+		_retiredRings.swap(stillRetired);
+	}
+
+	const ClusterRing *const old = _ring;
+	if ((old)&&(old->members() == ringMembers))
+		return;
+	const ClusterRing *const r = new ClusterRing(ringMembers);
+#ifdef __GNUC__
+	__sync_synchronize(); // finish building the ring before lookups can see it
+#endif
+	_ring = r;
+	if (old)
+		_retiredRings.push_back(std::pair<uint64_t,const ClusterRing *>(now,old));
+	TRACE("hash ring now has %u members",(unsigned int)ringMembers.size());
+}
+
+ClusterRing::ClusterRing(const std::vector<uint16_t> &members) :
+	_members(members)
+{
+	_points.reserve(members.size() * ZT_CLUSTER_RING_POINTS_PER_MEMBER);
+	for(std::vector<uint16_t>::const_iterator mid(members.begin());mid!=members.end();++mid) {
+		for(unsigned int i=0;i<ZT_CLUSTER_RING_POINTS_PER_MEMBER;++i) {
+			_Point p;
+			p.h = _ringHash(((uint64_t)*mid << 32) | (uint64_t)i);
+			p.memberId = *mid;
+			_points.push_back(p);
+		}
+	}
+	std::sort(_points.begin(),_points.end());
+}
+
+int ClusterRing::owner(const Address &peerAddress,const bool *eligible) const
+{
+	_Point k;
+	k.h = _ringHash(peerAddress.toInt());
+	k.memberId = 0;
+	std::vector<_Point>::const_iterator p(std::lower_bound(_points.begin(),_points.end(),k));
+	for(unsigned long i=0;i<_points.size();++i,++p) {
+		if (p == _points.end())
+			p = _points.begin();
+		if ((!eligible)||(eligible[p->memberId]))
+			return (int)p->memberId;
+	}
+	return -1;
+}
+
+void Cluster::_remotePeerFound(const Address &peerAddress)
+{
+	_ClusterSendQueueEntry *q[16384]; // 16384 is "tons"
+	unsigned int qc = _sendQueue->getByDest(peerAddress,q,16384);
+	for(unsigned int i=0;i<qc;++i)
+		this->relayViaCluster(q[i]->fromPeerAddress,q[i]->toPeerAddress,q[i]->data,q[i]->len,q[i]->unite);
+	_sendQueue->returnToPool(q,qc);
+	if (qc) {
+		TRACE("retried %u queued sends to %s",qc,peerAddress.toString().c_str());
+	}
+}
+
+void Cluster::_sendHavePeers(uint16_t memberId)
+{
+	_Member &m = _members[memberId];
+	// assumes m.lock is locked!
+	std::vector<Address>::const_iterator a(m.havePeers.begin());
+	while (a != m.havePeers.end()) {
+		Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> buf;
+		buf.addSize(2);
+		unsigned int count = 0;
+		while ((a != m.havePeers.end())&&(count < ZT_CLUSTER_MAX_HAVE_PEERS)) {
+			a->appendTo(buf);
+			++a;
+			++count;
+		}
+		buf.setAt(0,(uint16_t)count);
+		_send(memberId,CLUSTER_MESSAGE_HAVE_PEERS,buf.data(),buf.size());
+	}
+	m.havePeers.clear();
+}
+
 void Cluster::_send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len)
 {
 	if ((len + 3) > (ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2))) // sanity check
@@ -932,13 +1119,13 @@ void Cluster::_send(uint16_t memberId,StateMessageType type,const void *msg,unsi
 	_Member &m = _members[memberId];
 	// assumes m.lock is locked!
 	if ((m.q.size() + len + 3) > ZT_CLUSTER_MAX_MESSAGE_LENGTH)
-		_flush(memberId);
+		_flush(memberId,(const void *)0);
 	m.q.append((uint16_t)(len + 1));
 	m.q.append((uint8_t)type);
 	m.q.append(msg,len);
 }
 
-void Cluster::_flush(uint16_t memberId)
+void Cluster::_flush(uint16_t memberId,const void *nextIv)
 {
 	_Member &m = _members[memberId];
 	// assumes m.lock is locked!
@@ -948,7 +1135,7 @@ void Cluster::_flush(uint16_t memberId)
 		memcpy(keytmp,m.key,32);
 		for(int i=0;i<8;++i)
 			keytmp[i] ^= m.q[i];
-		Salsa20 s20(keytmp,256,m.q.field(8,8));
+		Salsa20 s20(keytmp,m.q.field(8,8));
 		Utils::burn(keytmp,sizeof(keytmp));
 
 		// One-time-use Poly1305 key from first 32 bytes of Salsa20 keystream (as per DJB/NaCl "standard")
@@ -969,9 +1156,13 @@ void Cluster::_flush(uint16_t memberId)
 
 		// Prepare for more
 		m.q.clear();
-		char iv[16];
-		Utils::getSecureRandom(iv,16);
-		m.q.append(iv,16);
+		if (nextIv) {
+			m.q.append(nextIv,16);
+		} else {
+			char iv[16];
+			Utils::getSecureRandom(iv,16);
+			m.q.append(iv,16);
+		}
 		m.q.addSize(8); // room for MAC
 		m.q.append((uint16_t)_id); // from member ID
 		m.q.append((uint16_t)memberId); // to member ID
@@ -980,21 +1171,32 @@ void Cluster::_flush(uint16_t memberId)
 
 void Cluster::_doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep)
 {
-	if (remotep.payloadLength() >= ZT_ADDRESS_LENGTH) {
-		Identity queried(RR->topology->getIdentity((void *)0,Address(remotep.payload(),ZT_ADDRESS_LENGTH)));
+	// WHOIS may ask for many addresses, so answer with as many identities
+	// per PROXY_SEND as will fit
+	Buffer<1024> routp;
+	unsigned int count = 0;
+	unsigned int ptr = ZT_PACKET_IDX_PAYLOAD;
+	while ((ptr + ZT_ADDRESS_LENGTH) <= remotep.size()) {
+		Identity queried(RR->topology->getIdentity((void *)0,Address(remotep.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH)));
+		ptr += ZT_ADDRESS_LENGTH;
 		if (queried) {
-			Buffer<1024> routp;
-			remotep.source().appendTo(routp);
-			routp.append((uint8_t)Packet::VERB_OK);
-			routp.addSize(2); // space for length
-			routp.append((uint8_t)Packet::VERB_WHOIS);
-			routp.append(remotep.packetId());
+			if (!count) {
+				routp.clear();
+				remotep.source().appendTo(routp);
+				routp.append((uint8_t)Packet::VERB_OK);
+				routp.addSize(2); // space for length
+				routp.append((uint8_t)Packet::VERB_WHOIS);
+				routp.append(remotep.packetId());
+			}
 			queried.serialize(routp);
-			routp.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(routp.size() - ZT_ADDRESS_LENGTH - 3));
-
+			++count;
 			TRACE("responding to remote WHOIS from %s @ %u with identity of %s",remotep.source().toString().c_str(),(unsigned int)fromMemberId,queried.address().toString().c_str());
+		}
+		if ((count)&&(((routp.size() + ZT_WHOIS_REPLY_IDENTITY_RESERVE) > routp.capacity())||((ptr + ZT_ADDRESS_LENGTH) > remotep.size()))) {
+			routp.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(routp.size() - ZT_ADDRESS_LENGTH - 3));
 			Mutex::Lock _l2(_members[fromMemberId].lock);
 			_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,routp.data(),routp.size());
+			count = 0;
 		}
 	}
 }
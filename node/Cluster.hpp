@@ -22,6 +22,7 @@
 #ifdef ZT_ENABLE_CLUSTER
 
 #include <map>
+#include <vector>
 
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
@@ -36,6 +37,10 @@
 #include "Packet.hpp"
 #include "SharedPtr.hpp"
 
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
 /**
  * Timeout for cluster members being considered "alive"
  *
@@ -93,6 +98,31 @@
  */
 #define ZT_CLUSTER_WANT_PEER_EVERY 1000
 
+/**
+ * Number of independently locked shards in the remote peer index (must be a power of two)
+ */
+#define ZT_CLUSTER_REMOTE_PEER_SHARDS 16
+
+/**
+ * Maximum number of addresses in one HAVE_PEERS message
+ */
+#define ZT_CLUSTER_MAX_HAVE_PEERS ((ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2 + 3 + 2)) / ZT_ADDRESS_LENGTH)
+
+/**
+ * Points per member on the consistent hash ring that assigns peers to members
+ */
+#define ZT_CLUSTER_RING_POINTS_PER_MEMBER 64
+
+/**
+ * A replaced hash ring is freed after this long (ms), far longer than any lookup that might still be using it
+ */
+#define ZT_CLUSTER_RING_RETIRE_AFTER 60000
+
+/**
+ * Members within this distance (km) of the closest member to a peer are treated as equally close
+ */
+#define ZT_CLUSTER_GEO_AFFINITY_SLACK 500.0
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -103,6 +133,46 @@ class Identity;
 // Internal class implemented inside Cluster.cpp
 class _ClusterSendQueue;
 
+/**
+ * Consistent hash ring that assigns peers to cluster members
+ *
+ * Every member builds the same ring from the same membership, so peer
+ * ownership can be computed locally. When a member leaves only the peers
+ * it owned move. A ring is immutable once built.
+ */
+class ClusterRing
+{
+public:
+	/**
+	 * @param members Member IDs in ascending order
+	 */
+	ClusterRing(const std::vector<uint16_t> &members);
+
+	/**
+	 * @return Member IDs on this ring in ascending order
+	 */
+	inline const std::vector<uint16_t> &members() const { return _members; }
+
+	/**
+	 * Find the member that owns a peer
+	 *
+	 * @param peerAddress Peer's ZeroTier address
+	 * @param eligible If non-NULL, an array of ZT_CLUSTER_MAX_MEMBERS flags: the first eligible member clockwise from the peer owns it
+	 * @return Member ID or -1 if no member is eligible
+	 */
+	int owner(const Address &peerAddress,const bool *eligible) const;
+
+private:
+	struct _Point
+	{
+		uint64_t h;
+		uint16_t memberId;
+		inline bool operator<(const _Point &p) const throw() { return (h < p.h); }
+	};
+	std::vector<_Point> _points; // sorted by h
+	std::vector<uint16_t> _members;
+};
+
 /**
  * Multi-homing cluster state replication and packet relaying
  *
@@ -229,7 +299,20 @@ public:
 		 * The first field of a network config chunk is the network ID,
 		 * so this can be checked to look up the network on receipt.
 		 */
-		CLUSTER_MESSAGE_NETWORK_CONFIG = 7
+		CLUSTER_MESSAGE_NETWORK_CONFIG = 7,
+
+		/**
+		 * Cluster member still has these peers:
+		 *   <[2] number of addresses>
+		 *   <[...] series of 5-byte ZeroTier addresses>
+		 *
+		 * This is sent instead of HAVE_PEER for peers whose full identity
+		 * we have already sent to the recipient within ZT_PEER_ACTIVITY_TIMEOUT,
+		 * and announcements made between flushes are batched into one
+		 * message. A recipient that doesn't know one of these peers (e.g.
+		 * because it restarted) answers with WANT_PEER to get HAVE_PEER.
+		 */
+		CLUSTER_MESSAGE_HAVE_PEERS = 8
 	};
 
 	/**
@@ -350,6 +433,13 @@ public:
 	/**
 	 * Find a better cluster endpoint for this peer (if any)
 	 *
+	 * Each peer has an owner: the first member clockwise from the peer's
+	 * address on a consistent hash ring of live members, skipping members
+	 * that are much farther from the peer than the closest one. Since the
+	 * ring alone is usually right, other members can guess where a peer is
+	 * without waiting for HAVE_PEER. Peers without location data go to the
+	 * plain ring owner.
+	 *
 	 * @param redirectTo InetAddress to be set to a better endpoint (if there is one)
 	 * @param peerAddress Address of peer to (possibly) redirect
 	 * @param peerPhysicalAddress Physical address of peer's current best path (where packet was most recently received or getBestPath()->address())
@@ -372,8 +462,17 @@ public:
 	void status(ZT_ClusterStatus &status) const;
 
 private:
+	int _findRemotePeer(const Address &peerAddress,const uint64_t now,uint64_t &mostRecentTs,void *peerSecret);
+	inline int _ringOwner(const Address &peerAddress,const bool *eligible) const
+	{
+		const ClusterRing *const r = _ring;
+		return r->owner(peerAddress,eligible);
+	}
+	void _updateRing(const std::vector<uint16_t> &ringMembers);
+	void _remotePeerFound(const Address &peerAddress);
+	void _sendHavePeers(uint16_t memberId);
 	void _send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len);
-	void _flush(uint16_t memberId);
+	void _flush(uint16_t memberId,const void *nextIv);
 
 	void _doREMOTE_WHOIS(uint64_t fromMemberId,const Packet &remotep);
 	void _doREMOTE_MULTICAST_GATHER(uint64_t fromMemberId,const Packet &remotep);
@@ -407,6 +506,9 @@ private:
 
 		std::vector<InetAddress> zeroTierPhysicalEndpoints;
 
+		Hashtable< Address,uint64_t > announced; // peers whose identity we've sent -> time last announced
+		std::vector<Address> havePeers; // announcements for the next HAVE_PEERS
+
 		Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> q;
 
 		Mutex lock;
@@ -421,6 +523,8 @@ private:
 			y = 0;
 			z = 0;
 			zeroTierPhysicalEndpoints.clear();
+			announced.clear();
+			havePeers.clear();
 			q.clear();
 		}
 
@@ -432,16 +536,37 @@ private:
 	std::vector<uint16_t> _memberIds;
 	Mutex _memberIds_m;
 
+	// Only the member that most recently sent HAVE_PEER matters for sending
+	// and relaying, so the index keeps just that one per peer.
 	struct _RemotePeer
 	{
-		_RemotePeer() : lastHavePeerReceived(0),lastSentWantPeer(0) {}
+		_RemotePeer() : lastHavePeerReceived(0),lastSentWantPeer(0),askedOwner(0),memberId(-1) {}
 		~_RemotePeer() { Utils::burn(key,ZT_PEER_SECRET_KEY_LENGTH); }
-		uint64_t lastHavePeerReceived;
+		uint64_t lastHavePeerReceived; // 0 if we have only sent WANT_PEER
 		uint64_t lastSentWantPeer;
+		uint64_t askedOwner; // when we sent WANT_PEER to just the predicted owner, 0 after a HAVE_PEER
+		int memberId; // member that sent the last HAVE_PEER or -1 if none
 		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH]; // secret key from identity agreement
 	};
-	std::map< std::pair<Address,unsigned int>,_RemotePeer > _remotePeers; // we need ordered behavior and lower_bound here
-	Mutex _remotePeers_m;
+	struct _RemotePeerShard
+	{
+		Hashtable< Address,_RemotePeer > peers;
+		Mutex lock;
+	};
+	_RemotePeerShard _remotePeers[ZT_CLUSTER_REMOTE_PEER_SHARDS];
+	inline _RemotePeerShard &_remotePeerShard(const Address &a) { return _remotePeers[(unsigned long)a.toInt() & (ZT_CLUSTER_REMOTE_PEER_SHARDS - 1)]; }
+
+	// Hash ring over ourselves and live members with endpoints. Lookups read
+	// the current ring without locking. _updateRing() swaps in a new one and
+	// keeps replaced rings (with the time they were replaced) until no
+	// lookup can still be using them.
+#ifdef __GNUC__
+	const ClusterRing *volatile _ring;
+#else
+	std::atomic<const ClusterRing *> _ring;
+#endif
+	std::vector< std::pair<uint64_t,const ClusterRing *> > _retiredRings;
+	Mutex _ring_m;
 
 	uint64_t _lastFlushed;
 	uint64_t _lastCleanedRemotePeers;
@@ -142,9 +142,10 @@
 /**
  * Default payload MTU for UDP packets
  *
- * In the future we might support UDP path MTU discovery, but for now we
- * set a maximum that is equal to 1500 minus 8 (for PPPoE overhead, common
- * in some markets) minus 48 (IPv6 UDP overhead).
+ * This is equal to 1500 minus 8 (for PPPoE overhead, common in some markets)
+ * minus 48 (IPv6 UDP overhead). It's assumed to work on any path. Larger
+ * sizes are only used on paths where path MTU discovery has shown them to
+ * work (see Path).
  */
 #define ZT_UDP_DEFAULT_PAYLOAD_MTU 1444
 
@@ -157,9 +158,30 @@
  * Maximum number of packet fragments we'll support
  *
  * The actual spec allows 16, but this is the most we'll support right
- * now. Packets with more than this many fragments are dropped.
+ * now. Packets with more than this many fragments are dropped. Builds with
+ * a larger ZT_MAX_MTU need enough fragments to carry a full frame over a
+ * path that only supports ZT_UDP_DEFAULT_PAYLOAD_MTU.
  */
+#if ZT_MAX_MTU > 2800
+#define ZT_MAX_PACKET_FRAGMENTS (((ZT_MAX_MTU + 1024) / (ZT_UDP_DEFAULT_PAYLOAD_MTU - 16)) + 1)
+#else
 #define ZT_MAX_PACKET_FRAGMENTS 4
+#endif
+#if ZT_MAX_PACKET_FRAGMENTS > 16
+#error ZT_MAX_MTU is too large: packets may not have more than 16 fragments
+#endif
+
+/**
+ * Largest UDP payload we will try to send unfragmented if a path allows it
+ *
+ * This is a 9000 byte jumbo frame minus IPv6 UDP overhead, or the largest
+ * packet we can hold if that is smaller.
+ */
+#if (ZT_MAX_PACKET_FRAGMENTS * ZT_UDP_DEFAULT_PAYLOAD_MTU) < 8952
+#define ZT_UDP_MAX_PAYLOAD_MTU (ZT_MAX_PACKET_FRAGMENTS * ZT_UDP_DEFAULT_PAYLOAD_MTU)
+#else
+#define ZT_UDP_MAX_PAYLOAD_MTU 8952
+#endif
 
 /**
  * Size of RX queue
@@ -200,10 +222,25 @@
 #define ZT_WHOIS_RETRY_DELAY 1000
 
 /**
- * Maximum identity WHOIS retries (each attempt tries consulting a different peer)
+ * Maximum identity WHOIS retries (each attempt tries consulting a different upstream)
  */
 #define ZT_MAX_WHOIS_RETRIES 4
 
+/**
+ * Addresses needing WHOIS within this many ms of the last WHOIS are held and sent together
+ */
+#define ZT_WHOIS_COALESCE_DELAY 25
+
+/**
+ * Room to leave for one more identity when packing identities into an OK(WHOIS)
+ */
+#define ZT_WHOIS_REPLY_IDENTITY_RESERVE 128
+
+/**
+ * How long to wait for an asynchronous data store get before forgetting it
+ */
+#define ZT_DATASTORE_ASYNC_TIMEOUT 5000
+
 /**
  * Transmit queue entry timeout
  */
@@ -283,6 +320,69 @@
  */
 #define ZT_PATH_HELLO_RATE_LIMIT 1000
 
+/**
+ * Smoothing of per-path loss estimate: each probe moves it 1/2^this of the way
+ */
+#define ZT_PATH_EWMA_SHIFT 3
+
+/**
+ * Path loss estimate meaning 100% loss
+ */
+#define ZT_PATH_LOSS_MAX 65536
+
+/**
+ * Latency assumed for paths that have not answered a probe yet (ms)
+ */
+#define ZT_PATH_UNKNOWN_LATENCY 100
+
+/**
+ * Paths whose cost is within 1/2^this of each other are considered equally good
+ *
+ * The current best path is only replaced by a live path that is cheaper by
+ * more than this, which keeps it from flapping between similar paths.
+ */
+#define ZT_PATH_COST_TOLERANCE_SHIFT 3
+
+/**
+ * Minimum time between path MTU probes on a path (ms)
+ */
+#define ZT_PATH_MTU_PROBE_INTERVAL ZT_PING_CHECK_INVERVAL
+
+/**
+ * Unanswered probes of a given size before we conclude it does not fit
+ */
+#define ZT_PATH_MTU_PROBE_TRIES 3
+
+/**
+ * Path MTU search stops once the largest working and smallest failing sizes are this close
+ */
+#define ZT_PATH_MTU_PROBE_GRANULARITY 32
+
+/**
+ * How often to re-check a path's MTU and search again for a larger one (ms)
+ */
+#define ZT_PATH_MTU_RESEARCH_INTERVAL 600000
+
+/**
+ * Interval over which path throughput is measured (ms)
+ */
+#define ZT_PATH_THROUGHPUT_INTERVAL 1000
+
+/**
+ * Flow ID for traffic that is not part of a flow (always sent via the best path)
+ */
+#define ZT_FLOW_ID_NONE 0
+
+/**
+ * Flow ID for traffic that should be sent over every live path in multipath mode
+ */
+#define ZT_FLOW_ID_ALL_PATHS 0xffffffff
+
+/**
+ * Size of table used to drop frames received more than once in multipath mode (must be a power of two)
+ */
+#define ZT_DUPLICATE_FRAME_FILTER_SIZE 1024
+
 /**
  * Delay between full-fledge pings of directly connected peers
  */
@@ -298,6 +398,24 @@
  */
 #define ZT_PEER_SEND_FULL_HELLO_EVERY (ZT_PEER_PING_PERIOD * 2)
 
+/**
+ * Peer snapshots older than this are ignored at startup
+ */
+#define ZT_PEER_SNAPSHOT_MAX_AGE 86400000
+
+/**
+ * Number of HELLOs sent to each endpoint of a peer restored from a snapshot
+ *
+ * These go out once per ping check, so a peer we can't reach is given up
+ * on (and left to WHOIS and RENDEZVOUS as usual) after this many checks.
+ */
+#define ZT_PEER_SNAPSHOT_CONTACT_TRIES 3
+
+/**
+ * Maximum size of one serialized peer in a snapshot
+ */
+#define ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE 1024
+
 /**
  * How often to retry expired paths that we're still remembering
  */
@@ -0,0 +1,216 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_CREDENTIALCACHE_HPP
+#define ZT_CREDENTIALCACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Identity.hpp"
+#include "C25519.hpp"
+#include "SHA512.hpp"
+#include "Mutex.hpp"
+#include "Metrics.hpp"
+
+/**
+ * Number of entries in the credential signature cache (must be a power of two)
+ */
+#define ZT_CREDENTIAL_CACHE_SIZE 1024
+
+namespace ZeroTier {
+
+/**
+ * Credential signatures collected for verification as a group
+ *
+ * Passing one of these to a credential's verify() queues its signatures
+ * instead of checking them. CredentialCache::verify(batch) then checks them
+ * all at once with C25519::verifyBatch() and caches the results, so the
+ * normal verify() that follows is a cache hit whether or not it passed.
+ */
+class CredentialBatch : NonCopyable
+{
+	friend class CredentialCache;
+
+public:
+	CredentialBatch() {}
+
+	/**
+	 * @return Number of signatures queued
+	 */
+	inline unsigned int size() const { return (unsigned int)_items.size(); }
+
+private:
+	struct _Item
+	{
+		uint64_t k[4];
+		C25519::Public pub;
+		C25519::Signature sig;
+		std::vector<uint8_t> data;
+	};
+	std::vector<_Item> _items;
+};
+
+/**
+ * Cache of recently verified credential signatures
+ *
+ * Peers re-push the same COMs, tags, capabilities and certificates of
+ * ownership every ZT_CREDENTIAL_PUSH_EVERY on every network, and each one
+ * would otherwise cost a full Ed25519 verification. Successful verifications
+ * are remembered by a 256-bit hash of the signer's public key, the signature
+ * and the signed data, so an identical credential from the same signer is
+ * accepted after two SHA-512 passes. Failures are remembered the same way
+ * in a second table, so they can't evict good entries. Both tables are
+ * direct mapped, so old entries are simply overwritten.
+ */
+class CredentialCache : NonCopyable
+{
+public:
+	CredentialCache(Metrics *m) :
+		_metrics(m)
+	{
+		memset(_entries,0,sizeof(_entries));
+		memset(_primed,0,sizeof(_primed));
+		memset(_rejected,0,sizeof(_rejected));
+		memset(_rejectedPrimed,0,sizeof(_rejectedPrimed));
+	}
+
+	/**
+	 * Verify a signature, consulting and updating the cache
+	 *
+	 * If batch is non-NULL a signature not already in the cache is queued
+	 * in it and true is returned without checking it. A signature already
+	 * known to be bad is never queued.
+	 *
+	 * @param signer Identity of signer
+	 * @param data Signed data
+	 * @param len Length of signed data
+	 * @param signature Signature
+	 * @param batch Batch to queue signature in or NULL to verify now
+	 * @return True if signature is valid (or queued)
+	 */
+	inline bool verify(const Identity &signer,const void *data,unsigned int len,const C25519::Signature &signature,CredentialBatch *batch = (CredentialBatch *)0)
+	{
+		uint64_t k[8];
+		_key(signer,data,len,signature,k);
+		const unsigned long slot = (unsigned long)(k[0] & (ZT_CREDENTIAL_CACHE_SIZE - 1));
+
+		{
+			Mutex::Lock _l(_lock);
+			if (!memcmp(_entries[slot],k,sizeof(_entries[slot]))) {
+				if (!batch) {
+					// The first use of a batch verified signature counts as a full one
+					_metrics->credentialVerification(!_primed[slot]);
+					_primed[slot] = false;
+				}
+				return true;
+			}
+			if (!memcmp(_rejected[slot],k,sizeof(_rejected[slot]))) {
+				if (!batch) {
+					_metrics->credentialVerification(!_rejectedPrimed[slot]);
+					_rejectedPrimed[slot] = false;
+				}
+				return false;
+			}
+		}
+
+		if (batch) {
+			batch->_items.push_back(CredentialBatch::_Item());
+			CredentialBatch::_Item &i = batch->_items.back();
+			memcpy(i.k,k,sizeof(i.k));
+			i.pub = signer.publicKey();
+			i.sig = signature;
+			i.data.assign(reinterpret_cast<const uint8_t *>(data),reinterpret_cast<const uint8_t *>(data) + len);
+			return true;
+		}
+
+		_metrics->credentialVerification(false);
+		const bool valid = signer.verify(data,len,signature);
+
+		Mutex::Lock _l(_lock);
+		if (valid) {
+			memcpy(_entries[slot],k,sizeof(_entries[slot]));
+			_primed[slot] = false;
+		} else {
+			memcpy(_rejected[slot],k,sizeof(_rejected[slot]));
+			_rejectedPrimed[slot] = false;
+		}
+		return valid;
+	}
+
+	/**
+	 * Verify all signatures queued in a batch and cache the results
+	 *
+	 * The batch is emptied.
+	 *
+	 * @param batch Batch of signatures
+	 */
+	inline void verify(CredentialBatch &batch)
+	{
+		const unsigned int n = batch.size();
+		if (n) {
+			std::vector<C25519::BatchEntry> e(n);
+			for(unsigned int i=0;i<n;++i) {
+				const CredentialBatch::_Item &item = batch._items[i];
+				e[i].their = &(item.pub);
+				e[i].msg = (item.data.empty()) ? (const void *)&item : (const void *)&(item.data[0]);
+				e[i].len = (unsigned int)item.data.size();
+				e[i].signature = item.sig.data;
+			}
+			C25519::verifyBatch(&(e[0]),n);
+
+			Mutex::Lock _l(_lock);
+			for(unsigned int i=0;i<n;++i) {
+				const unsigned long slot = (unsigned long)(batch._items[i].k[0] & (ZT_CREDENTIAL_CACHE_SIZE - 1));
+				if (e[i].valid) {
+					memcpy(_entries[slot],batch._items[i].k,sizeof(_entries[slot]));
+					_primed[slot] = true;
+				} else {
+					memcpy(_rejected[slot],batch._items[i].k,sizeof(_rejected[slot]));
+					_rejectedPrimed[slot] = true;
+				}
+			}
+		}
+		batch._items.clear();
+	}
+
+private:
+	static inline void _key(const Identity &signer,const void *data,unsigned int len,const C25519::Signature &signature,uint64_t k[8])
+	{
+		uint8_t tmp[ZT_C25519_PUBLIC_KEY_LEN + ZT_C25519_SIGNATURE_LEN + 64];
+		memcpy(tmp,signer.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+		memcpy(tmp + ZT_C25519_PUBLIC_KEY_LEN,signature.data,ZT_C25519_SIGNATURE_LEN);
+		SHA512::hash(tmp + ZT_C25519_PUBLIC_KEY_LEN + ZT_C25519_SIGNATURE_LEN,data,len);
+		SHA512::hash(k,tmp,sizeof(tmp));
+	}
+
+	Metrics *const _metrics;
+	uint64_t _entries[ZT_CREDENTIAL_CACHE_SIZE][4]; // first 256 bits of key hash
+	bool _primed[ZT_CREDENTIAL_CACHE_SIZE]; // true if filled by a batch and not yet used
+	uint64_t _rejected[ZT_CREDENTIAL_CACHE_SIZE][4]; // key hashes of signatures that failed
+	bool _rejectedPrimed[ZT_CREDENTIAL_CACHE_SIZE];
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
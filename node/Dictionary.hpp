@@ -40,7 +40,8 @@ namespace ZeroTier {
  * contains these characters it may not be retrievable. This is not checked.
  *
  * Lookup is via linear search and will be slow with a lot of keys. It's
- * designed for small things.
+ * designed for small things. Use DictionaryIndex to read many keys from
+ * the same dictionary.
  *
  * There is code to test and fuzz this in selftest.cpp. Fuzzing a blob of
  * pointer tricks like this is important after any modifications.
@@ -428,6 +429,287 @@ private:
 	char _d[C];
 };
 
+/**
+ * Maximum number of keys a DictionaryIndex hashes (more are found by linear search)
+ */
+#define ZT_DICTIONARY_INDEX_MAX_KEYS 64
+
+/**
+ * A read-only view of a Dictionary that tokenizes it once
+ *
+ * Dictionary::get() scans (and unescapes up to) the whole dictionary for
+ * every key, so reading N keys is O(N * size). This makes one pass over the
+ * data to find each key and the span of its value, and puts keys into a
+ * small hash table. Values are only unescaped when they are retrieved, and
+ * values without escapes are simply copied.
+ *
+ * Lookup semantics match Dictionary: if a key appears more than once the
+ * first occurrence wins, and keys beyond ZT_DICTIONARY_INDEX_MAX_KEYS are
+ * still found (by linear search of the remainder).
+ *
+ * This points into the dictionary's data, so the dictionary must not be
+ * modified or destroyed while the index is in use.
+ */
+class DictionaryIndex
+{
+public:
+	/**
+	 * @param d Dictionary data
+	 * @param maxlen Maximum length of data (parsing stops here or at the first 0)
+	 */
+	DictionaryIndex(const char *d,unsigned int maxlen)
+	{
+		_init(d,maxlen);
+	}
+
+	/**
+	 * @param d Dictionary to index
+	 * @tparam C Dictionary capacity (usually inferred)
+	 */
+	template<unsigned int C>
+	DictionaryIndex(const Dictionary<C> &d)
+	{
+		_init(d.data(),C);
+	}
+
+	/**
+	 * Get an entry
+	 *
+	 * This behaves exactly like Dictionary::get().
+	 *
+	 * @param key Key to look up
+	 * @param dest Destination buffer
+	 * @param destlen Size of destination buffer
+	 * @return -1 if not found, or actual number of bytes stored in dest[] minus trailing 0
+	 */
+	inline int get(const char *key,char *dest,unsigned int destlen) const
+	{
+		if (!destlen)
+			return -1;
+		_Entry e;
+		if (!_find(key,e)) {
+			dest[0] = (char)0;
+			return -1;
+		}
+		return _unescape(e,dest,destlen);
+	}
+
+	/**
+	 * Get the contents of a key into a buffer
+	 *
+	 * @param key Key to get
+	 * @param dest Destination buffer
+	 * @return True if key was found (if false, dest will be empty)
+	 * @tparam BC Buffer capacity (usually inferred)
+	 */
+	template<unsigned int BC>
+	inline bool get(const char *key,Buffer<BC> &dest) const
+	{
+		const int r = this->get(key,reinterpret_cast<char *>(dest.unsafeData()),BC);
+		if (r >= 0) {
+			dest.setSize((unsigned int)r);
+			return true;
+		} else {
+			dest.clear();
+			return false;
+		}
+	}
+
+	/**
+	 * Get a boolean value
+	 *
+	 * @param key Key to look up
+	 * @param dfl Default value if not found in dictionary
+	 * @return Boolean value of key or 'dfl' if not found
+	 */
+	inline bool getB(const char *key,bool dfl = false) const
+	{
+		char tmp[4];
+		if (this->get(key,tmp,sizeof(tmp)) >= 0)
+			return ((*tmp == '1')||(*tmp == 't')||(*tmp == 'T'));
+		return dfl;
+	}
+
+	/**
+	 * Get an unsigned int64 stored as hex in the dictionary
+	 *
+	 * @param key Key to look up
+	 * @param dfl Default value or 0 if unspecified
+	 * @return Decoded hex UInt value or 'dfl' if not found
+	 */
+	inline uint64_t getUI(const char *key,uint64_t dfl = 0) const
+	{
+		_Entry e;
+		if (_find(key,e)) {
+			char tmp[128];
+			if (_unescape(e,tmp,sizeof(tmp)) >= 1)
+				return Utils::hexStrToU64(tmp);
+		}
+		return dfl;
+	}
+
+	/**
+	 * @param key Key to check
+	 * @return True if key is present
+	 */
+	inline bool contains(const char *key) const
+	{
+		_Entry e;
+		return _find(key,e);
+	}
+
+private:
+	struct _Entry
+	{
+		const char *k;
+		const char *v;
+		unsigned int klen;
+		unsigned int vlen;
+		bool escaped;
+	};
+
+	static inline unsigned int _hash(const char *k,unsigned int klen)
+	{
+		unsigned int h = 2166136261U;
+		for(unsigned int i=0;i<klen;++i)
+			h = (h ^ (unsigned int)((unsigned char)k[i])) * 16777619U;
+		return h;
+	}
+
+	// Parse the line at p, returning the start of the next line or end if none
+	static inline const char *_parseLine(const char *p,const char *const end,_Entry &e,bool &valid)
+	{
+		e.k = p;
+		while ((p < end)&&(*p)&&(*p != '=')&&(*p != 13)&&(*p != 10))
+			++p;
+		valid = ((p < end)&&(*p == '='));
+		if (valid) {
+			e.klen = (unsigned int)(p - e.k);
+			e.v = ++p;
+			e.escaped = false;
+			while ((p < end)&&(*p)&&(*p != 13)&&(*p != 10)) {
+				if (*p == '\\')
+					e.escaped = true;
+				++p;
+			}
+			e.vlen = (unsigned int)(p - e.v);
+			if (p == end) // Dictionary::get() returns not found for unterminated values
+				valid = false;
+		} else {
+			while ((p < end)&&(*p)&&(*p != 13)&&(*p != 10))
+				++p;
+		}
+		if ((p < end)&&(*p))
+			++p;
+		return p;
+	}
+
+	inline void _init(const char *d,unsigned int maxlen)
+	{
+		for(unsigned int i=0;i<(ZT_DICTIONARY_INDEX_MAX_KEYS * 2);++i)
+			_table[i] = 0;
+		_count = 0;
+		_end = d + maxlen;
+		_rest = (const char *)0;
+
+		const char *p = d;
+		while ((p < _end)&&(*p)) {
+			if (_count >= ZT_DICTIONARY_INDEX_MAX_KEYS) {
+				_rest = p;
+				break;
+			}
+			bool valid;
+			_Entry &e = _entries[_count];
+			p = _parseLine(p,_end,e,valid);
+			if ((valid)&&(e.klen > 0)) {
+				unsigned int s = _hash(e.k,e.klen) % (ZT_DICTIONARY_INDEX_MAX_KEYS * 2);
+				for(;;) {
+					if (!_table[s]) {
+						_table[s] = (uint8_t)(++_count);
+						break;
+					}
+					const _Entry &e2 = _entries[_table[s] - 1];
+					if ((e2.klen == e.klen)&&(!memcmp(e2.k,e.k,e.klen)))
+						break; // duplicate key, first one wins
+					s = (s + 1) % (ZT_DICTIONARY_INDEX_MAX_KEYS * 2);
+				}
+			}
+		}
+	}
+
+	inline bool _find(const char *key,_Entry &e) const
+	{
+		const unsigned int klen = (unsigned int)strlen(key);
+		if (!klen)
+			return false;
+
+		unsigned int s = _hash(key,klen) % (ZT_DICTIONARY_INDEX_MAX_KEYS * 2);
+		while (_table[s]) {
+			const _Entry &e2 = _entries[_table[s] - 1];
+			if ((e2.klen == klen)&&(!memcmp(e2.k,key,klen))) {
+				e = e2;
+				return true;
+			}
+			s = (s + 1) % (ZT_DICTIONARY_INDEX_MAX_KEYS * 2);
+		}
+
+		if (_rest) {
+			const char *p = _rest;
+			while ((p < _end)&&(*p)) {
+				bool valid;
+				p = _parseLine(p,_end,e,valid);
+				if ((valid)&&(e.klen == klen)&&(!memcmp(e.k,key,klen)))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	static inline int _unescape(const _Entry &e,char *dest,unsigned int destlen)
+	{
+		if (!e.escaped) {
+			const unsigned int l = (e.vlen < destlen) ? e.vlen : (destlen - 1);
+			memcpy(dest,e.v,l);
+			dest[l] = (char)0;
+			return (int)l;
+		}
+
+		unsigned int j = 0;
+		bool esc = false;
+		for(unsigned int i=0;i<e.vlen;++i) {
+			const char c = e.v[i];
+			if (esc) {
+				esc = false;
+				switch(c) {
+					case 'r': dest[j++] = 13; break;
+					case 'n': dest[j++] = 10; break;
+					case '0': dest[j++] = (char)0; break;
+					case 'e': dest[j++] = '='; break;
+					default: dest[j++] = c; break;
+				}
+			} else if (c == '\\') {
+				esc = true;
+				continue;
+			} else {
+				dest[j++] = c;
+			}
+			if (j == destlen) {
+				dest[j-1] = (char)0;
+				return (int)(j-1);
+			}
+		}
+		dest[j] = (char)0;
+		return (int)j;
+	}
+
+	_Entry _entries[ZT_DICTIONARY_INDEX_MAX_KEYS];
+	const char *_end;
+	const char *_rest;
+	unsigned int _count;
+	uint8_t _table[ZT_DICTIONARY_INDEX_MAX_KEYS * 2];
+};
+
 } // namespace ZeroTier
 
 #endif
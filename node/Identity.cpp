@@ -31,7 +31,6 @@
 // parameters of the hashcash hashing/searching algorithm.
 
 #define ZT_IDENTITY_GEN_HASHCASH_FIRST_BYTE_LESS_THAN 17
-#define ZT_IDENTITY_GEN_MEMORY 2097152
 
 namespace ZeroTier {
 
@@ -89,21 +88,29 @@ struct _Identity_generate_cond
 
 void Identity::generate()
 {
-	unsigned char digest[64];
 	char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
+	while (!generateAttempt(genmem)) {}
+	delete [] genmem;
+}
+
+bool Identity::generateAttempt(char *genmem)
+{
+	unsigned char digest[64];
 
-	C25519::Pair kp;
-	do {
-		kp = C25519::generateSatisfying(_Identity_generate_cond(digest,genmem));
-		_address.setTo(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
-	} while (_address.isReserved());
+	const C25519::Pair kp(C25519::generate());
+	if (!_Identity_generate_cond(digest,genmem)(kp))
+		return false;
+	const Address addr(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
+	if (addr.isReserved())
+		return false;
 
+	_address = addr;
 	_publicKey = kp.pub;
 	if (!_privateKey)
 		_privateKey = new C25519::Private();
 	*_privateKey = kp.priv;
 
-	delete [] genmem;
+	return true;
 }
 
 bool Identity::locallyValidate() const
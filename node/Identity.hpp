@@ -31,6 +31,13 @@
 #include "Buffer.hpp"
 #include "SHA512.hpp"
 
+/**
+ * Scratch memory needed by the memory-hard hash used to generate and validate identities
+ *
+ * This can't be changed without a new identity type.
+ */
+#define ZT_IDENTITY_GEN_MEMORY 2097152
+
 namespace ZeroTier {
 
 /**
@@ -108,6 +115,18 @@ public:
 	 */
 	void generate();
 
+	/**
+	 * Make one attempt at generating a new identity
+	 *
+	 * generate() calls this until it succeeds, which takes about 15 tries on
+	 * average. Several threads can call it at once on different identities
+	 * as long as each has its own genmem.
+	 *
+	 * @param genmem Scratch memory of at least ZT_IDENTITY_GEN_MEMORY bytes
+	 * @return True if this is now a new identity, false if the candidate key pair was rejected
+	 */
+	bool generateAttempt(char *genmem);
+
 	/**
 	 * Check the validity of this identity's pairing of key to address
 	 *
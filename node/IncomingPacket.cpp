@@ -41,6 +41,9 @@
 #include "Capability.hpp"
 #include "Tag.hpp"
 #include "Revocation.hpp"
+#include "Metrics.hpp"
+#include "PacketTrace.hpp"
+#include "CredentialCache.hpp"
 
 namespace ZeroTier {
 
@@ -48,6 +51,8 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 {
 	const Address sourceAddress(source());
 
+	RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_DECODE,size());
+
 	try {
 		// Check for trusted paths or unencrypted HELLOs (HELLO is the only packet sent in the clear)
 		const unsigned int c = cipher();
@@ -61,19 +66,24 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 				TRACE("TRUSTED PATH packet approved from %s(%s), trusted path ID %llx",sourceAddress.toString().c_str(),_path->address().toString().c_str(),trustedPathId());
 			} else {
 				TRACE("dropped packet from %s(%s), cipher set to trusted path mode but path %llx@%s is not trusted!",sourceAddress.toString().c_str(),_path->address().toString().c_str(),trustedPathId(),_path->address().toString().c_str());
+				RR->metrics->drop(ZT_METRICS_DROP_UNTRUSTED_PATH);
 				return true;
 			}
 		} else if ((c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(verb() == Packet::VERB_HELLO)) {
-			// Only HELLO is allowed in the clear, but will still have a MAC
+			// Only HELLO is allowed in the clear, but will still have a MAC (counted in _doHELLO() once checked)
 			return _doHELLO(RR,tPtr,false);
 		}
 
 		const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,sourceAddress));
 		if (peer) {
 			if (!trusted) {
-				if (!dearmor(peer->key())) {
+				const uint64_t cryptoStart = Metrics::ticks();
+				const bool authentic = dearmor(peer->key());
+				RR->metrics->cryptoTime(Metrics::ticks() - cryptoStart);
+				if (!authentic) {
 					//fprintf(stderr,"dropped packet from %s(%s), MAC authentication failed (size: %u)" ZT_EOL_S,sourceAddress.toString().c_str(),_path->address().toString().c_str(),size());
 					TRACE("dropped packet from %s(%s), MAC authentication failed (size: %u)",sourceAddress.toString().c_str(),_path->address().toString().c_str(),size());
+					RR->metrics->drop(ZT_METRICS_DROP_MAC_FAILED);
 					return true;
 				}
 			}
@@ -81,10 +91,19 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 			if (!uncompress()) {
 				//fprintf(stderr,"dropped packet from %s(%s), compressed data invalid (size %u, verb may be %u)" ZT_EOL_S,sourceAddress.toString().c_str(),_path->address().toString().c_str(),size(),(unsigned int)verb());
 				TRACE("dropped packet from %s(%s), compressed data invalid (size %u, verb may be %u)",sourceAddress.toString().c_str(),_path->address().toString().c_str(),size(),(unsigned int)verb());
+				RR->metrics->drop(ZT_METRICS_DROP_DECOMPRESS_FAILED);
 				return true;
 			}
 
 			const Packet::Verb v = verb();
+			if ( ((v == Packet::VERB_FRAME)||(v == Packet::VERB_EXT_FRAME)) && (RR->sw->duplicateFrame(sourceAddress,packetId())) ) {
+				// Copy of a frame the sender sent over more than one path
+				peer->received(tPtr,_path,hops(),packetId(),v,0,Packet::VERB_NOP,false);
+				RR->metrics->drop(ZT_METRICS_DROP_DUPLICATE);
+				return true;
+			}
+			RR->metrics->rx((unsigned int)v,size());
+			RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_AUTHENTICATED,(unsigned int)v);
 			//TRACE("<< %s from %s(%s)",Packet::verbString(v),sourceAddress.toString().c_str(),_path->address().toString().c_str());
 			switch(v) {
 				//case Packet::VERB_NOP:
@@ -119,6 +138,7 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 		// Exceptions are more informatively caught in _do...() handlers but
 		// this outer try/catch will catch anything else odd.
 		TRACE("dropped ??? from %s(%s): unexpected exception in tryDecode()",sourceAddress.toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 		return true;
 	}
 }
@@ -198,6 +218,7 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_ERROR,inRePacketId,inReVerb,false);
 	} catch ( ... ) {
 		TRACE("dropped ERROR from %s(%s): unexpected exception",peer->address().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -234,8 +255,10 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 					// Identity is different from the one we already have -- address collision
 
 					// Check rate limits
-					if (!RR->node->rateGateIdentityVerification(now,_path->address()))
+					if (!RR->node->rateGateIdentityVerification(now,_path->address())) {
+						RR->metrics->drop(ZT_METRICS_DROP_RATE_LIMITED);
 						return true;
+					}
 
 					uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
 					if (RR->identity.agree(id,key,ZT_PEER_SECRET_KEY_LENGTH)) {
@@ -276,8 +299,10 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 			}
 
 			// Check rate limits
-			if (!RR->node->rateGateIdentityVerification(now,_path->address()))
+			if (!RR->node->rateGateIdentityVerification(now,_path->address())) {
+				RR->metrics->drop(ZT_METRICS_DROP_RATE_LIMITED);
 				return true;
+			}
 
 			// Check packet integrity and MAC (this is faster than locallyValidate() so do it first to filter out total crap)
 			SharedPtr<Peer> newPeer(new Peer(RR,RR->identity,id));
@@ -299,6 +324,9 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 
 		// VALID -- if we made it here, packet passed identity and authenticity checks!
 
+		if (!alreadyAuthenticated)
+			RR->metrics->rx((unsigned int)Packet::VERB_HELLO,size());
+
 		// Get external surface address if present (was not in old versions)
 		InetAddress externalSurfaceAddress;
 		if (ptr < size()) {
@@ -414,6 +442,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 		peer->received(tPtr,_path,hops(),pid,Packet::VERB_HELLO,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped HELLO from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -460,11 +489,12 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 					const unsigned int worldsLen = at<uint16_t>(ptr); ptr += 2;
 					if (RR->topology->shouldAcceptWorldUpdateFrom(peer->address())) {
 						const unsigned int endOfWorlds = ptr + worldsLen;
+						std::vector<World> worlds;
 						while (ptr < endOfWorlds) {
-							World w;
-							ptr += w.deserialize(*this,ptr);
-							RR->topology->addWorld(tPtr,w,false);
+							worlds.push_back(World());
+							ptr += worlds.back().deserialize(*this,ptr);
 						}
+						RR->topology->addWorlds(tPtr,worlds);
 					} else {
 						ptr += worldsLen;
 					}
@@ -485,18 +515,40 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 				TRACE("%s(%s): OK(HELLO), version %u.%u.%u, latency %u",tmp1.c_str(),tmp2.c_str(),vMajor,vMinor,vRevision,latency);
 #endif
 
-				if (!hops())
+				if (!hops()) {
 					peer->addDirectLatencyMeasurment((unsigned int)latency);
+					_path->probeAnswered((unsigned int)latency);
+				}
 				peer->setRemoteVersion(vProto,vMajor,vMinor,vRevision);
 
 				if ((externalSurfaceAddress)&&(hops() == 0))
 					RR->sa->iam(tPtr,peer->address(),_path->localAddress(),_path->address(),externalSurfaceAddress,RR->topology->isUpstream(peer->identity()),RR->node->now());
 			}	break;
 
+			case Packet::VERB_ECHO:
+				// Our ECHOs carry their send time, which the peer sends back. Path
+				// MTU probes are ECHOs too but aren't counted as latency probes.
+				if ((!hops())&&(_path->mtuProbeAnswered(inRePacketId)))
+					break;
+				if ((!hops())&&((ZT_PROTO_VERB_ECHO__OK__IDX_PAYLOAD + 8) <= size())) {
+					const uint64_t sent = at<uint64_t>(ZT_PROTO_VERB_ECHO__OK__IDX_PAYLOAD);
+					const uint64_t now = RR->node->now();
+					if ((sent <= now)&&((now - sent) < ZT_GENERAL_RTT_LIMIT)) {
+						peer->addDirectLatencyMeasurment((unsigned int)(now - sent));
+						_path->probeAnswered((unsigned int)(now - sent));
+					}
+				}
+				break;
+
 			case Packet::VERB_WHOIS:
 				if (RR->topology->isUpstream(peer->identity())) {
-					const Identity id(*this,ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY);
-					RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id))));
+					// Replies to batched WHOIS carry more than one identity
+					unsigned int ptr = ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY;
+					while (ptr < size()) {
+						Identity id;
+						ptr += id.deserialize(*this,ptr);
+						RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id))));
+					}
 				}
 				break;
 
@@ -551,6 +603,7 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_OK,inRePacketId,inReVerb,false);
 	} catch ( ... ) {
 		TRACE("dropped OK from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -560,6 +613,7 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 	try {
 		if ((!RR->topology->amRoot())&&(!peer->rateGateInboundWhoisRequest(RR->node->now()))) {
 			TRACE("dropped WHOIS from %s(%s): rate limit circuit breaker tripped",source().toString().c_str(),_path->address().toString().c_str());
+			RR->metrics->drop(ZT_METRICS_DROP_RATE_LIMITED);
 			return true;
 		}
 
@@ -567,7 +621,12 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 		outp.append((unsigned char)Packet::VERB_WHOIS);
 		outp.append(packetId());
 
+		// Answer every address in one pass, splitting replies so that each
+		// fits in a single unfragmented packet
 		unsigned int count = 0;
+#ifdef ZT_ENABLE_CLUSTER
+		bool unknown = false;
+#endif
 		unsigned int ptr = ZT_PACKET_IDX_PAYLOAD;
 		while ((ptr + ZT_ADDRESS_LENGTH) <= size()) {
 			const Address addr(field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
@@ -577,14 +636,19 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 			if (id) {
 				id.serialize(outp,false);
 				++count;
+				if ((outp.size() + ZT_WHOIS_REPLY_IDENTITY_RESERVE) > ZT_UDP_DEFAULT_PAYLOAD_MTU) {
+					outp.armor(peer->key(),true,_path->nextOutgoingCounter());
+					_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
+					outp.reset(peer->address(),RR->identity.address(),Packet::VERB_OK);
+					outp.append((unsigned char)Packet::VERB_WHOIS);
+					outp.append(packetId());
+					count = 0;
+				}
 			} else {
 				// Request unknown WHOIS from upstream from us (if we have one)
 				RR->sw->requestWhois(tPtr,addr);
 #ifdef ZT_ENABLE_CLUSTER
-				// Distribute WHOIS queries across a cluster if we do not know the ID.
-				// This may result in duplicate OKs to the querying peer, which is fine.
-				if (RR->cluster)
-					RR->cluster->sendDistributedQuery(*this);
+				unknown = true;
 #endif
 			}
 		}
@@ -594,9 +658,18 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 			_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 		}
 
+#ifdef ZT_ENABLE_CLUSTER
+		// Distribute WHOIS queries across a cluster if we do not know one or
+		// more IDs. This may result in duplicate OKs to the querying peer,
+		// which is fine.
+		if ((unknown)&&(RR->cluster))
+			RR->cluster->sendDistributedQuery(*this);
+#endif
+
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_WHOIS,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped WHOIS from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -631,6 +704,7 @@ bool IncomingPacket::_doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_RENDEZVOUS,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped RENDEZVOUS from %s(%s): unexpected exception",peer->address().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -649,8 +723,12 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 					const MAC sourceMac(peer->address(),nwid);
 					const unsigned int frameLen = size() - ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
 					const uint8_t *const frameData = reinterpret_cast<const uint8_t *>(data()) + ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
-					if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0)
+					const int verdict = network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0);
+					RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_FILTERED,(unsigned int)verdict);
+					if (verdict > 0) {
 						RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
+						RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_TAP,frameLen);
+					}
 				}
 			} else {
 				TRACE("dropped FRAME from %s(%s): not a member of private network %.16llx",peer->address().toString().c_str(),_path->address().toString().c_str(),(unsigned long long)network->id());
@@ -663,6 +741,7 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_FRAME,0,Packet::VERB_NOP,trustEstablished);
 	} catch ( ... ) {
 		TRACE("dropped FRAME from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -703,7 +782,9 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 					return true;
 				}
 
-				switch (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to,frameData,frameLen,etherType,0)) {
+				const int verdict = network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to,frameData,frameLen,etherType,0);
+				RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_FILTERED,(unsigned int)verdict);
+				switch (verdict) {
 					case 1:
 						if (from != MAC(peer->address(),nwid)) {
 							if (network->config().permitsBridging(peer->address())) {
@@ -729,6 +810,7 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 						// fall through -- 2 means accept regardless of bridging checks or other restrictions
 					case 2:
 						RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to,etherType,0,(const void *)frameData,frameLen);
+						RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_TAP,frameLen);
 						break;
 				}
 			}
@@ -750,6 +832,7 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 		}
 	} catch ( ... ) {
 		TRACE("dropped EXT_FRAME from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -759,6 +842,7 @@ bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,void *tPtr,const Share
 	try {
 		if (!peer->rateGateEchoRequest(RR->node->now())) {
 			TRACE("dropped ECHO from %s(%s): rate limit circuit breaker tripped",source().toString().c_str(),_path->address().toString().c_str());
+			RR->metrics->drop(ZT_METRICS_DROP_RATE_LIMITED);
 			return true;
 		}
 
@@ -774,6 +858,7 @@ bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,void *tPtr,const Share
 		peer->received(tPtr,_path,hops(),pid,Packet::VERB_ECHO,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped ECHO from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -822,6 +907,7 @@ bool IncomingPacket::_doMULTICAST_LIKE(const RuntimeEnvironment *RR,void *tPtr,c
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_LIKE,0,Packet::VERB_NOP,trustEstablished);
 	} catch ( ... ) {
 		TRACE("dropped MULTICAST_LIKE from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -831,6 +917,7 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	try {
 		if (!peer->rateGateCredentialsReceived(RR->node->now())) {
 			TRACE("dropped NETWORK_CREDENTIALS from %s(%s): rate limit circuit breaker tripped",source().toString().c_str(),_path->address().toString().c_str());
+			RR->metrics->drop(ZT_METRICS_DROP_RATE_LIMITED);
 			return true;
 		}
 
@@ -841,6 +928,53 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 		CertificateOfOwnership coo;
 		bool trustEstablished = false;
 
+		// Credentials tend to arrive in bunches, so first check all their
+		// signatures as one batch. The results land in the credential cache,
+		// so adding them below doesn't check any signature a second time.
+		CredentialBatch batch;
+		try {
+			unsigned int p = ZT_PACKET_IDX_PAYLOAD;
+			while ((p < size())&&((*this)[p] != 0)) {
+				p += com.deserialize(*this,p);
+				if ((com)&&(RR->node->network(com.networkId())))
+					com.verify(RR,tPtr,&batch);
+			}
+			++p;
+			if (p < size()) {
+				const unsigned int numCapabilities = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numCapabilities;++i) {
+					p += cap.deserialize(*this,p);
+					if (RR->node->network(cap.networkId()))
+						cap.verify(RR,tPtr,&batch);
+				}
+			}
+			if (p < size()) {
+				const unsigned int numTags = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numTags;++i) {
+					p += tag.deserialize(*this,p);
+					if (RR->node->network(tag.networkId()))
+						tag.verify(RR,tPtr,&batch);
+				}
+			}
+			if (p < size()) {
+				const unsigned int numRevocations = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numRevocations;++i) {
+					p += revocation.deserialize(*this,p);
+					if (RR->node->network(revocation.networkId()))
+						revocation.verify(RR,tPtr,&batch);
+				}
+			}
+			if (p < size()) {
+				const unsigned int numCoos = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numCoos;++i) {
+					p += coo.deserialize(*this,p);
+					if (RR->node->network(coo.networkId()))
+						coo.verify(RR,tPtr,&batch);
+				}
+			}
+		} catch ( ... ) {} // anything malformed is dealt with below as before
+		RR->credentialCache->verify(batch);
+
 		unsigned int p = ZT_PACKET_IDX_PAYLOAD;
 		while ((p < size())&&((*this)[p] != 0)) {
 			p += com.deserialize(*this,p);
@@ -946,9 +1080,11 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	} catch (std::exception &exc) {
 		//fprintf(stderr,"dropped NETWORK_CREDENTIALS from %s(%s): %s" ZT_EOL_S,source().toString().c_str(),_path->address().toString().c_str(),exc.what());
 		TRACE("dropped NETWORK_CREDENTIALS from %s(%s): %s",source().toString().c_str(),_path->address().toString().c_str(),exc.what());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	} catch ( ... ) {
 		//fprintf(stderr,"dropped NETWORK_CREDENTIALS from %s(%s): unknown exception" ZT_EOL_S,source().toString().c_str(),_path->address().toString().c_str());
 		TRACE("dropped NETWORK_CREDENTIALS from %s(%s): unknown exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -979,9 +1115,11 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,void
 	} catch (std::exception &exc) {
 		//fprintf(stderr,"dropped NETWORK_CONFIG_REQUEST from %s(%s): %s" ZT_EOL_S,source().toString().c_str(),_path->address().toString().c_str(),exc.what());
 		TRACE("dropped NETWORK_CONFIG_REQUEST from %s(%s): %s",source().toString().c_str(),_path->address().toString().c_str(),exc.what());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	} catch ( ... ) {
 		//fprintf(stderr,"dropped NETWORK_CONFIG_REQUEST from %s(%s): unknown exception" ZT_EOL_S,source().toString().c_str(),_path->address().toString().c_str());
 		TRACE("dropped NETWORK_CONFIG_REQUEST from %s(%s): unknown exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1005,6 +1143,7 @@ bool IncomingPacket::_doNETWORK_CONFIG(const RuntimeEnvironment *RR,void *tPtr,c
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_NETWORK_CONFIG,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped NETWORK_CONFIG_REFRESH from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1061,6 +1200,7 @@ bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,void *tPtr
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_GATHER,0,Packet::VERB_NOP,trustEstablished);
 	} catch ( ... ) {
 		TRACE("dropped MULTICAST_GATHER from %s(%s): unexpected exception",peer->address().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1140,8 +1280,11 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 				}
 
 				const uint8_t *const frameData = (const uint8_t *)field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME,frameLen);
-				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to.mac(),frameData,frameLen,etherType,0) > 0) {
+				const int verdict = network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to.mac(),frameData,frameLen,etherType,0);
+				RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_FILTERED,(unsigned int)verdict);
+				if (verdict > 0) {
 					RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to.mac(),etherType,0,(const void *)frameData,frameLen);
+					RR->trace->event(packetId(),ZT_TRACE_STAGE_RX_TAP,frameLen);
 				}
 			}
 
@@ -1166,6 +1309,7 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 		}
 	} catch ( ... ) {
 		TRACE("dropped MULTICAST_FRAME from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1178,6 +1322,7 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 		// First, subject this to a rate limit
 		if (!peer->rateGatePushDirectPaths(now)) {
 			TRACE("dropped PUSH_DIRECT_PATHS from %s(%s): circuit breaker tripped",source().toString().c_str(),_path->address().toString().c_str());
+			RR->metrics->drop(ZT_METRICS_DROP_RATE_LIMITED);
 			peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_PUSH_DIRECT_PATHS,0,Packet::VERB_NOP,false);
 			return true;
 		}
@@ -1240,6 +1385,7 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_PUSH_DIRECT_PATHS,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped PUSH_DIRECT_PATHS from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1381,6 +1527,7 @@ bool IncomingPacket::_doCIRCUIT_TEST(const RuntimeEnvironment *RR,void *tPtr,con
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_CIRCUIT_TEST,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped CIRCUIT_TEST from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1430,6 +1577,7 @@ bool IncomingPacket::_doCIRCUIT_TEST_REPORT(const RuntimeEnvironment *RR,void *t
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_CIRCUIT_TEST_REPORT,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped CIRCUIT_TEST_REPORT from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
@@ -1448,6 +1596,7 @@ bool IncomingPacket::_doUSER_MESSAGE(const RuntimeEnvironment *RR,void *tPtr,con
 		peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_CIRCUIT_TEST_REPORT,0,Packet::VERB_NOP,false);
 	} catch ( ... ) {
 		TRACE("dropped CIRCUIT_TEST_REPORT from %s(%s): unexpected exception",source().toString().c_str(),_path->address().toString().c_str());
+		RR->metrics->drop(ZT_METRICS_DROP_MALFORMED);
 	}
 	return true;
 }
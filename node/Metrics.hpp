@@ -0,0 +1,216 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_METRICS_HPP
+#define ZT_METRICS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+
+#include "../include/ZeroTierOne.h"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#else
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
+// Padding between counter groups so that unrelated hot counters do not share a cache line
+#define ZT_METRICS_CACHE_LINE 64
+
+namespace ZeroTier {
+
+/**
+ * Lock-free data plane counters
+ *
+ * Counters are bumped with relaxed atomic adds and read without locking
+ * when a snapshot is requested. Groups of counters that are updated from
+ * different places are kept on separate cache lines. On 32-bit targets
+ * without lock-free 64-bit atomics (e.g. mips32, armv5) counters are 32
+ * bits wide and wrap, which monitoring treats like a counter reset.
+ */
+class Metrics : NonCopyable
+{
+public:
+	Metrics()
+	{
+		_clear(&(_rx[0][0]),ZT_METRICS_VERB_COUNT * 2);
+		_clear(_drops,ZT_METRICS_DROP_REASON_COUNT);
+		_clear(_relayed,2);
+		_clear(&(_ruleVerdicts[0][0]),2 * ZT_METRICS_RULE_VERDICT_COUNT);
+		_clear(_cryptoTime,ZT_METRICS_CRYPTO_TIME_BUCKETS + 2);
+		_clear(_credentials,2);
+	}
+
+	/**
+	 * @param verb Packet verb (masked to 5 bits)
+	 * @param bytes Packet size in bytes
+	 */
+	inline void rx(unsigned int verb,unsigned int bytes)
+	{
+		verb &= (ZT_METRICS_VERB_COUNT - 1);
+		_add(_rx[verb][0],1);
+		_add(_rx[verb][1],bytes);
+	}
+
+	/**
+	 * @param reason Reason inbound packet was dropped
+	 */
+	inline void drop(const enum ZT_MetricsDropReason reason) { _add(_drops[(unsigned int)reason],1); }
+
+	/**
+	 * @param bytes Size of relayed packet or fragment
+	 */
+	inline void relayed(unsigned int bytes)
+	{
+		_add(_relayed[0],1);
+		_add(_relayed[1],bytes);
+	}
+
+	/**
+	 * @param inbound True for inbound filter, false for outbound
+	 * @param verdict Final verdict
+	 */
+	inline void ruleVerdict(bool inbound,const enum ZT_MetricsRuleVerdict verdict) { _add(_ruleVerdicts[(inbound) ? 0 : 1][(unsigned int)verdict],1); }
+
+	/**
+	 * @param ns Time in nanoseconds of a crypto operation (e.g. from ticks() deltas)
+	 */
+	inline void cryptoTime(uint64_t ns)
+	{
+		unsigned int b = 0;
+		while ((b < ZT_METRICS_CRYPTO_TIME_BUCKETS)&&(ns > (256ULL << b)))
+			++b;
+		if (b < ZT_METRICS_CRYPTO_TIME_BUCKETS)
+			_add(_cryptoTime[b],1);
+		_add(_cryptoTime[ZT_METRICS_CRYPTO_TIME_BUCKETS],ns);
+		_add(_cryptoTime[ZT_METRICS_CRYPTO_TIME_BUCKETS + 1],1);
+	}
+
+	/**
+	 * @param cached True if signature was found in the verification cache
+	 */
+	inline void credentialVerification(bool cached) { _add(_credentials[(cached) ? 1 : 0],1); }
+
+	/**
+	 * Fill counter fields of a metrics snapshot (gauges are left untouched)
+	 *
+	 * @param m Snapshot to fill
+	 */
+	inline void get(ZT_Metrics &m) const
+	{
+		for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v) {
+			m.rxPackets[v] = _get(_rx[v][0]);
+			m.rxBytes[v] = _get(_rx[v][1]);
+		}
+		for(unsigned int r=0;r<ZT_METRICS_DROP_REASON_COUNT;++r)
+			m.drops[r] = _get(_drops[r]);
+		m.relayedPackets = _get(_relayed[0]);
+		m.relayedBytes = _get(_relayed[1]);
+		for(unsigned int d=0;d<2;++d) {
+			for(unsigned int v=0;v<ZT_METRICS_RULE_VERDICT_COUNT;++v)
+				m.ruleVerdicts[d][v] = _get(_ruleVerdicts[d][v]);
+		}
+		for(unsigned int b=0;b<ZT_METRICS_CRYPTO_TIME_BUCKETS;++b)
+			m.cryptoTimeBuckets[b] = _get(_cryptoTime[b]);
+		m.cryptoTimeSum = _get(_cryptoTime[ZT_METRICS_CRYPTO_TIME_BUCKETS]);
+		m.cryptoTimeCount = _get(_cryptoTime[ZT_METRICS_CRYPTO_TIME_BUCKETS + 1]);
+		m.credentialVerifications = _get(_credentials[0]);
+		m.credentialVerificationsCached = _get(_credentials[1]);
+	}
+
+	/**
+	 * @return Monotonic high resolution time in nanoseconds (arbitrary epoch)
+	 */
+	static inline uint64_t ticks()
+	{
+#ifdef __WINDOWS__
+		static LARGE_INTEGER freq = { 0 };
+		if (!freq.QuadPart)
+			QueryPerformanceFrequency(&freq);
+		LARGE_INTEGER t;
+		QueryPerformanceCounter(&t);
+		return (uint64_t)(((double)t.QuadPart * 1000000000.0) / (double)freq.QuadPart);
+#else
+#ifdef __APPLE__
+		static mach_timebase_info_data_t tb = { 0,0 };
+		if (!tb.denom)
+			mach_timebase_info(&tb);
+		return ((uint64_t)mach_absolute_time() * (uint64_t)tb.numer) / (uint64_t)tb.denom;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return (((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+#endif
+#endif
+	}
+
+private:
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && (__GCC_ATOMIC_LLONG_LOCK_FREE < 2)
+	typedef uint32_t _V;
+#else
+	typedef uint64_t _V;
+#endif
+#ifdef __GNUC__
+	typedef volatile _V _C;
+	static inline void _add(_C &c,uint64_t v) { __sync_fetch_and_add(&c,(_V)v); }
+	static inline uint64_t _get(const _C &c) { return (uint64_t)__sync_fetch_and_add(const_cast<_C *>(&c),(_V)0); } // atomic read even where 64-bit loads can tear
+	static inline void _clear(_C *c,unsigned int n)
+	{
+		for(unsigned int i=0;i<n;++i)
+			c[i] = 0;
+	}
+#else
+	typedef std::atomic<_V> _C;
+	static inline void _add(_C &c,uint64_t v) { c.fetch_add((_V)v,std::memory_order_relaxed); }
+	static inline uint64_t _get(const _C &c) { return (uint64_t)c.load(std::memory_order_relaxed); }
+	static inline void _clear(_C *c,unsigned int n)
+	{
+		for(unsigned int i=0;i<n;++i)
+			c[i].store(0,std::memory_order_relaxed);
+	}
+#endif
+
+	_C _rx[ZT_METRICS_VERB_COUNT][2]; // [verb][packets,bytes]
+	char _p0[ZT_METRICS_CACHE_LINE];
+	_C _drops[ZT_METRICS_DROP_REASON_COUNT];
+	char _p1[ZT_METRICS_CACHE_LINE];
+	_C _relayed[2]; // packets,bytes
+	char _p2[ZT_METRICS_CACHE_LINE];
+	_C _ruleVerdicts[2][ZT_METRICS_RULE_VERDICT_COUNT]; // [inbound,outbound][verdict]
+	char _p3[ZT_METRICS_CACHE_LINE];
+	_C _cryptoTime[ZT_METRICS_CRYPTO_TIME_BUCKETS + 2]; // buckets...,sum,count
+	char _p4[ZT_METRICS_CACHE_LINE];
+	_C _credentials[2]; // verified,cached
+};
+
+} // namespace ZeroTier
+
+#endif
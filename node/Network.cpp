@@ -35,6 +35,7 @@
 #include "Node.hpp"
 #include "Peer.hpp"
 #include "Cluster.hpp"
+#include "Metrics.hpp"
 
 // Uncomment to make the rules engine dump trace info to stdout
 //#define ZT_RULES_ENGINE_DEBUGGING 1
@@ -693,13 +694,20 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 	Utils::snprintf(confn,sizeof(confn),"networks.d/%.16llx.conf",_id);
 
 	bool gotConf = false;
-	Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 	NetworkConfig *nconf = new NetworkConfig();
 	try {
 		std::string conf(RR->node->dataStoreGet(tPtr,confn));
 		if (conf.length()) {
-			dconf->load(conf.c_str());
-			if (nconf->fromDictionary(*dconf)) {
+			bool ok;
+			if (NetworkConfig::isBinary(conf.data(),(unsigned int)conf.length())) {
+				ok = nconf->fromBinary(conf.data(),(unsigned int)conf.length());
+			} else {
+				Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+				dconf->load(conf.c_str());
+				ok = nconf->fromDictionary(*dconf);
+				delete dconf;
+			}
+			if (ok) {
 				this->setConfiguration(tPtr,*nconf,false);
 				_lastConfigUpdate = 0; // we still want to re-request a new config from the network
 				gotConf = true;
@@ -707,7 +715,6 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 		}
 	} catch ( ... ) {} // ignore invalids, we'll re-request
 	delete nconf;
-	delete dconf;
 
 	if (!gotConf) {
 		// Save a one-byte CR to persist membership while we request a real netconf
@@ -754,6 +761,7 @@ bool Network::filterOutgoingPacket(
 	Address ztFinalDest(ztDest);
 	int localCapabilityIndex = -1;
 	bool accept = false;
+	bool teed = false;
 
 	Mutex::Lock _l(_lock);
 
@@ -794,6 +802,7 @@ bool Network::filterOutgoingPacket(
 							outp.append(frameData,ccLength2);
 							outp.compress();
 							RR->sw->send(tPtr,outp,true);
+							teed = true;
 						}
 
 						break;
@@ -804,6 +813,7 @@ bool Network::filterOutgoingPacket(
 			break;
 
 		case DOZTFILTER_DROP:
+			RR->metrics->ruleVerdict(false,ZT_METRICS_RULE_VERDICT_DROP);
 			return false;
 
 		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
@@ -830,6 +840,7 @@ bool Network::filterOutgoingPacket(
 			outp.append(frameData,ccLength);
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
+			teed = true;
 		}
 
 		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
@@ -846,11 +857,14 @@ bool Network::filterOutgoingPacket(
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 
+			RR->metrics->ruleVerdict(false,ZT_METRICS_RULE_VERDICT_REDIRECT);
 			return false; // DROP locally, since we redirected
 		} else {
+			RR->metrics->ruleVerdict(false,(teed) ? ZT_METRICS_RULE_VERDICT_TEE : ZT_METRICS_RULE_VERDICT_ACCEPT);
 			return true;
 		}
 	} else {
+		RR->metrics->ruleVerdict(false,ZT_METRICS_RULE_VERDICT_DROP);
 		return false;
 	}
 }
@@ -868,6 +882,7 @@ int Network::filterIncomingPacket(
 {
 	Address ztFinalDest(ztDest);
 	int accept = 0;
+	bool teed = false;
 
 	Mutex::Lock _l(_lock);
 
@@ -912,6 +927,7 @@ int Network::filterIncomingPacket(
 						outp.append(frameData,ccLength2);
 						outp.compress();
 						RR->sw->send(tPtr,outp,true);
+						teed = true;
 					}
 					break;
 				}
@@ -919,6 +935,8 @@ int Network::filterIncomingPacket(
 		}	break;
 
 		case DOZTFILTER_DROP:
+			RR->metrics->ruleVerdict(true,ZT_METRICS_RULE_VERDICT_DROP);
+			RR->metrics->drop(ZT_METRICS_DROP_FILTER);
 			return 0; // DROP
 
 		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
@@ -943,6 +961,7 @@ int Network::filterIncomingPacket(
 			outp.append(frameData,ccLength);
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
+			teed = true;
 		}
 
 		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
@@ -958,8 +977,14 @@ int Network::filterIncomingPacket(
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 
+			RR->metrics->ruleVerdict(true,ZT_METRICS_RULE_VERDICT_REDIRECT);
 			return 0; // DROP locally, since we redirected
 		}
+
+		RR->metrics->ruleVerdict(true,(teed) ? ZT_METRICS_RULE_VERDICT_TEE : ZT_METRICS_RULE_VERDICT_ACCEPT);
+	} else {
+		RR->metrics->ruleVerdict(true,ZT_METRICS_RULE_VERDICT_DROP);
+		RR->metrics->drop(ZT_METRICS_DROP_FILTER);
 	}
 
 	return accept;
@@ -1120,7 +1145,8 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 
 			nc = new NetworkConfig();
 			try {
-				if (!nc->fromDictionary(c->data)) {
+				const bool ok = (NetworkConfig::isBinary(c->data.data(),(unsigned int)c->haveBytes)) ? nc->fromBinary(c->data.data(),(unsigned int)c->haveBytes) : nc->fromDictionary(c->data);
+				if (!ok) {
 					delete nc;
 					nc = (NetworkConfig *)0;
 				}
@@ -1178,14 +1204,14 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 		_portError = RR->node->configureVirtualNetworkPort(tPtr,_id,&_uPtr,(oldPortInitialized) ? ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE : ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP,&ctmp);
 
 		if (saveToDisk) {
-			Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+			Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *b = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 			try {
 				char n[64];
 				Utils::snprintf(n,sizeof(n),"networks.d/%.16llx.conf",_id);
-				if (nconf.toDictionary(*d,false))
-					RR->node->dataStorePut(tPtr,n,(const void *)d->data(),d->sizeBytes(),true);
+				if (nconf.toBinary(*b))
+					RR->node->dataStorePut(tPtr,n,b->data(),b->size(),true);
 			} catch ( ... ) {}
-			delete d;
+			delete b;
 		}
 
 		return 2; // OK and configuration has changed
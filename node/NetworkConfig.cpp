@@ -192,36 +192,39 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 	try {
 		memset(this,0,sizeof(NetworkConfig));
 
+		// Tokenize once so each field below is a hash lookup instead of a scan
+		const DictionaryIndex di(d);
+
 		// Fields that are always present, new or old
-		this->networkId = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,0);
+		this->networkId = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,0);
 		if (!this->networkId) {
 			delete tmp;
 			return false;
 		}
-		this->timestamp = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,0);
-		this->credentialTimeMaxDelta = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA,0);
-		this->revision = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REVISION,0);
-		this->issuedTo = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,0);
+		this->timestamp = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,0);
+		this->credentialTimeMaxDelta = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA,0);
+		this->revision = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_REVISION,0);
+		this->issuedTo = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,0);
 		if (!this->issuedTo) {
 			delete tmp;
 			return false;
 		}
-		this->multicastLimit = (unsigned int)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
-		d.get(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name,sizeof(this->name));
+		this->multicastLimit = (unsigned int)di.getUI(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
+		di.get(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name,sizeof(this->name));
 
-		if (d.getUI(ZT_NETWORKCONFIG_DICT_KEY_VERSION,0) < 6) {
+		if (di.getUI(ZT_NETWORKCONFIG_DICT_KEY_VERSION,0) < 6) {
 	#ifdef ZT_SUPPORT_OLD_STYLE_NETCONF
 			char tmp2[1024];
 
 			// Decode legacy fields if version is old
-			if (d.getB(ZT_NETWORKCONFIG_DICT_KEY_ALLOW_PASSIVE_BRIDGING_OLD))
+			if (di.getB(ZT_NETWORKCONFIG_DICT_KEY_ALLOW_PASSIVE_BRIDGING_OLD))
 				this->flags |= ZT_NETWORKCONFIG_FLAG_ALLOW_PASSIVE_BRIDGING;
-			if (d.getB(ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST_OLD))
+			if (di.getB(ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST_OLD))
 				this->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
 			this->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION; // always enable for old-style netconf
-			this->type = (d.getB(ZT_NETWORKCONFIG_DICT_KEY_PRIVATE_OLD,true)) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
+			this->type = (di.getB(ZT_NETWORKCONFIG_DICT_KEY_PRIVATE_OLD,true)) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					if (this->staticIpCount >= ZT_MAX_ZT_ASSIGNED_ADDRESSES) break;
@@ -230,7 +233,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 						this->staticIps[this->staticIpCount++] = ip;
 				}
 			}
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					if (this->staticIpCount >= ZT_MAX_ZT_ASSIGNED_ADDRESSES) break;
@@ -240,11 +243,11 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP_OLD,tmp2,sizeof(tmp2)) > 0) {
 				this->com.fromString(tmp2);
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					unsigned int et = Utils::hexStrToUInt(f) & 0xffff;
@@ -261,7 +264,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				this->ruleCount = 1;
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					this->addSpecialist(Address(Utils::hexStrToU64(f)),ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
@@ -273,13 +276,13 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 	#endif // ZT_SUPPORT_OLD_STYLE_NETCONF
 		} else {
 			// Otherwise we can use the new fields
-			this->flags = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_FLAGS,0);
-			this->type = (ZT_VirtualNetworkType)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)ZT_NETWORK_TYPE_PRIVATE);
+			this->flags = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_FLAGS,0);
+			this->type = (ZT_VirtualNetworkType)di.getUI(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)ZT_NETWORK_TYPE_PRIVATE);
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp))
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp))
 				this->com.deserialize(*tmp,0);
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) {
 				try {
 					unsigned int p = 0;
 					while (p < tmp->size()) {
@@ -291,7 +294,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				std::sort(&(this->capabilities[0]),&(this->capabilities[this->capabilityCount]));
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) {
 				try {
 					unsigned int p = 0;
 					while (p < tmp->size()) {
@@ -303,7 +306,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				std::sort(&(this->tags[0]),&(this->tags[this->tagCount]));
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) {
 				unsigned int p = 0;
 				while (p < tmp->size()) {
 					if (certificateOfOwnershipCount < ZT_MAX_CERTIFICATES_OF_OWNERSHIP)
@@ -315,7 +318,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) {
 				unsigned int p = 0;
 				while ((p + 8) <= tmp->size()) {
 					if (specialistCount < ZT_MAX_NETWORK_SPECIALISTS)
@@ -324,7 +327,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) {
 				unsigned int p = 0;
 				while ((p < tmp->size())&&(routeCount < ZT_MAX_NETWORK_ROUTES)) {
 					p += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].target))->deserialize(*tmp,p);
@@ -335,14 +338,14 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) {
 				unsigned int p = 0;
 				while ((p < tmp->size())&&(staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
 					p += this->staticIps[this->staticIpCount++].deserialize(*tmp,p);
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) {
 				this->ruleCount = 0;
 				unsigned int p = 0;
 				Capability::deserializeRules(*tmp,p,this->rules,this->ruleCount,ZT_MAX_NETWORK_RULES);
@@ -361,4 +364,191 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 	}
 }
 
+bool NetworkConfig::toBinary(Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &b) const
+{
+	try {
+		b.clear();
+
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_MAGIC);
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_FORMAT_VERSION);
+		b.addSize(2); // offset of section table, filled in below
+		b.append(this->networkId);
+		b.append(this->timestamp);
+		b.append(this->credentialTimeMaxDelta);
+		b.append(this->revision);
+		this->issuedTo.appendTo(b);
+		b.append(this->flags);
+		b.append((uint32_t)this->multicastLimit);
+		b.append((uint8_t)this->type);
+		const unsigned int nameLen = (unsigned int)strnlen(this->name,ZT_MAX_NETWORK_SHORT_NAME_LENGTH);
+		b.append((uint8_t)nameLen);
+		b.append(this->name,nameLen);
+
+		b.setAt(2,(uint16_t)b.size());
+		b.append((uint8_t)ZT_NETWORKCONFIG_BINARY_SECTION_COUNT);
+		const unsigned int table = b.size();
+		b.append((unsigned char)0,ZT_NETWORKCONFIG_BINARY_SECTION_COUNT * ZT_NETWORKCONFIG_BINARY_SECTION_ENTRY_SIZE);
+
+		for(unsigned int s=0;s<ZT_NETWORKCONFIG_BINARY_SECTION_COUNT;++s) {
+			const unsigned int start = b.size();
+			unsigned int count = 0;
+			switch(s) {
+				case ZT_NETWORKCONFIG_BINARY_SECTION_RULES:
+					Capability::serializeRules(b,this->rules,this->ruleCount);
+					count = this->ruleCount;
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_CAPABILITIES:
+					for(unsigned int i=0;i<this->capabilityCount;++i)
+						this->capabilities[i].serialize(b);
+					count = this->capabilityCount;
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_TAGS:
+					for(unsigned int i=0;i<this->tagCount;++i)
+						this->tags[i].serialize(b);
+					count = this->tagCount;
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_COM:
+					if (this->com) {
+						this->com.serialize(b);
+						count = 1;
+					}
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_STATIC_IPS:
+					for(unsigned int i=0;i<this->staticIpCount;++i)
+						this->staticIps[i].serialize(b);
+					count = this->staticIpCount;
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_CERTIFICATES_OF_OWNERSHIP:
+					for(unsigned int i=0;i<this->certificateOfOwnershipCount;++i)
+						this->certificatesOfOwnership[i].serialize(b);
+					count = this->certificateOfOwnershipCount;
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_SPECIALISTS:
+					for(unsigned int i=0;i<this->specialistCount;++i)
+						b.append((uint64_t)this->specialists[i]);
+					count = this->specialistCount;
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_ROUTES:
+					for(unsigned int i=0;i<this->routeCount;++i) {
+						reinterpret_cast<const InetAddress *>(&(this->routes[i].target))->serialize(b);
+						reinterpret_cast<const InetAddress *>(&(this->routes[i].via))->serialize(b);
+						b.append((uint16_t)this->routes[i].flags);
+						b.append((uint16_t)this->routes[i].metric);
+					}
+					count = this->routeCount;
+					break;
+			}
+			const unsigned int e = table + (s * ZT_NETWORKCONFIG_BINARY_SECTION_ENTRY_SIZE);
+			b.setAt(e,(uint32_t)start);
+			b.setAt(e + 4,(uint32_t)(b.size() - start));
+			b.setAt(e + 8,(uint16_t)count);
+		}
+	} catch ( ... ) {
+		return false;
+	}
+
+	return true;
+}
+
+bool NetworkConfig::fromBinary(const void *data,unsigned int len)
+{
+	if ((!isBinary(data,len))||(len > ZT_NETWORKCONFIG_DICT_CAPACITY))
+		return false;
+
+	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *b = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>(data,len);
+
+	try {
+		memset(this,0,sizeof(NetworkConfig));
+
+		if ((*b)[1] != ZT_NETWORKCONFIG_BINARY_FORMAT_VERSION) {
+			delete b;
+			return false;
+		}
+
+		unsigned int p = 4;
+		this->networkId = b->at<uint64_t>(p); p += 8;
+		this->timestamp = b->at<uint64_t>(p); p += 8;
+		this->credentialTimeMaxDelta = b->at<uint64_t>(p); p += 8;
+		this->revision = b->at<uint64_t>(p); p += 8;
+		this->issuedTo.setTo(b->field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
+		this->flags = b->at<uint64_t>(p); p += 8;
+		this->multicastLimit = b->at<uint32_t>(p); p += 4;
+		this->type = (ZT_VirtualNetworkType)(*b)[p++];
+		const unsigned int nameLen = (*b)[p++];
+		memcpy(this->name,b->field(p,nameLen),std::min(nameLen,(unsigned int)ZT_MAX_NETWORK_SHORT_NAME_LENGTH));
+		if ((!this->networkId)||(!this->issuedTo)) {
+			delete b;
+			return false;
+		}
+
+		// Skip any header fields added by later revisions of this format version
+		p = b->at<uint16_t>(2);
+		const unsigned int sectionCount = (*b)[p++];
+		for(unsigned int s=0;((s<sectionCount)&&(s<ZT_NETWORKCONFIG_BINARY_SECTION_COUNT));++s) {
+			const unsigned int e = p + (s * ZT_NETWORKCONFIG_BINARY_SECTION_ENTRY_SIZE);
+			unsigned int sp = b->at<uint32_t>(e);
+			const unsigned int send = sp + b->at<uint32_t>(e + 4);
+			unsigned int count = b->at<uint16_t>(e + 8);
+			if ((send < sp)||(send > b->size())) {
+				delete b;
+				return false;
+			}
+
+			switch(s) {
+				case ZT_NETWORKCONFIG_BINARY_SECTION_RULES:
+					Capability::deserializeRules(*b,sp,this->rules,this->ruleCount,std::min(count,(unsigned int)ZT_MAX_NETWORK_RULES));
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_CAPABILITIES:
+					while ((count--)&&(this->capabilityCount < ZT_MAX_NETWORK_CAPABILITIES))
+						sp += this->capabilities[this->capabilityCount++].deserialize(*b,sp);
+					std::sort(&(this->capabilities[0]),&(this->capabilities[this->capabilityCount]));
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_TAGS:
+					while ((count--)&&(this->tagCount < ZT_MAX_NETWORK_TAGS))
+						sp += this->tags[this->tagCount++].deserialize(*b,sp);
+					std::sort(&(this->tags[0]),&(this->tags[this->tagCount]));
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_COM:
+					if (count)
+						sp += this->com.deserialize(*b,sp);
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_STATIC_IPS:
+					while ((count--)&&(this->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES))
+						sp += this->staticIps[this->staticIpCount++].deserialize(*b,sp);
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_CERTIFICATES_OF_OWNERSHIP:
+					while ((count--)&&(this->certificateOfOwnershipCount < ZT_MAX_CERTIFICATES_OF_OWNERSHIP))
+						sp += this->certificatesOfOwnership[this->certificateOfOwnershipCount++].deserialize(*b,sp);
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_SPECIALISTS:
+					while ((count--)&&(this->specialistCount < ZT_MAX_NETWORK_SPECIALISTS)) {
+						this->specialists[this->specialistCount++] = b->at<uint64_t>(sp);
+						sp += 8;
+					}
+					break;
+				case ZT_NETWORKCONFIG_BINARY_SECTION_ROUTES:
+					while ((count--)&&(this->routeCount < ZT_MAX_NETWORK_ROUTES)) {
+						sp += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].target))->deserialize(*b,sp);
+						sp += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].via))->deserialize(*b,sp);
+						this->routes[this->routeCount].flags = b->at<uint16_t>(sp); sp += 2;
+						this->routes[this->routeCount].metric = b->at<uint16_t>(sp); sp += 2;
+						++this->routeCount;
+					}
+					break;
+			}
+
+			if (sp > send) {
+				delete b;
+				return false;
+			}
+		}
+
+		delete b;
+		return true;
+	} catch ( ... ) {
+		delete b;
+		return false;
+	}
+}
+
 } // namespace ZeroTier
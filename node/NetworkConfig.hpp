@@ -107,7 +107,30 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY 1024
 
 // Network config version
-#define ZT_NETWORKCONFIG_VERSION 7
+#define ZT_NETWORKCONFIG_VERSION 8
+
+// Minimum network config version (as advertised in request meta-data) that can accept the binary format
+#define ZT_NETWORKCONFIG_VERSION_BINARY 8
+
+// First byte of a binary format network config (never the first byte of a dictionary)
+#define ZT_NETWORKCONFIG_BINARY_MAGIC 0xff
+
+// Binary network config format version
+#define ZT_NETWORKCONFIG_BINARY_FORMAT_VERSION 1
+
+// Sections in a binary network config, in section table order
+#define ZT_NETWORKCONFIG_BINARY_SECTION_RULES 0
+#define ZT_NETWORKCONFIG_BINARY_SECTION_CAPABILITIES 1
+#define ZT_NETWORKCONFIG_BINARY_SECTION_TAGS 2
+#define ZT_NETWORKCONFIG_BINARY_SECTION_COM 3
+#define ZT_NETWORKCONFIG_BINARY_SECTION_STATIC_IPS 4
+#define ZT_NETWORKCONFIG_BINARY_SECTION_CERTIFICATES_OF_OWNERSHIP 5
+#define ZT_NETWORKCONFIG_BINARY_SECTION_SPECIALISTS 6
+#define ZT_NETWORKCONFIG_BINARY_SECTION_ROUTES 7
+#define ZT_NETWORKCONFIG_BINARY_SECTION_COUNT 8
+
+// Size of a section table entry: offset (32), length (32), item count (16)
+#define ZT_NETWORKCONFIG_BINARY_SECTION_ENTRY_SIZE 10
 
 // Fields for meta-data sent with network config requests
 
@@ -247,6 +270,59 @@ public:
 	 */
 	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d);
 
+	/**
+	 * Write this network config in compact binary form for transport or storage
+	 *
+	 * The binary format is:
+	 *   <[1] ZT_NETWORKCONFIG_BINARY_MAGIC>
+	 *   <[1] binary format version>
+	 *   <[2] offset of section table>
+	 *   <[8] network ID>
+	 *   <[8] timestamp>
+	 *   <[8] credential time max delta>
+	 *   <[8] revision>
+	 *   <[5] issued to address>
+	 *   <[8] flags>
+	 *   <[4] multicast limit>
+	 *   <[1] network type>
+	 *   <[1] length of name>
+	 *   <[...] name>
+	 *   <[1] number of entries in section table>
+	 *   [... section table entries:]
+	 *     <[4] offset of section from start of config>
+	 *     <[4] length of section in bytes>
+	 *     <[2] number of items in section>
+	 *   [... sections]
+	 *
+	 * Sections are the same serialized objects that the dictionary format
+	 * stores as binary blobs, but nothing is escaped and a reader can go
+	 * directly to any section. Readers ignore sections and header fields
+	 * beyond those they know about.
+	 *
+	 * @param b Buffer to fill (will be cleared first)
+	 * @return True if buffer was successfully filled, false on overflow
+	 */
+	bool toBinary(Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &b) const;
+
+	/**
+	 * Read this network config from binary form
+	 *
+	 * @param data Binary network config as written by toBinary()
+	 * @param len Length of data in bytes
+	 * @return True if data was valid and network config successfully initialized
+	 */
+	bool fromBinary(const void *data,unsigned int len);
+
+	/**
+	 * @param data Serialized network config
+	 * @param len Length of data in bytes
+	 * @return True if data is a binary network config rather than a dictionary
+	 */
+	static inline bool isBinary(const void *data,unsigned int len)
+	{
+		return ((len > 0)&&(reinterpret_cast<const uint8_t *>(data)[0] == ZT_NETWORKCONFIG_BINARY_MAGIC));
+	}
+
 	/**
 	 * @return True if passive bridging is allowed (experimental)
 	 */
@@ -59,9 +59,9 @@ public:
 		 * @param requestPacketId Request packet ID to send OK(NETWORK_CONFIG_REQUEST) or 0 to send NETWORK_CONFIG (push)
 		 * @param destination Destination peer Address
 		 * @param nc Network configuration to send
-		 * @param sendLegacyFormatConfig If true, send an old-format network config
+		 * @param remoteConfigVersion Network config version from destination's request meta-data (selects legacy, dictionary, or binary format)
 		 */
-		virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig) = 0;
+		virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,unsigned int remoteConfigVersion) = 0;
 
 		/**
 		 * Send revocation to a node
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -37,6 +38,9 @@
 #include "Identity.hpp"
 #include "SelfAwareness.hpp"
 #include "Cluster.hpp"
+#include "Metrics.hpp"
+#include "PacketTrace.hpp"
+#include "CredentialCache.hpp"
 
 const struct sockaddr_storage ZT_SOCKADDR_NULL = {0};
 
@@ -50,13 +54,20 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,uint6
 	_RR(this),
 	RR(&_RR),
 	_uPtr(uptr),
+	_asyncGetCounter(0),
 	_now(now),
 	_lastPingCheck(0),
-	_lastHousekeepingRun(0)
-{
-	if (callbacks->version != 0)
-		throw std::runtime_error("callbacks struct version mismatch");
-	memcpy(&_cb,callbacks,sizeof(ZT_Node_Callbacks));
+	_lastHousekeepingRun(0),
+	_multipathMode(ZT_MULTIPATH_NONE)
+{
+	memset(&_cb,0,sizeof(ZT_Node_Callbacks));
+	if (callbacks->version == 0)
+		memcpy(&_cb,callbacks,offsetof(ZT_Node_Callbacks,dataStoreGetAsyncFunction)); // version 0 struct has no async get
+	else if (callbacks->version == 1)
+		memcpy(&_cb,callbacks,offsetof(ZT_Node_Callbacks,wirePacketSendDontFragmentFunction)); // version 1 struct has no don't fragment send
+	else if (callbacks->version == 2)
+		memcpy(&_cb,callbacks,sizeof(ZT_Node_Callbacks));
+	else throw std::runtime_error("callbacks struct version mismatch");
 
 	Utils::getSecureRandom((void *)_prngState,sizeof(_prngState));
 
@@ -83,6 +94,9 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,uint6
 	}
 
 	try {
+		RR->metrics = new Metrics();
+		RR->trace = new PacketTrace();
+		RR->credentialCache = new CredentialCache(RR->metrics);
 		RR->sw = new Switch(RR);
 		RR->mc = new Multicaster(RR);
 		RR->topology = new Topology(RR,tptr);
@@ -92,6 +106,9 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,uint6
 		delete RR->topology;
 		delete RR->mc;
 		delete RR->sw;
+		delete RR->credentialCache;
+		delete RR->trace;
+		delete RR->metrics;
 		throw;
 	}
 
@@ -104,6 +121,10 @@ Node::~Node()
 
 	_networks.clear(); // ensure that networks are destroyed before shutdow
 
+	try {
+		RR->topology->savePeerSnapshot((void *)0,_now);
+	} catch ( ... ) {}
+
 	delete RR->sa;
 	delete RR->topology;
 	delete RR->mc;
@@ -112,6 +133,10 @@ Node::~Node()
 #ifdef ZT_ENABLE_CLUSTER
 	delete RR->cluster;
 #endif
+
+	delete RR->credentialCache;
+	delete RR->trace;
+	delete RR->metrics;
 }
 
 ZT_ResultCode Node::processWirePacket(
@@ -125,6 +150,7 @@ ZT_ResultCode Node::processWirePacket(
 {
 	_now = now;
 	RR->sw->onRemotePacket(tptr,*(reinterpret_cast<const InetAddress *>(localAddress)),*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
+	_scheduleWhoisFlush(nextBackgroundTaskDeadline);
 	return ZT_RESULT_OK;
 }
 
@@ -144,10 +170,19 @@ ZT_ResultCode Node::processVirtualNetworkFrame(
 	SharedPtr<Network> nw(this->network(nwid));
 	if (nw) {
 		RR->sw->onLocalEthernet(tptr,nw,MAC(sourceMac),MAC(destMac),etherType,vlanId,frameData,frameLength);
+		_scheduleWhoisFlush(nextBackgroundTaskDeadline);
 		return ZT_RESULT_OK;
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
 
+void Node::_scheduleWhoisFlush(volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	// Held WHOIS requests go out from doTimerTasks(), so make sure it runs soon enough
+	const uint64_t wd = RR->sw->whoisFlushDeadline();
+	if ((wd)&&(wd < *nextBackgroundTaskDeadline))
+		*nextBackgroundTaskDeadline = wd;
+}
+
 // Closure used to ping upstream and active/online peers
 class _PingPeersThatNeedPing
 {
@@ -239,6 +274,9 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 			for(std::vector< SharedPtr<Network> >::const_iterator n(needConfig.begin());n!=needConfig.end();++n)
 				(*n)->requestConfiguration(tptr);
 
+			// HELLO peers restored from the last snapshot at their last known endpoints
+			RR->topology->contactRestoredPeers(tptr,now);
+
 			// Do pings and keepalives
 			Hashtable< Address,std::vector<InetAddress> > upstreamsToContact;
 			RR->topology->getUpstreamsToContact(upstreamsToContact);
@@ -264,10 +302,22 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 		timeUntilNextPingCheck -= (unsigned long)timeSinceLastPingCheck;
 	}
 
+	{	// Forget async gets that the host never answered
+		Mutex::Lock _l(_asyncGets_m);
+		Hashtable< uint64_t,_AsyncGet >::Iterator i(_asyncGets);
+		uint64_t *k = (uint64_t *)0;
+		_AsyncGet *g = (_AsyncGet *)0;
+		while (i.next(k,g)) {
+			if ((now - g->issued) >= ZT_DATASTORE_ASYNC_TIMEOUT)
+				_asyncGets.erase(*k);
+		}
+	}
+
 	if ((now - _lastHousekeepingRun) >= ZT_HOUSEKEEPING_PERIOD) {
 		try {
 			_lastHousekeepingRun = now;
 			RR->topology->clean(now);
+			RR->topology->savePeerSnapshot(tptr,now);
 			RR->sa->clean(now);
 			RR->mc->clean(now);
 		} catch ( ... ) {
@@ -295,6 +345,28 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,uint64_t now,volatile uint
 	return ZT_RESULT_OK;
 }
 
+ZT_ResultCode Node::dataStoreGetResult(void *tptr,uint64_t now,uint64_t requestId,const void *data,long len,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+
+	std::string name;
+	{
+		Mutex::Lock _l(_asyncGets_m);
+		const _AsyncGet *const g = _asyncGets.get(requestId);
+		if (!g)
+			return ZT_RESULT_OK;
+		name = g->name;
+		_asyncGets.erase(requestId);
+	}
+
+	if ((name.length() == (7 + ZT_ADDRESS_LENGTH_HEX))&&(!strncmp(name.c_str(),"iddb.d/",7))) {
+		const Address zta(Utils::hexStrToU64(name.c_str() + 7));
+		RR->topology->identityLookupComplete(tptr,zta,(len > 0) ? std::string((const char *)data,(unsigned long)len) : std::string());
+	}
+
+	return ZT_RESULT_OK;
+}
+
 ZT_ResultCode Node::join(uint64_t nwid,void *uptr,void *tptr)
 {
 	Mutex::Lock _l(_networks_m);
@@ -374,6 +446,37 @@ void Node::status(ZT_NodeStatus *status) const
 	status->online = _online ? 1 : 0;
 }
 
+void Node::metrics(ZT_Metrics *metrics) const
+{
+	RR->metrics->get(*metrics);
+	metrics->whoisQueueDepth = RR->sw->whoisQueueDepth();
+	metrics->rxQueueOccupancy = RR->sw->rxQueueOccupancy(_now);
+	metrics->rxQueueCapacity = ZT_RX_QUEUE_SIZE;
+}
+
+ZT_TraceEventList *Node::traceEvents() const
+{
+	return RR->trace->events();
+}
+
+void Node::setTraceSampleRate(unsigned int sampleRate)
+{
+	RR->trace->setSampleRate(sampleRate);
+}
+
+void Node::setMultipathMode(enum ZT_MultipathMode mode)
+{
+	switch(mode) {
+		case ZT_MULTIPATH_BALANCE:
+		case ZT_MULTIPATH_BALANCE_DUPLICATE_EF:
+			_multipathMode = mode;
+			break;
+		default:
+			_multipathMode = ZT_MULTIPATH_NONE;
+			break;
+	}
+}
+
 ZT_PeerList *Node::peers() const
 {
 	std::vector< std::pair< Address,SharedPtr<Peer> > > peers(RR->topology->allPeers());
@@ -412,6 +515,12 @@ ZT_PeerList *Node::peers() const
 			p->paths[p->pathCount].linkQuality = (int)(*path)->linkQuality();
 			p->paths[p->pathCount].expired = 0;
 			p->paths[p->pathCount].preferred = ((*path) == bestp) ? 1 : 0;
+			p->paths[p->pathCount].latency = (*path)->latency();
+			p->paths[p->pathCount].jitter = (*path)->jitter();
+			p->paths[p->pathCount].packetLoss = ((*path)->loss() * 1000) / ZT_PATH_LOSS_MAX;
+			p->paths[p->pathCount].txThroughput = (*path)->txThroughput(_now);
+			p->paths[p->pathCount].rxThroughput = (*path)->rxThroughput(_now);
+			p->paths[p->pathCount].mtu = (*path)->mtu();
 			++p->pathCount;
 		}
 	}
@@ -637,6 +746,26 @@ std::string Node::dataStoreGet(void *tPtr,const char *name)
 	return r;
 }
 
+bool Node::dataStoreGetAsync(void *tPtr,const char *name)
+{
+	if (!_cb.dataStoreGetAsyncFunction)
+		return false;
+	uint64_t requestId;
+	{
+		Mutex::Lock _l(_asyncGets_m);
+		requestId = ++_asyncGetCounter;
+		_AsyncGet &g = _asyncGets[requestId];
+		g.issued = _now;
+		g.name = name;
+	}
+	if (_cb.dataStoreGetAsyncFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,name,requestId) != 0) {
+		Mutex::Lock _l(_asyncGets_m);
+		_asyncGets.erase(requestId);
+		return false;
+	}
+	return true;
+}
+
 bool Node::shouldUsePathForZeroTierTraffic(void *tPtr,const Address &ztaddr,const InetAddress &localAddress,const InetAddress &remoteAddress)
 {
 	if (!Path::isAddressValidForPath(remoteAddress))
@@ -734,20 +863,37 @@ std::vector<World> Node::moons() const
 	return RR->topology->moons();
 }
 
-void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig)
+void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,unsigned int remoteConfigVersion)
 {
 	if (destination == RR->identity.address()) {
 		SharedPtr<Network> n(network(nwid));
 		if (!n) return;
 		n->setConfiguration((void *)0,nc,true);
 	} else {
-		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = (Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *)0;
+		Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *bconf = (Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *)0;
 		try {
-			if (nc.toDictionary(*dconf,sendLegacyFormatConfig)) {
+			// Newer nodes get the compact binary format, older ones a dictionary
+			const char *confData = (const char *)0;
+			unsigned int totalSize = 0;
+			if (remoteConfigVersion >= ZT_NETWORKCONFIG_VERSION_BINARY) {
+				bconf = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+				if (nc.toBinary(*bconf)) {
+					confData = reinterpret_cast<const char *>(bconf->data());
+					totalSize = bconf->size();
+				}
+			} else {
+				dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+				if (nc.toDictionary(*dconf,(remoteConfigVersion < 6))) {
+					confData = dconf->data();
+					totalSize = dconf->sizeBytes();
+				}
+			}
+
+			if (confData) {
 				uint64_t configUpdateId = prng();
 				if (!configUpdateId) ++configUpdateId;
 
-				const unsigned int totalSize = dconf->sizeBytes();
 				unsigned int chunkIndex = 0;
 				while (chunkIndex < totalSize) {
 					const unsigned int chunkLen = std::min(totalSize - chunkIndex,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - (ZT_PACKET_IDX_PAYLOAD + 256)));
@@ -760,7 +906,7 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 					const unsigned int sigStart = outp.size();
 					outp.append(nwid);
 					outp.append((uint16_t)chunkLen);
-					outp.append((const void *)(dconf->data() + chunkIndex),chunkLen);
+					outp.append((const void *)(confData + chunkIndex),chunkLen);
 
 					outp.append((uint8_t)0); // no flags
 					outp.append((uint64_t)configUpdateId);
@@ -778,8 +924,10 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 				}
 			}
 			delete dconf;
+			delete bconf;
 		} catch ( ... ) {
 			delete dconf;
+			delete bconf;
 			throw;
 		}
 	}
@@ -920,6 +1068,17 @@ enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void *tptr,uint6
 	}
 }
 
+enum ZT_ResultCode ZT_Node_dataStoreGetResult(ZT_Node *node,void *tptr,uint64_t now,uint64_t requestId,const void *data,long len,volatile uint64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->dataStoreGetResult(tptr,now,requestId,data,len,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
 enum ZT_ResultCode ZT_Node_join(ZT_Node *node,uint64_t nwid,void *uptr,void *tptr)
 {
 	try {
@@ -994,6 +1153,36 @@ void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status)
 	} catch ( ... ) {}
 }
 
+void ZT_Node_metrics(ZT_Node *node,ZT_Metrics *metrics)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->metrics(metrics);
+	} catch ( ... ) {}
+}
+
+ZT_TraceEventList *ZT_Node_traceEvents(ZT_Node *node)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->traceEvents();
+	} catch ( ... ) {
+		return (ZT_TraceEventList *)0;
+	}
+}
+
+void ZT_Node_setTraceSampleRate(ZT_Node *node,unsigned int sampleRate)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setTraceSampleRate(sampleRate);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setMultipathMode(ZT_Node *node,enum ZT_MultipathMode mode)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setMultipathMode(mode);
+	} catch ( ... ) {}
+}
+
 ZT_PeerList *ZT_Node_peers(ZT_Node *node)
 {
 	try {
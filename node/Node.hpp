@@ -25,6 +25,7 @@
 
 #include <map>
 #include <vector>
+#include <string>
 
 #include "Constants.hpp"
 
@@ -36,6 +37,7 @@
 #include "MAC.hpp"
 #include "Network.hpp"
 #include "Path.hpp"
+#include "Hashtable.hpp"
 #include "Salsa20.hpp"
 #include "NetworkController.hpp"
 
@@ -93,6 +95,7 @@ public:
 		unsigned int frameLength,
 		volatile uint64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processBackgroundTasks(void *tptr,uint64_t now,volatile uint64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode dataStoreGetResult(void *tptr,uint64_t now,uint64_t requestId,const void *data,long len,volatile uint64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode join(uint64_t nwid,void *uptr,void *tptr);
 	ZT_ResultCode leave(uint64_t nwid,void **uptr,void *tptr);
 	ZT_ResultCode multicastSubscribe(void *tptr,uint64_t nwid,uint64_t multicastGroup,unsigned long multicastAdi);
@@ -101,6 +104,10 @@ public:
 	ZT_ResultCode deorbit(void *tptr,uint64_t moonWorldId);
 	uint64_t address() const;
 	void status(ZT_NodeStatus *status) const;
+	void metrics(ZT_Metrics *metrics) const;
+	ZT_TraceEventList *traceEvents() const;
+	void setTraceSampleRate(unsigned int sampleRate);
+	void setMultipathMode(enum ZT_MultipathMode mode);
 	ZT_PeerList *peers() const;
 	ZT_VirtualNetworkConfig *networkConfig(uint64_t nwid) const;
 	ZT_VirtualNetworkList *networks() const;
@@ -131,9 +138,12 @@ public:
 
 	inline uint64_t now() const throw() { return _now; }
 
-	inline bool putPacket(void *tPtr,const InetAddress &localAddress,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl = 0)
+	inline bool putPacket(void *tPtr,const InetAddress &localAddress,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl = 0,bool dontFragment = false)
 	{
-		return (_cb.wirePacketSendFunction(
+		const ZT_WirePacketSendFunction f = (dontFragment) ? _cb.wirePacketSendDontFragmentFunction : _cb.wirePacketSendFunction;
+		if (!f)
+			return false;
+		return (f(
 			reinterpret_cast<ZT_Node *>(this),
 			_uPtr,
 			tPtr,
@@ -144,6 +154,11 @@ public:
 			ttl) == 0);
 	}
 
+	/**
+	 * @return True if the host can send with don't fragment set, which path MTU discovery needs
+	 */
+	inline bool canSendDontFragment() const { return (_cb.wirePacketSendDontFragmentFunction != 0); }
+
 	inline void putFrame(void *tPtr,uint64_t nwid,void **nuptr,const MAC &source,const MAC &dest,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
 		_cb.virtualNetworkFrameFunction(
@@ -197,12 +212,31 @@ public:
 	inline void dataStoreDelete(void *tPtr,const char *name) { _cb.dataStorePutFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,name,(const void *)0,0,0); }
 	std::string dataStoreGet(void *tPtr,const char *name);
 
+	/**
+	 * Start an asynchronous get if the host supports it
+	 *
+	 * The result is delivered via dataStoreGetResult(). Only names that
+	 * dataStoreGetResult() knows how to route should be requested here.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param name Object name
+	 * @return True if request was accepted, false if caller should use dataStoreGet()
+	 */
+	bool dataStoreGetAsync(void *tPtr,const char *name);
+
+	/**
+	 * @return True if host has an asynchronous data store get function
+	 */
+	inline bool hasAsyncDataStore() const { return (_cb.dataStoreGetAsyncFunction != (ZT_DataStoreGetAsyncFunction)0); }
+
 	inline void postEvent(void *tPtr,ZT_Event ev,const void *md = (const void *)0) { _cb.eventCallback(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,ev,md); }
 
 	inline int configureVirtualNetworkPort(void *tPtr,uint64_t nwid,void **nuptr,ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nc) { return _cb.virtualNetworkConfigFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,nwid,nuptr,op,nc); }
 
 	inline bool online() const throw() { return _online; }
 
+	inline enum ZT_MultipathMode multipathMode() const throw() { return _multipathMode; }
+
 #ifdef ZT_TRACE
 	void postTrace(const char *module,unsigned int line,const char *fmt,...);
 #endif
@@ -271,11 +305,13 @@ public:
 		return false;
 	}
 
-	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig);
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,unsigned int remoteConfigVersion);
 	virtual void ncSendRevocation(const Address &destination,const Revocation &rev);
 	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode);
 
 private:
+	void _scheduleWhoisFlush(volatile uint64_t *nextBackgroundTaskDeadline);
+
 	inline SharedPtr<Network> _network(uint64_t nwid) const
 	{
 		// assumes _networks_m is locked
@@ -307,12 +343,24 @@ private:
 	std::vector<InetAddress> _directPaths;
 	Mutex _directPaths_m;
 
+	// Outstanding asynchronous data store gets by request ID
+	struct _AsyncGet
+	{
+		_AsyncGet() : issued(0) {}
+		uint64_t issued;
+		std::string name;
+	};
+	Hashtable< uint64_t,_AsyncGet > _asyncGets;
+	uint64_t _asyncGetCounter;
+	Mutex _asyncGets_m;
+
 	Mutex _backgroundTasksLock;
 
 	uint64_t _now;
 	uint64_t _lastPingCheck;
 	uint64_t _lastHousekeepingRun;
 	volatile uint64_t _prngState[2];
+	volatile enum ZT_MultipathMode _multipathMode;
 	bool _online;
 };
 
@@ -328,6 +328,8 @@
 #define ZT_PROTO_VERB_HELLO__OK__IDX_MINOR_VERSION (ZT_PROTO_VERB_HELLO__OK__IDX_MAJOR_VERSION + 1)
 #define ZT_PROTO_VERB_HELLO__OK__IDX_REVISION (ZT_PROTO_VERB_HELLO__OK__IDX_MINOR_VERSION + 1)
 
+#define ZT_PROTO_VERB_ECHO__OK__IDX_PAYLOAD (ZT_PROTO_VERB_OK_IDX_PAYLOAD)
+
 #define ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY (ZT_PROTO_VERB_OK_IDX_PAYLOAD)
 
 #define ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST__OK__IDX_NETWORK_ID (ZT_PROTO_VERB_OK_IDX_PAYLOAD)
@@ -706,6 +708,9 @@ public:
 		 * This generates OK with a copy of the transmitted payload. No ERROR
 		 * is generated. Response to ECHO requests is optional and ECHO may be
 		 * ignored if a node detects a possible flood.
+		 *
+		 * Nodes send their current time as the payload of keepalive ECHOs so
+		 * they can measure latency from the OK.
 		 */
 		VERB_ECHO = 0x08,
 
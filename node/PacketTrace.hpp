@@ -0,0 +1,207 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_PACKETTRACE_HPP
+#define ZT_PACKETTRACE_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "Constants.hpp"
+#include "NonCopyable.hpp"
+#include "Metrics.hpp"
+
+#include "../include/ZeroTierOne.h"
+
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
+/**
+ * Number of events held in the trace ring (must be a power of two)
+ */
+#define ZT_PACKET_TRACE_RING_SIZE 4096
+
+namespace ZeroTier {
+
+/**
+ * Always-on binary trace of packet processing stages
+ *
+ * Events go into a fixed size ring. Writers claim a slot with one 32-bit
+ * atomic increment, of which only the low bits pick the slot, and never
+ * block; readers copy the ring and discard slots that were overwritten while
+ * being read. Packets are sampled by packet ID (with the send counter bits
+ * masked off) so that a sampled packet is recorded at every stage it passes
+ * through on this node.
+ */
+class PacketTrace : NonCopyable
+{
+public:
+	PacketTrace() :
+		_head(0),
+		_sampleRate(0)
+	{
+		memset(_ring,0,sizeof(_ring));
+		setSampleRate(ZT_TRACE_DEFAULT_SAMPLE_RATE);
+	}
+
+	/**
+	 * @param rate Trace one in this many packets (rounded up to a power of two), 0 to disable
+	 */
+	inline void setSampleRate(unsigned int rate)
+	{
+		uint32_t r = 0;
+		if (rate) {
+			r = 1;
+			while ((r < (uint32_t)rate)&&(r < 0x80000000UL))
+				r <<= 1;
+		}
+		_sampleRate = r;
+	}
+
+	/**
+	 * @return Current sample rate or 0 if disabled
+	 */
+	inline unsigned int sampleRate() const { return (unsigned int)_sampleRate; }
+
+	/**
+	 * @return True if tracing is enabled at all
+	 */
+	inline bool enabled() const { return (_sampleRate != 0); }
+
+	/**
+	 * @param packetId Packet ID
+	 * @return True if this packet should be traced
+	 */
+	inline bool sampled(const uint64_t packetId) const
+	{
+		const uint32_t r = _sampleRate;
+		return ((r)&&(((packetId >> 3) & (uint64_t)(r - 1)) == 0));
+	}
+
+	/**
+	 * Record an event if this packet is sampled
+	 *
+	 * @param packetId Packet ID
+	 * @param stage Stage (ZT_TraceStage)
+	 * @param arg Stage-specific argument
+	 */
+	inline void event(const uint64_t packetId,const enum ZT_TraceStage stage,const unsigned int arg)
+	{
+		if (sampled(packetId))
+			record(packetId,stage,arg,Metrics::ticks());
+	}
+
+	/**
+	 * Record an event unconditionally
+	 *
+	 * @param packetId Packet ID
+	 * @param stage Stage (ZT_TraceStage)
+	 * @param arg Stage-specific argument
+	 * @param ts Timestamp from Metrics::ticks()
+	 */
+	inline void record(const uint64_t packetId,const enum ZT_TraceStage stage,const unsigned int arg,const uint64_t ts)
+	{
+#ifdef __GNUC__
+		const uint32_t n = __sync_fetch_and_add(&_head,1);
+#else
+		const uint32_t n = _head++;
+#endif
+		_E &e = _ring[(unsigned long)(n & (ZT_PACKET_TRACE_RING_SIZE - 1))];
+		e.seq = 0;
+		_barrier();
+		e.packetId = packetId & 0xfffffffffffffff8ULL;
+		e.timestamp = ts;
+		e.stage = (uint32_t)stage;
+		e.arg = (uint32_t)arg;
+		_barrier();
+		e.seq = n + 1;
+	}
+
+	/**
+	 * Copy the ring into a newly allocated event list (free with ::free())
+	 *
+	 * @return Event list sorted by timestamp or NULL on allocation failure
+	 */
+	inline ZT_TraceEventList *events() const
+	{
+		char *const buf = (char *)::malloc(sizeof(ZT_TraceEventList) + (sizeof(ZT_TraceEvent) * ZT_PACKET_TRACE_RING_SIZE));
+		if (!buf)
+			return (ZT_TraceEventList *)0;
+		ZT_TraceEventList *const el = (ZT_TraceEventList *)buf;
+		el->sampleRate = sampleRate();
+		el->totalEvents = _head;
+		el->events = (ZT_TraceEvent *)(buf + sizeof(ZT_TraceEventList));
+		el->eventCount = 0;
+		for(unsigned long i=0;i<ZT_PACKET_TRACE_RING_SIZE;++i) {
+			const volatile _E &e = _ring[i];
+			const uint32_t s1 = e.seq;
+			_barrier();
+			ZT_TraceEvent &o = el->events[el->eventCount];
+			o.packetId = e.packetId;
+			o.timestamp = e.timestamp;
+			o.stage = e.stage;
+			o.arg = e.arg;
+			_barrier();
+			if ((s1)&&(s1 == e.seq))
+				++el->eventCount;
+		}
+		std::sort(el->events,el->events + el->eventCount,_EventTimestampLess());
+		return el;
+	}
+
+private:
+	struct _E
+	{
+		uint32_t seq; // 0 while being written, else (claim counter + 1), 32 bits so it can't tear
+		uint32_t reserved;
+		uint64_t packetId;
+		uint64_t timestamp;
+		uint32_t stage;
+		uint32_t arg;
+	};
+
+	struct _EventTimestampLess
+	{
+		inline bool operator()(const ZT_TraceEvent &a,const ZT_TraceEvent &b) const { return (a.timestamp < b.timestamp); }
+	};
+
+	static inline void _barrier()
+	{
+#ifdef __GNUC__
+		__sync_synchronize();
+#else
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+	}
+
+#ifdef __GNUC__
+	volatile uint32_t _head;
+#else
+	std::atomic<uint32_t> _head;
+#endif
+	volatile uint32_t _sampleRate;
+	_E _ring[ZT_PACKET_TRACE_RING_SIZE];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -26,6 +26,7 @@ bool Path::send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigne
 {
 	if (RR->node->putPacket(tPtr,_localAddress,address(),data,len)) {
 		_lastOut = now;
+		_meter(now,len,_txMeterStart,_txMeterBytes,_txThroughput);
 		return true;
 	}
 	return false;
@@ -28,6 +28,7 @@
 
 #include "Constants.hpp"
 #include "InetAddress.hpp"
+#include "Packet.hpp"
 #include "SharedPtr.hpp"
 #include "AtomicCounter.hpp"
 #include "NonCopyable.hpp"
@@ -38,6 +39,19 @@
  */
 #define ZT_PATH_MAX_PREFERENCE_RANK ((ZT_INETADDRESS_MAX_SCOPE << 1) | 1)
 
+/**
+ * Largest path MTU probe
+ *
+ * Probes are ECHOs, and the OK that answers one carries its payload back
+ * after a 9 byte in-re header, so a probe must leave that much room in a
+ * packet or the reply can't be built.
+ */
+#if ZT_UDP_MAX_PAYLOAD_MTU < (ZT_PROTO_MAX_PACKET_LENGTH - (ZT_PROTO_VERB_OK_IDX_PAYLOAD - ZT_PACKET_IDX_PAYLOAD))
+#define ZT_PATH_MTU_PROBE_MAX ZT_UDP_MAX_PAYLOAD_MTU
+#else
+#define ZT_PATH_MTU_PROBE_MAX (ZT_PROTO_MAX_PACKET_LENGTH - (ZT_PROTO_VERB_OK_IDX_PAYLOAD - ZT_PACKET_IDX_PAYLOAD))
+#endif
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -112,6 +126,26 @@ public:
 		_incomingLinkQualitySlowLogCounter(-64), // discard first fast log
 		_incomingLinkQualityPreviousPacketCounter(0),
 		_outgoingPacketCounter(0),
+		_lastProbe(0),
+		_rtt(0),
+		_rttVar(0),
+		_loss(0),
+		_rttKnown(false),
+		_probeOutstanding(false),
+		_lastMtuProbe(0),
+		_lastMtuSearch(0),
+		_mtuProbeId(0),
+		_mtu(ZT_UDP_DEFAULT_PAYLOAD_MTU),
+		_mtuCeiling(ZT_PATH_MTU_PROBE_MAX + 1),
+		_mtuProbeSize(0),
+		_mtuProbeFailures(0),
+		_mtuVerify(false),
+		_txMeterStart(0),
+		_txMeterBytes(0),
+		_txThroughput(0),
+		_rxMeterStart(0),
+		_rxMeterBytes(0),
+		_rxThroughput(0),
 		_addr(),
 		_localAddress(),
 		_ipScope(InetAddress::IP_SCOPE_NONE)
@@ -129,6 +163,26 @@ public:
 		_incomingLinkQualitySlowLogCounter(-64), // discard first fast log
 		_incomingLinkQualityPreviousPacketCounter(0),
 		_outgoingPacketCounter(0),
+		_lastProbe(0),
+		_rtt(0),
+		_rttVar(0),
+		_loss(0),
+		_rttKnown(false),
+		_probeOutstanding(false),
+		_lastMtuProbe(0),
+		_lastMtuSearch(0),
+		_mtuProbeId(0),
+		_mtu(ZT_UDP_DEFAULT_PAYLOAD_MTU),
+		_mtuCeiling(ZT_PATH_MTU_PROBE_MAX + 1),
+		_mtuProbeSize(0),
+		_mtuProbeFailures(0),
+		_mtuVerify(false),
+		_txMeterStart(0),
+		_txMeterBytes(0),
+		_txThroughput(0),
+		_rxMeterStart(0),
+		_rxMeterBytes(0),
+		_rxThroughput(0),
 		_addr(addr),
 		_localAddress(localAddress),
 		_ipScope(addr.ipScope())
@@ -141,8 +195,193 @@ public:
 	 * Called when a packet is received from this remote path, regardless of content
 	 *
 	 * @param t Time of receive
+	 * @param len Size of packet in bytes
+	 */
+	inline void received(const uint64_t t,const unsigned int len)
+	{
+		_lastIn = t;
+		_meter(t,len,_rxMeterStart,_rxMeterBytes,_rxThroughput);
+	}
+
+	/**
+	 * Called when a probe (ECHO or HELLO) is sent over this path
+	 *
+	 * If the previous probe was never answered it counts as lost.
+	 *
+	 * @param now Current time
+	 */
+	inline void probeSent(const uint64_t now)
+	{
+		if (_probeOutstanding)
+			_loss = _loss - (_loss >> ZT_PATH_EWMA_SHIFT) + (ZT_PATH_LOSS_MAX >> ZT_PATH_EWMA_SHIFT);
+		_probeOutstanding = true;
+		_lastProbe = now;
+	}
+
+	/**
+	 * Called when a reply to a probe is received over this path
+	 *
+	 * Smoothed RTT and RTT variation are kept as in TCP (RFC 6298), in
+	 * fixed point with 4 fractional bits.
+	 *
+	 * @param rtt Measured round trip time in milliseconds
+	 */
+	inline void probeAnswered(const unsigned int rtt)
+	{
+		const unsigned int r = std::min(rtt,(unsigned int)ZT_GENERAL_RTT_LIMIT) << 4;
+		if (_rttKnown) {
+			const unsigned int ortt = _rtt;
+			_rttVar = ((_rttVar * 3) + ((r > ortt) ? (r - ortt) : (ortt - r))) / 4;
+			_rtt = ((ortt * 7) + r) / 8;
+		} else {
+			_rtt = r;
+			_rttVar = r / 2;
+			_rttKnown = true;
+		}
+		if (_probeOutstanding) {
+			_probeOutstanding = false;
+			_loss = _loss - (_loss >> ZT_PATH_EWMA_SHIFT);
+		}
+	}
+
+	/**
+	 * @return True if a probe should be sent to keep RTT and loss estimates fresh
+	 */
+	inline bool needsProbe(const uint64_t now) const { return ((now - _lastProbe) >= ZT_PATH_HEARTBEAT_PERIOD); }
+
+	/**
+	 * @return Time of last probe
+	 */
+	inline uint64_t lastProbe() const { return _lastProbe; }
+
+	/**
+	 * @return True if at least one probe has been answered, i.e. latency() and jitter() are meaningful
+	 */
+	inline bool latencyKnown() const { return _rttKnown; }
+
+	/**
+	 * @return Smoothed round trip time in milliseconds or 0 if unknown
+	 */
+	inline unsigned int latency() const { return ((_rtt + 8) >> 4); }
+
+	/**
+	 * @return Smoothed round trip time variation in milliseconds
+	 */
+	inline unsigned int jitter() const { return ((_rttVar + 8) >> 4); }
+
+	/**
+	 * @return Estimated fraction of probes lost, 0 to ZT_PATH_LOSS_MAX
+	 */
+	inline unsigned int loss() const { return _loss; }
+
+	/**
+	 * Cost of sending over this path, lower is better
+	 *
+	 * This is smoothed RTT plus twice its variation, inflated by up to 5x
+	 * at 100% loss. Paths without a latency estimate yet are assumed to
+	 * have ZT_PATH_UNKNOWN_LATENCY.
+	 *
+	 * @return Cost in milliseconds
+	 */
+	inline unsigned int cost() const
+	{
+		const unsigned int c = (_rttKnown) ? (((_rtt + (_rttVar * 2)) >> 4) + 1) : ZT_PATH_UNKNOWN_LATENCY;
+		return (unsigned int)(((uint64_t)c * (uint64_t)(ZT_PATH_LOSS_MAX + (_loss * 4))) / (uint64_t)ZT_PATH_LOSS_MAX);
+	}
+
+	/**
+	 * @return Largest UDP payload known to reach the other side unfragmented
+	 */
+	inline unsigned int mtu() const { return _mtu; }
+
+	/**
+	 * Get the size of the next path MTU probe to send, if any
+	 *
+	 * This runs a binary search between the largest size known to work and
+	 * the smallest size known (or assumed) not to. It starts by trying
+	 * ZT_PATH_MTU_PROBE_MAX since jumbo frame paths are the ones worth
+	 * finding. A size is given up on after ZT_PATH_MTU_PROBE_TRIES probes
+	 * go unanswered. Every ZT_PATH_MTU_RESEARCH_INTERVAL the current MTU is
+	 * re-checked, falling back to the default if it no longer works (e.g.
+	 * after a route change), and the search for a larger one starts over.
+	 *
+	 * @param now Current time
+	 * @return Total packet size to probe with or 0 if no probe is needed now
+	 */
+	inline unsigned int nextMtuProbe(const uint64_t now)
+	{
+		if ((now - _lastMtuProbe) < ZT_PATH_MTU_PROBE_INTERVAL)
+			return 0;
+
+		if (_mtuProbeId) { // last probe was never answered
+			_mtuProbeId = 0;
+			if (++_mtuProbeFailures >= ZT_PATH_MTU_PROBE_TRIES) {
+				_mtuProbeFailures = 0;
+				if (_mtuVerify) {
+					_mtuVerify = false;
+					_mtu = ZT_UDP_DEFAULT_PAYLOAD_MTU;
+				} else {
+					_mtuCeiling = _mtuProbeSize;
+				}
+			}
+		}
+
+		if ((now - _lastMtuSearch) >= ZT_PATH_MTU_RESEARCH_INTERVAL) {
+			_lastMtuSearch = now;
+			_mtuCeiling = ZT_PATH_MTU_PROBE_MAX + 1;
+			_mtuProbeFailures = 0;
+			_mtuVerify = (_mtu > ZT_UDP_DEFAULT_PAYLOAD_MTU);
+		}
+
+		unsigned int s;
+		if (_mtuVerify)
+			s = _mtu;
+		else if ((_mtuCeiling > ZT_PATH_MTU_PROBE_MAX)&&(_mtu < ZT_PATH_MTU_PROBE_MAX))
+			s = ZT_PATH_MTU_PROBE_MAX;
+		else if ((_mtuCeiling - _mtu) > ZT_PATH_MTU_PROBE_GRANULARITY)
+			s = (_mtu + _mtuCeiling) / 2;
+		else return 0;
+
+		_mtuProbeSize = s;
+		_lastMtuProbe = now;
+		return s;
+	}
+
+	/**
+	 * @param packetId ID of path MTU probe just sent (after armor())
+	 */
+	inline void mtuProbeSent(const uint64_t packetId) { _mtuProbeId = packetId; }
+
+	/**
+	 * Check a reply against the outstanding path MTU probe
+	 *
+	 * @param inRePacketId Packet ID the reply is in reference to
+	 * @return True if this was a reply to our path MTU probe
+	 */
+	inline bool mtuProbeAnswered(const uint64_t inRePacketId)
+	{
+		if ((!_mtuProbeId)||(inRePacketId != _mtuProbeId))
+			return false;
+		_mtuProbeId = 0;
+		_mtuProbeFailures = 0;
+		if (_mtuVerify)
+			_mtuVerify = false;
+		else if (_mtuProbeSize > _mtu)
+			_mtu = _mtuProbeSize;
+		return true;
+	}
+
+	/**
+	 * @param now Current time
+	 * @return Bytes per second sent over the last full measurement interval
 	 */
-	inline void received(const uint64_t t) { _lastIn = t; }
+	inline uint64_t txThroughput(const uint64_t now) const { return ((now - _txMeterStart) < (ZT_PATH_THROUGHPUT_INTERVAL * 2)) ? _txThroughput : 0; }
+
+	/**
+	 * @param now Current time
+	 * @return Bytes per second received over the last full measurement interval
+	 */
+	inline uint64_t rxThroughput(const uint64_t now) const { return ((now - _rxMeterStart) < (ZT_PATH_THROUGHPUT_INTERVAL * 2)) ? _rxThroughput : 0; }
 
 	/**
 	 * Update link quality using a counter from an incoming packet (or packet head in fragmented case)
@@ -299,6 +538,19 @@ public:
 	inline unsigned int nextOutgoingCounter() { return _outgoingPacketCounter++; }
 
 private:
+	static inline void _meter(const uint64_t now,const unsigned int len,volatile uint64_t &start,volatile uint64_t &bytes,volatile uint64_t &throughput)
+	{
+		const uint64_t elapsed = now - start;
+		if (elapsed >= ZT_PATH_THROUGHPUT_INTERVAL) {
+			// An idle gap longer than one interval means nothing was moving
+			throughput = (elapsed < (ZT_PATH_THROUGHPUT_INTERVAL * 2)) ? ((bytes * 1000) / elapsed) : 0;
+			start = now;
+			bytes = len;
+		} else {
+			bytes += len;
+		}
+	}
+
 	volatile uint64_t _lastOut;
 	volatile uint64_t _lastIn;
 	volatile uint64_t _lastTrustEstablishedPacketReceived;
@@ -307,6 +559,26 @@ private:
 	volatile signed int _incomingLinkQualitySlowLogCounter;
 	volatile unsigned int _incomingLinkQualityPreviousPacketCounter;
 	volatile unsigned int _outgoingPacketCounter;
+	volatile uint64_t _lastProbe;
+	volatile unsigned int _rtt; // ms << 4
+	volatile unsigned int _rttVar; // ms << 4
+	volatile unsigned int _loss; // 0 to ZT_PATH_LOSS_MAX
+	volatile bool _rttKnown;
+	volatile bool _probeOutstanding;
+	volatile uint64_t _lastMtuProbe;
+	volatile uint64_t _lastMtuSearch;
+	volatile uint64_t _mtuProbeId; // 0 if no probe outstanding
+	volatile unsigned int _mtu; // largest size known to work
+	volatile unsigned int _mtuCeiling; // smallest size known or assumed not to work
+	volatile unsigned int _mtuProbeSize;
+	volatile unsigned int _mtuProbeFailures;
+	volatile bool _mtuVerify; // true if re-checking _mtu rather than searching
+	volatile uint64_t _txMeterStart;
+	volatile uint64_t _txMeterBytes;
+	volatile uint64_t _txThroughput;
+	volatile uint64_t _rxMeterStart;
+	volatile uint64_t _rxMeterBytes;
+	volatile uint64_t _rxThroughput;
 	InetAddress _addr;
 	InetAddress _localAddress;
 	InetAddress::IpScope _ipScope; // memoize this since it's a computed value checked often
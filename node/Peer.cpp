@@ -29,7 +29,7 @@
 
 namespace ZeroTier {
 
-Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity) :
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity,const void *key) :
 	RR(renv),
 	_lastReceive(0),
 	_lastNontrivialReceive(0),
@@ -47,12 +47,15 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 	_vMajor(0),
 	_vMinor(0),
 	_vRevision(0),
+	_currentBestPath(-1),
 	_id(peerIdentity),
 	_latency(0),
 	_directPathPushCutoffCount(0),
 	_credentialsCutoffCount(0)
 {
-	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
+	if (key)
+		memcpy(_key,key,ZT_PEER_SECRET_KEY_LENGTH);
+	else if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
 		throw std::runtime_error("new peer identity key agreement failed");
 }
 
@@ -138,51 +141,29 @@ void Peer::received(
 		bool pathAlreadyKnown = false;
 		{
 			Mutex::Lock _l(_paths_m);
-			if ((path->address().ss_family == AF_INET)&&(_v4Path.p)) {
-				const struct sockaddr_in *const r = reinterpret_cast<const struct sockaddr_in *>(&(path->address()));
-				const struct sockaddr_in *const l = reinterpret_cast<const struct sockaddr_in *>(&(_v4Path.p->address()));
-				const struct sockaddr_in *const rl = reinterpret_cast<const struct sockaddr_in *>(&(path->localAddress()));
-				const struct sockaddr_in *const ll = reinterpret_cast<const struct sockaddr_in *>(&(_v4Path.p->localAddress()));
-				if ((r->sin_addr.s_addr == l->sin_addr.s_addr)&&(r->sin_port == l->sin_port)&&(rl->sin_addr.s_addr == ll->sin_addr.s_addr)&&(rl->sin_port == ll->sin_port)) {
-					_v4Path.lr = now;
+			for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+				if (_paths[i].p == path) { // paths are canonicalized by Topology::getPath()
+					_paths[i].lr = now;
 #ifdef ZT_ENABLE_CLUSTER
-					_v4Path.localClusterSuboptimal = isClusterSuboptimalPath;
-#endif
-					pathAlreadyKnown = true;
-				}
-			} else if ((path->address().ss_family == AF_INET6)&&(_v6Path.p)) {
-				const struct sockaddr_in6 *const r = reinterpret_cast<const struct sockaddr_in6 *>(&(path->address()));
-				const struct sockaddr_in6 *const l = reinterpret_cast<const struct sockaddr_in6 *>(&(_v6Path.p->address()));
-				const struct sockaddr_in6 *const rl = reinterpret_cast<const struct sockaddr_in6 *>(&(path->localAddress()));
-				const struct sockaddr_in6 *const ll = reinterpret_cast<const struct sockaddr_in6 *>(&(_v6Path.p->localAddress()));
-				if ((!memcmp(r->sin6_addr.s6_addr,l->sin6_addr.s6_addr,16))&&(r->sin6_port == l->sin6_port)&&(!memcmp(rl->sin6_addr.s6_addr,ll->sin6_addr.s6_addr,16))&&(rl->sin6_port == ll->sin6_port)) {
-					_v6Path.lr = now;
-#ifdef ZT_ENABLE_CLUSTER
-					_v6Path.localClusterSuboptimal = isClusterSuboptimalPath;
+					_paths[i].localClusterSuboptimal = isClusterSuboptimalPath;
 #endif
 					pathAlreadyKnown = true;
+					break;
 				}
 			}
 		}
 
 		if ( (!pathAlreadyKnown) && (RR->node->shouldUsePathForZeroTierTraffic(tPtr,_id.address(),path->localAddress(),path->address())) ) {
 			Mutex::Lock _l(_paths_m);
-			_PeerPath *potentialNewPeerPath = (_PeerPath *)0;
-			if (path->address().ss_family == AF_INET) {
-				if ( (!_v4Path.p) || (!_v4Path.p->alive(now)) || ((_v4Path.p->address() != _v4ClusterPreferred)&&(path->preferenceRank() >= _v4Path.p->preferenceRank())) ) {
-					potentialNewPeerPath = &_v4Path;
-				}
-			} else if (path->address().ss_family == AF_INET6) {
-				if ( (!_v6Path.p) || (!_v6Path.p->alive(now)) || ((_v6Path.p->address() != _v6ClusterPreferred)&&(path->preferenceRank() >= _v6Path.p->preferenceRank())) ) {
-					potentialNewPeerPath = &_v6Path;
-				}
-			}
-			if (potentialNewPeerPath) {
+			const long slot = _newPathSlot(now,*path);
+			if (slot >= 0) {
 				if (verb == Packet::VERB_OK) {
-					potentialNewPeerPath->lr = now;
-					potentialNewPeerPath->p = path;
+					_paths[slot].lr = now;
+					_paths[slot].p = path;
+					if (slot == _currentBestPath)
+						_currentBestPath = -1;
 #ifdef ZT_ENABLE_CLUSTER
-					potentialNewPeerPath->localClusterSuboptimal = isClusterSuboptimalPath;
+					_paths[slot].localClusterSuboptimal = isClusterSuboptimalPath;
 					if (RR->cluster)
 						RR->cluster->broadcastHavePeer(_id);
 #endif
@@ -275,46 +256,25 @@ void Peer::received(
 bool Peer::sendDirect(void *tPtr,const void *data,unsigned int len,uint64_t now,bool force)
 {
 	Mutex::Lock _l(_paths_m);
-
-	uint64_t v6lr = 0;
-	if ( ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v6Path.p) )
-		v6lr = _v6Path.p->lastIn();
-	uint64_t v4lr = 0;
-	if ( ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v4Path.p) )
-		v4lr = _v4Path.p->lastIn();
-
-	if ( (v6lr > v4lr) && ((now - v6lr) < ZT_PATH_ALIVE_TIMEOUT) ) {
-		return _v6Path.p->send(RR,tPtr,data,len,now);
-	} else if ((now - v4lr) < ZT_PATH_ALIVE_TIMEOUT) {
-		return _v4Path.p->send(RR,tPtr,data,len,now);
-	} else if (force) {
-		if (v6lr > v4lr) {
-			return _v6Path.p->send(RR,tPtr,data,len,now);
-		} else if (v4lr) {
-			return _v4Path.p->send(RR,tPtr,data,len,now);
-		}
-	}
-
+	const long bp = _bestPath(now,false,-1);
+	_currentBestPath = bp;
+	if ( (bp >= 0) && ((force)||(_paths[bp].p->alive(now))) )
+		return _paths[bp].p->send(RR,tPtr,data,len,now);
 	return false;
 }
 
-SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired)
+SharedPtr<Path> Peer::getBestPath(uint64_t now,bool includeExpired,uint32_t flowId)
 {
 	Mutex::Lock _l(_paths_m);
-
-	uint64_t v6lr = 0;
-	if ( ( includeExpired || ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) ) && (_v6Path.p) )
-		v6lr = _v6Path.p->lastIn();
-	uint64_t v4lr = 0;
-	if ( ( includeExpired || ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) ) && (_v4Path.p) )
-		v4lr = _v4Path.p->lastIn();
-
-	if (v6lr > v4lr) {
-		return _v6Path.p;
-	} else if (v4lr) {
-		return _v4Path.p;
+	if ((flowId != ZT_FLOW_ID_NONE)&&(flowId != ZT_FLOW_ID_ALL_PATHS)&&(RR->node->multipathMode() != ZT_MULTIPATH_NONE)) {
+		const long fp = _flowPath(now,flowId);
+		if (fp >= 0)
+			return _paths[fp].p;
 	}
-
+	const long bp = _bestPath(now,includeExpired,-1);
+	_currentBestPath = bp;
+	if (bp >= 0)
+		return _paths[bp].p;
 	return SharedPtr<Path>();
 }
 
@@ -370,6 +330,7 @@ void Peer::attemptToContactAt(void *tPtr,const InetAddress &localAddr,const Inet
 {
 	if ( (!sendFullHello) && (_vProto >= 5) && (!((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0))) ) {
 		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+		outp.append(now); // echoed back in OK(ECHO) to measure latency over this path
 		RR->node->expectReplyTo(outp.packetId());
 		outp.armor(_key,true,counter);
 		RR->node->putPacket(tPtr,localAddr,atAddress,outp.data(),outp.size());
@@ -392,44 +353,150 @@ bool Peer::doPingAndKeepalive(void *tPtr,uint64_t now,int inetAddressFamily)
 {
 	Mutex::Lock _l(_paths_m);
 
-	if (inetAddressFamily < 0) {
-		uint64_t v6lr = 0;
-		if ( ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v6Path.p) )
-			v6lr = _v6Path.p->lastIn();
-		uint64_t v4lr = 0;
-		if ( ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) && (_v4Path.p) )
-			v4lr = _v4Path.p->lastIn();
-
-		if (v6lr > v4lr) {
-			if ( ((now - _v6Path.lr) >= ZT_PEER_PING_PERIOD) || (_v6Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v6Path.p->localAddress(),_v6Path.p->address(),now,false,_v6Path.p->nextOutgoingCounter());
-				_v6Path.p->sent(now);
-				return true;
+	// Pings double as probes that keep each path's RTT and loss estimates
+	// fresh, so every path is pinged at least every ZT_PATH_HEARTBEAT_PERIOD
+	// and not only when idle. Only one path is pinged per call, the one that
+	// has waited longest, since peers rate limit ECHO.
+	long pi = -1;
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		const _PeerPath &pp = _paths[i];
+		if ( (pp.p) && ((now - pp.lr) < ZT_PEER_PATH_EXPIRATION) && ((inetAddressFamily < 0)||(pp.p->address().ss_family == inetAddressFamily)) ) {
+			if ( ((now - pp.lr) >= ZT_PEER_PING_PERIOD) || (pp.p->needsHeartbeat(now)) || (pp.p->needsProbe(now)) ) {
+				if ((pi < 0)||(pp.p->lastProbe() < _paths[pi].p->lastProbe()))
+					pi = (long)i;
 			}
-		} else if (v4lr) {
-			if ( ((now - _v4Path.lr) >= ZT_PEER_PING_PERIOD) || (_v4Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v4Path.p->localAddress(),_v4Path.p->address(),now,false,_v4Path.p->nextOutgoingCounter());
-				_v4Path.p->sent(now);
-				return true;
+		}
+	}
+
+	if (pi >= 0) {
+		attemptToContactAt(tPtr,_paths[pi].p->localAddress(),_paths[pi].p->address(),now,false,_paths[pi].p->nextOutgoingCounter());
+		_paths[pi].p->sent(now);
+		_paths[pi].p->probeSent(now);
+		return true;
+	}
+
+	// If no ping went out this time, use the chance to probe a live path's
+	// MTU. This is a padded ECHO sent with don't fragment set. It's only done
+	// here since the peer rate limits ECHO and would drop one of two.
+	if ( (inetAddressFamily < 0) && (RR->node->canSendDontFragment()) && (_vProto >= 5) && (!((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0))) ) {
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			const SharedPtr<Path> &p = _paths[i].p;
+			if ( (p) && ((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION) && (p->alive(now)) ) {
+				const unsigned int probeSize = p->nextMtuProbe(now);
+				if (probeSize) {
+					Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+					outp.append(now);
+					outp.zeroUnused();
+					outp.setSize(probeSize);
+					RR->node->expectReplyTo(outp.packetId());
+					outp.armor(_key,true,p->nextOutgoingCounter());
+					p->mtuProbeSent(outp.packetId());
+					if (RR->node->putPacket(tPtr,p->localAddress(),p->address(),outp.data(),outp.size(),0,true))
+						p->sent(now);
+					break;
+				}
 			}
 		}
-	} else {
-		if ( (inetAddressFamily == AF_INET) && ((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION) ) {
-			if ( ((now - _v4Path.lr) >= ZT_PEER_PING_PERIOD) || (_v4Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v4Path.p->localAddress(),_v4Path.p->address(),now,false,_v4Path.p->nextOutgoingCounter());
-				_v4Path.p->sent(now);
-				return true;
+	}
+
+	return false;
+}
+
+long Peer::_bestPath(const uint64_t now,const bool includeExpired,const int inetAddressFamily) const
+{
+	// Prefer live paths, then lower cost (RTT, jitter, and loss), then higher
+	// preference rank (scope, then IPv6 over IPv4). Costs within a tolerance
+	// of each other count as equal, and the current best path is kept until
+	// another live path is cheaper by more than that tolerance, so similar
+	// paths don't flap. Among dead paths prefer the one we heard from most
+	// recently.
+	long best = -1;
+	bool bestAlive = false;
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		const _PeerPath &pp = _paths[i];
+		if ( (pp.p) && ((includeExpired)||((now - pp.lr) < ZT_PEER_PATH_EXPIRATION)) && ((inetAddressFamily < 0)||(pp.p->address().ss_family == inetAddressFamily)) ) {
+			const bool alive = pp.p->alive(now);
+			if (best >= 0) {
+				const Path &bp = *(_paths[best].p);
+				if (alive != bestAlive) {
+					if (!alive)
+						continue;
+				} else if (alive) {
+					const unsigned int c = pp.p->cost();
+					const unsigned int bc = bp.cost();
+					if (best == _currentBestPath) {
+						if ((c + (c >> ZT_PATH_COST_TOLERANCE_SHIFT)) >= bc)
+							continue;
+					} else if ((long)i == _currentBestPath) {
+						if ((bc + (bc >> ZT_PATH_COST_TOLERANCE_SHIFT)) < c)
+							continue;
+					} else if ((c + (c >> ZT_PATH_COST_TOLERANCE_SHIFT)) >= bc) {
+						if ((bc + (bc >> ZT_PATH_COST_TOLERANCE_SHIFT)) < c)
+							continue;
+						if (pp.p->preferenceRank() <= bp.preferenceRank())
+							continue;
+					}
+				} else if (pp.p->lastIn() <= bp.lastIn()) {
+					continue;
+				}
 			}
-		} else if ( (inetAddressFamily == AF_INET6) && ((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION) ) {
-			if ( ((now - _v6Path.lr) >= ZT_PEER_PING_PERIOD) || (_v6Path.p->needsHeartbeat(now)) ) {
-				attemptToContactAt(tPtr,_v6Path.p->localAddress(),_v6Path.p->address(),now,false,_v6Path.p->nextOutgoingCounter());
-				_v6Path.p->sent(now);
-				return true;
+			best = (long)i;
+			bestAlive = alive;
+		}
+	}
+	return best;
+}
+
+long Peer::_flowPath(const uint64_t now,const uint32_t flowId) const
+{
+	// Weighted rendezvous hashing: each live path scores the flow with a hash
+	// of the flow and path scaled by path quality, and the highest score wins.
+	// A flow only moves if its path dies or path qualities shift a lot, and
+	// when a path dies only the flows that were on it move.
+	long best = -1;
+	uint64_t bestScore = 0;
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		const _PeerPath &pp = _paths[i];
+		if ( (pp.p) && ((now - pp.lr) < ZT_PEER_PATH_EXPIRATION) && (pp.p->alive(now)) ) {
+			uint64_t h = (uint64_t)flowId ^ (uint64_t)((uintptr_t)pp.p.ptr());
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+
+			// Weight is inversely proportional to path cost (RTT, jitter, and loss)
+			const uint64_t w = 1048576ULL / ((uint64_t)pp.p->cost() + 20);
+
+			const uint64_t score = (h >> 32) * (w + 1);
+			if ((best < 0)||(score > bestScore)) {
+				best = (long)i;
+				bestScore = score;
 			}
 		}
 	}
+	return best;
+}
 
-	return false;
+long Peer::_newPathSlot(const uint64_t now,const Path &path) const
+{
+	// Use an empty slot or replace an expired or dead path or one to the same
+	// remote IP from the same local address (e.g. after a NAT remapped our
+	// port). Failing that, replace the lowest ranked path if the new one ranks
+	// at least as high, unless it's the path our cluster told us to use.
+	long worst = -1;
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		const _PeerPath &pp = _paths[i];
+		if ( (!pp.p) || ((now - pp.lr) >= ZT_PEER_PATH_EXPIRATION) || (!pp.p->alive(now)) || ((pp.p->address().ipsEqual(path.address()))&&(pp.p->localAddress() == path.localAddress())) )
+			return (long)i;
+		if ( (pp.p->address() != _v4ClusterPreferred) && (pp.p->address() != _v6ClusterPreferred) ) {
+			if ((worst < 0)||(pp.p->preferenceRank() < _paths[worst].p->preferenceRank())||((pp.p->preferenceRank() == _paths[worst].p->preferenceRank())&&(pp.p->lastIn() < _paths[worst].p->lastIn())))
+				worst = (long)i;
+		}
+	}
+	if ((worst >= 0)&&(path.preferenceRank() >= _paths[worst].p->preferenceRank()))
+		return worst;
+	return -1;
 }
 
 } // namespace ZeroTier
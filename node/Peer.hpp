@@ -64,9 +64,10 @@ public:
 	 * @param renv Runtime environment
 	 * @param myIdentity Identity of THIS node (for key agreement)
 	 * @param peerIdentity Identity of peer
+	 * @param key Previously agreed key to use instead of doing key agreement or NULL (default) to agree
 	 * @throws std::runtime_error Key agreement with peer's identity failed
 	 */
-	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity);
+	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity,const void *key = (const void *)0);
 
 	/**
 	 * @return This peer's ZT address (short for identity().address())
@@ -111,7 +112,11 @@ public:
 	inline bool hasActivePathTo(uint64_t now,const InetAddress &addr) const
 	{
 		Mutex::Lock _l(_paths_m);
-		return ( ((addr.ss_family == AF_INET)&&(_v4Path.p)&&(_v4Path.p->address() == addr)&&(_v4Path.p->alive(now))) || ((addr.ss_family == AF_INET6)&&(_v6Path.p)&&(_v6Path.p->address() == addr)&&(_v6Path.p->alive(now))) );
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			if ((_paths[i].p)&&(_paths[i].p->address() == addr)&&(_paths[i].p->alive(now)))
+				return true;
+		}
+		return false;
 	}
 
 	/**
@@ -129,14 +134,20 @@ public:
 	/**
 	 * Get the best current direct path
 	 *
-	 * This does not check Path::alive(), but does return the most recently
-	 * active path and does check expiration (which is a longer timeout).
+	 * This does not check Path::alive(), but does prefer live paths and
+	 * does check expiration (which is a longer timeout). Among live paths
+	 * the one with the lowest cost (see Path::cost()) wins.
+	 *
+	 * If multipath is enabled and a flow ID is given, the flow is hashed
+	 * onto one of the live paths instead, so different flows may use
+	 * different paths but each flow sticks to one.
 	 *
 	 * @param now Current time
 	 * @param includeExpired If true, include even expired paths
+	 * @param flowId Flow ID or ZT_FLOW_ID_NONE to always get the best path
 	 * @return Best current path or NULL if none
 	 */
-	SharedPtr<Path> getBestPath(uint64_t now,bool includeExpired);
+	SharedPtr<Path> getBestPath(uint64_t now,bool includeExpired,uint32_t flowId = ZT_FLOW_ID_NONE);
 
 	/**
 	 * Send a HELLO to this peer at a specified physical address
@@ -199,14 +210,12 @@ public:
 	inline void resetWithinScope(void *tPtr,InetAddress::IpScope scope,int inetAddressFamily,uint64_t now)
 	{
 		Mutex::Lock _l(_paths_m);
-		if ((inetAddressFamily == AF_INET)&&(_v4Path.lr)&&(_v4Path.p->address().ipScope() == scope)) {
-			attemptToContactAt(tPtr,_v4Path.p->localAddress(),_v4Path.p->address(),now,false,_v4Path.p->nextOutgoingCounter());
-			_v4Path.p->sent(now);
-			_v4Path.lr = 0; // path will not be used unless it speaks again
-		} else if ((inetAddressFamily == AF_INET6)&&(_v6Path.lr)&&(_v6Path.p->address().ipScope() == scope)) {
-			attemptToContactAt(tPtr,_v6Path.p->localAddress(),_v6Path.p->address(),now,false,_v6Path.p->nextOutgoingCounter());
-			_v6Path.p->sent(now);
-			_v6Path.lr = 0; // path will not be used unless it speaks again
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			if ((_paths[i].lr)&&(_paths[i].p->address().ss_family == inetAddressFamily)&&(_paths[i].p->address().ipScope() == scope)) {
+				attemptToContactAt(tPtr,_paths[i].p->localAddress(),_paths[i].p->address(),now,false,_paths[i].p->nextOutgoingCounter());
+				_paths[i].p->sent(now);
+				_paths[i].lr = 0; // path will not be used unless it speaks again
+			}
 		}
 	}
 
@@ -233,24 +242,26 @@ public:
 	inline void getRendezvousAddresses(uint64_t now,InetAddress &v4,InetAddress &v6) const
 	{
 		Mutex::Lock _l(_paths_m);
-		if (((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v4Path.p->alive(now)))
-			v4 = _v4Path.p->address();
-		if (((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v6Path.p->alive(now)))
-			v6 = _v6Path.p->address();
+		const long v4i = _bestPath(now,false,AF_INET);
+		if ((v4i >= 0)&&(_paths[v4i].p->alive(now)))
+			v4 = _paths[v4i].p->address();
+		const long v6i = _bestPath(now,false,AF_INET6);
+		if ((v6i >= 0)&&(_paths[v6i].p->alive(now)))
+			v6 = _paths[v6i].p->address();
 	}
 
 	/**
 	 * @param now Current time
-	 * @return All known paths to this peer
+	 * @return All known live paths to this peer
 	 */
 	inline std::vector< SharedPtr<Path> > paths(const uint64_t now) const
 	{
 		std::vector< SharedPtr<Path> > pp;
 		Mutex::Lock _l(_paths_m);
-		if (((now - _v4Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v4Path.p->alive(now)))
-			pp.push_back(_v4Path.p);
-		if (((now - _v6Path.lr) < ZT_PEER_PATH_EXPIRATION)&&(_v6Path.p->alive(now)))
-			pp.push_back(_v6Path.p);
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			if ((_paths[i].p)&&((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION)&&(_paths[i].p->alive(now)))
+				pp.push_back(_paths[i].p);
+		}
 		return pp;
 	}
 
@@ -317,7 +328,11 @@ public:
 	inline bool hasLocalClusterOptimalPath(uint64_t now) const
 	{
 		Mutex::Lock _l(_paths_m);
-		return ( ((_v4Path.p)&&(_v4Path.p->alive(now))&&(!_v4Path.localClusterSuboptimal)) || ((_v6Path.p)&&(_v6Path.p->alive(now))&&(!_v6Path.localClusterSuboptimal)) );
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			if ((_paths[i].p)&&(_paths[i].p->alive(now))&&(!_paths[i].localClusterSuboptimal))
+				return true;
+		}
+		return false;
 	}
 #endif
 
@@ -349,6 +364,69 @@ public:
 
 	inline bool remoteVersionKnown() const { return ((_vMajor > 0)||(_vMinor > 0)||(_vRevision > 0)); }
 
+	/**
+	 * Serialize this peer for a snapshot (see Topology::savePeerSnapshot())
+	 *
+	 * This includes the secret key, so the result must only go to secure storage.
+	 *
+	 * @param b Buffer to append to
+	 * @param now Current time
+	 * @return Number of direct endpoints included
+	 * @throws std::out_of_range Buffer too small
+	 */
+	template<unsigned int C>
+	inline unsigned int serializeForSnapshot(Buffer<C> &b,const uint64_t now) const
+	{
+		_id.serialize(b,false);
+		b.append(_key,ZT_PEER_SECRET_KEY_LENGTH);
+		b.append((uint16_t)_vProto);
+		b.append((uint16_t)_vMajor);
+		b.append((uint16_t)_vMinor);
+		b.append((uint16_t)_vRevision);
+		const std::vector< SharedPtr<Path> > pp(paths(now));
+		b.append((uint8_t)pp.size());
+		for(std::vector< SharedPtr<Path> >::const_iterator p(pp.begin());p!=pp.end();++p)
+			(*p)->address().serialize(b);
+		return (unsigned int)pp.size();
+	}
+
+	/**
+	 * Re-create a peer from a snapshot record
+	 *
+	 * @param renv Runtime environment
+	 * @param b Buffer containing record written by serializeForSnapshot()
+	 * @param endpoints Vector to receive the peer's last known direct endpoints
+	 * @return Peer or NULL if record is invalid or not for a peer of ours
+	 */
+	template<unsigned int C>
+	static inline SharedPtr<Peer> deserializeFromSnapshot(const RuntimeEnvironment *renv,const Buffer<C> &b,std::vector<InetAddress> &endpoints)
+	{
+		try {
+			unsigned int ptr = 0;
+			Identity id;
+			ptr += id.deserialize(b,ptr);
+			if ((!id)||(id.address().isReserved()))
+				return SharedPtr<Peer>();
+			SharedPtr<Peer> p(new Peer(renv,renv->identity,id,b.field(ptr,ZT_PEER_SECRET_KEY_LENGTH)));
+			ptr += ZT_PEER_SECRET_KEY_LENGTH;
+			const unsigned int vproto = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vmaj = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vmin = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vrev = b.template at<uint16_t>(ptr); ptr += 2;
+			p->setRemoteVersion(vproto,vmaj,vmin,vrev);
+			const unsigned int pc = (unsigned int)b[ptr++];
+			for(unsigned int i=0;i<pc;++i) {
+				InetAddress a;
+				ptr += a.deserialize(b,ptr);
+				if (a)
+					endpoints.push_back(a);
+			}
+			return p;
+		} catch ( ... ) {
+			return SharedPtr<Peer>();
+		}
+	}
+
 	/**
 	 * @return True if peer has received a trust established packet (e.g. common network membership) in the past ZT_TRUST_EXPIRATION ms
 	 */
@@ -453,6 +531,11 @@ private:
 #endif
 	};
 
+	// These all assume _paths_m is locked and return an index in _paths[] or -1
+	long _bestPath(const uint64_t now,const bool includeExpired,const int inetAddressFamily) const;
+	long _flowPath(const uint64_t now,const uint32_t flowId) const;
+	long _newPathSlot(const uint64_t now,const Path &path) const;
+
 	uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
 
 	const RuntimeEnvironment *RR;
@@ -478,9 +561,9 @@ private:
 	InetAddress _v4ClusterPreferred;
 	InetAddress _v6ClusterPreferred;
 
-	_PeerPath _v4Path; // IPv4 direct path
-	_PeerPath _v6Path; // IPv6 direct path
+	_PeerPath _paths[ZT_MAX_PEER_NETWORK_PATHS]; // direct paths, in no particular order
 	Mutex _paths_m;
+	long _currentBestPath; // index in _paths[] of the last path chosen as best or -1, sticks until clearly beaten
 
 	Identity _id;
 
@@ -22,10 +22,11 @@
 #include "Topology.hpp"
 #include "Switch.hpp"
 #include "Network.hpp"
+#include "CredentialCache.hpp"
 
 namespace ZeroTier {
 
-int Revocation::verify(const RuntimeEnvironment *RR,void *tPtr) const
+int Revocation::verify(const RuntimeEnvironment *RR,void *tPtr,CredentialBatch *batch) const
 {
 	if ((!_signedBy)||(_signedBy != Network::controllerFor(_networkId)))
 		return -1;
@@ -37,7 +38,7 @@ int Revocation::verify(const RuntimeEnvironment *RR,void *tPtr) const
 	try {
 		Buffer<sizeof(Revocation) + 64> tmp;
 		this->serialize(tmp,true);
-		return (id.verify(tmp.data(),tmp.size(),_signature) ? 0 : -1);
+		return (RR->credentialCache->verify(id,tmp.data(),tmp.size(),_signature,batch) ? 0 : -1);
 	} catch ( ... ) {
 		return -1;
 	}
@@ -41,6 +41,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class CredentialBatch;
 
 /**
  * Revocation certificate to instantaneously revoke a COM, capability, or tag
@@ -105,9 +106,10 @@ public:
 	 *
 	 * @param RR Runtime environment to provide for peer lookup, etc.
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL queue signatures here to be checked later instead of checking them now
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or chain
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,CredentialBatch *batch = (CredentialBatch *)0) const;
 
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
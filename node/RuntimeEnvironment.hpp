@@ -35,6 +35,9 @@ class Multicaster;
 class NetworkController;
 class SelfAwareness;
 class Cluster;
+class Metrics;
+class PacketTrace;
+class CredentialCache;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
@@ -46,6 +49,9 @@ public:
 		node(n)
 		,identity()
 		,localNetworkController((NetworkController *)0)
+		,metrics((Metrics *)0)
+		,trace((PacketTrace *)0)
+		,credentialCache((CredentialCache *)0)
 		,sw((Switch *)0)
 		,mc((Multicaster *)0)
 		,topology((Topology *)0)
@@ -75,6 +81,9 @@ public:
 	 * These are constant and never null after startup unless indicated.
 	 */
 
+	Metrics *metrics;
+	PacketTrace *trace;
+	CredentialCache *credentialCache;
 	Switch *sw;
 	Multicaster *mc;
 	Topology *topology;
@@ -36,6 +36,8 @@
 #include "SelfAwareness.hpp"
 #include "Packet.hpp"
 #include "Cluster.hpp"
+#include "Metrics.hpp"
+#include "PacketTrace.hpp"
 
 namespace ZeroTier {
 
@@ -56,12 +58,54 @@ static const char *etherTypeName(const unsigned int etherType)
 }
 #endif // ZT_TRACE
 
+uint32_t Switch::ipFlowId(const unsigned int etherType,const uint8_t *const data,const unsigned int len,const bool duplicateEf)
+{
+	const uint8_t *addrs;
+	unsigned int addrsLen,proto,l4;
+	bool fragment;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		if (((data[1] >> 2) == 46)&&(duplicateEf))
+			return ZT_FLOW_ID_ALL_PATHS;
+		addrs = data + 12;
+		addrsLen = 8;
+		proto = data[9];
+		l4 = (data[0] & 0x0f) * 4;
+		fragment = (((data[6] & 0x3f) != 0)||(data[7] != 0)); // MF or fragment offset
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		if (((((((unsigned int)data[0] & 0x0f) << 4) | ((unsigned int)data[1] >> 4)) >> 2) == 46)&&(duplicateEf))
+			return ZT_FLOW_ID_ALL_PATHS;
+		addrs = data + 8;
+		addrsLen = 32;
+		proto = data[6]; // extension headers are not followed, such flows just hash without ports
+		l4 = 40;
+		fragment = false;
+	} else {
+		return ZT_FLOW_ID_NONE;
+	}
+
+	uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+	for(unsigned int i=0;i<addrsLen;++i)
+		h = (h ^ (uint64_t)addrs[i]) * 0x100000001b3ULL;
+	h = (h ^ (uint64_t)proto) * 0x100000001b3ULL;
+	if ( (!fragment) && ((proto == 6)||(proto == 17)||(proto == 132)) && ((l4 + 4) <= len) ) {
+		for(unsigned int i=0;i<4;++i)
+			h = (h ^ (uint64_t)data[l4 + i]) * 0x100000001b3ULL;
+	}
+
+	const uint32_t f = (uint32_t)(h ^ (h >> 32));
+	return ((f == ZT_FLOW_ID_NONE)||(f == ZT_FLOW_ID_ALL_PATHS)) ? 1 : f;
+}
+
 Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
 	_outstandingWhoisRequests(32),
+	_lastWhoisFlush(0),
+	_whoisHeld(0),
 	_lastUniteAttempt(8) // only really used on root servers and upstreams, and it'll grow there just fine
 {
+	for(unsigned int i=0;i<ZT_DUPLICATE_FRAME_FILTER_SIZE;++i)
+		_recentFrames[i] = 0;
 }
 
 void Switch::onRemotePacket(void *tPtr,const InetAddress &localAddr,const InetAddress &fromAddr,const void *data,unsigned int len)
@@ -70,7 +114,15 @@ void Switch::onRemotePacket(void *tPtr,const InetAddress &localAddr,const InetAd
 		const uint64_t now = RR->node->now();
 
 		SharedPtr<Path> path(RR->topology->getPath(localAddr,fromAddr));
-		path->received(now);
+		path->received(now,len);
+
+		if (len >= 8) { // packets and fragments both begin with the 64-bit packet ID
+			const uint8_t *const pid = reinterpret_cast<const uint8_t *>(data);
+			RR->trace->event(
+				(((uint64_t)pid[0]) << 56) | (((uint64_t)pid[1]) << 48) | (((uint64_t)pid[2]) << 40) | (((uint64_t)pid[3]) << 32) |
+				(((uint64_t)pid[4]) << 24) | (((uint64_t)pid[5]) << 16) | (((uint64_t)pid[6]) << 8) | ((uint64_t)pid[7]),
+				ZT_TRACE_STAGE_RX_WIRE,len);
+		}
 
 		if (len == 13) {
 			/* LEGACY: before VERB_PUSH_DIRECT_PATHS, peers used broadcast
@@ -112,6 +164,7 @@ void Switch::onRemotePacket(void *tPtr,const InetAddress &localAddr,const InetAd
 
 					if (fragment.hops() < ZT_RELAY_MAX_HOPS) {
 						fragment.incrementHops();
+						RR->metrics->relayed(fragment.size());
 
 						// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
 						// It wouldn't hurt anything, just redundant and unnecessary.
@@ -131,6 +184,7 @@ void Switch::onRemotePacket(void *tPtr,const InetAddress &localAddr,const InetAd
 						}
 					} else {
 						TRACE("dropped relay [fragment](%s) -> %s, max hops exceeded",fromAddr.toString().c_str(),destination.toString().c_str());
+						RR->metrics->drop(ZT_METRICS_DROP_MAX_HOPS);
 					}
 				} else {
 					// Fragment looks like ours
@@ -211,6 +265,7 @@ void Switch::onRemotePacket(void *tPtr,const InetAddress &localAddr,const InetAd
 #else
 						packet.incrementHops();
 #endif
+						RR->metrics->relayed(packet.size());
 
 						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
 						if ((relayTo)&&(relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,false))) {
@@ -282,6 +337,7 @@ void Switch::onRemotePacket(void *tPtr,const InetAddress &localAddr,const InetAd
 						}
 					} else {
 						TRACE("dropped relay %s(%s) -> %s, max hops exceeded",packet.source().toString().c_str(),fromAddr.toString().c_str(),destination.toString().c_str());
+						RR->metrics->drop(ZT_METRICS_DROP_MAX_HOPS);
 					}
 				} else if ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
 					// Packet is the head of a fragmented packet series
@@ -522,31 +578,32 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 		Address toZT(to.toAddress(network->id())); // since in-network MACs are derived from addresses and network IDs, we can reverse this
 		SharedPtr<Peer> toPeer(RR->topology->getPeer(tPtr,toZT));
 
+		// The packet ID that decides trace sampling doesn't exist yet, so take timestamps now and record them once it does
+		const uint64_t traceTapTime = (RR->trace->enabled()) ? Metrics::ticks() : 0;
+
 		if (!network->filterOutgoingPacket(tPtr,false,RR->identity.address(),toZT,from,to,(const uint8_t *)data,len,etherType,vlanId)) {
 			TRACE("%.16llx: %s -> %s %s packet not sent: filterOutgoingPacket() returned false",network->id(),from.toString().c_str(),to.toString().c_str(),etherTypeName(etherType));
 			return;
 		}
 
+		const uint64_t traceFilterTime = (traceTapTime) ? Metrics::ticks() : 0;
+
+		Packet outp(toZT,RR->identity.address(),(fromBridged) ? Packet::VERB_EXT_FRAME : Packet::VERB_FRAME);
+		outp.append(network->id());
 		if (fromBridged) {
-			Packet outp(toZT,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(network->id());
 			outp.append((unsigned char)0x00);
 			to.appendTo(outp);
 			from.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			send(tPtr,outp,true);
-		} else {
-			Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
-			outp.append(network->id());
-			outp.append((uint16_t)etherType);
-			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			send(tPtr,outp,true);
 		}
+		outp.append((uint16_t)etherType);
+		outp.append(data,len);
+		if ((traceTapTime)&&(RR->trace->sampled(outp.packetId()))) {
+			RR->trace->record(outp.packetId(),ZT_TRACE_STAGE_TX_TAP,len,traceTapTime);
+			RR->trace->record(outp.packetId(),ZT_TRACE_STAGE_TX_FILTERED,1,traceFilterTime);
+		}
+		if (!network->config().disableCompression())
+			outp.compress();
+		send(tPtr,outp,true,(RR->node->multipathMode() != ZT_MULTIPATH_NONE) ? ipFlowId(etherType,reinterpret_cast<const uint8_t *>(data),len,(RR->node->multipathMode() == ZT_MULTIPATH_BALANCE_DUPLICATE_EF)) : ZT_FLOW_ID_NONE);
 
 		//TRACE("%.16llx: UNICAST: %s -> %s etherType==%s(%.4x) vlanId==%u len==%u fromBridged==%d includeCom==%d",network->id(),from.toString().c_str(),to.toString().c_str(),etherTypeName(etherType),etherType,vlanId,len,(int)fromBridged,(int)includeCom);
 	} else {
@@ -592,6 +649,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			}
 		}
 
+		const uint32_t flowId = (RR->node->multipathMode() != ZT_MULTIPATH_NONE) ? ipFlowId(etherType,reinterpret_cast<const uint8_t *>(data),len,(RR->node->multipathMode() == ZT_MULTIPATH_BALANCE_DUPLICATE_EF)) : ZT_FLOW_ID_NONE;
 		for(unsigned int b=0;b<numBridges;++b) {
 			if (network->filterOutgoingPacket(tPtr,true,RR->identity.address(),bridges[b],from,to,(const uint8_t *)data,len,etherType,vlanId)) {
 				Packet outp(bridges[b],RR->identity.address(),Packet::VERB_EXT_FRAME);
@@ -603,7 +661,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				outp.append(data,len);
 				if (!network->config().disableCompression())
 					outp.compress();
-				send(tPtr,outp,true);
+				send(tPtr,outp,true,flowId);
 			} else {
 				TRACE("%.16llx: %s -> %s %s packet not sent: filterOutgoingPacket() returned false",network->id(),from.toString().c_str(),to.toString().c_str(),etherTypeName(etherType));
 			}
@@ -611,16 +669,16 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 	}
 }
 
-void Switch::send(void *tPtr,Packet &packet,bool encrypt)
+void Switch::send(void *tPtr,Packet &packet,bool encrypt,uint32_t flowId)
 {
 	if (packet.destination() == RR->identity.address()) {
 		TRACE("BUG: caught attempt to send() to self, ignored");
 		return;
 	}
 
-	if (!_trySend(tPtr,packet,encrypt)) {
+	if (!_trySend(tPtr,packet,encrypt,flowId)) {
 		Mutex::Lock _l(_txQueue_m);
-		_txQueue.push_back(TXQueueEntry(packet.destination(),RR->node->now(),packet,encrypt));
+		_txQueue.push_back(TXQueueEntry(packet.destination(),RR->node->now(),packet,encrypt,flowId));
 	}
 }
 
@@ -633,19 +691,53 @@ void Switch::requestWhois(void *tPtr,const Address &addr)
 	}
 #endif
 
-	bool inserted = false;
+	// If the identity is being loaded asynchronously from the data store,
+	// hold off on the network WHOIS. It goes out after the normal retry
+	// delay or as soon as the data store says it doesn't have it.
+	const bool deferred = RR->topology->identityLookupPending(addr);
+
+	const uint64_t now = RR->node->now();
+	bool flush = false;
 	{
 		Mutex::Lock _l(_outstandingWhoisRequests_m);
 		WhoisRequest &r = _outstandingWhoisRequests[addr];
 		if (r.lastSent) {
 			r.retries = 0; // reset retry count if entry already existed, but keep waiting and retry again after normal timeout
 		} else {
-			r.lastSent = RR->node->now();
-			inserted = true;
+			r.lastSent = now;
+			r.deferred = deferred;
+			if (!deferred) {
+				r.pending = true;
+				// Send right away unless a WHOIS just went out, in which case
+				// hold this one so a burst of lookups shares a few packets
+				if ((now - _lastWhoisFlush) >= ZT_WHOIS_COALESCE_DELAY)
+					flush = true;
+				else ++_whoisHeld;
+			}
+		}
+	}
+	if (flush)
+		_flushWhoisRequests(tPtr,now);
+}
+
+void Switch::identityLookupFailed(void *tPtr,const Address &addr)
+{
+	const uint64_t now = RR->node->now();
+	bool flush = false;
+	{
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		WhoisRequest *const r = _outstandingWhoisRequests.get(addr);
+		if ((r)&&(r->deferred)) {
+			r->lastSent = now;
+			r->deferred = false;
+			r->pending = true;
+			if ((now - _lastWhoisFlush) >= ZT_WHOIS_COALESCE_DELAY)
+				flush = true;
+			else ++_whoisHeld;
 		}
 	}
-	if (inserted)
-		_sendWhoisRequest(tPtr,addr,(const Address *)0,0);
+	if (flush)
+		_flushWhoisRequests(tPtr,now);
 }
 
 void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
@@ -671,7 +763,7 @@ void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
 		Mutex::Lock _l(_txQueue_m);
 		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
 			if (txi->dest == peer->address()) {
-				if (_trySend(tPtr,txi->packet,txi->encrypt))
+				if (_trySend(tPtr,txi->packet,txi->encrypt,txi->flowId))
 					_txQueue.erase(txi++);
 				else ++txi;
 			} else ++txi;
@@ -696,9 +788,10 @@ unsigned long Switch::doTimerTasks(void *tPtr,uint64_t now)
 					_outstandingWhoisRequests.erase(*a);
 				} else {
 					r->lastSent = now;
-					r->peersConsulted[r->retries] = _sendWhoisRequest(tPtr,*a,r->peersConsulted,(r->retries > 1) ? r->retries : 0);
-					TRACE("WHOIS %s (retry %u)",a->toString().c_str(),r->retries);
+					r->deferred = false;
+					r->pending = true;
 					++r->retries;
+					TRACE("WHOIS %s (retry %u)",a->toString().c_str(),r->retries);
 					nextDelay = std::min(nextDelay,(unsigned long)ZT_WHOIS_RETRY_DELAY);
 				}
 			} else {
@@ -707,10 +800,13 @@ unsigned long Switch::doTimerTasks(void *tPtr,uint64_t now)
 		}
 	}
 
+	// Send retries and anything held back for coalescing
+	_flushWhoisRequests(tPtr,now);
+
 	{	// Time out TX queue packets that never got WHOIS lookups or other info.
 		Mutex::Lock _l(_txQueue_m);
 		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (_trySend(tPtr,txi->packet,txi->encrypt))
+			if (_trySend(tPtr,txi->packet,txi->encrypt,txi->flowId))
 				_txQueue.erase(txi++);
 			else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
 				TRACE("TX %s -> %s timed out",txi->packet.source().toString().c_str(),txi->packet.destination().toString().c_str());
@@ -744,19 +840,69 @@ bool Switch::_shouldUnite(const uint64_t now,const Address &source,const Address
 	return false;
 }
 
-Address Switch::_sendWhoisRequest(void *tPtr,const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted)
+void Switch::_flushWhoisRequests(void *tPtr,const uint64_t now)
 {
-	SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer(peersAlreadyConsulted,numPeersAlreadyConsulted,false));
-	if (upstream) {
-		Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
-		addr.appendTo(outp);
-		RR->node->expectReplyTo(outp.packetId());
-		send(tPtr,outp,true);
+	std::vector< std::pair<Address,unsigned int> > due; // address, retries
+	{
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		Hashtable< Address,WhoisRequest >::Iterator i(_outstandingWhoisRequests);
+		Address *a = (Address *)0;
+		WhoisRequest *r = (WhoisRequest *)0;
+		while (i.next(a,r)) {
+			if (r->pending) {
+				r->pending = false;
+				r->lastSent = now;
+				due.push_back(std::pair<Address,unsigned int>(*a,r->retries));
+			}
+		}
+		_whoisHeld = 0;
+		if (due.empty())
+			return;
+		_lastWhoisFlush = now;
+	}
+
+	// Spread lookups across the upstreams we can reach, moving each address
+	// on to the next upstream with every retry
+	std::vector< SharedPtr<Peer> > upstreams;
+	{
+		const std::vector<Address> ua(RR->topology->upstreamAddresses());
+		for(std::vector<Address>::const_iterator u(ua.begin());u!=ua.end();++u) {
+			const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*u));
+			if ((p)&&(p->getBestPath(now,false)))
+				upstreams.push_back(p);
+		}
+	}
+	if (upstreams.empty()) {
+		const SharedPtr<Peer> p(RR->topology->getUpstreamPeer());
+		if (!p)
+			return;
+		upstreams.push_back(p);
+	}
+
+	for(unsigned long u=0;u<upstreams.size();++u) {
+		Packet outp(upstreams[u]->address(),RR->identity.address(),Packet::VERB_WHOIS);
+		unsigned int count = 0;
+		for(std::vector< std::pair<Address,unsigned int> >::const_iterator d(due.begin());d!=due.end();++d) {
+			if ((unsigned long)((d->first.toInt() + (uint64_t)d->second) % (uint64_t)upstreams.size()) != u)
+				continue;
+			d->first.appendTo(outp);
+			if (++count >= ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST) {
+				TRACE("WHOIS %u addresses via %s",count,upstreams[u]->address().toString().c_str());
+				RR->node->expectReplyTo(outp.packetId());
+				send(tPtr,outp,true);
+				outp.reset(upstreams[u]->address(),RR->identity.address(),Packet::VERB_WHOIS);
+				count = 0;
+			}
+		}
+		if (count) {
+			TRACE("WHOIS %u addresses via %s",count,upstreams[u]->address().toString().c_str());
+			RR->node->expectReplyTo(outp.packetId());
+			send(tPtr,outp,true);
+		}
 	}
-	return Address();
 }
 
-bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
+bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt,uint32_t flowId)
 {
 	SharedPtr<Path> viaPath;
 	const uint64_t now = RR->node->now();
@@ -779,7 +925,7 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 		 * to send heartbeats "down" and because we have to at least try to
 		 * go somewhere. */
 
-		viaPath = peer->getBestPath(now,false);
+		viaPath = peer->getBestPath(now,false,flowId);
 		if ( (viaPath) && (!viaPath->alive(now)) && (!RR->topology->isUpstream(peer->identity())) ) {
 #ifdef ZT_ENABLE_CLUSTER
 			if ((clusterMostRecentMemberId < 0)||(viaPath->lastIn() > clusterMostRecentTs)) {
@@ -825,7 +971,18 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 #endif
 	}
 
-	unsigned int chunkSize = std::min(packet.size(),(unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU);
+	if ( (flowId == ZT_FLOW_ID_ALL_PATHS) && (peer) && (viaPath) && (RR->node->multipathMode() == ZT_MULTIPATH_BALANCE_DUPLICATE_EF) ) {
+		// Latency-critical packet, also send a copy over every other live path
+		const std::vector< SharedPtr<Path> > others(peer->paths(now));
+		for(std::vector< SharedPtr<Path> >::const_iterator p(others.begin());p!=others.end();++p) {
+			if (*p != viaPath)
+				_sendCopy(tPtr,packet,encrypt,peer,*p,now);
+		}
+	}
+
+	// Fragment only as much as the path's discovered MTU requires
+	const unsigned int mtu = (viaPath) ? viaPath->mtu() : (unsigned int)ZT_UDP_DEFAULT_PAYLOAD_MTU;
+	unsigned int chunkSize = std::min(packet.size(),mtu);
 	packet.setFragmented(chunkSize < packet.size());
 
 #ifdef ZT_ENABLE_CLUSTER
@@ -844,6 +1001,10 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 	}
 #endif
 
+	const bool traced = RR->trace->sampled(packet.packetId());
+	if (traced)
+		RR->trace->record(packet.packetId(),ZT_TRACE_STAGE_TX_ARMORED,packet.size(),Metrics::ticks());
+
 #ifdef ZT_ENABLE_CLUSTER
 	if ( ((viaPath)&&(viaPath->send(RR,tPtr,packet.data(),chunkSize,now))) || ((clusterMostRecentMemberId >= 0)&&(RR->cluster->sendViaCluster(clusterMostRecentMemberId,destination,packet.data(),chunkSize))) ) {
 #else
@@ -853,13 +1014,13 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 			// Too big for one packet, fragment the rest
 			unsigned int fragStart = chunkSize;
 			unsigned int remaining = packet.size() - chunkSize;
-			unsigned int fragsRemaining = (remaining / (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
-			if ((fragsRemaining * (ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
+			unsigned int fragsRemaining = (remaining / (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+			if ((fragsRemaining * (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
 				++fragsRemaining;
 			const unsigned int totalFragments = fragsRemaining + 1;
 
 			for(unsigned int fno=1;fno<totalFragments;++fno) {
-				chunkSize = std::min(remaining,(unsigned int)(ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+				chunkSize = std::min(remaining,(unsigned int)(mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
 				Packet::Fragment frag(packet,fragStart,chunkSize,fno,totalFragments);
 #ifdef ZT_ENABLE_CLUSTER
 				if (viaPath)
@@ -873,9 +1034,47 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 				remaining -= chunkSize;
 			}
 		}
+
+		if (traced)
+			RR->trace->record(packet.packetId(),ZT_TRACE_STAGE_TX_WIRE,packet.size(),Metrics::ticks());
 	}
 
 	return true;
 }
 
+void Switch::_sendCopy(void *tPtr,const Packet &packet,bool encrypt,const SharedPtr<Peer> &peer,const SharedPtr<Path> &viaPath,uint64_t now)
+{
+	// Each copy is armored with its own path's counter so link quality
+	// measurement on every path stays accurate. The rest of the packet ID
+	// is the same, which is what lets the receiver drop extra copies.
+	Packet copy(packet);
+
+	const unsigned int mtu = viaPath->mtu();
+	unsigned int chunkSize = std::min(copy.size(),mtu);
+	copy.setFragmented(chunkSize < copy.size());
+
+	const uint64_t trustedPathId = RR->topology->getOutboundPathTrust(viaPath->address());
+	if (trustedPathId) {
+		copy.setTrusted(trustedPathId);
+	} else {
+		copy.armor(peer->key(),encrypt,viaPath->nextOutgoingCounter());
+	}
+
+	if ((viaPath->send(RR,tPtr,copy.data(),chunkSize,now))&&(chunkSize < copy.size())) {
+		unsigned int fragStart = chunkSize;
+		unsigned int remaining = copy.size() - chunkSize;
+		unsigned int fragsRemaining = (remaining / (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+		if ((fragsRemaining * (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
+			++fragsRemaining;
+		const unsigned int totalFragments = fragsRemaining + 1;
+		for(unsigned int fno=1;fno<totalFragments;++fno) {
+			chunkSize = std::min(remaining,(unsigned int)(mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+			Packet::Fragment frag(copy,fragStart,chunkSize,fno,totalFragments);
+			viaPath->send(RR,tPtr,frag.data(),frag.size(),now);
+			fragStart += chunkSize;
+			remaining -= chunkSize;
+		}
+	}
+}
+
 } // namespace ZeroTier
@@ -37,6 +37,16 @@
 #include "SharedPtr.hpp"
 #include "IncomingPacket.hpp"
 #include "Hashtable.hpp"
+#include "Identity.hpp"
+
+/**
+ * Maximum number of addresses in one outgoing WHOIS
+ *
+ * Older upstreams answer a WHOIS with one OK carrying every identity they
+ * know, so this is as many public identities as fit in one unfragmented
+ * OK(WHOIS).
+ */
+#define ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST ((ZT_UDP_DEFAULT_PAYLOAD_MTU - ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY) / (ZT_ADDRESS_LENGTH + 1 + ZT_C25519_PUBLIC_KEY_LEN + 1))
 
 namespace ZeroTier {
 
@@ -96,17 +106,30 @@ public:
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param packet Packet to send (buffer may be modified)
 	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 * @param flowId Flow ID for multipath path selection (default: not part of a flow)
 	 */
-	void send(void *tPtr,Packet &packet,bool encrypt);
+	void send(void *tPtr,Packet &packet,bool encrypt,uint32_t flowId = ZT_FLOW_ID_NONE);
 
 	/**
 	 * Request WHOIS on a given address
 	 *
+	 * Requests made soon after a WHOIS went out are held for up to
+	 * ZT_WHOIS_COALESCE_DELAY and then sent together, many addresses per
+	 * packet and spread across upstreams.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param addr Address to look up
 	 */
 	void requestWhois(void *tPtr,const Address &addr);
 
+	/**
+	 * Send a WHOIS held back by an asynchronous data store lookup that came up empty
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param addr Address that was not found in the data store
+	 */
+	void identityLookupFailed(void *tPtr,const Address &addr);
+
 	/**
 	 * Run any processes that are waiting for this peer's identity
 	 *
@@ -129,10 +152,89 @@ public:
 	 */
 	unsigned long doTimerTasks(void *tPtr,uint64_t now);
 
+	/**
+	 * Check whether a frame has already been received over another path
+	 *
+	 * Senders in multipath mode may send latency-critical frames over more
+	 * than one path. Copies share a packet ID except for the link quality
+	 * counter bits. This must only be called for authenticated packets.
+	 *
+	 * The filter holds a 32-bit tag per slot and takes no lock. Two threads
+	 * racing on one slot can only let a copy through, which is no worse than
+	 * the copy arriving after its slot was reused.
+	 *
+	 * @param source Packet source
+	 * @param packetId Packet ID
+	 * @return True if this frame was already seen and should be dropped
+	 */
+	inline bool duplicateFrame(const Address &source,const uint64_t packetId)
+	{
+		uint64_t k = (packetId & 0xfffffffffffffff8ULL) ^ source.toInt();
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		volatile uint32_t &slot = _recentFrames[(unsigned long)k & (ZT_DUPLICATE_FRAME_FILTER_SIZE - 1)];
+		const uint32_t tag = (uint32_t)(k >> 32) | 1; // never 0, which is an empty slot
+		if (slot == tag)
+			return true;
+		slot = tag;
+		return false;
+	}
+
+	/**
+	 * Flow ID of an IP packet for multipath path selection
+	 *
+	 * This is a hash of protocol, addresses, and (for unfragmented TCP, UDP,
+	 * and SCTP) ports, so every packet of a flow gets the same ID.
+	 *
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload
+	 * @param len Length of frame payload
+	 * @param duplicateEf If true, IP packets marked DSCP EF get ZT_FLOW_ID_ALL_PATHS
+	 * @return Flow ID or ZT_FLOW_ID_NONE if this is not an IP packet
+	 */
+	static uint32_t ipFlowId(const unsigned int etherType,const uint8_t *const data,const unsigned int len,const bool duplicateEf);
+
+	/**
+	 * @return Time by which held WHOIS requests should be sent by doTimerTasks(), or 0 if none are held
+	 */
+	inline uint64_t whoisFlushDeadline() const
+	{
+		if (!_whoisHeld) // checked without locking since this is called for every packet
+			return 0;
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		return (_whoisHeld) ? (_lastWhoisFlush + ZT_WHOIS_COALESCE_DELAY) : 0;
+	}
+
+	/**
+	 * @return Number of addresses with outstanding WHOIS requests
+	 */
+	inline unsigned int whoisQueueDepth() const
+	{
+		Mutex::Lock _l(_outstandingWhoisRequests_m);
+		return (unsigned int)_outstandingWhoisRequests.size();
+	}
+
+	/**
+	 * @param now Current time
+	 * @return Number of unexpired entries in the RX (reassembly / pending decode) queue
+	 */
+	inline unsigned int rxQueueOccupancy(const uint64_t now) const
+	{
+		unsigned int n = 0;
+		Mutex::Lock _l(_rxQueue_m);
+		for(unsigned long i=0;i<ZT_RX_QUEUE_SIZE;++i) {
+			if ((_rxQueue[i].timestamp)&&((now - _rxQueue[i].timestamp) < ZT_RX_QUEUE_EXPIRE))
+				++n;
+		}
+		return n;
+	}
+
 private:
 	bool _shouldUnite(const uint64_t now,const Address &source,const Address &destination);
-	Address _sendWhoisRequest(void *tPtr,const Address &addr,const Address *peersAlreadyConsulted,unsigned int numPeersAlreadyConsulted);
-	bool _trySend(void *tPtr,Packet &packet,bool encrypt); // packet is modified if return is true
+	void _flushWhoisRequests(void *tPtr,const uint64_t now);
+	bool _trySend(void *tPtr,Packet &packet,bool encrypt,uint32_t flowId); // packet is modified if return is true
+	void _sendCopy(void *tPtr,const Packet &packet,bool encrypt,const SharedPtr<Peer> &peer,const SharedPtr<Path> &viaPath,uint64_t now);
 
 	const RuntimeEnvironment *const RR;
 	uint64_t _lastBeaconResponse;
@@ -140,12 +242,15 @@ private:
 	// Outstanding WHOIS requests and how many retries they've undergone
 	struct WhoisRequest
 	{
-		WhoisRequest() : lastSent(0),retries(0) {}
+		WhoisRequest() : lastSent(0),retries(0),deferred(false),pending(false) {}
 		uint64_t lastSent;
-		Address peersConsulted[ZT_MAX_WHOIS_RETRIES]; // by retry
-		unsigned int retries; // 0..ZT_MAX_WHOIS_RETRIES
+		unsigned int retries; // 0..ZT_MAX_WHOIS_RETRIES, also picks which upstream to ask
+		bool deferred; // true if not sent yet because of a pending data store lookup
+		bool pending; // true if this should go out with the next batch
 	};
 	Hashtable< Address,WhoisRequest > _outstandingWhoisRequests;
+	uint64_t _lastWhoisFlush;
+	volatile unsigned int _whoisHeld; // requests held back waiting for ZT_WHOIS_COALESCE_DELAY
 	Mutex _outstandingWhoisRequests_m;
 
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
@@ -186,16 +291,18 @@ private:
 	struct TXQueueEntry
 	{
 		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc) :
+		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc,uint32_t fid) :
 			dest(d),
 			creationTime(ct),
 			packet(p),
-			encrypt(enc) {}
+			encrypt(enc),
+			flowId(fid) {}
 
 		Address dest;
 		uint64_t creationTime;
 		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
 		bool encrypt;
+		uint32_t flowId;
 	};
 	std::list< TXQueueEntry > _txQueue;
 	Mutex _txQueue_m;
@@ -220,6 +327,9 @@ private:
 	};
 	Hashtable< _LastUniteKey,uint64_t > _lastUniteAttempt; // key is always sorted in ascending order, for set-like behavior
 	Mutex _lastUniteAttempt_m;
+
+	// Tags of recently received frames by packet ID (sans counter) XOR source, for dropping multipath duplicates
+	volatile uint32_t _recentFrames[ZT_DUPLICATE_FRAME_FILTER_SIZE];
 };
 
 } // namespace ZeroTier
@@ -76,6 +76,8 @@ Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 		defaultPlanet.deserialize(wtmp,0); // throws on error, which would indicate a bad static variable up top
 	}
 	addWorld(tPtr,defaultPlanet,false);
+
+	_loadPeerSnapshot(tPtr);
 }
 
 SharedPtr<Peer> Topology::addPeer(void *tPtr,const SharedPtr<Peer> &peer)
@@ -156,6 +158,41 @@ void Topology::saveIdentity(void *tPtr,const Identity &id)
 	}
 }
 
+bool Topology::identityLookupPending(const Address &zta)
+{
+	Mutex::Lock _l(_identityLookups_m);
+	const uint64_t *const issued = _identityLookups.get(zta);
+	return ((issued)&&((RR->node->now() - *issued) < ZT_DATASTORE_ASYNC_TIMEOUT));
+}
+
+void Topology::identityLookupComplete(void *tPtr,const Address &zta,const std::string &ids)
+{
+	{
+		Mutex::Lock _l(_identityLookups_m);
+		_identityLookups.erase(zta);
+	}
+
+	if (ids.length() > 0) {
+		try {
+			const Identity id(ids);
+			if (id.address() == zta) {
+				SharedPtr<Peer> np(new Peer(RR,RR->identity,id));
+				{
+					Mutex::Lock _l(_peers_m);
+					SharedPtr<Peer> &ap = _peers[zta];
+					if (!ap)
+						ap.swap(np);
+					np = ap;
+				}
+				RR->sw->doAnythingWaitingForPeer(tPtr,np);
+				return;
+			}
+		} catch ( ... ) {} // invalid identity in data store?
+	}
+
+	RR->sw->identityLookupFailed(tPtr,zta);
+}
+
 SharedPtr<Peer> Topology::getUpstreamPeer(const Address *avoid,unsigned int avoidCount,bool strictAvoid)
 {
 	const uint64_t now = RR->node->now();
@@ -266,31 +303,82 @@ bool Topology::isProhibitedEndpoint(const Address &ztaddr,const InetAddress &ipa
 
 bool Topology::addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew)
 {
-	if ((newWorld.type() != World::TYPE_PLANET)&&(newWorld.type() != World::TYPE_MOON))
-		return false;
+	Mutex::Lock _l1(_upstreams_m);
+	Mutex::Lock _l2(_peers_m);
+	return _addWorld(tPtr,newWorld,alwaysAcceptNew,false);
+}
 
+unsigned int Topology::addWorlds(void *tPtr,const std::vector<World> &newWorlds)
+{
 	Mutex::Lock _l1(_upstreams_m);
 	Mutex::Lock _l2(_peers_m);
 
-	World *existing = (World *)0;
-	switch(newWorld.type()) {
+	std::vector< Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> > signedData;
+	std::vector<C25519::Public> keys;
+	std::vector<C25519::BatchEntry> batch;
+	std::vector<unsigned int> batchIdx;
+	for(unsigned int i=0;i<(unsigned int)newWorlds.size();++i) {
+		const World *const existing = _getWorld(newWorlds[i]);
+		if ((existing)&&(existing->id())&&(existing->isOlderVersionOf(newWorlds[i]))) {
+			signedData.push_back(Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH>());
+			newWorlds[i].serialize(signedData.back(),true);
+			keys.push_back(existing->updatesMustBeSignedBy());
+			batch.push_back(C25519::BatchEntry());
+			batch.back().signature = newWorlds[i].signature().data;
+			batchIdx.push_back(i);
+		}
+	}
+	if (!batch.empty()) {
+		for(unsigned int k=0;k<(unsigned int)batch.size();++k) {
+			batch[k].their = &(keys[k]);
+			batch[k].msg = signedData[k].data();
+			batch[k].len = signedData[k].size();
+		}
+		C25519::verifyBatch(&(batch[0]),(unsigned int)batch.size());
+	}
+
+	unsigned int added = 0;
+	for(unsigned int i=0,k=0;i<(unsigned int)newWorlds.size();++i) {
+		if ((k < (unsigned int)batchIdx.size())&&(batchIdx[k] == i)) {
+			if (batch[k].valid) {
+				// The result only holds if an earlier world in this set didn't change the update key
+				const World *const existing = _getWorld(newWorlds[i]);
+				if (_addWorld(tPtr,newWorlds[i],false,((existing)&&(existing->updatesMustBeSignedBy() == keys[k]))))
+					++added;
+			}
+			++k;
+		} else if (_addWorld(tPtr,newWorlds[i],false,false)) {
+			++added;
+		}
+	}
+	return added;
+}
+
+World *Topology::_getWorld(const World &w)
+{
+	switch(w.type()) {
 		case World::TYPE_PLANET:
-			existing = &_planet;
-			break;
+			return &_planet;
 		case World::TYPE_MOON:
 			for(std::vector< World >::iterator m(_moons.begin());m!=_moons.end();++m) {
-				if (m->id() == newWorld.id()) {
-					existing = &(*m);
-					break;
-				}
+				if (m->id() == w.id())
+					return &(*m);
 			}
 			break;
 		default:
-			return false;
+			break;
 	}
+	return (World *)0;
+}
+
+bool Topology::_addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew,bool signatureChecked)
+{
+	if ((newWorld.type() != World::TYPE_PLANET)&&(newWorld.type() != World::TYPE_MOON))
+		return false;
 
+	World *existing = _getWorld(newWorld);
 	if (existing) {
-		if (existing->shouldBeReplacedBy(newWorld))
+		if (existing->shouldBeReplacedBy(newWorld,signatureChecked))
 			*existing = newWorld;
 		else return false;
 	} else if (newWorld.type() == World::TYPE_MOON) {
@@ -392,14 +480,25 @@ void Topology::removeMoon(void *tPtr,const uint64_t id)
 
 void Topology::clean(uint64_t now)
 {
+	{
+		Mutex::Lock _l(_identityLookups_m);
+		Hashtable< Address,uint64_t >::Iterator i(_identityLookups);
+		Address *a = (Address *)0;
+		uint64_t *issued = (uint64_t *)0;
+		while (i.next(a,issued)) {
+			if ((now - *issued) >= ZT_DATASTORE_ASYNC_TIMEOUT)
+				_identityLookups.erase(*a);
+		}
+	}
 	{
 		Mutex::Lock _l1(_peers_m);
 		Mutex::Lock _l2(_upstreams_m);
 		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
 		Address *a = (Address *)0;
 		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		Mutex::Lock _l3(_restoredPeers_m);
 		while (i.next(a,p)) {
-			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) )
+			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) && (!_restoredPeers.contains(*a)) )
 				_peers.erase(*a);
 		}
 	}
@@ -415,10 +514,138 @@ void Topology::clean(uint64_t now)
 	}
 }
 
+/*
+ * Peer snapshot format:
+ *
+ *   <[1] version (currently 1)>
+ *   <[5] address of the node that wrote it>
+ *   <[8] time written>
+ *   for each peer:
+ *     <[2] length of record>
+ *     <[...] record from Peer::serializeForSnapshot()>
+ */
+
+void Topology::savePeerSnapshot(void *tPtr,uint64_t now)
+{
+	{
+		// Don't replace a snapshot with a mostly empty one while we are still
+		// trying to reach the peers in it, e.g. when stopped right after start.
+		Mutex::Lock _l(_restoredPeers_m);
+		if (_restoredPeers.size() > 0)
+			return;
+	}
+
+	std::vector< std::pair< Address,SharedPtr<Peer> > > peers(allPeers());
+	std::string snap;
+	{
+		Buffer<16> hdr;
+		hdr.append((uint8_t)1);
+		RR->identity.address().appendTo(hdr);
+		hdr.append((uint64_t)now);
+		snap.append((const char *)hdr.data(),hdr.size());
+	}
+	Buffer<ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE + 2> rec;
+	for(std::vector< std::pair< Address,SharedPtr<Peer> > >::const_iterator p(peers.begin());p!=peers.end();++p) {
+		if ((!p->second->isAlive(now))||(isUpstream(p->second->identity())))
+			continue;
+		try {
+			rec.clear();
+			rec.addSize(2);
+			if (p->second->serializeForSnapshot(rec,now) > 0) {
+				rec.setAt(0,(uint16_t)(rec.size() - 2));
+				snap.append((const char *)rec.data(),rec.size());
+			}
+		} catch ( ... ) {} // skip any peer that somehow doesn't fit
+	}
+
+	RR->node->dataStorePut(tPtr,"peers.save",snap,true);
+	rec.burn();
+}
+
+void Topology::contactRestoredPeers(void *tPtr,uint64_t now)
+{
+	Mutex::Lock _l(_restoredPeers_m);
+	Hashtable< Address,_RestoredPeer >::Iterator i(_restoredPeers);
+	Address *a = (Address *)0;
+	_RestoredPeer *r = (_RestoredPeer *)0;
+	while (i.next(a,r)) {
+		if ((r->tries++ >= ZT_PEER_SNAPSHOT_CONTACT_TRIES)||(r->peer->getBestPath(now,false))) {
+			_restoredPeers.erase(*a);
+			continue;
+		}
+		for(std::vector<InetAddress>::const_iterator ep(r->endpoints.begin());ep!=r->endpoints.end();++ep) {
+			if (!r->peer->hasActivePathTo(now,*ep))
+				r->peer->attemptToContactAt(tPtr,InetAddress(),*ep,now,true,0);
+		}
+	}
+}
+
+void Topology::_loadPeerSnapshot(void *tPtr)
+{
+	const uint64_t now = RR->node->now();
+	std::string snap(RR->node->dataStoreGet(tPtr,"peers.save"));
+	if (snap.length() < 14)
+		return;
+
+	const uint8_t *const s = reinterpret_cast<const uint8_t *>(snap.data());
+	{
+		const Buffer<14> hdr(s,14);
+		if ((hdr[0] != 1)||(Address(hdr.field(1,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH) != RR->identity.address()))
+			return; // unknown version, or another identity's (or pre-1.2 format) peer cache
+		const uint64_t ts = hdr.at<uint64_t>(6);
+		if ((ts > now)||((now - ts) > ZT_PEER_SNAPSHOT_MAX_AGE))
+			return;
+	}
+
+	Mutex::Lock _l1(_peers_m);
+	Mutex::Lock _l2(_restoredPeers_m);
+	unsigned int ptr = 14;
+	while ((ptr + 2) <= (unsigned int)snap.length()) {
+		const unsigned int len = ((unsigned int)s[ptr] << 8) | (unsigned int)s[ptr + 1];
+		ptr += 2;
+		if ((len > ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE)||((ptr + len) > (unsigned int)snap.length()))
+			break;
+		Buffer<ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE> rec(s + ptr,len);
+		ptr += len;
+
+		std::vector<InetAddress> endpoints;
+		SharedPtr<Peer> p(Peer::deserializeFromSnapshot(RR,rec,endpoints));
+		rec.burn();
+		if ((!p)||(p->address() == RR->identity.address())||(endpoints.empty()))
+			continue;
+
+		SharedPtr<Peer> &hp = _peers[p->address()];
+		if (!hp)
+			hp = p;
+		_RestoredPeer &r = _restoredPeers[p->address()];
+		r.peer = hp;
+		r.endpoints.swap(endpoints);
+	}
+}
+
 Identity Topology::_getIdentity(void *tPtr,const Address &zta)
 {
 	char p[128];
 	Utils::snprintf(p,sizeof(p),"iddb.d/%.10llx",(unsigned long long)zta.toInt());
+
+	// With an async data store the lookup completes in identityLookupComplete()
+	// and callers see this identity as unknown until then, just as if it were
+	// being fetched by WHOIS.
+	if (RR->node->hasAsyncDataStore()) {
+		const uint64_t now = RR->node->now();
+		{
+			Mutex::Lock _l(_identityLookups_m);
+			uint64_t &issued = _identityLookups[zta];
+			if ((issued)&&((now - issued) < ZT_DATASTORE_ASYNC_TIMEOUT))
+				return Identity();
+			issued = now;
+		}
+		if (RR->node->dataStoreGetAsync(tPtr,p))
+			return Identity();
+		Mutex::Lock _l(_identityLookups_m);
+		_identityLookups.erase(zta);
+	}
+
 	std::string ids(RR->node->dataStoreGet(tPtr,p));
 	if (ids.length() > 0) {
 		try {
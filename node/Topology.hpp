@@ -128,6 +128,24 @@ public:
 	 */
 	void saveIdentity(void *tPtr,const Identity &id);
 
+	/**
+	 * @param zta ZeroTier address
+	 * @return True if an asynchronous data store lookup of this identity is in flight
+	 */
+	bool identityLookupPending(const Address &zta);
+
+	/**
+	 * Handle the result of an asynchronous identity lookup
+	 *
+	 * If the identity was found its peer is created and anything waiting
+	 * on it is run. Otherwise any WHOIS held back for it is sent.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param zta ZeroTier address that was looked up
+	 * @param ids Identity in string form or empty if not found
+	 */
+	void identityLookupComplete(void *tPtr,const Address &zta,const std::string &ids);
+
 	/**
 	 * Get the current best upstream peer
 	 *
@@ -278,6 +296,19 @@ public:
 	 */
 	bool addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew);
 
+	/**
+	 * Validate and learn several worlds at once, e.g. from OK(HELLO)
+	 *
+	 * Signatures of updates to worlds we already have are checked together
+	 * with C25519::verifyBatch(). Otherwise this is the same as calling
+	 * addWorld() with alwaysAcceptNew false for each.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param newWorlds Planets and/or moons to learn
+	 * @return Number of worlds that were valid and newer than current (or totally new for moons)
+	 */
+	unsigned int addWorlds(void *tPtr,const std::vector<World> &newWorlds);
+
 	/**
 	 * Add a moon
 	 *
@@ -302,6 +333,31 @@ public:
 	 */
 	void clean(uint64_t now);
 
+	/**
+	 * Save peers with live direct paths to the data store as "peers.save"
+	 *
+	 * The snapshot holds each peer's identity, agreed key, version, and
+	 * direct endpoints, so that after a restart we can HELLO peers directly
+	 * instead of waiting on WHOIS and RENDEZVOUS through upstreams. Since it
+	 * holds keys it is written as a secure object. Upstreams are not saved
+	 * since they are contacted at their stable endpoints anyway.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void savePeerSnapshot(void *tPtr,uint64_t now);
+
+	/**
+	 * Send HELLO to the saved endpoints of peers restored from a snapshot
+	 *
+	 * This is called with each ping check. Each peer is tried at most
+	 * ZT_PEER_SNAPSHOT_CONTACT_TRIES times and forgotten once it answers.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void contactRestoredPeers(void *tPtr,uint64_t now);
+
 	/**
 	 * @param now Current time
 	 * @return Number of peers with active direct paths
@@ -429,6 +485,9 @@ public:
 
 private:
 	Identity _getIdentity(void *tPtr,const Address &zta);
+	void _loadPeerSnapshot(void *tPtr);
+	World *_getWorld(const World &w); // assumes _upstreams_m is locked
+	bool _addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew,bool signatureChecked); // assumes _upstreams_m and _peers_m are locked
 	void _memoizeUpstreams(void *tPtr);
 
 	const RuntimeEnvironment *const RR;
@@ -441,6 +500,20 @@ private:
 	Hashtable< Address,SharedPtr<Peer> > _peers;
 	Mutex _peers_m;
 
+	// Peers loaded from the snapshot that we are still trying to reach
+	struct _RestoredPeer
+	{
+		_RestoredPeer() : tries(0) {}
+		SharedPtr<Peer> peer;
+		std::vector<InetAddress> endpoints;
+		unsigned int tries;
+	};
+	Hashtable< Address,_RestoredPeer > _restoredPeers;
+	Mutex _restoredPeers_m;
+
+	Hashtable< Address,uint64_t > _identityLookups; // async data store lookups in flight -> time issued
+	Mutex _identityLookups_m;
+
 	Hashtable< Path::HashKey,SharedPtr<Path> > _paths;
 	Mutex _paths_m;
 
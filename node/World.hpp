@@ -145,17 +145,26 @@ public:
 	 */
 	inline const C25519::Public &updatesMustBeSignedBy() const { return _updatesMustBeSignedBy; }
 
+	/**
+	 * @param update Candidate update
+	 * @return True if update is newer than current and matches its ID and type (signature is not checked)
+	 */
+	inline bool isOlderVersionOf(const World &update) const { return ((_id == update._id)&&(_ts < update._ts)&&(_type == update._type)); }
+
 	/**
 	 * Check whether a world update should replace this one
 	 *
 	 * @param update Candidate update
+	 * @param signatureChecked If true the caller has already checked update's signature against updatesMustBeSignedBy()
 	 * @return True if update is newer than current, matches its ID and type, and is properly signed (or if current is NULL)
 	 */
-	inline bool shouldBeReplacedBy(const World &update)
+	inline bool shouldBeReplacedBy(const World &update,const bool signatureChecked = false)
 	{
 		if ((_id == 0)||(_type == TYPE_NULL))
 			return true;
-		if ((_id == update._id)&&(_ts < update._ts)&&(_type == update._type)) {
+		if (isOlderVersionOf(update)) {
+			if (signatureChecked)
+				return true;
 			Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> tmp;
 			update.serialize(tmp,true);
 			return C25519::verify(_updatesMustBeSignedBy,tmp.data(),tmp.size(),update._signature);
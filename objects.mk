@@ -29,6 +29,8 @@ OBJS=\
 	node/Utils.o \
 	osdep/ManagedRoute.o \
 	osdep/Http.o \
+	osdep/IdentityGenerator.o \
+	osdep/IdentityStore.o \
 	osdep/OSUtils.o \
 	service/ClusterGeoIpService.o \
 	service/SoftwareUpdater.o
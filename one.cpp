@@ -73,8 +73,10 @@
 #include "osdep/OSUtils.hpp"
 #include "osdep/Http.hpp"
 #include "osdep/Thread.hpp"
+#include "osdep/IdentityGenerator.hpp"
 
 #include "service/OneService.hpp"
+#include "service/ClusterGeoIpService.hpp"
 
 #include "ext/json/json.hpp"
 
@@ -629,6 +631,14 @@ static void idtoolPrintHelp(FILE *out,const char *pn)
 	fprintf(out,"  verify <identity.secret/public> <file> <signature>" ZT_EOL_S);
 	fprintf(out,"  initmoon <identity.public of first seed>" ZT_EOL_S);
 	fprintf(out,"  genmoon <moon json>" ZT_EOL_S);
+#ifdef ZT_ENABLE_CLUSTER
+	fprintf(out,"  geoip <csv> <ip start col> <ip end col> <lat col> <lon col> <index>" ZT_EOL_S);
+#endif
+}
+
+static void idtoolVanityProgress(void *arg,uint64_t generated,unsigned int found)
+{
+	fprintf(stderr,"vanity address: tried %llu identities\n",(unsigned long long)generated);
 }
 
 static Identity getIdFromArg(char *arg)
@@ -668,18 +678,17 @@ static int idtool(int argc,char **argv)
 				vanityBits = 40;
 		}
 
-		Identity id;
-		for(;;) {
-			id.generate();
-			if ((id.address().toInt() >> (40 - vanityBits)) == vanity) {
-				if (vanityBits > 0) {
-					fprintf(stderr,"vanity address: found %.10llx !\n",(unsigned long long)id.address().toInt());
-				}
-				break;
-			} else {
-				fprintf(stderr,"vanity address: tried %.10llx looking for first %d bits of %.10llx\n",(unsigned long long)id.address().toInt(),vanityBits,(unsigned long long)(vanity << (40 - vanityBits)));
-			}
+		IdentityGenerator gen;
+		if (vanityBits > 0)
+			fprintf(stderr,"vanity address: looking for first %d bits of %.10llx on %u threads\n",vanityBits,(unsigned long long)(vanity << (40 - vanityBits)),gen.threads());
+		std::vector<Identity> ids(gen.generate(1,vanity,(unsigned int)vanityBits,(vanityBits > 0) ? &idtoolVanityProgress : (IdentityGenerator::ProgressFunction)0,(void *)0));
+		if (ids.empty()) {
+			fprintf(stderr,"Error generating identity" ZT_EOL_S);
+			return 1;
 		}
+		const Identity id(ids.front());
+		if (vanityBits > 0)
+			fprintf(stderr,"vanity address: found %.10llx after %llu identities\n",(unsigned long long)id.address().toInt(),(unsigned long long)gen.generated());
 
 		std::string idser = id.toString(true);
 		if (argc >= 3) {
@@ -860,6 +869,19 @@ static int idtool(int argc,char **argv)
 			OSUtils::writeFile(fn,wbuf.data(),wbuf.size());
 			printf("wrote %s (signed world with timestamp %llu)" ZT_EOL_S,fn,(unsigned long long)now);
 		}
+#ifdef ZT_ENABLE_CLUSTER
+	} else if (!strcmp(argv[1],"geoip")) {
+		if (argc < 8) {
+			idtoolPrintHelp(stdout,argv[0]);
+		} else {
+			const long n = ClusterGeoIpService::convert(argv[2],Utils::strToInt(argv[3]),Utils::strToInt(argv[4]),Utils::strToInt(argv[5]),Utils::strToInt(argv[6]),argv[7]);
+			if (n <= 0) {
+				fprintf(stderr,"unable to convert %s or no valid IP ranges found" ZT_EOL_S,argv[2]);
+				return 1;
+			}
+			printf("wrote %s (%ld IP ranges)" ZT_EOL_S,argv[7],n);
+		}
+#endif
 	} else {
 		idtoolPrintHelp(stdout,argv[0]);
 		return 1;
@@ -883,6 +905,12 @@ static void _sighandlerQuit(int sig)
 		s->terminate();
 	else exit(0);
 }
+static void _sighandlerDumpTrace(int sig)
+{
+	OneService *s = zt1Service;
+	if (s)
+		s->dumpTrace();
+}
 #endif
 
 // Drop privileges on Linux, if supported by libc etc. and "zerotier-one" user exists on system
@@ -1265,7 +1293,7 @@ int main(int argc,char **argv)
 #ifdef __UNIX_LIKE__
 	signal(SIGHUP,&_sighandlerHup);
 	signal(SIGPIPE,SIG_IGN);
-	signal(SIGUSR1,SIG_IGN);
+	signal(SIGUSR1,&_sighandlerDumpTrace);
 	signal(SIGUSR2,SIG_IGN);
 	signal(SIGALRM,SIG_IGN);
 	signal(SIGINT,&_sighandlerQuit);
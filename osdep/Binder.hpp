@@ -394,9 +394,10 @@ public:
 	 * @param data Data to send
 	 * @param len Length of data
 	 * @param v4ttl If non-zero, send this packet with the specified IP TTL (IPv4 only)
+	 * @param dontFragment If true, send this packet with the IP don't fragment flag set
 	 */
 	template<typename PHY_HANDLER_TYPE>
-	inline bool udpSend(Phy<PHY_HANDLER_TYPE> &phy,const InetAddress &local,const InetAddress &remote,const void *data,unsigned int len,unsigned int v4ttl = 0) const
+	inline bool udpSend(Phy<PHY_HANDLER_TYPE> &phy,const InetAddress &local,const InetAddress &remote,const void *data,unsigned int len,unsigned int v4ttl = 0,bool dontFragment = false) const
 	{
 		Mutex::Lock _l(_lock);
 		if (local) {
@@ -404,7 +405,11 @@ public:
 				if (i->address == local) {
 					if ((v4ttl)&&(local.ss_family == AF_INET))
 						phy.setIp4UdpTtl(i->udpSock,v4ttl);
+					if (dontFragment)
+						phy.setUdpDontFragment(i->udpSock,true);
 					const bool result = phy.udpSend(i->udpSock,reinterpret_cast<const struct sockaddr *>(&remote),data,len);
+					if (dontFragment)
+						phy.setUdpDontFragment(i->udpSock,false);
 					if ((v4ttl)&&(local.ss_family == AF_INET))
 						phy.setIp4UdpTtl(i->udpSock,255);
 					return result;
@@ -417,7 +422,11 @@ public:
 				if (i->address.ss_family == remote.ss_family) {
 					if ((v4ttl)&&(remote.ss_family == AF_INET))
 						phy.setIp4UdpTtl(i->udpSock,v4ttl);
+					if (dontFragment)
+						phy.setUdpDontFragment(i->udpSock,true);
 					result |= phy.udpSend(i->udpSock,reinterpret_cast<const struct sockaddr *>(&remote),data,len);
+					if (dontFragment)
+						phy.setUdpDontFragment(i->udpSock,false);
 					if ((v4ttl)&&(remote.ss_family == AF_INET))
 						phy.setIp4UdpTtl(i->udpSock,255);
 				}
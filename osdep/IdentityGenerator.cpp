@@ -0,0 +1,163 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "../node/Constants.hpp"
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "IdentityGenerator.hpp"
+
+// Upper bound on threads, mostly to bound scratch memory
+#define ZT_IDENTITYGENERATOR_MAX_THREADS 256
+
+namespace ZeroTier {
+
+IdentityGenerator::IdentityGenerator(unsigned int threads) :
+	_threads((threads) ? threads : cpuCount()),
+	_count(0),
+	_prefix(0),
+	_prefixBits(0),
+	_run(false),
+	_generated(0),
+	_active(0)
+{
+	if (_threads > ZT_IDENTITYGENERATOR_MAX_THREADS)
+		_threads = ZT_IDENTITYGENERATOR_MAX_THREADS;
+}
+
+std::vector<Identity> IdentityGenerator::generate(unsigned int count,uint64_t prefix,unsigned int prefixBits,ProgressFunction progress,void *arg)
+{
+	if (prefixBits > 40)
+		prefixBits = 40;
+	{
+		Mutex::Lock _l(_lock);
+		_count = count;
+		_prefix = (prefixBits) ? (prefix & (0xffffffffffULL >> (40 - prefixBits))) : 0;
+		_prefixBits = prefixBits;
+		_found.clear();
+		_generated = 0;
+	}
+	if (!count)
+		return std::vector<Identity>();
+	_run = true;
+
+	std::vector<Thread> threads(_threads);
+	unsigned int started = 0;
+	for(unsigned int t=0;t<_threads;++t) {
+		{
+			Mutex::Lock _l(_lock);
+			++_active;
+		}
+		try {
+			threads[t] = Thread::start(this);
+			++started;
+		} catch ( ... ) {
+			Mutex::Lock _l(_lock);
+			--_active;
+		}
+	}
+	if (!started) { // can't create threads at all, so do it here
+		_active = 1;
+		threadMain();
+	}
+
+	unsigned long sinceProgress = 0;
+	for(;;) {
+		{
+			Mutex::Lock _l(_lock);
+			if ((!_run)||(!_active))
+				break;
+		}
+		Thread::sleep(100);
+		if ((progress)&&((sinceProgress += 100) >= 1000)) {
+			sinceProgress = 0;
+			uint64_t g;
+			unsigned int f;
+			{
+				Mutex::Lock _l(_lock);
+				g = _generated;
+				f = (unsigned int)_found.size();
+			}
+			progress(arg,g,f);
+		}
+	}
+
+	_run = false;
+	for(std::vector<Thread>::iterator t(threads.begin());t!=threads.end();++t)
+		Thread::join(*t);
+
+	Mutex::Lock _l(_lock);
+	if (_found.size() > _count)
+		_found.resize(_count);
+	return _found;
+}
+
+unsigned int IdentityGenerator::cpuCount()
+{
+#ifdef __WINDOWS__
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return ((si.dwNumberOfProcessors > 0) ? (unsigned int)si.dwNumberOfProcessors : 1);
+#else
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return ((n > 0) ? (unsigned int)n : 1);
+#endif
+}
+
+void IdentityGenerator::threadMain()
+	throw()
+{
+	char *const genmem = new (std::nothrow) char[ZT_IDENTITY_GEN_MEMORY];
+	if (!genmem) {
+		Mutex::Lock _l(_lock);
+		--_active;
+		return;
+	}
+	Identity id;
+	while (_run) {
+		if (!id.generateAttempt(genmem))
+			continue;
+		const bool match = ((!_prefixBits)||((id.address().toInt() >> (40 - _prefixBits)) == _prefix));
+		Mutex::Lock _l(_lock);
+		++_generated;
+		if (match) {
+			if (_found.size() < _count)
+				_found.push_back(id);
+			if (_found.size() >= _count)
+				_run = false;
+		}
+	}
+	delete [] genmem;
+	Mutex::Lock _l(_lock);
+	--_active;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,117 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ZT_IDENTITYGENERATOR_HPP
+#define ZT_IDENTITYGENERATOR_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "../node/Constants.hpp"
+#include "../node/NonCopyable.hpp"
+#include "../node/Identity.hpp"
+#include "../node/Mutex.hpp"
+
+#include "Thread.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Generates identities on several threads at once
+ *
+ * Identity generation is dominated by a memory-hard hash that can't be
+ * made faster, but each attempt is independent so throughput scales with
+ * cores. Each thread has its own scratch memory (ZT_IDENTITY_GEN_MEMORY
+ * bytes). Optionally only identities whose addresses start with a given
+ * prefix are kept, for picking "vanity" addresses.
+ */
+class IdentityGenerator : NonCopyable
+{
+public:
+	/**
+	 * Progress callback, called about once a second by the thread running generate()
+	 *
+	 * @param arg Argument supplied to generate()
+	 * @param generated Valid identities generated so far, including any not matching the prefix
+	 * @param found Identities found so far that match the prefix
+	 */
+	typedef void (*ProgressFunction)(void *arg,uint64_t generated,unsigned int found);
+
+	/**
+	 * @param threads Number of threads to use or 0 for one per CPU core
+	 */
+	IdentityGenerator(unsigned int threads = 0);
+
+	/**
+	 * Generate identities, blocking until done or cancelled
+	 *
+	 * @param count Number of identities to generate
+	 * @param prefix Address prefix to look for (the most significant prefixBits of the address)
+	 * @param prefixBits Number of bits in prefix, 0 to accept any address (max: 40)
+	 * @param progress Progress callback or NULL for none
+	 * @param arg Argument for progress callback
+	 * @return Generated identities (fewer than count only if cancelled)
+	 */
+	std::vector<Identity> generate(unsigned int count,uint64_t prefix = 0,unsigned int prefixBits = 0,ProgressFunction progress = (ProgressFunction)0,void *arg = (void *)0);
+
+	/**
+	 * Stop a running generate() (may be called from the progress callback or any thread)
+	 */
+	inline void cancel() { _run = false; }
+
+	/**
+	 * @return Valid identities generated so far by the current or last call to generate()
+	 */
+	inline uint64_t generated() const
+	{
+		Mutex::Lock _l(_lock);
+		return _generated;
+	}
+
+	/**
+	 * @return Number of threads used
+	 */
+	inline unsigned int threads() const { return _threads; }
+
+	/**
+	 * @return Number of CPU cores online (at least 1)
+	 */
+	static unsigned int cpuCount();
+
+	// Worker thread entry point
+	void threadMain()
+		throw();
+
+private:
+	unsigned int _threads;
+	unsigned int _count;
+	uint64_t _prefix;
+	unsigned int _prefixBits;
+	volatile bool _run;
+
+	std::vector<Identity> _found;
+	uint64_t _generated;
+	unsigned int _active; // worker threads still running
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../node/Constants.hpp"
+
+#ifdef __UNIX_LIKE__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "IdentityStore.hpp"
+
+/*
+ * File layout (host byte order):
+ *
+ *   <[8] magic>
+ *   <[8] bytes of file in use, including this header>
+ *   <[48] reserved>
+ *   records...
+ *
+ * Each record is padded to a multiple of 8 bytes:
+ *
+ *   <[4] total record length>
+ *   <[4] identity length>
+ *   <[8] ZeroTier address>
+ *   <[8] timestamp, 0 if record is dead>
+ *   <[...] identity in string form>
+ */
+
+#define ZT_IDENTITYSTORE_MAGIC "ZTIDDB\x00\x01"
+#define ZT_IDENTITYSTORE_HEADER_SIZE 64
+#define ZT_IDENTITYSTORE_RECORD_HEADER_SIZE 24
+#define ZT_IDENTITYSTORE_MAX_IDENTITY_SIZE 4096
+
+// Files grow in steps of at least this size to keep remaps rare
+#define ZT_IDENTITYSTORE_GROW_SIZE 1048576ULL
+
+namespace ZeroTier {
+
+namespace {
+
+struct _Rec
+{
+	uint32_t len;
+	uint32_t idLen;
+	uint64_t address;
+	uint64_t ts;
+};
+
+} // anonymous namespace
+
+IdentityStore::IdentityStore() :
+	_fd(-1),
+	_map((uint8_t *)0),
+	_mapSize(0),
+	_index(1024)
+{
+}
+
+IdentityStore::~IdentityStore()
+{
+	this->close();
+}
+
+#ifdef __UNIX_LIKE__
+
+bool IdentityStore::open(const char *path)
+{
+	Mutex::Lock _l(_lock);
+
+	if (_map)
+		return false;
+	_path = path;
+	_index.clear();
+
+	_fd = ::open(path,O_RDWR|O_CREAT,0600);
+	if (_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd,&st) != 0) {
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+
+	uint64_t fsize = (uint64_t)st.st_size;
+	bool init = (fsize < ZT_IDENTITYSTORE_HEADER_SIZE);
+	if (init) {
+		fsize = ZT_IDENTITYSTORE_GROW_SIZE;
+		if (ftruncate(_fd,(off_t)fsize) != 0) {
+			::close(_fd);
+			_fd = -1;
+			return false;
+		}
+	}
+	if (!_remap(fsize)) {
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+
+	if ((!init)&&((memcmp(_map,ZT_IDENTITYSTORE_MAGIC,8) != 0)||(_used() < ZT_IDENTITYSTORE_HEADER_SIZE)||(_used() > _mapSize)))
+		init = true;
+	if (init) {
+		memset(_map,0,ZT_IDENTITYSTORE_HEADER_SIZE);
+		memcpy(_map,ZT_IDENTITYSTORE_MAGIC,8);
+		_used() = ZT_IDENTITYSTORE_HEADER_SIZE;
+		return true;
+	}
+
+	uint64_t ptr = ZT_IDENTITYSTORE_HEADER_SIZE;
+	const uint64_t used = _used();
+	while ((ptr + ZT_IDENTITYSTORE_RECORD_HEADER_SIZE) <= used) {
+		_Rec *const r = reinterpret_cast<_Rec *>(_map + ptr);
+		if ((r->len < ZT_IDENTITYSTORE_RECORD_HEADER_SIZE)||((r->len & 7) != 0)||((ptr + r->len) > used)||(r->idLen > (r->len - ZT_IDENTITYSTORE_RECORD_HEADER_SIZE)))
+			break; // torn or corrupt record, discard it and anything after it
+		if (r->ts) {
+			uint64_t &o = _index[r->address];
+			if (o) // an address should only have one live record, but if not the last one wins
+				reinterpret_cast<_Rec *>(_map + o)->ts = 0;
+			o = ptr;
+		}
+		ptr += r->len;
+	}
+	_used() = ptr;
+
+	return true;
+}
+
+void IdentityStore::close()
+{
+	Mutex::Lock _l(_lock);
+	if (_map) {
+		msync(_map,(size_t)_mapSize,MS_ASYNC);
+		munmap(_map,(size_t)_mapSize);
+		_map = (uint8_t *)0;
+		_mapSize = 0;
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+	_index.clear();
+}
+
+bool IdentityStore::_remap(uint64_t newSize)
+{
+	// assumes _lock is locked
+	if (_map)
+		munmap(_map,(size_t)_mapSize);
+	void *m = mmap((void *)0,(size_t)newSize,PROT_READ|PROT_WRITE,MAP_SHARED,_fd,0);
+	if (m == MAP_FAILED) {
+		_map = (uint8_t *)0;
+		_mapSize = 0;
+		return false;
+	}
+	_map = reinterpret_cast<uint8_t *>(m);
+	_mapSize = newSize;
+	return true;
+}
+
+bool IdentityStore::_reserve(uint64_t bytes)
+{
+	// assumes _lock is locked
+	const uint64_t need = _used() + bytes;
+	if (need <= _mapSize)
+		return true;
+	uint64_t newSize = _mapSize + ((_mapSize < ZT_IDENTITYSTORE_GROW_SIZE) ? ZT_IDENTITYSTORE_GROW_SIZE : _mapSize);
+	if (newSize < need)
+		newSize = need + ZT_IDENTITYSTORE_GROW_SIZE;
+	if (ftruncate(_fd,(off_t)newSize) != 0)
+		return false;
+	if (!_remap(newSize)) {
+		// Try to get the old mapping back so the store stays usable
+		if (!_remap((uint64_t)lseek(_fd,0,SEEK_END)))
+			_index.clear();
+		return false;
+	}
+	return true;
+}
+
+unsigned long IdentityStore::clean(const uint64_t olderThan)
+{
+	Mutex::Lock _l(_lock);
+	if (!_map)
+		return 0;
+
+	// Slide live records down over dead and expired ones. If we crash part
+	// way through, the worst case is a stale duplicate record that open()
+	// resolves to the newer copy anyway.
+	unsigned long dropped = 0;
+	uint64_t rptr = ZT_IDENTITYSTORE_HEADER_SIZE;
+	uint64_t wptr = ZT_IDENTITYSTORE_HEADER_SIZE;
+	const uint64_t used = _used();
+	while (rptr < used) {
+		const _Rec *const r = reinterpret_cast<const _Rec *>(_map + rptr);
+		const uint32_t len = r->len;
+		if ((r->ts)&&(r->ts >= olderThan)) {
+			if (wptr != rptr)
+				memmove(_map + wptr,_map + rptr,len);
+			_index[reinterpret_cast<const _Rec *>(_map + wptr)->address] = wptr;
+			wptr += len;
+		} else if (r->ts) {
+			_index.erase(r->address);
+			++dropped;
+		}
+		rptr += len;
+	}
+	_used() = wptr;
+
+	// Give back space if the file has become mostly empty
+	if ((_mapSize > ZT_IDENTITYSTORE_GROW_SIZE)&&((wptr * 4) < _mapSize)) {
+		const uint64_t newSize = ((wptr / ZT_IDENTITYSTORE_GROW_SIZE) + 1) * ZT_IDENTITYSTORE_GROW_SIZE;
+		msync(_map,(size_t)_mapSize,MS_SYNC);
+		munmap(_map,(size_t)_mapSize);
+		_map = (uint8_t *)0;
+		if ((ftruncate(_fd,(off_t)newSize) != 0)||(!_remap(newSize))) {
+			if (!_remap((uint64_t)lseek(_fd,0,SEEK_END)))
+				_index.clear();
+		}
+	} else {
+		msync(_map,(size_t)_mapSize,MS_ASYNC);
+	}
+
+	return dropped;
+}
+
+#else // no mmap(), callers fall back to one file per identity
+
+bool IdentityStore::open(const char *path) { return false; }
+void IdentityStore::close() {}
+bool IdentityStore::_remap(uint64_t newSize) { return false; }
+bool IdentityStore::_reserve(uint64_t bytes) { return false; }
+unsigned long IdentityStore::clean(const uint64_t olderThan) { return 0; }
+
+#endif
+
+long IdentityStore::get(const uint64_t address,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize) const
+{
+	Mutex::Lock _l(_lock);
+	if (!_map)
+		return -1;
+	const uint64_t *const o = _index.get(address);
+	if (!o)
+		return -1;
+	const _Rec *const r = reinterpret_cast<const _Rec *>(_map + *o);
+	*totalSize = r->idLen;
+	if (readIndex >= r->idLen)
+		return 0;
+	unsigned long n = r->idLen - readIndex;
+	if (n > bufSize)
+		n = bufSize;
+	memcpy(buf,_map + *o + ZT_IDENTITYSTORE_RECORD_HEADER_SIZE + readIndex,n);
+	return (long)n;
+}
+
+bool IdentityStore::put(const uint64_t address,const void *id,unsigned int len,uint64_t ts)
+{
+	if ((len > ZT_IDENTITYSTORE_MAX_IDENTITY_SIZE)||(!ts))
+		return false;
+
+	Mutex::Lock _l(_lock);
+	if (!_map)
+		return false;
+
+	const uint64_t *o = _index.get(address);
+	if (o) {
+		_Rec *const r = reinterpret_cast<_Rec *>(_map + *o);
+		if ((r->idLen == len)&&(memcmp(_map + *o + ZT_IDENTITYSTORE_RECORD_HEADER_SIZE,id,len) == 0)) {
+			r->ts = ts;
+			return true;
+		}
+	}
+
+	const uint32_t rlen = (uint32_t)((ZT_IDENTITYSTORE_RECORD_HEADER_SIZE + len + 7) & ~7);
+	if (!_reserve(rlen))
+		return false;
+	o = _index.get(address); // _reserve() may have remapped, but offsets are still valid
+	if (o)
+		reinterpret_cast<_Rec *>(_map + *o)->ts = 0;
+
+	const uint64_t ptr = _used();
+	_Rec *const r = reinterpret_cast<_Rec *>(_map + ptr);
+	r->len = rlen;
+	r->idLen = len;
+	r->address = address;
+	r->ts = ts;
+	memcpy(_map + ptr + ZT_IDENTITYSTORE_RECORD_HEADER_SIZE,id,len);
+	memset(_map + ptr + ZT_IDENTITYSTORE_RECORD_HEADER_SIZE + len,0,rlen - (ZT_IDENTITYSTORE_RECORD_HEADER_SIZE + len));
+	_used() = ptr + rlen; // only advance once the record is complete
+	_index[address] = ptr;
+
+	return true;
+}
+
+void IdentityStore::erase(const uint64_t address)
+{
+	Mutex::Lock _l(_lock);
+	if (!_map)
+		return;
+	const uint64_t *const o = _index.get(address);
+	if (o) {
+		reinterpret_cast<_Rec *>(_map + *o)->ts = 0;
+		_index.erase(address);
+	}
+}
+
+} // namespace ZeroTier
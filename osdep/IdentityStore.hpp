@@ -0,0 +1,138 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2016  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_IDENTITYSTORE_HPP
+#define ZT_IDENTITYSTORE_HPP
+
+#include <stdint.h>
+
+#include <string>
+
+#include "../node/Constants.hpp"
+#include "../node/NonCopyable.hpp"
+#include "../node/Hashtable.hpp"
+#include "../node/Mutex.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Memory mapped append-only store of peer identities keyed by address
+ *
+ * This replaces one small file per identity under iddb.d. Records are
+ * appended to a single mapped file and found through an in-memory hash
+ * index, so lookups are a hash probe and a memcpy with no system calls.
+ * Replacing or deleting an identity marks its old record dead; clean()
+ * compacts the file in place, dropping dead records and records not
+ * written or refreshed since a cutoff time.
+ *
+ * The file is in host byte order and is only meant to be read by the
+ * host that wrote it. This is only implemented where mmap() is available;
+ * elsewhere open() fails and callers should fall back to plain files.
+ */
+class IdentityStore : NonCopyable
+{
+public:
+	IdentityStore();
+	~IdentityStore();
+
+	/**
+	 * Open or create a store, building the index from its records
+	 *
+	 * A file that is not a valid store is reinitialized. A torn record at
+	 * the end (e.g. from a crash during append) is discarded.
+	 *
+	 * @param path Path to store file
+	 * @return True on success
+	 */
+	bool open(const char *path);
+
+	/**
+	 * Unmap and close (also done on destruct)
+	 */
+	void close();
+
+	/**
+	 * @return True if store is open
+	 */
+	inline bool isOpen() const { return (_map != (uint8_t *)0); }
+
+	/**
+	 * Read an identity with the same semantics as a ZT_DataStoreGetFunction
+	 *
+	 * @param address ZeroTier address
+	 * @param buf Buffer to fill
+	 * @param bufSize Size of buffer
+	 * @param readIndex Offset within identity to start reading
+	 * @param totalSize Set to total size of identity
+	 * @return Number of bytes read or -1 if not found
+	 */
+	long get(const uint64_t address,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize) const;
+
+	/**
+	 * Store or refresh an identity
+	 *
+	 * If the same identity is already present only its timestamp is
+	 * refreshed in place.
+	 *
+	 * @param address ZeroTier address
+	 * @param id Identity in string form
+	 * @param len Length of identity
+	 * @param ts Timestamp to record (used by clean())
+	 * @return True on success
+	 */
+	bool put(const uint64_t address,const void *id,unsigned int len,uint64_t ts);
+
+	/**
+	 * @param address ZeroTier address to remove
+	 */
+	void erase(const uint64_t address);
+
+	/**
+	 * Compact the store
+	 *
+	 * @param olderThan Drop identities last stored before this time
+	 * @return Number of identities dropped
+	 */
+	unsigned long clean(const uint64_t olderThan);
+
+	/**
+	 * @return Number of identities in store
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _index.size();
+	}
+
+private:
+	bool _reserve(uint64_t bytes);
+	bool _remap(uint64_t newSize);
+
+	inline uint64_t &_used() const { return *reinterpret_cast<uint64_t *>(_map + 8); }
+
+	std::string _path;
+	int _fd;
+	uint8_t *_map;
+	uint64_t _mapSize;
+	Hashtable< uint64_t,uint64_t > _index; // address -> record offset
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
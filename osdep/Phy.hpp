@@ -215,6 +215,7 @@ public:
 		_nfds = (pipes[0] > pipes[1]) ? (long)pipes[0] : (long)pipes[1];
 		_whackReceiveSocket = pipes[0];
 		_whackSendSocket = pipes[1];
+		FD_SET(_whackReceiveSocket,&_readfds); // otherwise whack() can't wake up select()
 		_noDelay = noDelay;
 		_noCheck = noCheck;
 	}
@@ -432,6 +433,60 @@ public:
 #endif
 	}
 
+	/**
+	 * Set or clear the don't fragment flag for outgoing packets on a UDP socket
+	 *
+	 * UDP sockets are created with fragmentation allowed. This is set
+	 * temporarily to send path MTU probes, which must not be fragmented
+	 * to mean anything.
+	 *
+	 * @param sock UDP socket
+	 * @param df If true set DF, otherwise allow fragmentation again
+	 * @return True on success
+	 */
+	inline bool setUdpDontFragment(PhySocket *sock,bool df)
+	{
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		const bool v6 = (reinterpret_cast<const struct sockaddr *>(&(sws.saddr))->sa_family == AF_INET6);
+#if defined(_WIN32) || defined(_WIN64)
+		DWORD tmp = (df) ? 1 : 0;
+		if (v6)
+			return (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_DONTFRAG,(const char *)&tmp,sizeof(tmp)) == 0);
+		return (::setsockopt(sws.sock,IPPROTO_IP,IP_DONTFRAGMENT,(const char *)&tmp,sizeof(tmp)) == 0);
+#else
+		int tmp;
+		if (v6) {
+#ifdef IPV6_MTU_DISCOVER
+#ifdef IPV6_PMTUDISC_PROBE
+			tmp = (df) ? IPV6_PMTUDISC_PROBE : 0;
+#else
+			tmp = (df) ? IPV6_PMTUDISC_DO : 0;
+#endif
+			::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_MTU_DISCOVER,&tmp,sizeof(tmp));
+#endif
+#ifdef IPV6_DONTFRAG
+			tmp = (df) ? 1 : 0;
+			return (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_DONTFRAG,&tmp,sizeof(tmp)) == 0);
+#else
+			return false;
+#endif
+		}
+#if defined(IP_MTU_DISCOVER)
+#ifdef IP_PMTUDISC_PROBE
+		tmp = (df) ? IP_PMTUDISC_PROBE : 0; // PROBE ignores the kernel's cached path MTU
+#else
+		tmp = (df) ? IP_PMTUDISC_DO : 0;
+#endif
+		return (::setsockopt(sws.sock,IPPROTO_IP,IP_MTU_DISCOVER,&tmp,sizeof(tmp)) == 0);
+#elif defined(IP_DONTFRAG)
+		tmp = (df) ? 1 : 0;
+		return (::setsockopt(sws.sock,IPPROTO_IP,IP_DONTFRAG,&tmp,sizeof(tmp)) == 0);
+#else
+		return false;
+#endif
+#endif
+	}
+
 	/**
 	 * Send a UDP packet
 	 *
@@ -25,6 +25,9 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
 
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
@@ -38,6 +41,7 @@
 #include "node/MAC.hpp"
 #include "node/NetworkConfig.hpp"
 #include "node/Peer.hpp"
+#include "node/Path.hpp"
 #include "node/Dictionary.hpp"
 #include "node/SHA512.hpp"
 #include "node/C25519.hpp"
@@ -45,14 +49,25 @@
 #include "node/CertificateOfMembership.hpp"
 #include "node/Node.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/Metrics.hpp"
+#include "node/PacketTrace.hpp"
+#include "node/CredentialCache.hpp"
+#include "node/Topology.hpp"
+#include "node/Cluster.hpp"
+#include "node/Switch.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Phy.hpp"
 #include "osdep/Http.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
+#include "osdep/IdentityStore.hpp"
+#include "osdep/IdentityGenerator.hpp"
 
 #include "controller/JSONDB.hpp"
+#include "controller/IpAllocationMap.hpp"
+
+#include "service/ClusterGeoIpService.hpp"
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
 #include "ext/x64-salsa2012-asm/salsa2012.h"
@@ -365,16 +380,98 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	if (C25519::useReferenceImplementation(true)) {
+		std::cout << "[crypto] Testing 64-bit C25519 against reference implementation... "; std::cout.flush();
+		for(unsigned int i=0;i<64;++i) {
+			C25519::useReferenceImplementation(true);
+			const C25519::Pair rp(C25519::generate());
+			C25519::useReferenceImplementation(false);
+			const C25519::Pair fp(C25519::generate());
+			C25519::Public theirs;
+			Utils::getSecureRandom(theirs.data,theirs.size()); // usually not a valid point, results must still match
+			for(unsigned int k=0;k<sizeof(buf1);++k)
+				buf1[k] = (unsigned char)rand();
+			unsigned char k1[2][64],k2[2][64],k3[2][64];
+			C25519::Signature s1[2],s2[2];
+			for(unsigned int r=0;r<2;++r) {
+				C25519::useReferenceImplementation(r == 0);
+				C25519::agree(fp,rp.pub,k1[r],64);
+				C25519::agree(rp,fp.pub,k2[r],64);
+				C25519::agree(fp,theirs,k3[r],64);
+				s1[r] = C25519::sign(fp,buf1,sizeof(buf1));
+				s2[r] = C25519::sign(rp,buf1,sizeof(buf1));
+			}
+			if ((memcmp(k1[0],k1[1],64))||(memcmp(k1[0],k2[0],64))||(memcmp(k2[0],k2[1],64))||(memcmp(k3[0],k3[1],64))||(s1[0] != s1[1])||(s2[0] != s2[1])) {
+				C25519::useReferenceImplementation(false);
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+			C25519::Signature bad(s1[0]);
+			bad.data[rand() % 64] ^= (unsigned char)(1 << (rand() & 7));
+			for(unsigned int r=0;r<2;++r) {
+				C25519::useReferenceImplementation(r == 0);
+				if ((!C25519::verify(fp.pub,buf1,sizeof(buf1),s1[0]))||(!C25519::verify(rp.pub,buf1,sizeof(buf1),s2[0]))||(C25519::verify(fp.pub,buf1,sizeof(buf1),bad))) {
+					C25519::useReferenceImplementation(false);
+					std::cout << "FAIL (2)" << std::endl;
+					return -1;
+				}
+			}
+			C25519::useReferenceImplementation(false);
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
 	std::cout << "[crypto] Benchmarking C25519 ECC key agreement... "; std::cout.flush();
 	C25519::Pair bp[8];
 	for(int k=0;k<8;++k)
 		bp[k] = C25519::generate();
+	double refAgree = 0.0,refSign = 0.0,refVerify = 0.0;
+	if (C25519::useReferenceImplementation(true)) {
+		const uint64_t rst = OSUtils::now();
+		for(unsigned int k=0;k<50;++k) {
+			C25519::agree(bp[~k & 7],bp[k & 7].pub,buf1,64);
+		}
+		refAgree = (double)(OSUtils::now() - rst) / 50.0;
+		C25519::useReferenceImplementation(false);
+	}
 	const uint64_t st = OSUtils::now();
 	for(unsigned int k=0;k<50;++k) {
 		C25519::agree(bp[~k & 7],bp[k & 7].pub,buf1,64);
 	}
 	const uint64_t et = OSUtils::now();
-	std::cout << ((double)(et - st) / 50.0) << "ms per agreement." << std::endl;
+	const double fastAgree = (double)(et - st) / 50.0;
+	std::cout << fastAgree << "ms per agreement";
+	if (refAgree > 0.0)
+		std::cout << " (reference: " << refAgree << "ms, " << (refAgree / ((fastAgree > 0.0) ? fastAgree : 0.01)) << "x faster)";
+	std::cout << std::endl;
+
+	std::cout << "[crypto] Benchmarking Ed25519 ECC signatures... "; std::cout.flush();
+	{
+		C25519::Signature bsig;
+		for(unsigned int r=0;r<2;++r) {
+			if ((r == 0)&&(!C25519::useReferenceImplementation(true)))
+				continue;
+			C25519::useReferenceImplementation(r == 0);
+			uint64_t bst = OSUtils::now();
+			for(unsigned int k=0;k<50;++k)
+				bsig = C25519::sign(bp[k & 7],buf1,64);
+			const double sms = (double)(OSUtils::now() - bst) / 50.0;
+			bst = OSUtils::now();
+			for(unsigned int k=0;k<50;++k)
+				C25519::verify(bp[7].pub,buf1,64,bsig);
+			const double vms = (double)(OSUtils::now() - bst) / 50.0;
+			if (r == 0) {
+				refSign = sms;
+				refVerify = vms;
+			} else {
+				std::cout << sms << "ms per signature, " << vms << "ms per verification";
+				if ((refSign > 0.0)&&(refVerify > 0.0))
+					std::cout << " (reference: " << refSign << "ms, " << refVerify << "ms)";
+				std::cout << std::endl;
+			}
+		}
+		C25519::useReferenceImplementation(false);
+	}
 
 	std::cout << "[crypto] Testing Ed25519 ECC signatures... "; std::cout.flush();
 	C25519::Pair didntSign = C25519::generate();
@@ -412,6 +509,59 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[crypto] Testing Ed25519 batch signature verification... "; std::cout.flush();
+	{
+		C25519::Pair bsigners[4];
+		C25519::Signature bsigs[40];
+		unsigned char bmsgs[40][32];
+		C25519::BatchEntry be[40];
+		for(unsigned int k=0;k<4;++k)
+			bsigners[k] = C25519::generate();
+		for(unsigned int k=0;k<40;++k) {
+			Utils::getSecureRandom(bmsgs[k],32);
+			bsigs[k] = C25519::sign(bsigners[k & 3],bmsgs[k],32);
+			be[k].their = &(bsigners[k & 3].pub);
+			be[k].msg = bmsgs[k];
+			be[k].len = 32;
+			be[k].signature = bsigs[k].data;
+		}
+		uint64_t bst = OSUtils::now();
+		for(unsigned int k=0;k<40;++k) {
+			if (!C25519::verify(*(be[k].their),be[k].msg,be[k].len,be[k].signature)) {
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+		}
+		uint64_t bet = OSUtils::now();
+		const double individual = (double)(bet - bst) / 40.0;
+		bst = OSUtils::now();
+		if (!C25519::verifyBatch(be,40)) {
+			std::cout << "FAIL (2)" << std::endl;
+			return -1;
+		}
+		bet = OSUtils::now();
+		for(unsigned int k=0;k<40;++k) {
+			if (!be[k].valid) {
+				std::cout << "FAIL (3)" << std::endl;
+				return -1;
+			}
+		}
+		bsigs[21].data[rand() % 32] ^= 0x01; // corrupt R
+		bsigs[33].data[32 + (rand() % 31)] ^= 0x01; // corrupt s
+		be[7].their = &(didntSign.pub);
+		if (C25519::verifyBatch(be,40)) {
+			std::cout << "FAIL (4)" << std::endl;
+			return -1;
+		}
+		for(unsigned int k=0;k<40;++k) {
+			if (be[k].valid != ((k != 7)&&(k != 21)&&(k != 33))) {
+				std::cout << "FAIL (5)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS (" << individual << "ms individually, " << ((double)(bet - bst) / 40.0) << "ms batched per signature)" << std::endl;
+	}
+
 	return 0;
 }
 
@@ -461,6 +611,26 @@ static int testIdentity()
 		}
 	}
 
+	{
+		IdentityGenerator idgen(2);
+		std::cout << "[identity] Generate 2 identities with address prefix 0x2 (2 bits) on " << idgen.threads() << " threads... "; std::cout.flush();
+		uint64_t genstart = OSUtils::now();
+		const std::vector<Identity> ids(idgen.generate(2,0x2,2));
+		uint64_t genend = OSUtils::now();
+		std::cout << "(took " << (genend - genstart) << "ms, " << idgen.generated() << " generated): ";
+		if (ids.size() != 2) {
+			std::cout << "FAIL (got " << ids.size() << ")" << std::endl;
+			return -1;
+		}
+		for(std::vector<Identity>::const_iterator i(ids.begin());i!=ids.end();++i) {
+			if (((i->address().toInt() >> 38) != 0x2)||(!i->locallyValidate())) {
+				std::cout << "FAIL (" << i->address().toString() << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
 	{
 		Identity id2;
 		buf.clear();
@@ -618,6 +788,25 @@ static int testPacket()
 	}
 
 	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing that a full WHOIS batch gets an unfragmented OK... ";
+	{
+		// Older upstreams answer with one OK no matter how many addresses were asked for
+		Identity id;
+		id.fromString(KNOWN_GOOD_IDENTITY);
+		a.reset(Address(),Address(),Packet::VERB_OK);
+		a.append((unsigned char)Packet::VERB_WHOIS);
+		a.append((uint64_t)0);
+		for(unsigned int i=0;i<ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST;++i)
+			id.serialize(a,false);
+		std::cout << "(" << ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST << " identities, " << a.size() << " bytes) ";
+		if ((ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST < 1)||(a.size() > ZT_UDP_DEFAULT_PAYLOAD_MTU)) {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	return 0;
 }
 
@@ -843,6 +1032,35 @@ static int testOther()
 				return -1;
 			}
 		}
+		const DictionaryIndex idx(*test);
+		for(unsigned int q=0;q<32;++q) {
+			char tmp[128],tmp2[128];
+			const int r1 = test->get(key[q],tmp,sizeof(tmp));
+			const int r2 = idx.get(key[q],tmp2,sizeof(tmp2));
+			if ((r1 != r2)||(memcmp(tmp,tmp2,(r1 >= 0) ? (r1 + 1) : 1))||(test->getUI(key[q],7) != idx.getUI(key[q],7))) {
+				std::cout << "FAILED (DictionaryIndex returned a different value for key '" << key[q] << "')!" << std::endl;
+				return -1;
+			}
+		}
+		delete test;
+	}
+	{
+		// More keys than DictionaryIndex hashes, some duplicated
+		Dictionary<8194> *test = new Dictionary<8194>();
+		for(uint64_t q=0;q<(ZT_DICTIONARY_INDEX_MAX_KEYS * 2);++q) {
+			char key[16];
+			Utils::snprintf(key,sizeof(key),"k%u",(unsigned int)(q % ((ZT_DICTIONARY_INDEX_MAX_KEYS * 3) / 2)));
+			test->add(key,q);
+		}
+		const DictionaryIndex idx(*test);
+		for(unsigned int q=0;q<(ZT_DICTIONARY_INDEX_MAX_KEYS * 2);++q) {
+			char key[16];
+			Utils::snprintf(key,sizeof(key),"k%u",q);
+			if ((test->getUI(key,0xffff) != idx.getUI(key,0xffff))||(test->contains(key) != idx.contains(key))) {
+				std::cout << "FAILED (DictionaryIndex mismatch for key '" << key << "' past index capacity)!" << std::endl;
+				return -1;
+			}
+		}
 		delete test;
 	}
 	int foo = 0;
@@ -862,11 +1080,418 @@ static int testOther()
 			char value[8194];
 			*bar += test->get(tmp,value,sizeof(value));
 		}
+		const DictionaryIndex idx(*test);
+		for(unsigned int q=0;q<100;++q) {
+			char tmp[128];
+			for(unsigned int x=0;x<128;++x)
+				tmp[x] = (char)(rand() & 0xff);
+			tmp[127] = (char)0;
+			char value[8194];
+			*bar += idx.get(tmp,value,sizeof(value));
+		}
 		delete test;
 		delete[] tmp;
 	}
 	std::cout << "PASS (junk value to prevent optimization-out of test: " << foo << ")" << std::endl;
 
+	std::cout << "[other] Testing IpAllocationMap... "; std::cout.flush();
+	{
+		IpAllocationMap am;
+		std::set<uint32_t> ref;
+		for(int k=0;k<100000;++k) {
+			const uint32_t ip = 0x0a000000 + (uint32_t)(rand() % 4096);
+			if (rand() & 1) {
+				am.addV4(ip);
+				ref.insert(ip);
+			} else {
+				am.removeV4(ip);
+				ref.erase(ip);
+			}
+		}
+		if (am.v4Count() != (unsigned long)ref.size()) {
+			std::cout << "FAILED (count mismatch)" << std::endl;
+			return -1;
+		}
+		for(uint32_t ip=0x09ffff00;ip<0x0a001100;++ip) {
+			if (am.hasV4(ip) != (ref.count(ip) > 0)) {
+				std::cout << "FAILED (membership mismatch)" << std::endl;
+				return -1;
+			}
+			uint32_t f = 0;
+			const bool found = am.nextFreeV4(ip,0x0a000fff,f);
+			uint32_t rf = ip;
+			while ((rf <= 0x0a000fff)&&(ref.count(rf))) ++rf;
+			if ((found != (rf <= 0x0a000fff))||((found)&&(f != rf))) {
+				std::cout << "FAILED (nextFreeV4 mismatch)" << std::endl;
+				return -1;
+			}
+		}
+		am.clear();
+		for(uint32_t ip=0x0a000000;ip<0x0a010000;++ip)
+			am.addV4(ip);
+		am.removeV4(0x0a00fffe);
+		uint32_t f = 0;
+		if ((am.v4Runs() != 2)||(!am.nextFreeV4(0x0a000000,0x0a00ffff,f))||(f != 0x0a00fffe)) {
+			std::cout << "FAILED (full /16)" << std::endl;
+			return -1;
+		}
+		InetAddress v6("fd00::1234");
+		am.add(v6);
+		if ((!am.has(InetAddress("fd00::1234/64")))||(am.has(InetAddress("fd00::1235")))) {
+			std::cout << "FAILED (IPv6)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Metrics... "; std::cout.flush();
+	{
+		Metrics *m = new Metrics();
+		for(unsigned int k=0;k<1000;++k)
+			m->rx(Packet::VERB_FRAME,100);
+		m->rx(Packet::VERB_HELLO | 0x20,10); // flag bits above the verb are ignored
+		m->drop(ZT_METRICS_DROP_RATE_LIMITED);
+		m->relayed(1400);
+		m->ruleVerdict(false,ZT_METRICS_RULE_VERDICT_TEE);
+		m->cryptoTime(0);
+		m->cryptoTime(256);
+		m->cryptoTime(257);
+		m->cryptoTime(3000);
+		m->cryptoTime(1000000000ULL);
+		ZT_Metrics s;
+		memset(&s,0,sizeof(s));
+		m->get(s);
+		delete m;
+		if ((s.rxPackets[Packet::VERB_FRAME] != 1000)||(s.rxBytes[Packet::VERB_FRAME] != 100000)||(s.rxPackets[Packet::VERB_HELLO] != 1)) {
+			std::cout << "FAILED (rx counters)" << std::endl;
+			return -1;
+		}
+		if ((s.drops[ZT_METRICS_DROP_RATE_LIMITED] != 1)||(s.drops[ZT_METRICS_DROP_MAC_FAILED] != 0)||(s.relayedPackets != 1)||(s.relayedBytes != 1400)||(s.ruleVerdicts[1][ZT_METRICS_RULE_VERDICT_TEE] != 1)||(s.ruleVerdicts[0][ZT_METRICS_RULE_VERDICT_TEE] != 0)) {
+			std::cout << "FAILED (drop/relay/verdict counters)" << std::endl;
+			return -1;
+		}
+		// 0 and 256 -> bucket 0 (<=256ns), 257 -> bucket 1, 3000 -> bucket 4 (<=4096ns), 1s -> only in sum/count
+		if ((s.cryptoTimeBuckets[0] != 2)||(s.cryptoTimeBuckets[1] != 1)||(s.cryptoTimeBuckets[4] != 1)||(s.cryptoTimeCount != 5)||(s.cryptoTimeSum != 1000003513ULL)) {
+			std::cout << "FAILED (crypto time histogram)" << std::endl;
+			return -1;
+		}
+		const uint64_t t0 = Metrics::ticks();
+		if (Metrics::ticks() < t0) {
+			std::cout << "FAILED (ticks not monotonic)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing CredentialCache... "; std::cout.flush();
+	{
+		Identity signer;
+		signer.fromString(KNOWN_GOOD_IDENTITY);
+		char msg[128];
+		memset(msg,0x5a,sizeof(msg));
+		const C25519::Signature sig(signer.sign(msg,sizeof(msg)));
+		Metrics *m = new Metrics();
+		CredentialCache *cc = new CredentialCache(m);
+		bool ok = ((cc->verify(signer,msg,sizeof(msg),sig))&&(cc->verify(signer,msg,sizeof(msg),sig))&&(cc->verify(signer,msg,sizeof(msg),sig)));
+		msg[7] ^= 1; // altered credential is verified in full once, then rejected from the cache
+		ok = ((ok)&&(!cc->verify(signer,msg,sizeof(msg),sig))&&(!cc->verify(signer,msg,sizeof(msg),sig)));
+		CredentialBatch batch;
+		char bmsg[6][32];
+		C25519::Signature bsig[6];
+		for(unsigned int k=0;k<6;++k) {
+			memset(bmsg[k],(int)k,sizeof(bmsg[k]));
+			bsig[k] = signer.sign(bmsg[k],sizeof(bmsg[k]));
+		}
+		bsig[5].data[40] ^= 1;
+		for(unsigned int k=0;k<6;++k)
+			ok = ((ok)&&(cc->verify(signer,bmsg[k],sizeof(bmsg[k]),bsig[k],&batch))); // queued, not checked
+		ok = ((ok)&&(batch.size() == 6));
+		cc->verify(batch);
+		ok = ((ok)&&(batch.size() == 0));
+		for(unsigned int k=0;k<6;++k) // first use of a batch verified signature counts as a full verification
+			ok = ((ok)&&(cc->verify(signer,bmsg[k],sizeof(bmsg[k]),bsig[k]) == (k != 5)));
+		for(unsigned int k=0;k<6;++k)
+			ok = ((ok)&&(cc->verify(signer,bmsg[k],sizeof(bmsg[k]),bsig[k]) == (k != 5)));
+		ok = ((ok)&&(!cc->verify(signer,bmsg[5],sizeof(bmsg[5]),bsig[5],&batch))&&(batch.size() == 0)); // known bad, not queued again
+		ZT_Metrics s;
+		memset(&s,0,sizeof(s));
+		m->get(s);
+		delete cc;
+		delete m;
+		if ((!ok)||(s.credentialVerifications != 8)||(s.credentialVerificationsCached != 9)) {
+			std::cout << "FAILED" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing PacketTrace... "; std::cout.flush();
+	{
+		PacketTrace *pt = new PacketTrace();
+		pt->setSampleRate(3); // rounds up to 4
+		if ((pt->sampleRate() != 4)||(!pt->sampled(0x1000ULL | 0x07))||(pt->sampled(0x1008ULL))) {
+			std::cout << "FAILED (sampling)" << std::endl;
+			return -1;
+		}
+		pt->setSampleRate(1);
+		for(uint64_t k=0;k<(ZT_PACKET_TRACE_RING_SIZE + 100);++k)
+			pt->record((k << 3) | 0x05,ZT_TRACE_STAGE_RX_WIRE,(unsigned int)k,1000 + k);
+		ZT_TraceEventList *el = pt->events();
+		bool ok = ((el)&&(el->eventCount == ZT_PACKET_TRACE_RING_SIZE)&&(el->totalEvents == (ZT_PACKET_TRACE_RING_SIZE + 100)));
+		for(unsigned long k=0;((ok)&&(k<el->eventCount));++k)
+			ok = ((el->events[k].arg == (unsigned int)(k + 100))&&(el->events[k].packetId == ((uint64_t)(k + 100) << 3))&&(el->events[k].timestamp == (1100 + k)));
+		::free(el);
+		pt->setSampleRate(0);
+		pt->event(0,ZT_TRACE_STAGE_RX_DECODE,0);
+		el = pt->events();
+		ok = ((ok)&&(el)&&(el->totalEvents == (ZT_PACKET_TRACE_RING_SIZE + 100)));
+		::free(el);
+		delete pt;
+		if (!ok) {
+			std::cout << "FAILED (ring contents)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+#ifdef __UNIX_LIKE__
+	std::cout << "[other] Testing IdentityStore... "; std::cout.flush();
+	{
+		const char *const isp = "selftest-iddb.dat";
+		OSUtils::rm(isp);
+		std::map< uint64_t,std::string > ref;
+		IdentityStore *is = new IdentityStore();
+		if (!is->open(isp)) {
+			std::cout << "FAILED (open)" << std::endl;
+			return -1;
+		}
+		char idtmp[256];
+		for(unsigned int k=0;k<20000;++k) {
+			const uint64_t a = (uint64_t)(rand() % 5000) + 1;
+			Utils::snprintf(idtmp,sizeof(idtmp),"%.10llx:0:%.8x%.8x",(unsigned long long)a,(unsigned int)rand(),(unsigned int)((rand() % 3) * 1000));
+			is->put(a,idtmp,(unsigned int)strlen(idtmp),(uint64_t)(k + 1));
+			ref[a] = idtmp;
+			if ((k % 7) == 0) {
+				const uint64_t d = (uint64_t)(rand() % 5000) + 1;
+				is->erase(d);
+				ref.erase(d);
+			}
+		}
+		is->clean(1); // nothing is that old, so this only drops dead records
+		delete is;
+		is = new IdentityStore();
+		bool ok = ((is->open(isp))&&(is->size() == (unsigned long)ref.size()));
+		for(uint64_t a=1;((ok)&&(a<=5000));++a) {
+			unsigned long ts = 0;
+			const long n = is->get(a,idtmp,sizeof(idtmp),0,&ts);
+			std::map< uint64_t,std::string >::const_iterator r(ref.find(a));
+			if (r == ref.end())
+				ok = (n < 0);
+			else ok = ((n == (long)r->second.length())&&(ts == (unsigned long)n)&&(memcmp(idtmp,r->second.data(),n) == 0));
+		}
+		if (ok) {
+			// Everything written in the first half of the loop above is now expired
+			const unsigned long before = is->size();
+			ok = ((is->clean(10001) > 0)&&(is->size() < before));
+		}
+		delete is;
+		OSUtils::rm(isp);
+		if (!ok) {
+			std::cout << "FAILED (contents)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+#endif
+
+#ifdef __UNIX_LIKE__
+	std::cout << "[other] Testing JSONDB write-behind queue... "; std::cout.flush();
+	{
+		const char *const dbp = "selftest-jsondb";
+		OSUtils::rmDashRf(dbp);
+		JSONDB *db = new JSONDB(dbp);
+		nlohmann::json o;
+		std::string buf;
+
+		// Repeated puts of one object are one write of its latest value
+		for(int k=0;k<100;++k) {
+			o["v"] = k;
+			db->put("net","a",o);
+		}
+		bool ok = ((db->flush())&&(db->writes() == 1));
+		ok = ((ok)&&(OSUtils::readFile("selftest-jsondb/net/a.json",buf))&&(OSUtils::jsonInt(OSUtils::jsonParse(buf)["v"],0) == 99));
+
+		// flush() writes everything queued
+		for(int k=0;k<10;++k) {
+			char n[16];
+			Utils::snprintf(n,sizeof(n),"m%d",k);
+			o["v"] = k;
+			db->put("net",n,o);
+		}
+		ok = ((ok)&&(db->flush())&&(db->writes() == 11));
+
+		// A failed write is kept for retry, and a newer put replaces it
+		OSUtils::mkdir("selftest-jsondb/net/b.json"); // writing over a directory fails
+		o["v"] = 1;
+		db->put("net","b",o);
+		ok = ((ok)&&(!db->flush()));
+		o["v"] = 2;
+		db->put("net","b",o);
+		OSUtils::rmDashRf("selftest-jsondb/net/b.json");
+		buf.clear();
+		ok = ((ok)&&(db->flush())&&(OSUtils::readFile("selftest-jsondb/net/b.json",buf))&&(OSUtils::jsonInt(OSUtils::jsonParse(buf)["v"],0) == 2));
+
+		// erase() drops queued and failed writes, so they can't bring the object back
+		o["v"] = 3;
+		db->put("net","c",o);
+		db->erase("net","c");
+		OSUtils::mkdir("selftest-jsondb/net/d.json");
+		db->put("net","d",o);
+		ok = ((ok)&&(!db->flush()));
+		db->erase("net","d");
+		OSUtils::rmDashRf("selftest-jsondb/net/d.json");
+		ok = ((ok)&&(db->flush())&&(!OSUtils::fileExists("selftest-jsondb/net/c.json"))&&(!OSUtils::fileExists("selftest-jsondb/net/d.json")));
+		delete db;
+
+		// What was written is what a new instance loads
+		db = new JSONDB(dbp);
+		ok = ((ok)&&(OSUtils::jsonInt(db->get("net","a")["v"],0) == 99)&&(OSUtils::jsonInt(db->get("net","b")["v"],0) == 2)&&(OSUtils::jsonInt(db->get("net","m7")["v"],0) == 7));
+		ok = ((ok)&&(db->get("net","c").empty())&&(db->get("net","d").empty()));
+		delete db;
+		OSUtils::rmDashRf(dbp);
+		if (!ok) {
+			std::cout << "FAILED" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+#endif
+
+#ifdef ZT_ENABLE_CLUSTER
+	std::cout << "[other] Testing ClusterGeoIpService... "; std::cout.flush();
+	{
+		const char *const csv = "selftest-geoip.csv";
+		const char *const idx = "selftest-geoip.idx";
+		OSUtils::rm(idx);
+		int x = 0,y = 0,z = 0;
+
+		// Nothing usable in the CSV, so no index is written
+		OSUtils::writeFile(csv,std::string("not,an,ip,range\n"));
+		ClusterGeoIpService *gip = new ClusterGeoIpService();
+		bool ok = ((ClusterGeoIpService::convert(csv,0,1,2,3,idx) == 0)&&(gip->load(idx) < 0)&&(!gip->available())&&(!gip->locate(InetAddress("10.0.0.1",0),x,y,z)));
+
+		// IPv4 only, so the IPv6 table is empty
+		OSUtils::writeFile(csv,std::string("10.0.0.0,10.0.0.255,0,0\n"));
+		ok = ((ok)&&(ClusterGeoIpService::convert(csv,0,1,2,3,idx) == 1)&&(gip->load(idx) == 1)&&(gip->available()));
+		ok = ((ok)&&(gip->locate(InetAddress("10.0.0.1",0),x,y,z))&&(x == -6371)&&(y == 0)&&(z == 0));
+		ok = ((ok)&&(!gip->locate(InetAddress("2001:db8::1",0),x,y,z)));
+
+		// Overlapping ranges are trimmed so the later start wins. The IPv6
+		// range is trimmed to end just below one starting on a 64-bit
+		// boundary, which must borrow from the high half.
+		OSUtils::writeFile(csv,std::string(
+			"10.0.0.0,10.0.0.255,0,0\n"
+			"10.0.0.128,10.0.1.255,90,0\n"
+			"2001:db8::,2001:db8:0:2::ffff,-90,0\n"
+			"2001:db8:0:1::,2001:db8:0:1:ffff:ffff:ffff:ffff,0,90\n"
+			"garbage\n"));
+		ok = ((ok)&&(ClusterGeoIpService::convert(csv,0,1,2,3,idx) == 4)&&(gip->load(idx) == 4));
+		ok = ((ok)&&(gip->locate(InetAddress("10.0.0.127",0),x,y,z))&&(y == 0));
+		ok = ((ok)&&(gip->locate(InetAddress("10.0.0.128",0),x,y,z))&&(y == 6371));
+		ok = ((ok)&&(gip->locate(InetAddress("10.0.1.255",0),x,y,z))&&(y == 6371));
+		ok = ((ok)&&(!gip->locate(InetAddress("10.0.2.0",0),x,y,z))&&(!gip->locate(InetAddress("9.255.255.255",0),x,y,z)));
+		ok = ((ok)&&(gip->locate(InetAddress("2001:db8::ffff:ffff:ffff:ffff",0),x,y,z))&&(y == -6371));
+		ok = ((ok)&&(gip->locate(InetAddress("2001:db8:0:1::",0),x,y,z))&&(z == 6371));
+		ok = ((ok)&&(!gip->locate(InetAddress("2001:db8:0:2::1",0),x,y,z))&&(!gip->locate(InetAddress("2001:db7::1",0),x,y,z)));
+
+		// Damaged index files are rejected and the loaded index stays in use
+		std::string good;
+		ok = ((ok)&&(OSUtils::readFile(idx,good))&&(good.length() > 64));
+		if (ok) {
+			std::string bad(good.substr(0,10)); // shorter than the header
+			ok = ((OSUtils::writeFile(idx,bad))&&(gip->load(idx) < 0));
+			bad = good;
+			bad[0] ^= 1; // magic
+			ok = ((ok)&&(OSUtils::writeFile(idx,bad))&&(gip->load(idx) < 0));
+			bad = good.substr(0,good.length() - 8); // truncated
+			ok = ((ok)&&(OSUtils::writeFile(idx,bad))&&(gip->load(idx) < 0));
+			bad = good;
+			memset(&(bad[16]),0xff,8); // IPv4 range count
+			ok = ((ok)&&(OSUtils::writeFile(idx,bad))&&(gip->load(idx) < 0));
+			ok = ((ok)&&(gip->locate(InetAddress("10.0.0.128",0),x,y,z))&&(y == 6371));
+		}
+
+		delete gip;
+		OSUtils::rm(csv);
+		OSUtils::rm(idx);
+		if (!ok) {
+			std::cout << "FAILED" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+#endif
+
+	std::cout << "[other] Testing NetworkConfig binary format... "; std::cout.flush();
+	{
+		NetworkConfig *nc = new NetworkConfig();
+		NetworkConfig *nc2 = new NetworkConfig();
+		NetworkConfig *nc3 = new NetworkConfig();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *b = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const Address issuedTo(0x1122334455ULL);
+		nc->networkId = nwid;
+		nc->timestamp = 1234567890123ULL;
+		nc->credentialTimeMaxDelta = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+		nc->revision = 42;
+		nc->issuedTo = issuedTo;
+		nc->flags = ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
+		nc->multicastLimit = 32;
+		nc->type = ZT_NETWORK_TYPE_PRIVATE;
+		Utils::scopy(nc->name,sizeof(nc->name),"binary-test");
+		for(unsigned int i=0;i<(ZT_MAX_NETWORK_RULES - 1);++i) {
+			nc->rules[nc->ruleCount].t = (uint8_t)ZT_NETWORK_RULE_MATCH_IPV4_DEST;
+			nc->rules[nc->ruleCount].v.ipv4.ip = Utils::hton((uint32_t)(0x0a000000 + i));
+			nc->rules[nc->ruleCount++].v.ipv4.mask = 32;
+		}
+		nc->rules[nc->ruleCount++].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+		nc->capabilities[nc->capabilityCount++] = Capability(1,nwid,nc->timestamp,1,nc->rules,8);
+		nc->tags[nc->tagCount++] = Tag(nwid,nc->timestamp,issuedTo,100,7);
+		nc->com = CertificateOfMembership(nc->timestamp,nc->credentialTimeMaxDelta,nwid,issuedTo);
+		nc->staticIps[nc->staticIpCount++] = InetAddress("10.1.2.3/16");
+		nc->staticIps[nc->staticIpCount++] = InetAddress("fd80:56c2:e21c::1/88");
+		nc->addSpecialist(Address(0x0102030405ULL),ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
+		*(reinterpret_cast<InetAddress *>(&(nc->routes[0].target))) = InetAddress("10.1.0.0/16");
+		nc->routeCount = 1;
+
+		if ((!nc->toDictionary(*d,false))||(!nc2->fromDictionary(*d))) {
+			std::cout << "FAILED (dictionary)" << std::endl;
+			return -1;
+		}
+		if ((!nc->toBinary(*b))||(!NetworkConfig::isBinary(b->data(),b->size()))||(!nc3->fromBinary(b->data(),b->size()))) {
+			std::cout << "FAILED (binary)" << std::endl;
+			return -1;
+		}
+		if (*nc2 != *nc3) {
+			std::cout << "FAILED (binary and dictionary decode differ)" << std::endl;
+			return -1;
+		}
+		if (nc3->fromBinary(b->data(),b->size() - 1)) {
+			std::cout << "FAILED (accepted truncated config)" << std::endl;
+			return -1;
+		}
+
+		std::cout << "PASS (" << b->size() << " bytes binary, " << d->sizeBytes() << " bytes dictionary)" << std::endl;
+
+		delete b;
+		delete d;
+		delete nc3;
+		delete nc2;
+		delete nc;
+	}
+
 	return 0;
 }
 
@@ -938,6 +1563,1071 @@ struct TestPhyHandlers
 
 	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
 };
+struct DataStoreTestContext
+{
+	std::map<std::string,std::string> store;
+	std::vector< std::pair<std::string,uint64_t> > asyncGets;
+	std::vector<Address> sentTo;
+	std::vector<std::string> sent;
+};
+
+static long testDataStoreGet(ZT_Node *,void *uptr,void *,const char *name,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize)
+{
+	const DataStoreTestContext *const ctx = reinterpret_cast<const DataStoreTestContext *>(uptr);
+	std::map<std::string,std::string>::const_iterator o(ctx->store.find(name));
+	if ((o == ctx->store.end())||(readIndex >= o->second.length()))
+		return -1;
+	*totalSize = (unsigned long)o->second.length();
+	const unsigned long n = std::min(bufSize,(unsigned long)o->second.length() - readIndex);
+	memcpy(buf,o->second.data() + readIndex,n);
+	return (long)n;
+}
+static int testDataStorePut(ZT_Node *,void *uptr,void *,const char *name,const void *data,unsigned long len,int)
+{
+	DataStoreTestContext *const ctx = reinterpret_cast<DataStoreTestContext *>(uptr);
+	if (data)
+		ctx->store[name] = std::string((const char *)data,len);
+	else ctx->store.erase(name);
+	return 0;
+}
+static int testDataStoreGetAsync(ZT_Node *,void *uptr,void *,const char *name,uint64_t requestId)
+{
+	reinterpret_cast<DataStoreTestContext *>(uptr)->asyncGets.push_back(std::pair<std::string,uint64_t>(std::string(name),requestId));
+	return 0;
+}
+static int testDataStoreWirePacketSend(ZT_Node *,void *uptr,void *,const struct sockaddr_storage *,const struct sockaddr_storage *,const void *data,unsigned int len,unsigned int)
+{
+	if (len >= ZT_PROTO_MIN_PACKET_LENGTH) {
+		reinterpret_cast<DataStoreTestContext *>(uptr)->sentTo.push_back(Address(reinterpret_cast<const unsigned char *>(data) + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH));
+		reinterpret_cast<DataStoreTestContext *>(uptr)->sent.push_back(std::string(reinterpret_cast<const char *>(data),len));
+	}
+	return 0;
+}
+static void testDataStoreFrame(ZT_Node *,void *,void *,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *,unsigned int) {}
+static int testDataStoreConfig(ZT_Node *,void *,void *,uint64_t,void **,enum ZT_VirtualNetworkConfigOperation,const ZT_VirtualNetworkConfig *) { return 0; }
+static void testDataStoreEvent(ZT_Node *,void *,void *,enum ZT_Event,const void *) {}
+
+// Create a node backed by ctx (identity.secret defaults to KNOWN_GOOD_IDENTITY), NULL on failure
+static ZT_Node *newTestNode(DataStoreTestContext &ctx,uint64_t now,int callbacksVersion = 0)
+{
+	struct ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = callbacksVersion;
+	cb.dataStoreGetFunction = &testDataStoreGet;
+	cb.dataStorePutFunction = &testDataStorePut;
+	cb.wirePacketSendFunction = &testDataStoreWirePacketSend;
+	cb.virtualNetworkFrameFunction = &testDataStoreFrame;
+	cb.virtualNetworkConfigFunction = &testDataStoreConfig;
+	cb.eventCallback = &testDataStoreEvent;
+	if (callbacksVersion >= 1)
+		cb.dataStoreGetAsyncFunction = &testDataStoreGetAsync;
+	if (ctx.store.find("identity.secret") == ctx.store.end())
+		ctx.store["identity.secret"] = KNOWN_GOOD_IDENTITY;
+	ZT_Node *node = (ZT_Node *)0;
+	if (ZT_Node_new(&node,&ctx,(void *)0,&cb,now) != ZT_RESULT_OK)
+		return (ZT_Node *)0;
+	return node;
+}
+
+// Send node an armored ECHO from peer, as if it arrived over UDP
+static void testDataStoreSendEcho(ZT_Node *node,uint64_t now,const Identity &nodeId,const Identity &peer)
+{
+	unsigned char key[ZT_PEER_SECRET_KEY_LENGTH];
+	peer.agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+	Packet outp(nodeId.address(),peer.address(),Packet::VERB_ECHO);
+	outp.append("echo",4);
+	outp.armor(key,true,0);
+	InetAddress localAddress,remoteAddress("10.1.2.3/9993");
+	volatile uint64_t nextDeadline = 0;
+	ZT_Node_processWirePacket(node,(void *)0,now,reinterpret_cast<const struct sockaddr_storage *>(&localAddress),reinterpret_cast<const struct sockaddr_storage *>(&remoteAddress),outp.data(),outp.size(),&nextDeadline);
+}
+
+static int testDataStore()
+{
+	Identity nodeId,idA,idB;
+	std::cout << "[datastore] Generating identities for node, A (stored) and B (not stored)... "; std::cout.flush();
+	nodeId.generate();
+	idA.generate();
+	idB.generate();
+	std::cout << nodeId.address().toString() << ", " << idA.address().toString() << ", " << idB.address().toString() << std::endl;
+
+	char aName[64],bName[64];
+	Utils::snprintf(aName,sizeof(aName),"iddb.d/%.10llx",(unsigned long long)idA.address().toInt());
+	Utils::snprintf(bName,sizeof(bName),"iddb.d/%.10llx",(unsigned long long)idB.address().toInt());
+
+	DataStoreTestContext ctx;
+	ctx.store["identity.secret"] = nodeId.toString(true);
+	ctx.store[aName] = idA.toString(false);
+
+	uint64_t now = OSUtils::now();
+	ZT_Node *node = newTestNode(ctx,now,1);
+	if (!node) {
+		std::cout << "[datastore] Creating node with async get... FAIL" << std::endl;
+		return -1;
+	}
+
+	std::cout << "[datastore] Packet from A starts one async get and waits... ";
+	testDataStoreSendEcho(node,now,nodeId,idA);
+	testDataStoreSendEcho(node,++now,nodeId,idA);
+	if ((ctx.asyncGets.size() != 1)||(ctx.asyncGets[0].first != aName)||(std::find(ctx.sentTo.begin(),ctx.sentTo.end(),idA.address()) != ctx.sentTo.end())) {
+		std::cout << "FAIL (" << ctx.asyncGets.size() << " gets)" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "OK" << std::endl;
+
+	std::cout << "[datastore] Result for A answers the waiting packet... ";
+	volatile uint64_t nextDeadline = 0;
+	const std::string aIdStr(ctx.store[aName]);
+	ZT_Node_dataStoreGetResult(node,(void *)0,++now,ctx.asyncGets[0].second,aIdStr.data(),(long)aIdStr.length(),&nextDeadline);
+	if (std::find(ctx.sentTo.begin(),ctx.sentTo.end(),idA.address()) == ctx.sentTo.end()) {
+		std::cout << "FAIL" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	if (ZT_Node_dataStoreGetResult(node,(void *)0,++now,ctx.asyncGets[0].second,aIdStr.data(),(long)aIdStr.length(),&nextDeadline) != ZT_RESULT_OK) {
+		std::cout << "FAIL (repeated result not ignored)" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "OK" << std::endl;
+
+	std::cout << "[datastore] Miss for B ends the lookup so the next packet retries... ";
+	testDataStoreSendEcho(node,++now,nodeId,idB);
+	if ((ctx.asyncGets.size() != 2)||(ctx.asyncGets[1].first != bName)) {
+		std::cout << "FAIL (no get for B)" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	ZT_Node_dataStoreGetResult(node,(void *)0,++now,ctx.asyncGets[1].second,(const void *)0,-1,&nextDeadline);
+	testDataStoreSendEcho(node,++now,nodeId,idB);
+	if ((ctx.asyncGets.size() != 3)||(ctx.asyncGets[2].first != bName)||(std::find(ctx.sentTo.begin(),ctx.sentTo.end(),idB.address()) != ctx.sentTo.end())) {
+		std::cout << "FAIL (" << ctx.asyncGets.size() << " gets)" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "OK" << std::endl;
+	ZT_Node_delete(node);
+
+	std::cout << "[datastore] Version 0 callbacks look A up synchronously... ";
+	ctx.asyncGets.clear();
+	ctx.sentTo.clear();
+	node = newTestNode(ctx,++now,0);
+	if (!node) {
+		std::cout << "FAIL (node)" << std::endl;
+		return -1;
+	}
+	testDataStoreSendEcho(node,++now,nodeId,idA);
+	ZT_Node_delete(node);
+	if ((!ctx.asyncGets.empty())||(std::find(ctx.sentTo.begin(),ctx.sentTo.end(),idA.address()) == ctx.sentTo.end())) {
+		std::cout << "FAIL" << std::endl;
+		return -1;
+	}
+	std::cout << "OK" << std::endl;
+
+	return 0;
+}
+
+static int testPath()
+{
+	std::cout << "[path] Testing RTT, jitter and loss estimates... "; std::cout.flush();
+	{
+		Path p(InetAddress(),InetAddress("10.0.0.1/9993"));
+		bool ok = ((!p.latencyKnown())&&(p.cost() == ZT_PATH_UNKNOWN_LATENCY));
+		p.probeSent(1000);
+		p.probeAnswered(100); // first sample sets RTT, with variation half of it
+		ok = ((ok)&&(p.latencyKnown())&&(p.latency() == 100)&&(p.jitter() == 50)&&(p.loss() == 0)&&(p.cost() == 201));
+		p.probeAnswered(140); // RTT moves 1/8 and variation 1/4 of the way
+		ok = ((ok)&&(p.latency() == 105)&&(p.jitter() == 48));
+		for(int k=0;k<64;++k)
+			p.probeAnswered(100);
+		ok = ((ok)&&(p.latency() == 100)&&(p.jitter() == 0)&&(p.cost() == 101));
+		p.probeSent(2000);
+		p.probeSent(3000); // first probe was never answered
+		ok = ((ok)&&(p.loss() == (ZT_PATH_LOSS_MAX >> ZT_PATH_EWMA_SHIFT))&&(p.cost() == 151));
+		p.probeAnswered(100);
+		ok = ((ok)&&(p.loss() == (ZT_PATH_LOSS_MAX >> ZT_PATH_EWMA_SHIFT) - (ZT_PATH_LOSS_MAX >> (ZT_PATH_EWMA_SHIFT * 2)))&&(p.cost() == 145));
+		p.probeAnswered(100); // no probe outstanding, so no change to loss
+		ok = ((ok)&&(p.cost() == 145));
+		for(int k=0;k<200;++k)
+			p.probeSent(4000 + k);
+		ok = ((ok)&&(p.loss() == ZT_PATH_LOSS_MAX)&&(p.cost() == 505)); // 5x at 100% loss
+		if (!ok) {
+			std::cout << "FAILED (latency " << p.latency() << " jitter " << p.jitter() << " loss " << p.loss() << " cost " << p.cost() << ")" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[path] Testing path MTU discovery... "; std::cout.flush();
+	{
+		Path p(InetAddress(),InetAddress("10.0.0.1/9993"));
+		uint64_t t = ZT_PATH_MTU_RESEARCH_INTERVAL;
+		uint64_t probeId = 0;
+		bool ok = (p.nextMtuProbe(t) == ZT_PATH_MTU_PROBE_MAX); // search starts at the top
+		p.mtuProbeSent(++probeId);
+		ok = ((ok)&&(p.nextMtuProbe(t + 1) == 0)); // too soon
+
+		// The largest size goes unanswered, so after enough tries the search halves
+		for(unsigned int k=1;k<ZT_PATH_MTU_PROBE_TRIES;++k) {
+			ok = ((ok)&&(p.nextMtuProbe(t += ZT_PATH_MTU_PROBE_INTERVAL) == ZT_PATH_MTU_PROBE_MAX));
+			p.mtuProbeSent(++probeId);
+		}
+		unsigned int s = p.nextMtuProbe(t += ZT_PATH_MTU_PROBE_INTERVAL);
+		ok = ((ok)&&(s == (ZT_UDP_DEFAULT_PAYLOAD_MTU + ZT_PATH_MTU_PROBE_MAX) / 2)&&(p.mtu() == ZT_UDP_DEFAULT_PAYLOAD_MTU));
+		p.mtuProbeSent(++probeId);
+		ok = ((ok)&&(!p.mtuProbeAnswered(probeId - 1))&&(p.mtuProbeAnswered(probeId))&&(p.mtu() == s));
+
+		// Answering everything closes in on the ceiling that failed
+		unsigned int probes = 0;
+		while ((s = p.nextMtuProbe(t += ZT_PATH_MTU_PROBE_INTERVAL)) != 0) {
+			ok = ((ok)&&(s > p.mtu())&&(s < ZT_PATH_MTU_PROBE_MAX)&&(++probes < 16));
+			p.mtuProbeSent(++probeId);
+			p.mtuProbeAnswered(probeId);
+		}
+		const unsigned int found = p.mtu();
+		ok = ((ok)&&(found < ZT_PATH_MTU_PROBE_MAX)&&((ZT_PATH_MTU_PROBE_MAX - found) <= ZT_PATH_MTU_PROBE_GRANULARITY));
+
+		// A successful re-check keeps the MTU and the search starts over from the top
+		t += ZT_PATH_MTU_RESEARCH_INTERVAL;
+		ok = ((ok)&&(p.nextMtuProbe(t) == found));
+		p.mtuProbeSent(++probeId);
+		ok = ((ok)&&(p.mtuProbeAnswered(probeId))&&(p.mtu() == found));
+		ok = ((ok)&&(p.nextMtuProbe(t += ZT_PATH_MTU_PROBE_INTERVAL) == ZT_PATH_MTU_PROBE_MAX));
+		p.mtuProbeSent(++probeId);
+
+		// A failed re-check falls back to the default
+		t += ZT_PATH_MTU_RESEARCH_INTERVAL;
+		ok = ((ok)&&(p.nextMtuProbe(t) == found));
+		p.mtuProbeSent(++probeId);
+		for(unsigned int k=1;k<ZT_PATH_MTU_PROBE_TRIES;++k) {
+			ok = ((ok)&&(p.nextMtuProbe(t += ZT_PATH_MTU_PROBE_INTERVAL) == found));
+			p.mtuProbeSent(++probeId);
+		}
+		ok = ((ok)&&(p.nextMtuProbe(t += ZT_PATH_MTU_PROBE_INTERVAL) == ZT_PATH_MTU_PROBE_MAX)&&(p.mtu() == ZT_UDP_DEFAULT_PAYLOAD_MTU));
+
+		// The reply to the largest probe must fit in a packet (built as in IncomingPacket::_doECHO())
+		try {
+			Packet probe(Address(),Address(),Packet::VERB_ECHO);
+			probe.setSize(ZT_PATH_MTU_PROBE_MAX);
+			Packet reply(Address(),Address(),Packet::VERB_OK);
+			reply.append((unsigned char)Packet::VERB_ECHO);
+			reply.append((uint64_t)probe.packetId());
+			reply.append(reinterpret_cast<const unsigned char *>(probe.data()) + ZT_PACKET_IDX_PAYLOAD,probe.size() - ZT_PACKET_IDX_PAYLOAD);
+		} catch ( ... ) {
+			ok = false;
+		}
+
+		if (!ok) {
+			std::cout << "FAILED (mtu " << p.mtu() << ")" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[path] Testing best path hysteresis... "; std::cout.flush();
+	{
+		DataStoreTestContext ctx;
+		uint64_t now = OSUtils::now();
+		ZT_Node *node = newTestNode(ctx,now);
+		if (!node) {
+			std::cout << "FAILED (node)" << std::endl;
+			return -1;
+		}
+
+		RuntimeEnvironment rr(reinterpret_cast<Node *>(node));
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		Identity peerId;
+		peerId.generate();
+		bool ok;
+		{
+			SharedPtr<Peer> peer(new Peer(&rr,rr.identity,peerId));
+			SharedPtr<Path> v4(new Path(InetAddress(),InetAddress("10.0.0.1/9993")));
+			SharedPtr<Path> v6(new Path(InetAddress(),InetAddress("fd00::1/9993"))); // same scope as v4, so ranks higher
+			v4->received(now,64);
+			v6->received(now,64);
+			peer->received((void *)0,v4,0,1,Packet::VERB_OK,0,Packet::VERB_NOP,false);
+			peer->received((void *)0,v6,0,2,Packet::VERB_OK,0,Packet::VERB_NOP,false);
+
+			for(int k=0;k<64;++k) {
+				v4->probeAnswered(100);
+				v6->probeAnswered(110);
+			}
+			ok = (peer->getBestPath(now,false) == v6); // within 1/8 and nothing chosen yet, so rank decides
+			for(int k=0;k<64;++k)
+				v4->probeAnswered(90);
+			ok = ((ok)&&(peer->getBestPath(now,false) == v4)); // clearly cheaper
+			for(int k=0;k<64;++k)
+				v6->probeAnswered(100);
+			ok = ((ok)&&(peer->getBestPath(now,false) == v4)); // back within 1/8, but the current path stays
+			for(int k=0;k<64;++k)
+				v6->probeAnswered(85);
+			ok = ((ok)&&(peer->getBestPath(now,false) == v4)); // a little cheaper isn't enough either
+			for(int k=0;k<64;++k)
+				v6->probeAnswered(70);
+			ok = ((ok)&&(peer->getBestPath(now,false) == v6)); // clearly cheaper
+			for(int k=0;k<64;++k)
+				v4->probeAnswered(65);
+			ok = ((ok)&&(peer->getBestPath(now,false) == v6));
+			now += ZT_PATH_ALIVE_TIMEOUT + 1;
+			v4->received(now,64);
+			ok = ((ok)&&(peer->getBestPath(now,false) == v4)); // live beats dead regardless of cost
+		}
+		ZT_Node_delete(node);
+
+		if (!ok) {
+			std::cout << "FAILED" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+// Give peer a live direct path to endpoint, last heard from at lastIn
+static SharedPtr<Path> testMultipathAddPath(const SharedPtr<Peer> &peer,const char *endpoint,uint64_t lastIn)
+{
+	SharedPtr<Path> path(new Path(InetAddress(),InetAddress(endpoint)));
+	path->received(lastIn,64);
+	peer->received((void *)0,path,0,1,Packet::VERB_OK,0,Packet::VERB_NOP,false);
+	return path;
+}
+
+static bool testMultipathHasPath(const std::vector< SharedPtr<Path> > &paths,const char *endpoint)
+{
+	for(std::vector< SharedPtr<Path> >::const_iterator p(paths.begin());p!=paths.end();++p) {
+		if ((*p)->address() == InetAddress(endpoint))
+			return true;
+	}
+	return false;
+}
+
+static int testMultipath()
+{
+	std::cout << "[multipath] Testing IP flow IDs... "; std::cout.flush();
+	{
+		uint8_t ip[64];
+		memset(ip,0,sizeof(ip));
+		ip[0] = 0x45; // IPv4, 20 byte header
+		ip[9] = 6; // TCP
+		ip[12] = 10; ip[15] = 1; // 10.0.0.1
+		ip[16] = 10; ip[19] = 2; // 10.0.0.2
+		ip[20] = 0x30; ip[21] = 0x39; // source port 12345
+		ip[22] = 0x00; ip[23] = 0x50; // destination port 80
+		const uint32_t f = Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),true);
+		bool ok = ((f != ZT_FLOW_ID_NONE)&&(f != ZT_FLOW_ID_ALL_PATHS));
+		ip[40] = 0xff; // payload doesn't matter
+		ok = ((ok)&&(Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),true) == f));
+		ip[21] = 0x3a; // another source port is another flow
+		const uint32_t f2 = Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),true);
+		ok = ((ok)&&(f2 != f));
+		ip[6] = 0x20; // fragments hash without ports, so all fragments of a packet stay together
+		const uint32_t ff = Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),true);
+		ip[21] = 0x39;
+		ok = ((ok)&&(ff != f2)&&(Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),true) == ff));
+		ip[6] = 0;
+		ip[1] = 46 << 2; // DSCP EF
+		ok = ((ok)&&(Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),true) == ZT_FLOW_ID_ALL_PATHS)&&(Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,sizeof(ip),false) == f));
+		ok = ((ok)&&(Switch::ipFlowId(ZT_ETHERTYPE_ARP,ip,sizeof(ip),true) == ZT_FLOW_ID_NONE)&&(Switch::ipFlowId(ZT_ETHERTYPE_IPV4,ip,19,true) == ZT_FLOW_ID_NONE));
+		if (!ok) {
+			std::cout << "FAILED" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	DataStoreTestContext ctx;
+	const uint64_t now = OSUtils::now();
+	ZT_Node *node = newTestNode(ctx,now);
+	if (!node) {
+		std::cout << "[multipath] Creating node... FAILED" << std::endl;
+		return -1;
+	}
+	RuntimeEnvironment rr(reinterpret_cast<Node *>(node));
+	rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+	Identity peerId;
+	peerId.generate();
+	bool ok = true;
+
+	std::cout << "[multipath] Testing duplicate frame filter... "; std::cout.flush();
+	{
+		Switch sw(&rr);
+		const Address a(peerId.address()),b((uint64_t)0x0102030405ULL);
+		ok = (!sw.duplicateFrame(a,0x1234567890abcdf0ULL));
+		ok = ((ok)&&(sw.duplicateFrame(a,0x1234567890abcdf3ULL))); // same frame, other link quality counter
+		ok = ((ok)&&(!sw.duplicateFrame(b,0x1234567890abcdf0ULL))); // same packet ID from someone else
+		ok = ((ok)&&(!sw.duplicateFrame(a,0x1234567890abcdf8ULL))); // next packet
+		unsigned int falseDrops = 0;
+		for(uint64_t k=1;k<=100000;++k) {
+			if (sw.duplicateFrame(a,k << 3))
+				++falseDrops;
+		}
+		ok = ((ok)&&(falseDrops == 0));
+	}
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[multipath] Testing flows stick to one path and spread across paths... "; std::cout.flush();
+	{
+		SharedPtr<Peer> peer(new Peer(&rr,rr.identity,peerId));
+		const char *const endpoints[3] = { "10.0.0.1/9993","10.0.0.2/9993","10.0.0.3/9993" };
+		SharedPtr<Path> paths[3];
+		for(unsigned int i=0;i<3;++i)
+			paths[i] = testMultipathAddPath(peer,endpoints[i],now);
+
+		const SharedPtr<Path> best(peer->getBestPath(now,false));
+		for(uint32_t f=1;((ok)&&(f<=300));++f) // multipath off, flow IDs are ignored
+			ok = (peer->getBestPath(now,false,f) == best);
+
+		ZT_Node_setMultipathMode(node,ZT_MULTIPATH_BALANCE);
+		unsigned int perPath[3] = { 0,0,0 };
+		for(uint32_t f=1;((ok)&&(f<=300));++f) {
+			const SharedPtr<Path> p(peer->getBestPath(now,false,f));
+			for(unsigned int k=0;((ok)&&(k<3));++k)
+				ok = (peer->getBestPath(now,false,f) == p);
+			for(unsigned int i=0;i<3;++i) {
+				if (p == paths[i])
+					++perPath[i];
+			}
+		}
+		ok = ((ok)&&(perPath[0] > 50)&&(perPath[1] > 50)&&(perPath[2] > 50));
+		ZT_Node_setMultipathMode(node,ZT_MULTIPATH_NONE);
+		if (!ok)
+			std::cout << "(" << perPath[0] << "," << perPath[1] << "," << perPath[2] << ") ";
+	}
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[multipath] Testing path slot replacement when all slots are full... "; std::cout.flush();
+	{
+		SharedPtr<Peer> peer(new Peer(&rr,rr.identity,peerId));
+		char ep[64];
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			Utils::snprintf(ep,sizeof(ep),"10.0.0.%u/9993",i + 1);
+			testMultipathAddPath(peer,ep,(i == 1) ? (now - 1000) : now); // 10.0.0.2 is the least recently heard from
+		}
+		ok = (peer->paths(now).size() == ZT_MAX_PEER_NETWORK_PATHS);
+
+		// A lower ranked (global scope) path does not push out a private one
+		testMultipathAddPath(peer,"8.8.8.8/9993",now);
+		ok = ((ok)&&(!testMultipathHasPath(peer->paths(now),"8.8.8.8/9993")));
+
+		// An equally ranked path replaces the least recently heard from one
+		testMultipathAddPath(peer,"10.0.0.9/9993",now);
+		std::vector< SharedPtr<Path> > pp(peer->paths(now));
+		ok = ((ok)&&(pp.size() == ZT_MAX_PEER_NETWORK_PATHS)&&(testMultipathHasPath(pp,"10.0.0.9/9993"))&&(!testMultipathHasPath(pp,"10.0.0.2/9993")));
+
+		// A new port at a known IP (e.g. after a NAT remap) replaces that IP's path
+		testMultipathAddPath(peer,"10.0.0.3/9994",now);
+		pp = peer->paths(now);
+		ok = ((ok)&&(pp.size() == ZT_MAX_PEER_NETWORK_PATHS)&&(testMultipathHasPath(pp,"10.0.0.3/9994"))&&(!testMultipathHasPath(pp,"10.0.0.3/9993")));
+
+		// A higher ranked (private IPv6) path goes in too
+		testMultipathAddPath(peer,"fd00::1/9993",now);
+		pp = peer->paths(now);
+		ok = ((ok)&&(pp.size() == ZT_MAX_PEER_NETWORK_PATHS)&&(testMultipathHasPath(pp,"fd00::1/9993")));
+	}
+	ZT_Node_delete(node);
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+// A live peer with one direct path, as savePeerSnapshot() would write it
+static SharedPtr<Peer> testSnapshotPeer(const RuntimeEnvironment *rr,const Identity &id,const char *endpoint,uint64_t now)
+{
+	SharedPtr<Peer> p(new Peer(rr,rr->identity,id));
+	SharedPtr<Path> path(new Path(InetAddress(),InetAddress(endpoint)));
+	path->received(now,64);
+	p->received((void *)0,path,0,1,Packet::VERB_OK,0,Packet::VERB_NOP,false);
+	p->setRemoteVersion(9,1,2,4);
+	return p;
+}
+
+// Copy of snapshot s with its header timestamp replaced
+static std::string testSnapshotWithTime(std::string s,uint64_t ts)
+{
+	for(unsigned int i=0;i<8;++i)
+		s[6 + i] = (char)((ts >> (56 - (i * 8))) & 0xff);
+	return s;
+}
+
+// Number of peers a and b that a new Topology restores from snapshot s
+static unsigned int testSnapshotRestored(RuntimeEnvironment &rr,DataStoreTestContext &ctx,const std::string &s,const Identity &a,const Identity &b)
+{
+	ctx.store["peers.save"] = s;
+	Topology *const t = new Topology(&rr,(void *)0);
+	unsigned int n = 0;
+	SharedPtr<Peer> p(t->getPeerNoCache(a.address()));
+	if ((p)&&(p->identity() == a))
+		++n;
+	p = t->getPeerNoCache(b.address());
+	if ((p)&&(p->identity() == b))
+		++n;
+	delete t;
+	return n;
+}
+
+static int testPeerSnapshot()
+{
+	Identity idA,idB;
+	std::cout << "[snapshot] Generating identities for peers A and B... "; std::cout.flush();
+	idA.generate();
+	idB.generate();
+	std::cout << idA.address().toString() << ", " << idB.address().toString() << std::endl;
+
+	DataStoreTestContext ctx;
+	const uint64_t now = OSUtils::now();
+	ZT_Node *node = newTestNode(ctx,now);
+	if (!node) {
+		std::cout << "[snapshot] Creating node... FAILED" << std::endl;
+		return -1;
+	}
+	RuntimeEnvironment rr(reinterpret_cast<Node *>(node));
+	rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+	rr.topology = new Topology(&rr,(void *)0);
+	const SharedPtr<Peer> a(testSnapshotPeer(&rr,idA,"10.0.0.1/9993",now));
+	const SharedPtr<Peer> b(testSnapshotPeer(&rr,idB,"10.0.0.2/9993",now));
+	bool ok;
+
+	std::cout << "[snapshot] Testing peer record round trip... "; std::cout.flush();
+	{
+		Buffer<ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE> rec;
+		std::vector<InetAddress> endpoints;
+		ok = (a->serializeForSnapshot(rec,now) == 1);
+		const SharedPtr<Peer> r(Peer::deserializeFromSnapshot(&rr,rec,endpoints));
+		ok = ((ok)&&(r)&&(r->identity() == idA)&&(memcmp(r->key(),a->key(),ZT_PEER_SECRET_KEY_LENGTH) == 0));
+		ok = ((ok)&&(r->remoteVersionProtocol() == 9)&&(r->remoteVersionMajor() == 1)&&(r->remoteVersionMinor() == 2)&&(r->remoteVersionRevision() == 4));
+		ok = ((ok)&&(endpoints.size() == 1)&&(endpoints[0] == InetAddress("10.0.0.1/9993")));
+		for(unsigned int l=0;((ok)&&(l<rec.size()));++l) { // every truncation is rejected
+			const Buffer<ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE> t(rec.data(),l);
+			endpoints.clear();
+			ok = (!Peer::deserializeFromSnapshot(&rr,t,endpoints));
+		}
+	}
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		delete rr.topology;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[snapshot] Testing save, restore and rejection of bad snapshots... "; std::cout.flush();
+	{
+		rr.topology->addPeer((void *)0,a);
+		rr.topology->addPeer((void *)0,b);
+		rr.topology->savePeerSnapshot((void *)0,now);
+		const std::string saved(ctx.store["peers.save"]);
+		ok = (testSnapshotRestored(rr,ctx,saved,idA,idB) == 2);
+
+		std::string s(saved);
+		s[0] = 2; // unknown format version
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,s,idA,idB) == 0));
+		s = saved;
+		s[1] ^= 0x01; // written by another node
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,s,idA,idB) == 0));
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,testSnapshotWithTime(saved,now - ZT_PEER_SNAPSHOT_MAX_AGE - 1),idA,idB) == 0));
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,testSnapshotWithTime(saved,now - ZT_PEER_SNAPSHOT_MAX_AGE + 1000),idA,idB) == 2));
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,testSnapshotWithTime(saved,now + 1000),idA,idB) == 0));
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,saved.substr(0,13),idA,idB) == 0));
+
+		// Damage the second record; the first is still restored
+		const unsigned int firstLen = ((unsigned int)(uint8_t)saved[14] << 8) | (unsigned int)(uint8_t)saved[15];
+		const std::string first(saved.substr(0,16 + firstLen));
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,saved.substr(0,saved.length() - 1),idA,idB) == 1));
+		s = first;
+		s.push_back((char)((ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE + 1) >> 8));
+		s.push_back((char)((ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE + 1) & 0xff));
+		s.append(saved.substr(16 + firstLen + 2));
+		s.append(ZT_PEER_SNAPSHOT_MAX_RECORD_SIZE,(char)0);
+		ok = ((ok)&&(testSnapshotRestored(rr,ctx,s,idA,idB) == 1));
+	}
+	delete rr.topology;
+	ZT_Node_delete(node);
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+// An identity for address a borrowing KNOWN_GOOD_IDENTITY's public key; nothing here validates it
+static Identity testWhoisIdentity(const Address &a)
+{
+	char s[256];
+	Utils::snprintf(s,sizeof(s),"%.10llx:0:%s",(unsigned long long)a.toInt(),std::string(KNOWN_GOOD_IDENTITY).substr(13,ZT_C25519_PUBLIC_KEY_LEN * 2).c_str());
+	Identity id;
+	id.fromString(s);
+	return id;
+}
+
+// Advance the node's clock, which requestWhois() reads, by feeding it a runt packet
+static void testWhoisSetNow(ZT_Node *node,uint64_t now)
+{
+	const char runt = 0;
+	InetAddress localAddress,remoteAddress("10.0.3.99/9993");
+	volatile uint64_t nextDeadline = 0;
+	ZT_Node_processWirePacket(node,(void *)0,now,reinterpret_cast<const struct sockaddr_storage *>(&localAddress),reinterpret_cast<const struct sockaddr_storage *>(&remoteAddress),&runt,1,&nextDeadline);
+}
+
+struct WhoisTestPacket
+{
+	Address to;
+	uint64_t packetId;
+	std::vector<Address> addresses;
+};
+
+// WHOIS requests rr has sent to its upstreams since ctx.sent[from]
+static std::vector<WhoisTestPacket> testWhoisSent(const RuntimeEnvironment &rr,const DataStoreTestContext &ctx,unsigned long from)
+{
+	std::vector<WhoisTestPacket> r;
+	for(unsigned long i=from;i<ctx.sent.size();++i) {
+		Packet p(ctx.sent[i].data(),(unsigned int)ctx.sent[i].length());
+		const SharedPtr<Peer> up(rr.topology->getPeerNoCache(p.destination()));
+		if ((!up)||(!rr.topology->isUpstream(up->identity()))||(!p.dearmor(up->key()))||(p.verb() != Packet::VERB_WHOIS))
+			continue;
+		WhoisTestPacket w;
+		w.to = p.destination();
+		w.packetId = p.packetId();
+		for(unsigned int ptr=ZT_PACKET_IDX_PAYLOAD;(ptr + ZT_ADDRESS_LENGTH)<=p.size();ptr+=ZT_ADDRESS_LENGTH)
+			w.addresses.push_back(Address(p.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH));
+		r.push_back(w);
+	}
+	return r;
+}
+
+// True if sent holds each of addresses exactly once, at most ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST per
+// packet, with each address asking upstream (address + retries) % n in the sorted upstream list
+static bool testWhoisSentTo(const std::vector<WhoisTestPacket> &sent,const std::vector<Address> &addresses,const std::vector<Address> &upstreams,unsigned int retries)
+{
+	std::map<Address,unsigned int> seen;
+	for(std::vector<WhoisTestPacket>::const_iterator w(sent.begin());w!=sent.end();++w) {
+		if ((w->addresses.empty())||(w->addresses.size() > ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST))
+			return false;
+		for(std::vector<Address>::const_iterator a(w->addresses.begin());a!=w->addresses.end();++a) {
+			if (upstreams[(unsigned long)((a->toInt() + retries) % upstreams.size())] != w->to)
+				return false;
+			++seen[*a];
+		}
+	}
+	if (seen.size() != addresses.size())
+		return false;
+	for(std::vector<Address>::const_iterator a(addresses.begin());a!=addresses.end();++a) {
+		if (seen[*a] != 1)
+			return false;
+	}
+	return true;
+}
+
+static int testWhois()
+{
+	DataStoreTestContext ctx;
+	uint64_t now = OSUtils::now();
+	ZT_Node *node = newTestNode(ctx,now);
+	if (!node) {
+		std::cout << "[whois] Creating node... FAILED" << std::endl;
+		return -1;
+	}
+	RuntimeEnvironment rr(reinterpret_cast<Node *>(node));
+	rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+	rr.metrics = new Metrics();
+	rr.trace = new PacketTrace();
+	rr.topology = new Topology(&rr,(void *)0);
+	rr.sw = new Switch(&rr);
+
+	// Give every root a live path at its stable endpoint so WHOIS spreads across all of them
+	const std::vector<Address> upstreams(rr.topology->upstreamAddresses());
+	const World planet(rr.topology->planet());
+	std::vector< SharedPtr<Path> > upstreamPaths;
+	for(unsigned long i=0;i<upstreams.size();++i) {
+		for(std::vector<World::Root>::const_iterator r(planet.roots().begin());r!=planet.roots().end();++r) {
+			if ((r->identity.address() == upstreams[i])&&(!r->stableEndpoints.empty()))
+				upstreamPaths.push_back(SharedPtr<Path>(new Path(InetAddress(),r->stableEndpoints.front())));
+		}
+		if (upstreamPaths.size() != (i + 1))
+			break;
+		upstreamPaths.back()->received(now,64);
+		rr.topology->getPeerNoCache(upstreams[i])->received((void *)0,upstreamPaths.back(),0,1,Packet::VERB_OK,0,Packet::VERB_NOP,false);
+	}
+
+	// 30 addresses bound for the same upstream (more than fit in one request) and 10 spread out
+	std::vector<Address> addresses;
+	for(uint64_t k=0;k<40;++k) {
+		addresses.push_back(Address(0x2000000000ULL + ((k < 30) ? (k * (uint64_t)upstreams.size()) : (k * 7919ULL))));
+		char name[64];
+		Utils::snprintf(name,sizeof(name),"iddb.d/%.10llx",(unsigned long long)addresses.back().toInt());
+		ctx.store[name] = testWhoisIdentity(addresses.back()).toString(false);
+	}
+	const std::vector<Address> first(1,addresses[0]),held(addresses.begin() + 1,addresses.end());
+	std::vector<WhoisTestPacket> retried;
+	bool ok = ((upstreams.size() >= 2)&&(upstreamPaths.size() == upstreams.size()));
+
+	std::cout << "[whois] Testing request coalescing and upstream rotation... "; std::cout.flush();
+	{
+		testWhoisSetNow(node,now);
+		unsigned long mark = (unsigned long)ctx.sent.size();
+		rr.sw->requestWhois((void *)0,addresses[0]); // nothing sent recently, so this goes out at once
+		ok = ((ok)&&(testWhoisSentTo(testWhoisSent(rr,ctx,mark),first,upstreams,0))&&(rr.sw->whoisFlushDeadline() == 0));
+
+		mark = (unsigned long)ctx.sent.size();
+		for(std::vector<Address>::const_iterator a(held.begin());a!=held.end();++a)
+			rr.sw->requestWhois((void *)0,*a);
+		ok = ((ok)&&(testWhoisSent(rr,ctx,mark).empty())&&(rr.sw->whoisFlushDeadline() == (now + ZT_WHOIS_COALESCE_DELAY))&&(rr.sw->whoisQueueDepth() == 40));
+
+		now += ZT_WHOIS_COALESCE_DELAY;
+		testWhoisSetNow(node,now);
+		rr.sw->doTimerTasks((void *)0,now);
+		const std::vector<WhoisTestPacket> batched(testWhoisSent(rr,ctx,mark));
+		ok = ((ok)&&(testWhoisSentTo(batched,held,upstreams,0))&&(batched.size() < held.size())&&(rr.sw->whoisFlushDeadline() == 0));
+
+		now += ZT_WHOIS_RETRY_DELAY;
+		testWhoisSetNow(node,now);
+		mark = (unsigned long)ctx.sent.size();
+		rr.sw->doTimerTasks((void *)0,now); // every address is retried via the next upstream
+		retried = testWhoisSent(rr,ctx,mark);
+		ok = ((ok)&&(testWhoisSentTo(retried,addresses,upstreams,1)));
+	}
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		delete rr.sw;
+		delete rr.topology;
+		delete rr.trace;
+		delete rr.metrics;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[whois] Testing OK(WHOIS) carrying many identities... "; std::cout.flush();
+	{
+		// Answer the largest retried request from the upstream it went to
+		const WhoisTestPacket *w = &(retried[0]);
+		for(std::vector<WhoisTestPacket>::const_iterator i(retried.begin());i!=retried.end();++i) {
+			if (i->addresses.size() > w->addresses.size())
+				w = &(*i);
+		}
+		const SharedPtr<Peer> up(rr.topology->getPeerNoCache(w->to));
+		const SharedPtr<Path> upPath(upstreamPaths[std::find(upstreams.begin(),upstreams.end(),w->to) - upstreams.begin()]);
+		for(unsigned int expected=0;expected<2;++expected) {
+			Packet outp(rr.identity.address(),w->to,Packet::VERB_OK);
+			outp.append((unsigned char)Packet::VERB_WHOIS);
+			outp.append((uint64_t)((expected) ? w->packetId : (w->packetId ^ 0xffffffff00000000ULL)));
+			for(std::vector<Address>::const_iterator a(w->addresses.begin());a!=w->addresses.end();++a)
+				testWhoisIdentity(*a).serialize(outp,false);
+			outp.armor(up->key(),true,0);
+			IncomingPacket in(outp.data(),outp.size(),upPath,now);
+			in.tryDecode(&rr,(void *)0);
+
+			unsigned int known = 0;
+			for(std::vector<Address>::const_iterator a(w->addresses.begin());a!=w->addresses.end();++a) {
+				const SharedPtr<Peer> p(rr.topology->getPeerNoCache(*a));
+				if ((p)&&(p->identity() == testWhoisIdentity(*a)))
+					++known;
+			}
+			if (expected) // every identity is learned and its WHOIS is done
+				ok = ((ok)&&(w->addresses.size() > 1)&&(known == w->addresses.size())&&(rr.sw->whoisQueueDepth() == (40 - known)));
+			else ok = ((ok)&&(known == 0)&&(rr.sw->whoisQueueDepth() == 40)); // not a reply to anything we asked
+		}
+	}
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		delete rr.sw;
+		delete rr.topology;
+		delete rr.trace;
+		delete rr.metrics;
+		ZT_Node_delete(node);
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[whois] Testing WHOIS replies are split to fit ZT_UDP_DEFAULT_PAYLOAD_MTU... "; std::cout.flush();
+	{
+		unsigned char key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		const Identity requester(testWhoisIdentity(Address((uint64_t)0x3000000001ULL)));
+		rr.topology->addPeer((void *)0,SharedPtr<Peer>(new Peer(&rr,rr.identity,requester,key)));
+		const SharedPtr<Path> requesterPath(new Path(InetAddress(),InetAddress("10.0.4.1/9993")));
+
+		Packet outp(rr.identity.address(),requester.address(),Packet::VERB_WHOIS);
+		for(std::vector<Address>::const_iterator a(addresses.begin());a!=addresses.end();++a)
+			a->appendTo(outp);
+		outp.armor(key,true,0);
+		const unsigned long mark = (unsigned long)ctx.sent.size();
+		IncomingPacket in(outp.data(),outp.size(),requesterPath,now);
+		in.tryDecode(&rr,(void *)0);
+
+		std::set<Address> answered;
+		unsigned int replies = 0;
+		for(unsigned long i=mark;i<ctx.sent.size();++i) {
+			Packet p(ctx.sent[i].data(),(unsigned int)ctx.sent[i].length());
+			if ((p.destination() != requester.address())||(!p.dearmor(key))||(p.verb() != Packet::VERB_OK)) // also skips the HELLO to the requester's new path
+				continue;
+			ok = ((ok)&&(p.size() <= ZT_UDP_DEFAULT_PAYLOAD_MTU)&&(p[ZT_PROTO_VERB_OK_IDX_IN_RE_VERB] == Packet::VERB_WHOIS)&&(p.at<uint64_t>(ZT_PROTO_VERB_OK_IDX_IN_RE_PACKET_ID) == outp.packetId()));
+			++replies;
+			unsigned int ptr = ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY;
+			while ((ok)&&(ptr < p.size())) {
+				Identity id;
+				ptr += id.deserialize(p,ptr);
+				ok = (id == testWhoisIdentity(id.address()));
+				answered.insert(id.address());
+			}
+		}
+		ok = ((ok)&&(replies > 1)&&(answered == std::set<Address>(addresses.begin(),addresses.end())));
+	}
+	delete rr.sw;
+	delete rr.topology;
+	delete rr.trace;
+	delete rr.metrics;
+	ZT_Node_delete(node);
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+
+#ifdef ZT_ENABLE_CLUSTER
+struct ClusterTestMessage
+{
+	unsigned int to;
+	std::string data;
+};
+
+static void testClusterSend(void *arg,unsigned int toMemberId,const void *data,unsigned int len)
+{
+	ClusterTestMessage m;
+	m.to = toMemberId;
+	m.data.assign(reinterpret_cast<const char *>(data),len);
+	reinterpret_cast< std::vector<ClusterTestMessage> *>(arg)->push_back(m);
+}
+
+// 10.1.x.x is near members 1 and 2, 10.2.x.x is near member 0, anything else is unknown
+static int testClusterLocate(void *,const struct sockaddr_storage *ss,int *x,int *y,int *z)
+{
+	const InetAddress &ip = *(reinterpret_cast<const InetAddress *>(ss));
+	if ((ip.ss_family != AF_INET)||(reinterpret_cast<const uint8_t *>(ip.rawIpData())[0] != 10))
+		return 0;
+	switch(reinterpret_cast<const uint8_t *>(ip.rawIpData())[1]) {
+		case 1: *x = -5000; *y = 150; *z = 0; return 1;
+		case 2: *x = 1000; *y = 0; *z = 0; return 1;
+	}
+	return 0;
+}
+
+static Cluster *newTestClusterMember(RuntimeEnvironment &rr,unsigned int id,std::vector<ClusterTestMessage> *wire)
+{
+	static const int32_t loc[3][3] = { { 1000,0,0 },{ -5000,0,0 },{ -5000,300,0 } };
+	char ep[64];
+	Utils::snprintf(ep,sizeof(ep),"192.168.0.%u/9993",id + 1);
+	Cluster *const c = new Cluster(&rr,(uint16_t)id,std::vector<InetAddress>(1,InetAddress(ep)),loc[id][0],loc[id][1],loc[id][2],&testClusterSend,wire,&testClusterLocate,(void *)0);
+	for(unsigned int m=0;m<3;++m)
+		c->addMember((uint16_t)m);
+	return c;
+}
+
+// Advance time, let every member flush, and deliver what they sent
+static void testClusterStep(ZT_Node *node,uint64_t &now,Cluster *const *c,std::vector<ClusterTestMessage> *wire)
+{
+	now += 100;
+	volatile uint64_t nextDeadline = 0;
+	ZT_Node_processBackgroundTasks(node,(void *)0,now,&nextDeadline);
+	for(unsigned int i=0;i<3;++i)
+		c[i]->doPeriodicTasks();
+	for(unsigned int i=0;i<3;++i) {
+		for(std::vector<ClusterTestMessage>::const_iterator m(wire[i].begin());m!=wire[i].end();++m)
+			c[m->to]->handleIncomingStateMessage(m->data.data(),(unsigned int)m->data.length());
+		wire[i].clear();
+	}
+}
+
+static int testCluster()
+{
+	std::cout << "[cluster] Testing hash ring stability... "; std::cout.flush();
+	{
+		std::vector<uint16_t> all,allBut3;
+		for(uint16_t m=0;m<8;++m) {
+			all.push_back(m);
+			if (m != 3)
+				allBut3.push_back(m);
+		}
+		const ClusterRing r8(all),r7(allBut3);
+		bool eligible[ZT_CLUSTER_MAX_MEMBERS];
+		memset(eligible,0,sizeof(eligible));
+		eligible[1] = true;
+		eligible[5] = true;
+		unsigned int owned[8];
+		memset(owned,0,sizeof(owned));
+		bool ok = true;
+		for(uint64_t k=0;k<8000;++k) {
+			const Address a((k * 0x9e3779b1ULL) & 0xffffffffffULL);
+			const int o8 = r8.owner(a,(const bool *)0);
+			const int o7 = r7.owner(a,(const bool *)0);
+			const int oe = r8.owner(a,eligible);
+			if ((o8 < 0)||(o8 >= 8)) {
+				ok = false;
+				break;
+			}
+			++owned[o8];
+			if (o8 == 3)
+				ok = ((ok)&&(o7 >= 0)&&(o7 != 3)); // only peers of the removed member move
+			else ok = ((ok)&&(o7 == o8));
+			if ((o8 == 1)||(o8 == 5))
+				ok = ((ok)&&(oe == o8)); // an eligible owner keeps its peers
+			else ok = ((ok)&&((oe == 1)||(oe == 5)));
+		}
+		for(unsigned int m=0;m<8;++m)
+			ok = ((ok)&&(owned[m] > (8000 / 8 / 3))); // roughly balanced
+		memset(eligible,0,sizeof(eligible));
+		ok = ((ok)&&(r8.owner(Address(0x1234567890ULL),eligible) == -1));
+		if (!ok) {
+			std::cout << "FAILED" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	DataStoreTestContext ctx;
+	uint64_t now = OSUtils::now();
+	ZT_Node *node = newTestNode(ctx,now);
+	if (!node) {
+		std::cout << "[cluster] Creating node... FAILED" << std::endl;
+		return -1;
+	}
+
+	// Three members sharing one identity, as a real cluster does
+	RuntimeEnvironment rr(reinterpret_cast<Node *>(node));
+	rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+	rr.topology = new Topology(&rr,(void *)0);
+	std::vector<ClusterTestMessage> wire[3];
+	Cluster *c[3];
+	for(unsigned int i=0;i<3;++i)
+		c[i] = newTestClusterMember(rr,i,&(wire[i]));
+	for(unsigned int round=0;round<2;++round) // announce, then rebuild rings with everyone alive
+		testClusterStep(node,now,c,wire);
+	bool ok = true;
+
+	std::cout << "[cluster] Testing geographic redirects... "; std::cout.flush();
+	{
+		std::vector<uint16_t> members;
+		for(uint16_t m=0;m<3;++m)
+			members.push_back(m);
+		const ClusterRing ring(members);
+		unsigned int to1 = 0,to2 = 0,stayed = 0;
+		for(uint64_t k=1;((ok)&&(k<=300));++k) {
+			const Address a((k * 0x9e3779b1ULL) & 0xffffffffffULL);
+			InetAddress redirectTo;
+
+			// Near members 1 and 2, so one of them gets the peer
+			ok = (c[0]->findBetterEndpoint(redirectTo,a,InetAddress("10.1.0.1/1234"),false));
+			if (redirectTo == InetAddress("192.168.0.2/9993"))
+				++to1;
+			else if (redirectTo == InetAddress("192.168.0.3/9993"))
+				++to2;
+			else ok = false;
+
+			// Near us, so it stays
+			ok = ((ok)&&(!c[0]->findBetterEndpoint(redirectTo,a,InetAddress("10.2.0.1/1234"),false)));
+
+			// Location unknown, so the plain ring decides
+			const int owner = ring.owner(a,(const bool *)0);
+			if (c[0]->findBetterEndpoint(redirectTo,a,InetAddress("10.3.0.1/1234"),false)) {
+				char ep[64];
+				Utils::snprintf(ep,sizeof(ep),"192.168.0.%d/9993",owner + 1);
+				ok = ((ok)&&(owner != 0)&&(redirectTo == InetAddress(ep)));
+			} else {
+				ok = ((ok)&&(owner == 0));
+				++stayed;
+			}
+		}
+		ok = ((ok)&&(to1 > 50)&&(to2 > 50)&&(stayed > 50)&&(stayed < 150));
+		if (!ok) {
+			std::cout << "FAILED (" << to1 << "," << to2 << "," << stayed << ")" << std::endl;
+			for(unsigned int i=0;i<3;++i)
+				delete c[i];
+			delete rr.topology;
+			ZT_Node_delete(node);
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[cluster] Testing remote peer index... "; std::cout.flush();
+	{
+		Identity peerId;
+		peerId.generate();
+		const Address pa(peerId.address());
+		uint64_t ts = 0;
+
+		// The first announcement carries the identity, repeats are HAVE_PEERS that refresh it
+		c[0]->broadcastHavePeer(peerId);
+		testClusterStep(node,now,c,wire);
+		ok = ((c[1]->checkSendViaCluster(pa,ts,(void *)0) == 0)&&(ts == now));
+		c[0]->broadcastHavePeer(peerId);
+		testClusterStep(node,now,c,wire);
+		ok = ((ok)&&(c[1]->checkSendViaCluster(pa,ts,(void *)0) == 0)&&(ts == now));
+		ok = ((ok)&&(c[2]->checkSendViaCluster(pa,ts,(void *)0) == 0)&&(ts == now));
+
+		// A restarted member can't learn the peer from HAVE_PEERS alone. It asks
+		// with WANT_PEER, which member 0 answers only while it has the peer.
+		delete c[1];
+		c[1] = newTestClusterMember(rr,1,&(wire[1]));
+		c[0]->broadcastHavePeer(peerId);
+		for(unsigned int i=0;i<3;++i)
+			testClusterStep(node,now,c,wire);
+		c[1]->checkSendViaCluster(pa,ts,(void *)0);
+		ok = ((ok)&&(ts == 0));
+		testClusterStep(node,now,c,wire); // deliver the WANT_PEER that lookup sent, still unanswerable
+
+		SharedPtr<Peer> peer(new Peer(&rr,rr.identity,peerId));
+		SharedPtr<Path> path(new Path(InetAddress(),InetAddress("10.2.0.1/9993")));
+		path->received(now,64);
+		peer->received((void *)0,path,0,1,Packet::VERB_OK,0,Packet::VERB_NOP,false);
+		rr.topology->addPeer((void *)0,peer);
+		c[0]->broadcastHavePeer(peerId);
+		for(unsigned int i=0;i<3;++i) // HAVE_PEERS, WANT_PEER, HAVE_PEER
+			testClusterStep(node,now,c,wire);
+		ok = ((ok)&&(c[1]->checkSendViaCluster(pa,ts,(void *)0) == 0)&&(ts == now));
+
+		// The index follows whichever member announced the peer last
+		c[2]->broadcastHavePeer(peerId);
+		testClusterStep(node,now,c,wire);
+		ok = ((ok)&&(c[0]->checkSendViaCluster(pa,ts,(void *)0) == 2)&&(c[1]->checkSendViaCluster(pa,ts,(void *)0) == 2));
+		c[0]->broadcastHavePeer(peerId);
+		testClusterStep(node,now,c,wire);
+		ok = ((ok)&&(c[1]->checkSendViaCluster(pa,ts,(void *)0) == 0)&&(c[2]->checkSendViaCluster(pa,ts,(void *)0) == 0));
+	}
+	for(unsigned int i=0;i<3;++i)
+		delete c[i];
+	delete rr.topology;
+	ZT_Node_delete(node);
+	if (!ok) {
+		std::cout << "FAILED" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	return 0;
+}
+#endif
+
 static int testPhy()
 {
 	char udpTestPayload[ZT_TEST_PHY_UDP_PACKET_SIZE];
@@ -1124,6 +2814,14 @@ int main(int argc,char **argv)
 	r |= testPacket();
 	r |= testIdentity();
 	r |= testCertificate();
+	r |= testDataStore();
+	r |= testPath();
+	r |= testMultipath();
+	r |= testPeerSnapshot();
+	r |= testWhois();
+#ifdef ZT_ENABLE_CLUSTER
+	r |= testCluster();
+#endif
 	r |= testPhy();
 	//r |= testHttp();
 	//*/
@@ -69,22 +69,36 @@ public:
 		std::vector<std::string> lines(OSUtils::split(cf.c_str(),"\r\n","",""));
 		for(std::vector<std::string>::iterator l(lines.begin());l!=lines.end();++l) {
 			std::vector<std::string> fields(OSUtils::split(l->c_str()," \t","",""));
-			if ((fields.size() < 5)||(fields[0][0] == '#')||(fields[0] != myAddressStr))
+			if ((fields.size() < 3)||(fields[0][0] == '#')||(fields[0] != myAddressStr))
 				continue;
 
+			// <address> geo <index path>
 			// <address> geo <CSV path> <ip start column> <ip end column> <latitutde column> <longitude column>
+			//
+			// Indexes are made from CSVs with "zerotier-idtool geoip". If a CSV
+			// is given it's converted to <CSV path>.idx here if that is missing
+			// or older than the CSV, which is slow for large databases.
 			if (fields[1] == "geo") {
+				std::string indexPath(fields[2]);
 				if ((fields.size() >= 7)&&(OSUtils::fileExists(fields[2].c_str()))) {
-					int ipStartColumn = Utils::strToInt(fields[3].c_str());
-					int ipEndColumn = Utils::strToInt(fields[4].c_str());
-					int latitudeColumn = Utils::strToInt(fields[5].c_str());
-					int longitudeColumn = Utils::strToInt(fields[6].c_str());
-					if (_geo.load(fields[2].c_str(),ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn) <= 0)
-						throw std::runtime_error(std::string("failed to load geo-ip data from ")+fields[2]);
+					indexPath.append(".idx");
+					if ((!OSUtils::fileExists(indexPath.c_str()))||(OSUtils::getLastModified(indexPath.c_str()) < OSUtils::getLastModified(fields[2].c_str()))) {
+						int ipStartColumn = Utils::strToInt(fields[3].c_str());
+						int ipEndColumn = Utils::strToInt(fields[4].c_str());
+						int latitudeColumn = Utils::strToInt(fields[5].c_str());
+						int longitudeColumn = Utils::strToInt(fields[6].c_str());
+						if (ClusterGeoIpService::convert(fields[2].c_str(),ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn,indexPath.c_str()) <= 0)
+							throw std::runtime_error(std::string("failed to convert geo-ip data from ")+fields[2]);
+					}
 				}
+				if ((OSUtils::fileExists(indexPath.c_str()))&&(_geo.load(indexPath.c_str()) <= 0))
+					throw std::runtime_error(std::string("failed to load geo-ip data from ")+indexPath);
 				continue;
 			}
 
+			if (fields.size() < 5)
+				continue;
+
 			// <address> <ID> <name> <backplane IP/port(s)> <ZT frontplane IP/port(s)> <x,y,z>
 			int id = Utils::strToUInt(fields[1].c_str());
 			if ((id < 0)||(id > ZT_CLUSTER_MAX_MEMBERS))
@@ -27,72 +27,267 @@
 #include "../node/Utils.hpp"
 #include "../osdep/OSUtils.hpp"
 
+#ifdef __UNIX_LIKE__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 #define ZT_CLUSTERGEOIPSERVICE_FILE_MODIFICATION_CHECK_EVERY 10000
 
+// A replaced index is unmapped once it has been out of use this long,
+// which is far longer than any lookup that might still be reading it.
+#define ZT_CLUSTERGEOIPSERVICE_RETIRE_AFTER 60000
+
+/*
+ * Index file layout (host byte order):
+ *
+ *   <[8] magic>
+ *   <[4] 0x01020304 to check byte order>
+ *   <[4] reserved>
+ *   <[8] number of IPv4 ranges (n4)>
+ *   <[8] number of IPv6 ranges (n6)>
+ *   <[32] reserved>
+ *   <[16 * (n4 + 1)] IPv4 ranges, unused entry then Eytzinger order>
+ *   <[40 * (n6 + 1)] IPv6 ranges, unused entry then Eytzinger order>
+ *
+ * Ranges are disjoint, so they are sorted by both start and end.
+ */
+
+#define ZT_CLUSTERGEOIPSERVICE_MAGIC "ZTGEOIX\x01"
+#define ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE 64
+
 namespace ZeroTier {
 
+namespace {
+
+struct _Header
+{
+	char magic[8];
+	uint32_t byteOrder;
+	uint32_t reserved;
+	uint64_t v4Count;
+	uint64_t v6Count;
+	uint8_t reserved2[32];
+};
+
+// Lay out sorted[] in Eytzinger order in out[1..n]
+template<typename E>
+static void _eytzinger(const std::vector<E> &sorted,std::vector<E> &out,unsigned long &i,unsigned long k)
+{
+	if (k <= (unsigned long)sorted.size()) {
+		_eytzinger(sorted,out,i,k << 1);
+		out[k] = sorted[i++];
+		_eytzinger(sorted,out,i,(k << 1) + 1);
+	}
+}
+
+// Undo the trailing right turns of an Eytzinger descent, giving the index
+// of the first entry not less than the key or 0 if there is none
+static inline uint64_t _eytzingerResult(uint64_t k)
+{
+	while (k & 1)
+		k >>= 1;
+	return (k >> 1);
+}
+
+static inline bool _lt128(uint64_t ah,uint64_t al,uint64_t bh,uint64_t bl) { return ((ah < bh)||((ah == bh)&&(al < bl))); }
+
+} // anonymous namespace
+
 ClusterGeoIpService::ClusterGeoIpService() :
-	_pathToCsv(),
-	_ipStartColumn(-1),
-	_ipEndColumn(-1),
-	_latitudeColumn(-1),
-	_longitudeColumn(-1),
-	_lastFileCheckTime(0),
-	_csvModificationTime(0),
-	_csvFileSize(0)
+	_index((_Index *)0),
+	_lastFileCheckTime(0)
 {
 }
 
 ClusterGeoIpService::~ClusterGeoIpService()
 {
+	Mutex::Lock _l(_reload_m);
+	_unmap(_index.exchange((_Index *)0));
+	for(std::vector<_Index *>::iterator i(_retired.begin());i!=_retired.end();++i)
+		_unmap(*i);
+}
+
+long ClusterGeoIpService::convert(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn,const char *pathToIndex)
+{
+	FILE *f = fopen(pathToCsv,"rb");
+	if (!f)
+		return -1;
+
+	std::vector<_V4E> v4db;
+	std::vector<_V6E> v6db;
+
+	char buf[4096];
+	char linebuf[1024];
+	unsigned int lineptr = 0;
+	for(;;) {
+		int n = (int)fread(buf,1,sizeof(buf),f);
+		if (n <= 0)
+			break;
+		for(int i=0;i<n;++i) {
+			if ((buf[i] == '\r')||(buf[i] == '\n')||(buf[i] == (char)0)) {
+				if (lineptr) {
+					linebuf[lineptr] = (char)0;
+					_parseLine(linebuf,v4db,v6db,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
+				}
+				lineptr = 0;
+			} else if (lineptr < (unsigned int)(sizeof(linebuf) - 1))
+				linebuf[lineptr++] = buf[i];
+		}
+	}
+	if (lineptr) {
+		linebuf[lineptr] = (char)0;
+		_parseLine(linebuf,v4db,v6db,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
+	}
+
+	fclose(f);
+
+	if ((v4db.empty())&&(v6db.empty()))
+		return 0;
+
+	// Sort by start and trim overlaps so that where ranges overlap the one
+	// starting later wins, leaving disjoint ranges that are also sorted by end.
+	{
+		std::vector<_V4E> tmp;
+		std::sort(v4db.begin(),v4db.end());
+		for(unsigned long i=0;i<(unsigned long)v4db.size();++i) {
+			_V4E &e = v4db[i];
+			if ((i + 1) < (unsigned long)v4db.size()) {
+				const _V4E &next = v4db[i + 1];
+				if (next.start == e.start)
+					continue;
+				if (e.end >= next.start)
+					e.end = next.start - 1;
+			}
+			if (e.end >= e.start)
+				tmp.push_back(e);
+		}
+		v4db.swap(tmp);
+	}
+	{
+		std::vector<_V6E> tmp;
+		std::sort(v6db.begin(),v6db.end());
+		for(unsigned long i=0;i<(unsigned long)v6db.size();++i) {
+			_V6E &e = v6db[i];
+			if ((i + 1) < (unsigned long)v6db.size()) {
+				const _V6E &next = v6db[i + 1];
+				if ((next.startHi == e.startHi)&&(next.startLo == e.startLo))
+					continue;
+				if (!_lt128(e.endHi,e.endLo,next.startHi,next.startLo)) {
+					e.endHi = next.startHi - ((next.startLo == 0) ? 1 : 0);
+					e.endLo = next.startLo - 1;
+				}
+			}
+			if (!_lt128(e.endHi,e.endLo,e.startHi,e.startLo))
+				tmp.push_back(e);
+		}
+		v6db.swap(tmp);
+	}
+
+	std::vector<_V4E> v4e(v4db.size() + 1);
+	std::vector<_V6E> v6e(v6db.size() + 1);
+	memset(&(v4e[0]),0,sizeof(_V4E));
+	memset(&(v6e[0]),0,sizeof(_V6E));
+	unsigned long i = 0;
+	_eytzinger(v4db,v4e,i,1);
+	i = 0;
+	_eytzinger(v6db,v6e,i,1);
+
+	_Header h;
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,ZT_CLUSTERGEOIPSERVICE_MAGIC,8);
+	h.byteOrder = 0x01020304;
+	h.v4Count = (uint64_t)v4db.size();
+	h.v6Count = (uint64_t)v6db.size();
+
+	const std::string tmpPath(std::string(pathToIndex) + ".tmp");
+	f = fopen(tmpPath.c_str(),"wb");
+	if (!f)
+		return -1;
+	bool ok = (fwrite(&h,sizeof(h),1,f) == 1);
+	ok &= (fwrite(&(v4e[0]),sizeof(_V4E),v4e.size(),f) == v4e.size());
+	ok &= (fwrite(&(v6e[0]),sizeof(_V6E),v6e.size(),f) == v6e.size());
+	ok &= (fclose(f) == 0);
+	if (!ok) {
+		OSUtils::rm(tmpPath.c_str());
+		return -1;
+	}
+#ifdef __WINDOWS__
+	OSUtils::rm(pathToIndex); // rename() won't replace on Windows
+#endif
+	if (rename(tmpPath.c_str(),pathToIndex) != 0) {
+		OSUtils::rm(tmpPath.c_str());
+		return -1;
+	}
+
+	return (long)(v4db.size() + v6db.size());
+}
+
+long ClusterGeoIpService::load(const char *pathToIndex)
+{
+	_Index *const idx = _map(pathToIndex);
+	if (!idx)
+		return -1;
+	const long n = (long)(idx->v4Count + idx->v6Count);
+
+	Mutex::Lock _l(_reload_m);
+	_pathToIndex = pathToIndex;
+	_lastFileCheckTime = OSUtils::now();
+	_replace(idx,_lastFileCheckTime);
+
+	return n;
 }
 
 bool ClusterGeoIpService::locate(const InetAddress &ip,int &x,int &y,int &z)
 {
-	Mutex::Lock _l(_lock);
-
-	if ((_pathToCsv.length() > 0)&&((OSUtils::now() - _lastFileCheckTime) > ZT_CLUSTERGEOIPSERVICE_FILE_MODIFICATION_CHECK_EVERY)) {
-		_lastFileCheckTime = OSUtils::now();
-		if ((_csvFileSize != OSUtils::getFileSize(_pathToCsv.c_str()))||(_csvModificationTime != OSUtils::getLastModified(_pathToCsv.c_str())))
-			_load(_pathToCsv.c_str(),_ipStartColumn,_ipEndColumn,_latitudeColumn,_longitudeColumn);
-	}
-
-	/* We search by looking up the upper bound of the sorted vXdb vectors
-	 * and then iterating down for a matching IP range. We stop when we hit
-	 * the beginning or an entry whose start and end are before the IP we
-	 * are searching. */
-
-	if ((ip.ss_family == AF_INET)&&(_v4db.size() > 0)) {
-		_V4E key;
-		key.start = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr));
-		std::vector<_V4E>::const_iterator i(std::upper_bound(_v4db.begin(),_v4db.end(),key));
-		while (i != _v4db.begin()) {
-			--i;
-			if ((key.start >= i->start)&&(key.start <= i->end)) {
-				x = i->x;
-				y = i->y;
-				z = i->z;
-				//printf("%s : %f,%f %d,%d,%d\n",ip.toIpString().c_str(),i->lat,i->lon,x,y,z);
-				return true;
-			} else if ((key.start > i->start)&&(key.start > i->end))
-				break;
+	const uint64_t now = OSUtils::now();
+	uint64_t lastCheck = _lastFileCheckTime.load();
+	if (((now - lastCheck) > ZT_CLUSTERGEOIPSERVICE_FILE_MODIFICATION_CHECK_EVERY)&&(_lastFileCheckTime.compare_exchange_strong(lastCheck,now)))
+		_checkForChanges(now); // only the one thread that wins the exchange does this
+
+	const _Index *const idx = _index.load();
+	if (!idx)
+		return false;
+
+	/* Each range array is in Eytzinger order, so we descend it like an
+	 * implicit binary tree looking for the first range whose end is not
+	 * below the IP. Since ranges are disjoint that's the only one that
+	 * can contain it. */
+
+	if (ip.ss_family == AF_INET) {
+		const uint32_t key = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr));
+		const _V4E *const e = idx->v4;
+		const uint64_t n = idx->v4Count;
+		uint64_t k = 1;
+		while (k <= n)
+			k = (k << 1) | (uint64_t)(e[k].end < key);
+		k = _eytzingerResult(k);
+		if ((k)&&(e[k].start <= key)) {
+			x = e[k].x;
+			y = e[k].y;
+			z = e[k].z;
+			return true;
 		}
-	} else if ((ip.ss_family == AF_INET6)&&(_v6db.size() > 0)) {
-		_V6E key;
-		memcpy(key.start,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
-		std::vector<_V6E>::const_iterator i(std::upper_bound(_v6db.begin(),_v6db.end(),key));
-		while (i != _v6db.begin()) {
-			--i;
-			const int s_vs_s = memcmp(key.start,i->start,16);
-			const int s_vs_e = memcmp(key.start,i->end,16);
-			if ((s_vs_s >= 0)&&(s_vs_e <= 0)) {
-				x = i->x;
-				y = i->y;
-				z = i->z;
-				//printf("%s : %f,%f %d,%d,%d\n",ip.toIpString().c_str(),i->lat,i->lon,x,y,z);
-				return true;
-			} else if ((s_vs_s > 0)&&(s_vs_e > 0))
-				break;
+	} else if (ip.ss_family == AF_INET6) {
+		uint64_t kh,kl;
+		memcpy(&kh,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,8);
+		memcpy(&kl,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr + 8,8);
+		kh = Utils::ntoh(kh);
+		kl = Utils::ntoh(kl);
+		const _V6E *const e = idx->v6;
+		const uint64_t n = idx->v6Count;
+		uint64_t k = 1;
+		while (k <= n)
+			k = (k << 1) | (uint64_t)_lt128(e[k].endHi,e[k].endLo,kh,kl);
+		k = _eytzingerResult(k);
+		if ((k)&&(!_lt128(kh,kl,e[k].startHi,e[k].startLo))) {
+			x = e[k].x;
+			y = e[k].y;
+			z = e[k].z;
+			return true;
 		}
 	}
 
@@ -123,86 +318,141 @@ void ClusterGeoIpService::_parseLine(const char *line,std::vector<_V4E> &v4db,st
 				v4db.push_back(_V4E());
 				v4db.back().start = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ipStart)->sin_addr.s_addr));
 				v4db.back().end = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&ipEnd)->sin_addr.s_addr));
-				v4db.back().lat = (float)lat;
-				v4db.back().lon = (float)lon;
 				v4db.back().x = x;
 				v4db.back().y = y;
 				v4db.back().z = z;
+				v4db.back().reserved = 0;
+				if (v4db.back().end < v4db.back().start)
+					v4db.pop_back();
 				//printf("%s - %s : %d,%d,%d\n",ipStart.toIpString().c_str(),ipEnd.toIpString().c_str(),x,y,z);
 			} else if (ipStart.ss_family == AF_INET6) {
 				v6db.push_back(_V6E());
-				memcpy(v6db.back().start,reinterpret_cast<const struct sockaddr_in6 *>(&ipStart)->sin6_addr.s6_addr,16);
-				memcpy(v6db.back().end,reinterpret_cast<const struct sockaddr_in6 *>(&ipEnd)->sin6_addr.s6_addr,16);
-				v6db.back().lat = (float)lat;
-				v6db.back().lon = (float)lon;
-				v6db.back().x = x;
-				v6db.back().y = y;
-				v6db.back().z = z;
+				_V6E &e = v6db.back();
+				const uint8_t *const s = reinterpret_cast<const struct sockaddr_in6 *>(&ipStart)->sin6_addr.s6_addr;
+				const uint8_t *const en = reinterpret_cast<const struct sockaddr_in6 *>(&ipEnd)->sin6_addr.s6_addr;
+				memcpy(&e.startHi,s,8);
+				memcpy(&e.startLo,s + 8,8);
+				memcpy(&e.endHi,en,8);
+				memcpy(&e.endLo,en + 8,8);
+				e.startHi = Utils::ntoh(e.startHi);
+				e.startLo = Utils::ntoh(e.startLo);
+				e.endHi = Utils::ntoh(e.endHi);
+				e.endLo = Utils::ntoh(e.endLo);
+				e.x = x;
+				e.y = y;
+				e.z = z;
+				e.reserved = 0;
+				if (_lt128(e.endHi,e.endLo,e.startHi,e.startLo))
+					v6db.pop_back();
 				//printf("%s - %s : %d,%d,%d\n",ipStart.toIpString().c_str(),ipEnd.toIpString().c_str(),x,y,z);
 			}
 		}
 	}
 }
 
-long ClusterGeoIpService::_load(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
+ClusterGeoIpService::_Index *ClusterGeoIpService::_map(const char *path)
 {
-	// assumes _lock is locked
-
-	FILE *f = fopen(pathToCsv,"rb");
-	if (!f)
-		return -1;
-
-	std::vector<_V4E> v4db;
-	std::vector<_V6E> v6db;
-	v4db.reserve(16777216);
-	v6db.reserve(16777216);
-
-	char buf[4096];
-	char linebuf[1024];
-	unsigned int lineptr = 0;
-	for(;;) {
-		int n = (int)fread(buf,1,sizeof(buf),f);
-		if (n <= 0)
-			break;
-		for(int i=0;i<n;++i) {
-			if ((buf[i] == '\r')||(buf[i] == '\n')||(buf[i] == (char)0)) {
-				if (lineptr) {
-					linebuf[lineptr] = (char)0;
-					_parseLine(linebuf,v4db,v6db,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
-				}
-				lineptr = 0;
-			} else if (lineptr < (unsigned int)sizeof(linebuf))
-				linebuf[lineptr++] = buf[i];
-		}
+	_Index *idx = new _Index();
+	memset(idx,0,sizeof(_Index));
+	idx->modificationTime = OSUtils::getLastModified(path);
+
+#ifdef __UNIX_LIKE__
+	const int fd = ::open(path,O_RDONLY);
+	if (fd < 0) {
+		delete idx;
+		return (_Index *)0;
 	}
-	if (lineptr) {
-		linebuf[lineptr] = (char)0;
-		_parseLine(linebuf,v4db,v6db,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
+	struct stat st;
+	if ((fstat(fd,&st) != 0)||(st.st_size < ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE)) {
+		::close(fd);
+		delete idx;
+		return (_Index *)0;
 	}
+	void *m = mmap((void *)0,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	::close(fd);
+	if (m == MAP_FAILED) {
+		delete idx;
+		return (_Index *)0;
+	}
+	idx->data = m;
+	idx->size = (uint64_t)st.st_size;
+#else
+	std::string buf;
+	if ((!OSUtils::readFile(path,buf))||(buf.length() < ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE)) {
+		delete idx;
+		return (_Index *)0;
+	}
+	idx->data = malloc(buf.length());
+	if (!idx->data) {
+		delete idx;
+		return (_Index *)0;
+	}
+	memcpy(idx->data,buf.data(),buf.length());
+	idx->size = (uint64_t)buf.length();
+#endif
+	idx->fileSize = (int64_t)idx->size;
+
+	const _Header *const h = reinterpret_cast<const _Header *>(idx->data);
+	if ( (memcmp(h->magic,ZT_CLUSTERGEOIPSERVICE_MAGIC,8) != 0) ||
+	     (h->byteOrder != 0x01020304) ||
+	     (h->v4Count >= (idx->size / sizeof(_V4E))) ||
+	     (h->v6Count >= (idx->size / sizeof(_V6E))) ||
+	     ((ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE + ((h->v4Count + 1) * sizeof(_V4E)) + ((h->v6Count + 1) * sizeof(_V6E))) != idx->size) ) {
+		_unmap(idx);
+		return (_Index *)0;
+	}
+	idx->v4 = reinterpret_cast<const _V4E *>(reinterpret_cast<const uint8_t *>(idx->data) + ZT_CLUSTERGEOIPSERVICE_HEADER_SIZE);
+	idx->v4Count = h->v4Count;
+	idx->v6 = reinterpret_cast<const _V6E *>(reinterpret_cast<const uint8_t *>(idx->v4) + ((h->v4Count + 1) * sizeof(_V4E)));
+	idx->v6Count = h->v6Count;
 
-	fclose(f);
-
-	if ((v4db.size() > 0)||(v6db.size() > 0)) {
-		std::sort(v4db.begin(),v4db.end());
-		std::sort(v6db.begin(),v6db.end());
+	return idx;
+}
 
-		_pathToCsv = pathToCsv;
-		_ipStartColumn = ipStartColumn;
-		_ipEndColumn = ipEndColumn;
-		_latitudeColumn = latitudeColumn;
-		_longitudeColumn = longitudeColumn;
+void ClusterGeoIpService::_unmap(_Index *idx)
+{
+	if (idx) {
+		if (idx->data) {
+#ifdef __UNIX_LIKE__
+			munmap(idx->data,(size_t)idx->size);
+#else
+			free(idx->data);
+#endif
+		}
+		delete idx;
+	}
+}
 
-		_lastFileCheckTime = OSUtils::now();
-		_csvModificationTime = OSUtils::getLastModified(pathToCsv);
-		_csvFileSize = OSUtils::getFileSize(pathToCsv);
+void ClusterGeoIpService::_replace(_Index *idx,uint64_t now)
+{
+	// assumes _reload_m is locked
+	_Index *const old = _index.exchange(idx);
+	if (old) {
+		old->retired = now;
+		_retired.push_back(old);
+	}
+}
 
-		_v4db.swap(v4db);
-		_v6db.swap(v6db);
+void ClusterGeoIpService::_checkForChanges(uint64_t now)
+{
+	Mutex::Lock _l(_reload_m);
 
-		return (long)(_v4db.size() + _v6db.size());
-	} else {
-		return 0;
+	std::vector<_Index *> stillRetired;
+	for(std::vector<_Index *>::iterator i(_retired.begin());i!=_retired.end();++i) {
+		if ((now - (*i)->retired) >= ZT_CLUSTERGEOIPSERVICE_RETIRE_AFTER)
+			_unmap(*i);
+		else stillRetired.push_back(*i);
 	}
+	_retired.swap(stillRetired);
+
+	if (_pathToIndex.length() == 0)
+		return;
+	const _Index *const cur = _index.load();
+	if ((cur)&&(cur->fileSize == OSUtils::getFileSize(_pathToIndex.c_str()))&&(cur->modificationTime == OSUtils::getLastModified(_pathToIndex.c_str())))
+		return;
+	_Index *const idx = _map(_pathToIndex.c_str());
+	if (idx)
+		_replace(idx,now);
 }
 
 } // namespace ZeroTier
@@ -215,8 +465,9 @@ int main(int argc,char **argv)
 	char buf[1024];
 
 	ZeroTier::ClusterGeoIpService gip;
-	printf("loading...\n");
-	gip.load("/Users/api/Code/ZeroTier/Infrastructure/root-servers/zerotier-one/cluster-geoip.csv",0,1,5,6);
+	printf("converting and loading...\n");
+	ZeroTier::ClusterGeoIpService::convert("/Users/api/Code/ZeroTier/Infrastructure/root-servers/zerotier-one/cluster-geoip.csv",0,1,5,6,"/tmp/cluster-geoip.idx");
+	gip.load("/tmp/cluster-geoip.idx");
 	printf("... done!\n"); fflush(stdout);
 
 	while (gets(buf)) { // unsafe, testing only
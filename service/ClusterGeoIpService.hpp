@@ -29,6 +29,7 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <atomic>
 
 #include "../node/Constants.hpp"
 #include "../node/Mutex.hpp"
@@ -38,14 +39,22 @@
 namespace ZeroTier {
 
 /**
- * Loads a GeoIP CSV into memory for fast lookup, reloading as needed
+ * Memory mapped GeoIP range index for fast lookup, reloading as needed
  *
- * This was designed around the CSV from https://db-ip.com but can be used
- * with any similar GeoIP CSV database that is presented in the form of an
- * IP range and lat/long coordinates.
+ * A GeoIP CSV is converted offline by convert() into a compact binary
+ * index, which is then mapped by load(). This was designed around the CSV
+ * from https://db-ip.com but can be used with any similar GeoIP CSV
+ * database that is presented in the form of an IP range and lat/long
+ * coordinates.
  *
- * It loads the whole database into memory, which can be kind of large. If
- * the CSV file changes, the changes are loaded automatically.
+ * Ranges are stored in Eytzinger (BFS) order so a lookup is a branch-free
+ * descent through the array with good cache behavior, and lookups take no
+ * locks. If the index file changes it is mapped again and swapped in
+ * atomically. Replace it by writing a new file and renaming it over the
+ * old one, as convert() does.
+ *
+ * The index is in host byte order and is only meant to be read by hosts
+ * with the same byte order as the one that wrote it.
  */
 class ClusterGeoIpService : NonCopyable
 {
@@ -54,24 +63,30 @@ public:
 	~ClusterGeoIpService();
 
 	/**
-	 * Load or reload CSV file
+	 * Convert a GeoIP CSV file to a binary index
 	 *
 	 * CSV column indexes start at zero. CSVs can be quoted with single or
 	 * double quotes. Whitespace before or after commas is ignored. Backslash
-	 * may be used for escaping whitespace as well.
+	 * may be used for escaping whitespace as well. Where ranges overlap the
+	 * one starting later wins.
 	 *
 	 * @param pathToCsv Path to (uncompressed) CSV file
 	 * @param ipStartColumn Column with IP range start
 	 * @param ipEndColumn Column with IP range end (inclusive)
 	 * @param latitudeColumn Column with latitude
 	 * @param longitudeColumn Column with longitude
-	 * @return Number of valid records loaded or -1 on error (invalid file, not found, etc.)
+	 * @param pathToIndex Path to index file to write (replaced atomically where supported)
+	 * @return Number of ranges written or -1 on error (invalid file, not found, etc.)
 	 */
-	inline long load(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn)
-	{
-		Mutex::Lock _l(_lock);
-		return _load(pathToCsv,ipStartColumn,ipEndColumn,latitudeColumn,longitudeColumn);
-	}
+	static long convert(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn,const char *pathToIndex);
+
+	/**
+	 * Load or reload an index written by convert()
+	 *
+	 * @param pathToIndex Path to index file
+	 * @return Number of ranges in index or -1 on error (invalid file, not found, etc.)
+	 */
+	long load(const char *pathToIndex);
 
 	/**
 	 * Attempt to locate an IP
@@ -92,8 +107,8 @@ public:
 	 */
 	inline bool available() const
 	{
-		Mutex::Lock _l(_lock);
-		return ((_v4db.size() + _v6db.size()) > 0);
+		const _Index *const idx = _index.load();
+		return ((idx)&&((idx->v4Count + idx->v6Count) > 0));
 	}
 
 private:
@@ -101,39 +116,48 @@ private:
 	{
 		uint32_t start;
 		uint32_t end;
-		float lat,lon;
 		int16_t x,y,z;
+		int16_t reserved;
 
 		inline bool operator<(const _V4E &e) const { return (start < e.start); }
 	};
 
 	struct _V6E
 	{
-		uint8_t start[16];
-		uint8_t end[16];
-		float lat,lon;
+		uint64_t startHi,startLo;
+		uint64_t endHi,endLo;
 		int16_t x,y,z;
+		int16_t reserved;
 
-		inline bool operator<(const _V6E &e) const { return (memcmp(start,e.start,16) < 0); }
+		inline bool operator<(const _V6E &e) const { return ((startHi < e.startHi)||((startHi == e.startHi)&&(startLo < e.startLo))); }
 	};
 
-	static void _parseLine(const char *line,std::vector<_V4E> &v4db,std::vector<_V6E> &v6db,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
-	long _load(const char *pathToCsv,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
-
-	std::string _pathToCsv;
-	int _ipStartColumn;
-	int _ipEndColumn;
-	int _latitudeColumn;
-	int _longitudeColumn;
-
-	uint64_t _lastFileCheckTime;
-	uint64_t _csvModificationTime;
-	int64_t _csvFileSize;
-
-	std::vector<_V4E> _v4db;
-	std::vector<_V6E> _v6db;
+	struct _Index
+	{
+		void *data;
+		uint64_t size;
+		const _V4E *v4; // Eytzinger order, 1-based
+		uint64_t v4Count;
+		const _V6E *v6; // Eytzinger order, 1-based
+		uint64_t v6Count;
+		uint64_t modificationTime;
+		int64_t fileSize;
+		uint64_t retired; // time this index was replaced, or 0 if current
+	};
 
-	Mutex _lock;
+	static void _parseLine(const char *line,std::vector<_V4E> &v4db,std::vector<_V6E> &v6db,int ipStartColumn,int ipEndColumn,int latitudeColumn,int longitudeColumn);
+	static _Index *_map(const char *path);
+	static void _unmap(_Index *idx);
+	void _replace(_Index *idx,uint64_t now); // assumes _reload_m is locked
+	void _checkForChanges(uint64_t now);
+
+	std::atomic<_Index *> _index;
+	std::atomic<uint64_t> _lastFileCheckTime;
+
+	// Everything below is only touched under _reload_m
+	std::string _pathToIndex;
+	std::vector<_Index *> _retired; // replaced indexes that lookups may still be reading
+	Mutex _reload_m;
 };
 
 } // namespace ZeroTier
@@ -47,6 +47,9 @@
 #include "../osdep/PortMapper.hpp"
 #include "../osdep/Binder.hpp"
 #include "../osdep/ManagedRoute.hpp"
+#include "../osdep/BlockingQueue.hpp"
+#include "../osdep/IdentityStore.hpp"
+#include "../osdep/IdentityGenerator.hpp"
 
 #include "OneService.hpp"
 #include "ClusterGeoIpService.hpp"
@@ -125,6 +128,9 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 #define ZT_MAX_HTTP_MESSAGE_SIZE (1024 * 1024 * 64)
 #define ZT_MAX_HTTP_CONNECTIONS 64
 
+// Close idle keep-alive control plane connections after this many ms
+#define ZT_HTTP_KEEPALIVE_TIMEOUT 30000
+
 // Interface metric for ZeroTier taps -- this ensures that if we are on WiFi and also
 // bridged via ZeroTier to the same LAN traffic will (if the OS is sane) prefer WiFi.
 #define ZT_IF_METRIC 5000
@@ -147,7 +153,7 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // How often to check for local interface addresses
 #define ZT_LOCAL_INTERFACE_CHECK_INTERVAL 60000
 
-// Clean files from iddb.d that are older than this (60 days)
+// Drop identities of other peers not seen in this long (60 days)
 #define ZT_IDDB_CLEANUP_AGE 5184000000ULL
 
 namespace ZeroTier {
@@ -262,6 +268,12 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		j["active"] = (bool)(peer->paths[i].expired == 0);
 		j["expired"] = (bool)(peer->paths[i].expired != 0);
 		j["preferred"] = (bool)(peer->paths[i].preferred != 0);
+		j["latency"] = peer->paths[i].latency;
+		j["jitter"] = peer->paths[i].jitter;
+		j["packetLoss"] = (double)peer->paths[i].packetLoss / 1000.0;
+		j["txThroughput"] = peer->paths[i].txThroughput;
+		j["rxThroughput"] = peer->paths[i].rxThroughput;
+		j["mtu"] = peer->paths[i].mtu;
 		pa.push_back(j);
 	}
 	pj["paths"] = pa;
@@ -289,6 +301,114 @@ static void _moonToJson(nlohmann::json &mj,const World &world)
 	mj["waiting"] = false;
 }
 
+static void _metricsToText(std::string &buf,const ZT_Metrics &m)
+{
+	static const char *const dropReasons[ZT_METRICS_DROP_REASON_COUNT] = { "mac_failed","decompress_failed","malformed","rate_limited","filter","untrusted_path","max_hops","duplicate" };
+	static const char *const ruleVerdicts[ZT_METRICS_RULE_VERDICT_COUNT] = { "accept","drop","redirect","tee" };
+	static const char *const verbs[ZT_METRICS_VERB_COUNT] = { // see Packet::Verb, null for unassigned verb IDs
+		"NOP","HELLO","ERROR","OK","WHOIS","RENDEZVOUS","FRAME","EXT_FRAME","ECHO","MULTICAST_LIKE","NETWORK_CREDENTIALS","NETWORK_CONFIG_REQUEST","NETWORK_CONFIG","MULTICAST_GATHER","MULTICAST_FRAME",(const char *)0,
+		"PUSH_DIRECT_PATHS","CIRCUIT_TEST","CIRCUIT_TEST_REPORT",(const char *)0,"USER_MESSAGE"
+	};
+	char tmp[256],vn[32];
+
+	// Prometheus text format wants \n line endings everywhere, so ZT_EOL_S is not used here
+	buf.append("# HELP zt_rx_packets_total Authenticated inbound packets by verb\n# TYPE zt_rx_packets_total counter\n");
+	for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v) {
+		if ((m.rxPackets[v])||(verbs[v])) {
+			if (verbs[v])
+				Utils::snprintf(vn,sizeof(vn),"%s",verbs[v]);
+			else Utils::snprintf(vn,sizeof(vn),"0x%.2x",v);
+			Utils::snprintf(tmp,sizeof(tmp),"zt_rx_packets_total{verb=\"%s\"} %llu\n",vn,(unsigned long long)m.rxPackets[v]);
+			buf.append(tmp);
+		}
+	}
+	buf.append("# HELP zt_rx_bytes_total Authenticated inbound bytes by verb\n# TYPE zt_rx_bytes_total counter\n");
+	for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v) {
+		if ((m.rxBytes[v])||(verbs[v])) {
+			if (verbs[v])
+				Utils::snprintf(vn,sizeof(vn),"%s",verbs[v]);
+			else Utils::snprintf(vn,sizeof(vn),"0x%.2x",v);
+			Utils::snprintf(tmp,sizeof(tmp),"zt_rx_bytes_total{verb=\"%s\"} %llu\n",vn,(unsigned long long)m.rxBytes[v]);
+			buf.append(tmp);
+		}
+	}
+
+	buf.append("# HELP zt_rx_dropped_total Inbound packets dropped by reason\n# TYPE zt_rx_dropped_total counter\n");
+	for(unsigned int r=0;r<ZT_METRICS_DROP_REASON_COUNT;++r) {
+		Utils::snprintf(tmp,sizeof(tmp),"zt_rx_dropped_total{reason=\"%s\"} %llu\n",dropReasons[r],(unsigned long long)m.drops[r]);
+		buf.append(tmp);
+	}
+
+	Utils::snprintf(tmp,sizeof(tmp),"# HELP zt_relayed_packets_total Packets and fragments relayed for other peers\n# TYPE zt_relayed_packets_total counter\nzt_relayed_packets_total %llu\n",(unsigned long long)m.relayedPackets);
+	buf.append(tmp);
+	Utils::snprintf(tmp,sizeof(tmp),"# HELP zt_relayed_bytes_total Bytes relayed for other peers\n# TYPE zt_relayed_bytes_total counter\nzt_relayed_bytes_total %llu\n",(unsigned long long)m.relayedBytes);
+	buf.append(tmp);
+
+	buf.append("# HELP zt_rule_verdicts_total Rules engine verdicts by direction\n# TYPE zt_rule_verdicts_total counter\n");
+	for(unsigned int d=0;d<2;++d) {
+		for(unsigned int v=0;v<ZT_METRICS_RULE_VERDICT_COUNT;++v) {
+			Utils::snprintf(tmp,sizeof(tmp),"zt_rule_verdicts_total{direction=\"%s\",verdict=\"%s\"} %llu\n",(d == 0) ? "in" : "out",ruleVerdicts[v],(unsigned long long)m.ruleVerdicts[d][v]);
+			buf.append(tmp);
+		}
+	}
+
+	buf.append("# HELP zt_crypto_seconds Inbound packet authentication and decryption time\n# TYPE zt_crypto_seconds histogram\n");
+	uint64_t cumulative = 0;
+	for(unsigned int b=0;b<ZT_METRICS_CRYPTO_TIME_BUCKETS;++b) {
+		cumulative += m.cryptoTimeBuckets[b];
+		Utils::snprintf(tmp,sizeof(tmp),"zt_crypto_seconds_bucket{le=\"%.9f\"} %llu\n",(double)(256ULL << b) / 1000000000.0,(unsigned long long)cumulative);
+		buf.append(tmp);
+	}
+	Utils::snprintf(tmp,sizeof(tmp),"zt_crypto_seconds_bucket{le=\"+Inf\"} %llu\nzt_crypto_seconds_sum %.9f\nzt_crypto_seconds_count %llu\n",(unsigned long long)m.cryptoTimeCount,(double)m.cryptoTimeSum / 1000000000.0,(unsigned long long)m.cryptoTimeCount);
+	buf.append(tmp);
+
+	buf.append("# HELP zt_credential_verifications_total Credential signature checks, labeled by whether the verification cache answered\n# TYPE zt_credential_verifications_total counter\n");
+	Utils::snprintf(tmp,sizeof(tmp),"zt_credential_verifications_total{cached=\"false\"} %llu\nzt_credential_verifications_total{cached=\"true\"} %llu\n",(unsigned long long)m.credentialVerifications,(unsigned long long)m.credentialVerificationsCached);
+	buf.append(tmp);
+
+	Utils::snprintf(tmp,sizeof(tmp),"# HELP zt_whois_queue_depth Addresses with outstanding WHOIS requests\n# TYPE zt_whois_queue_depth gauge\nzt_whois_queue_depth %u\n",m.whoisQueueDepth);
+	buf.append(tmp);
+	Utils::snprintf(tmp,sizeof(tmp),"# HELP zt_rx_queue_occupancy Live entries in the fragment reassembly queue\n# TYPE zt_rx_queue_occupancy gauge\nzt_rx_queue_occupancy %u\n",m.rxQueueOccupancy);
+	buf.append(tmp);
+	Utils::snprintf(tmp,sizeof(tmp),"# HELP zt_rx_queue_capacity Size of the fragment reassembly queue\n# TYPE zt_rx_queue_capacity gauge\nzt_rx_queue_capacity %u\n",m.rxQueueCapacity);
+	buf.append(tmp);
+}
+
+static void _traceToJson(nlohmann::json &tj,const ZT_TraceEventList *el)
+{
+	static const char *const stages[] = { "rx_wire","rx_decode","rx_authenticated","rx_filtered","rx_tap","tx_tap","tx_filtered","tx_armored","tx_wire" };
+	char tmp[64];
+
+	tj["sampleRate"] = el->sampleRate;
+	tj["totalEvents"] = el->totalEvents;
+
+	// Events arrive in timestamp order; group them by packet so each packet's
+	// stages read as offsets from the first time it was seen here.
+	std::map< uint64_t,std::pair<unsigned long,uint64_t> > byId; // packet ID -> (index in packets, first timestamp)
+	nlohmann::json packets = nlohmann::json::array();
+	for(unsigned long i=0;i<el->eventCount;++i) {
+		const ZT_TraceEvent &e = el->events[i];
+		std::map< uint64_t,std::pair<unsigned long,uint64_t> >::iterator p(byId.find(e.packetId));
+		if (p == byId.end()) {
+			p = byId.insert(std::pair< uint64_t,std::pair<unsigned long,uint64_t> >(e.packetId,std::pair<unsigned long,uint64_t>((unsigned long)packets.size(),e.timestamp))).first;
+			nlohmann::json pj;
+			Utils::snprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)e.packetId);
+			pj["id"] = tmp;
+			pj["timestamp"] = e.timestamp;
+			pj["stages"] = nlohmann::json::array();
+			packets.push_back(pj);
+		}
+		nlohmann::json &pj = packets[p->second.first];
+		nlohmann::json sj;
+		sj["stage"] = (e.stage < (sizeof(stages) / sizeof(stages[0]))) ? stages[e.stage] : "unknown";
+		sj["ns"] = e.timestamp - p->second.second;
+		sj["arg"] = e.arg;
+		pj["stages"].push_back(sj);
+		pj["totalNs"] = e.timestamp - p->second.second;
+	}
+	tj["packets"] = packets;
+}
+
 class OneServiceImpl;
 
 static int SnodeVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf);
@@ -296,6 +416,7 @@ static void SnodeEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event
 static long SnodeDataStoreGetFunction(ZT_Node *node,void *uptr,void *tptr,const char *name,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize);
 static int SnodeDataStorePutFunction(ZT_Node *node,void *uptr,void *tptr,const char *name,const void *data,unsigned long len,int secure);
 static int SnodeWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl);
+static int SnodeWirePacketSendDontFragmentFunction(ZT_Node *node,void *uptr,void *tptr,const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl);
 static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,const struct sockaddr_storage *localAddr,const struct sockaddr_storage *remoteAddr);
 static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result);
@@ -343,6 +464,35 @@ static const struct http_parser_settings HTTP_PARSER_SETTINGS = {
 };
 #endif
 
+struct TcpConnection;
+
+/**
+ * A control plane request queued for the HTTP executor thread
+ *
+ * Request fields are moved out of the connection so the connection can go
+ * on parsing pipelined requests while this one is handled.
+ */
+struct HttpRequest
+{
+	TcpConnection *tc;
+	InetAddress from;
+	unsigned int method;
+	bool keepAlive;
+	std::string url;
+	std::map< std::string,std::string > headers;
+	std::string body;
+	std::string response; // complete response including headers, set by executor
+};
+
+/**
+ * Thread target for the data store write-behind thread
+ */
+struct DataStoreWriter
+{
+	OneServiceImpl *parent;
+	void threadMain() throw();
+};
+
 struct TcpConnection
 {
 	enum {
@@ -369,6 +519,9 @@ struct TcpConnection
 
 	std::string writeBuf;
 	Mutex writeBuf_m;
+
+	unsigned int pendingRequests; // requests handed to executor, only touched by main thread
+	bool closed; // closed but not deleted since requests are still pending
 };
 
 // Used to pseudo-randomize local source port picking
@@ -382,9 +535,12 @@ public:
 	const std::string _homePath;
 	std::string _authToken;
 	std::string _controllerDbPath;
+	unsigned int _controllerThreads; // local.conf settings
+	bool _controllerDbSync;
 	EmbeddedNetworkController *_controller;
 	Phy<OneServiceImpl *> _phy;
 	Node *_node;
+	IdentityStore _identityStore; // replaces iddb.d/ if it can be opened
 	SoftwareUpdater *_updater;
 	bool _updateAutoApply;
 	unsigned int _primaryPort;
@@ -457,6 +613,37 @@ public:
 	std::set< TcpConnection * > _tcpConnections; // no mutex for this since it's done in the main loop thread only
 	TcpConnection *_tcpFallbackTunnel;
 
+	// Control plane requests are handled by an executor thread so that slow
+	// responses (e.g. big /peer dumps) don't stall packet I/O. There is only
+	// one executor, which keeps responses to pipelined requests in order.
+	BlockingQueue<HttpRequest *> _httpRequests; // null pointer stops executor
+	std::vector<HttpRequest *> _httpResponses;
+	Mutex _httpResponses_m;
+	Thread _httpThread;
+	bool _httpThreadRunning;
+
+	// Data store writes are queued and done by a write-behind thread so the
+	// core never waits on the disk. Writes to the same object coalesce, and
+	// reads check the queue first so the core always sees its own writes.
+	struct PendingWrite
+	{
+		PendingWrite() : seq(0),secure(false),del(false) {}
+		uint64_t seq;
+		std::string data;
+		bool secure;
+		bool del;
+	};
+	std::map< std::string,PendingWrite > _pendingWrites;
+	uint64_t _pendingWriteSeq;
+	Mutex _pendingWrites_m;
+	BlockingQueue<bool> _dataStoreWakeups; // false stops writer
+	DataStoreWriter _dataStoreWriter;
+	Thread _dataStoreThread;
+	bool _dataStoreThreadRunning;
+
+	// Set by dumpTrace(), possibly from a signal handler
+	volatile bool _traceDumpRequested;
+
 	// Termination status information
 	ReasonForTermination _termReason;
 	std::string _fatalErrorMessage;
@@ -484,6 +671,8 @@ public:
 	OneServiceImpl(const char *hp,unsigned int port) :
 		_homePath((hp) ? hp : ".")
 		,_controllerDbPath(_homePath + ZT_PATH_SEPARATOR_S ZT_CONTROLLER_DB_PATH)
+		,_controllerThreads(0)
+		,_controllerDbSync(false)
 		,_controller((EmbeddedNetworkController *)0)
 		,_phy(this,false,true)
 		,_node((Node *)0)
@@ -499,6 +688,10 @@ public:
 		,_lastRestart(0)
 		,_nextBackgroundTaskDeadline(0)
 		,_tcpFallbackTunnel((TcpConnection *)0)
+		,_httpThreadRunning(false)
+		,_pendingWriteSeq(0)
+		,_dataStoreThreadRunning(false)
+		,_traceDumpRequested(false)
 		,_termReason(ONE_STILL_RUNNING)
 		,_portMappingEnabled(true)
 #ifdef ZT_USE_MINIUPNPC
@@ -514,10 +707,14 @@ public:
 		_ports[0] = 0;
 		_ports[1] = 0;
 		_ports[2] = 0;
+		_dataStoreWriter.parent = this;
 	}
 
 	virtual ~OneServiceImpl()
 	{
+		// run() can return early (e.g. if the control port can't be bound)
+		_stopDataStoreWriter();
+
 		for(int i=0;i<3;++i)
 			_bindings[i].closeAll(_phy);
 
@@ -560,13 +757,42 @@ public:
 				_authToken = _trimString(_authToken);
 			}
 
-			// Clean up any legacy files if present
-			OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S "peers.save").c_str());
+			// Clean up any legacy files if present (peers.save is now the core's peer snapshot, old ones are ignored)
 			OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S "world").c_str());
 
+			// Keep other peers' identities in one mapped file instead of one file each, importing any old iddb.d
+			if (_identityStore.open((_homePath + ZT_PATH_SEPARATOR_S "iddb.dat").c_str())) {
+				const std::string iddbPath(_homePath + ZT_PATH_SEPARATOR_S "iddb.d");
+				std::vector<std::string> iddb(OSUtils::listDirectory(iddbPath.c_str()));
+				if (!iddb.empty()) {
+					for(std::vector<std::string>::iterator f(iddb.begin());f!=iddb.end();++f) {
+						const std::string fp(iddbPath + ZT_PATH_SEPARATOR_S + *f);
+						std::string ids;
+						if ((f->length() == ZT_ADDRESS_LENGTH_HEX)&&(OSUtils::readFile(fp.c_str(),ids))) {
+							uint64_t ts = OSUtils::getLastModified(fp.c_str());
+							if (!ts)
+								ts = OSUtils::now();
+							_identityStore.put(Utils::hexStrToU64(f->c_str()),ids.data(),(unsigned int)ids.length(),ts);
+						}
+					}
+					OSUtils::rmDashRf(iddbPath.c_str());
+				}
+			}
+
+			// On first start generate our identity on all cores instead of letting Node do it on one
+			if (!OSUtils::fileExists((_homePath + ZT_PATH_SEPARATOR_S "identity.secret").c_str())) {
+				IdentityGenerator idgen;
+				const std::vector<Identity> ids(idgen.generate(1));
+				if (!ids.empty()) {
+					const std::string idser(ids.front().toString(true));
+					_dataStoreWrite("identity.secret",idser.data(),(unsigned long)idser.length(),1);
+				}
+			}
+
 			{
 				struct ZT_Node_Callbacks cb;
-				cb.version = 0;
+				memset(&cb,0,sizeof(cb));
+				cb.version = 2;
 				cb.dataStoreGetFunction = SnodeDataStoreGetFunction;
 				cb.dataStorePutFunction = SnodeDataStorePutFunction;
 				cb.wirePacketSendFunction = SnodeWirePacketSendFunction;
@@ -575,9 +801,14 @@ public:
 				cb.eventCallback = SnodeEventCallback;
 				cb.pathCheckFunction = SnodePathCheckFunction;
 				cb.pathLookupFunction = SnodePathLookupFunction;
+				cb.wirePacketSendDontFragmentFunction = SnodeWirePacketSendDontFragmentFunction;
 				_node = new Node(this,(void *)0,&cb,OSUtils::now());
 			}
 
+			// Node writes its identity synchronously on startup, after that writes are queued
+			_dataStoreThread = Thread::start(&_dataStoreWriter);
+			_dataStoreThreadRunning = true;
+
 			// Read local configuration
 			{
 				uint64_t trustedPathIds[ZT_MAX_TRUSTED_PATHS];
@@ -749,7 +980,7 @@ public:
 			for(int i=0;i<3;++i)
 				_portsBE[i] = Utils::hton((uint16_t)_ports[i]);
 
-			_controller = new EmbeddedNetworkController(_node,_controllerDbPath.c_str());
+			_controller = new EmbeddedNetworkController(_node,_controllerDbPath.c_str(),_controllerThreads,_controllerDbSync);
 			_node->setNetconfMaster((void *)_controller);
 
 #ifdef ZT_ENABLE_CLUSTER
@@ -826,6 +1057,9 @@ public:
 			uint64_t lastUpdateCheck = clockShouldBe;
 			uint64_t lastLocalInterfaceAddressCheck = (clockShouldBe - ZT_LOCAL_INTERFACE_CHECK_INTERVAL) + 15000; // do this in 15s to give portmapper time to configure and other things time to settle
 			uint64_t lastCleanedIddb = 0;
+			uint64_t lastHttpIdleCheck = clockShouldBe;
+			_httpThread = Thread::start(this);
+			_httpThreadRunning = true;
 			for(;;) {
 				_run_m.lock();
 				if (!_run) {
@@ -840,10 +1074,41 @@ public:
 
 				const uint64_t now = OSUtils::now();
 
-				// Clean iddb.d on start and every 24 hours
+				// Send any control plane responses completed by the HTTP executor
+				_sendHttpResponses();
+
+				if (_traceDumpRequested) {
+					_traceDumpRequested = false;
+					ZT_TraceEventList *el = _node->traceEvents();
+					if (el) {
+						json tj;
+						_traceToJson(tj,el);
+						_node->freeQueryResult((void *)el);
+						OSUtils::writeFile((_homePath + ZT_PATH_SEPARATOR_S "trace.json").c_str(),OSUtils::jsonDump(tj));
+					}
+				}
+
+				// Close keep-alive control plane connections that have gone idle
+				if ((now - lastHttpIdleCheck) >= (ZT_HTTP_KEEPALIVE_TIMEOUT / 4)) {
+					lastHttpIdleCheck = now;
+					std::vector<PhySocket *> idle;
+					for(std::set<TcpConnection *>::const_iterator c(_tcpConnections.begin());c!=_tcpConnections.end();++c) {
+						if (((*c)->type == TcpConnection::TCP_HTTP_INCOMING)&&(!(*c)->pendingRequests)&&((now - (*c)->lastActivity) > ZT_HTTP_KEEPALIVE_TIMEOUT)) {
+							Mutex::Lock _l((*c)->writeBuf_m);
+							if (!(*c)->writeBuf.length())
+								idle.push_back((*c)->sock);
+						}
+					}
+					for(std::vector<PhySocket *>::const_iterator s(idle.begin());s!=idle.end();++s)
+						_phy.close(*s);
+				}
+
+				// Clean identity store (or iddb.d) on start and every 24 hours
 				if ((now - lastCleanedIddb) > 86400000) {
 					lastCleanedIddb = now;
-					OSUtils::cleanDirectory((_homePath + ZT_PATH_SEPARATOR_S "iddb.d").c_str(),now - ZT_IDDB_CLEANUP_AGE);
+					if (_identityStore.isOpen())
+						_identityStore.clean(now - ZT_IDDB_CLEANUP_AGE);
+					else OSUtils::cleanDirectory((_homePath + ZT_PATH_SEPARATOR_S "iddb.d").c_str(),now - ZT_IDDB_CLEANUP_AGE);
 				}
 
 				// Attempt to detect sleep/wake events by detecting delay overruns
@@ -933,6 +1198,13 @@ public:
 			_fatalErrorMessage = "unexpected exception in main thread";
 		}
 
+		if (_httpThreadRunning) {
+			_httpRequests.post((HttpRequest *)0);
+			Thread::join(_httpThread);
+			_httpThreadRunning = false;
+			_sendHttpResponses();
+		}
+
 		try {
 			while (!_tcpConnections.empty())
 				_phy.close((*_tcpConnections.begin())->sock);
@@ -950,6 +1222,8 @@ public:
 		delete _node;
 		_node = (Node *)0;
 
+		_stopDataStoreWriter();
+
 		return _termReason;
 	}
 
@@ -982,6 +1256,12 @@ public:
 		_phy.whack();
 	}
 
+	virtual void dumpTrace()
+	{
+		_traceDumpRequested = true;
+		_phy.whack();
+	}
+
 	virtual bool getNetworkSettings(const uint64_t nwid,NetworkSettings &settings) const
 	{
 		Mutex::Lock _l(_nets_m);
@@ -1178,6 +1458,19 @@ public:
 #endif
 
 					scode = 200;
+				} else if (ps[0] == "metrics") {
+					ZT_Metrics m;
+					_node->metrics(&m);
+					_metricsToText(responseBody,m);
+					responseContentType = "text/plain; version=0.0.4";
+					scode = 200;
+				} else if (ps[0] == "trace") {
+					ZT_TraceEventList *el = _node->traceEvents();
+					if (el) {
+						_traceToJson(res,el);
+						_node->freeQueryResult((void *)el);
+						scode = 200;
+					} else scode = 500;
 				} else if (ps[0] == "moon") {
 					std::vector<World> moons(_node->moons());
 					if (ps.size() == 1) {
@@ -1525,6 +1818,18 @@ public:
 			}
 		}
 
+		_controllerThreads = (unsigned int)OSUtils::jsonInt(settings["controllerThreads"],0ULL);
+		if (_node) {
+			_node->setTraceSampleRate((unsigned int)OSUtils::jsonInt(settings["traceSampleRate"],(uint64_t)ZT_TRACE_DEFAULT_SAMPLE_RATE));
+			const std::string mp(OSUtils::jsonString(settings["multipath"],"none"));
+			if (mp == "balance")
+				_node->setMultipathMode(ZT_MULTIPATH_BALANCE);
+			else if (mp == "duplicate-ef")
+				_node->setMultipathMode(ZT_MULTIPATH_BALANCE_DUPLICATE_EF);
+			else _node->setMultipathMode(ZT_MULTIPATH_NONE);
+		}
+		_controllerDbSync = OSUtils::jsonBool(settings["controllerDbSync"],false);
+
 		json &controllerDbHttpHost = settings["controllerDbHttpHost"];
 		json &controllerDbHttpPort = settings["controllerDbHttpPort"];
 		json &controllerDbHttpPath = settings["controllerDbHttpPath"];
@@ -1752,6 +2057,8 @@ public:
 		tc->lastActivity = OSUtils::now();
 		// HTTP stuff is not used
 		tc->writeBuf = "";
+		tc->pendingRequests = 0;
+		tc->closed = false;
 		*uptr = (void *)tc;
 
 		// Send "hello" message
@@ -1793,6 +2100,8 @@ public:
 			tc->headers.clear();
 			tc->body = "";
 			tc->writeBuf = "";
+			tc->pendingRequests = 0;
+			tc->closed = false;
 			*uptrN = (void *)tc;
 		}
 	}
@@ -1804,7 +2113,9 @@ public:
 			if (tc == _tcpFallbackTunnel)
 				_tcpFallbackTunnel = (TcpConnection *)0;
 			_tcpConnections.erase(tc);
-			delete tc;
+			if (tc->pendingRequests) // deleted in _sendHttpResponses() when executor is done with it
+				tc->closed = true;
+			else delete tc;
 		}
 	}
 
@@ -1815,9 +2126,14 @@ public:
 
 			case TcpConnection::TCP_HTTP_INCOMING:
 			case TcpConnection::TCP_HTTP_OUTGOING:
+				tc->lastActivity = OSUtils::now();
 				http_parser_execute(&(tc->parser),&HTTP_PARSER_SETTINGS,(const char *)data,len);
 				if ((tc->parser.upgrade)||(tc->parser.http_errno != HPE_OK)) {
-					_phy.close(sock);
+					// Data after a "Connection: close" request is also an error, so
+					// let any responses still being worked on go out first.
+					if (tc->pendingRequests)
+						tc->shouldKeepAlive = false;
+					else _phy.close(sock);
 					return;
 				}
 				break;
@@ -1910,7 +2226,7 @@ public:
 				if ((unsigned long)sent >= (unsigned long)tc->writeBuf.length()) {
 					tc->writeBuf = "";
 					_phy.setNotifyWritable(sock,false);
-					if (!tc->shouldKeepAlive)
+					if ((!tc->shouldKeepAlive)&&(!tc->pendingRequests))
 						_phy.close(sock); // will call close handler to delete from _tcpConnections
 				} else {
 					tc->writeBuf = tc->writeBuf.substr(sent);
@@ -2080,6 +2396,27 @@ public:
 
 	inline long nodeDataStoreGetFunction(const char *name,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize)
 	{
+		uint64_t ida;
+		if ((_identityStore.isOpen())&&(_identityStoreAddress(name,ida)))
+			return _identityStore.get(ida,buf,bufSize,readIndex,totalSize);
+
+		{
+			Mutex::Lock _l(_pendingWrites_m);
+			std::map< std::string,PendingWrite >::const_iterator pw(_pendingWrites.find(std::string(name)));
+			if (pw != _pendingWrites.end()) {
+				if (pw->second.del)
+					return -1;
+				*totalSize = (unsigned long)pw->second.data.length();
+				if (readIndex >= pw->second.data.length())
+					return 0;
+				unsigned long n = (unsigned long)pw->second.data.length() - readIndex;
+				if (n > bufSize)
+					n = bufSize;
+				memcpy(buf,pw->second.data.data() + readIndex,n);
+				return (long)n;
+			}
+		}
+
 		std::string p(_dataStorePrepPath(name));
 		if (!p.length())
 			return -2;
@@ -2107,6 +2444,82 @@ public:
 	}
 
 	inline int nodeDataStorePutFunction(const char *name,const void *data,unsigned long len,int secure)
+	{
+		uint64_t ida;
+		if ((_identityStore.isOpen())&&(_identityStoreAddress(name,ida))) {
+			if (!data) {
+				_identityStore.erase(ida);
+				return 0;
+			}
+			return (_identityStore.put(ida,data,(unsigned int)len,OSUtils::now()) ? 0 : -1);
+		}
+
+		if (_dataStoreThreadRunning) {
+			if (strstr(name,".."))
+				return -2; // same check as _dataStorePrepPath(), which we don't call here since it creates directories
+			bool wake;
+			{
+				Mutex::Lock _l(_pendingWrites_m);
+				PendingWrite &pw = _pendingWrites[std::string(name)];
+				wake = (pw.seq == 0); // already queued writes will pick up the new data
+				pw.seq = ++_pendingWriteSeq;
+				pw.secure = (secure != 0);
+				pw.del = (data == (const void *)0);
+				if (data)
+					pw.data.assign((const char *)data,len);
+				else pw.data.clear();
+			}
+			if (wake)
+				_dataStoreWakeups.post(true);
+			return 0;
+		}
+
+		return _dataStoreWrite(name,data,len,secure);
+	}
+
+	// Stop the write-behind thread once it has written everything queued
+	inline void _stopDataStoreWriter()
+	{
+		if (_dataStoreThreadRunning) {
+			_dataStoreWakeups.post(false); // writer drains the queue before exiting
+			Thread::join(_dataStoreThread);
+			_dataStoreThreadRunning = false;
+		}
+	}
+
+	// Called in write-behind thread
+	void dataStoreWriterMain()
+		throw()
+	{
+		for(;;) {
+			const bool run = _dataStoreWakeups.get();
+			for(;;) {
+				std::string name;
+				PendingWrite pw;
+				{
+					Mutex::Lock _l(_pendingWrites_m);
+					if (_pendingWrites.empty())
+						break;
+					name = _pendingWrites.begin()->first;
+					pw = _pendingWrites.begin()->second;
+				}
+
+				if (_dataStoreWrite(name.c_str(),(pw.del) ? (const void *)0 : (const void *)pw.data.data(),(unsigned long)pw.data.length(),(int)pw.secure) != 0)
+					fprintf(stderr,"WARNING: unable to write %s to data store" ZT_EOL_S,name.c_str());
+
+				{	// leave it queued if it was changed while we were writing it
+					Mutex::Lock _l(_pendingWrites_m);
+					std::map< std::string,PendingWrite >::iterator i(_pendingWrites.find(name));
+					if ((i != _pendingWrites.end())&&(i->second.seq == pw.seq))
+						_pendingWrites.erase(i);
+				}
+			}
+			if (!run)
+				break;
+		}
+	}
+
+	inline int _dataStoreWrite(const char *name,const void *data,unsigned long len,int secure)
 	{
 		std::string p(_dataStorePrepPath(name));
 		if (!p.length())
@@ -2132,7 +2545,7 @@ public:
 		}
 	}
 
-	inline int nodeWirePacketSendFunction(const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+	inline int nodeWirePacketSendFunction(const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl,int dontFragment)
 	{
 		unsigned int fromBindingNo = 0;
 
@@ -2152,8 +2565,9 @@ public:
 			}
 
 #ifdef ZT_TCP_FALLBACK_RELAY
-			// TCP fallback tunnel support, currently IPv4 only
-			if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(addr)->ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
+			// TCP fallback tunnel support, currently IPv4 only (path MTU probes are
+			// not tunneled since the relay would fragment them)
+			if ((len >= 16)&&(!dontFragment)&&(reinterpret_cast<const InetAddress *>(addr)->ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
 				// Engage TCP tunnel fallback if we haven't received anything valid from a global
 				// IP address in ZT_TCP_FALLBACK_AFTER milliseconds. If we do start getting
 				// valid direct traffic we'll stop using it and close the socket after a while.
@@ -2199,7 +2613,7 @@ public:
 			return 0; // silently break UDP
 #endif
 
-		return (_bindings[fromBindingNo].udpSend(_phy,*(reinterpret_cast<const InetAddress *>(localAddr)),*(reinterpret_cast<const InetAddress *>(addr)),data,len,ttl)) ? 0 : -1;
+		return (_bindings[fromBindingNo].udpSend(_phy,*(reinterpret_cast<const InetAddress *>(localAddr)),*(reinterpret_cast<const InetAddress *>(addr)),data,len,ttl,(dontFragment != 0))) ? 0 : -1;
 	}
 
 	inline void nodeVirtualNetworkFrameFunction(uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
@@ -2284,6 +2698,43 @@ public:
 	}
 
 	inline void onHttpRequestToServer(TcpConnection *tc)
+	{
+		// Anything after a request that did not ask for keep-alive is ignored
+		if ((!tc->shouldKeepAlive)&&(tc->pendingRequests))
+			return;
+		tc->shouldKeepAlive = (http_should_keep_alive(&(tc->parser)) != 0);
+
+		HttpRequest *const r = new HttpRequest();
+		r->tc = tc;
+		r->from = tc->from;
+		r->method = tc->parser.method;
+		r->keepAlive = tc->shouldKeepAlive;
+		r->url.swap(tc->url);
+		r->headers.swap(tc->headers);
+		r->body.swap(tc->body);
+		++tc->pendingRequests;
+		_httpRequests.post(r);
+	}
+
+	// Control plane executor thread main loop
+	void threadMain()
+		throw()
+	{
+		for(;;) {
+			HttpRequest *const r = _httpRequests.get();
+			if (!r)
+				break;
+			_handleHttpRequest(*r);
+			{
+				Mutex::Lock _l(_httpResponses_m);
+				_httpResponses.push_back(r);
+			}
+			_phy.whack();
+		}
+	}
+
+	// Called in executor thread to handle a request and build its response
+	void _handleHttpRequest(HttpRequest &r)
 	{
 		char tmpn[256];
 		std::string data;
@@ -2294,11 +2745,11 @@ public:
 		{
 			Mutex::Lock _l(_localConfig_m);
 			if (_allowManagementFrom.size() == 0) {
-				allow = (tc->from.ipScope() == InetAddress::IP_SCOPE_LOOPBACK);
+				allow = (r.from.ipScope() == InetAddress::IP_SCOPE_LOOPBACK);
 			} else {
 				allow = false;
 				for(std::vector<InetAddress>::const_iterator i(_allowManagementFrom.begin());i!=_allowManagementFrom.end();++i) {
-					if (i->containsAddress(tc->from)) {
+					if (i->containsAddress(r.from)) {
 						allow = true;
 						break;
 					}
@@ -2308,7 +2759,7 @@ public:
 
 		if (allow) {
 			try {
-				scode = handleControlPlaneHttpRequest(tc->from,tc->parser.method,tc->url,tc->headers,tc->body,data,contentType);
+				scode = handleControlPlaneHttpRequest(r.from,r.method,r.url,r.headers,r.body,data,contentType);
 			} catch (std::exception &exc) {
 				fprintf(stderr,"WARNING: unexpected exception processing control HTTP request: %s" ZT_EOL_S,exc.what());
 				scode = 500;
@@ -2334,21 +2785,42 @@ public:
 		}
 
 		Utils::snprintf(tmpn,sizeof(tmpn),"HTTP/1.1 %.3u %s\r\nCache-Control: no-cache\r\nPragma: no-cache\r\n",scode,scodestr);
+		r.response.assign(tmpn);
+		r.response.append("Content-Type: ");
+		r.response.append(contentType);
+		Utils::snprintf(tmpn,sizeof(tmpn),"\r\nContent-Length: %lu\r\n",(unsigned long)data.length());
+		r.response.append(tmpn);
+		if (!r.keepAlive)
+			r.response.append("Connection: close\r\n");
+		r.response.append("\r\n");
+		if (r.method != HTTP_HEAD)
+			r.response.append(data);
+	}
+
+	// Called in main thread to queue responses from executor for sending
+	void _sendHttpResponses()
+	{
+		std::vector<HttpRequest *> done;
 		{
-			Mutex::Lock _l(tc->writeBuf_m);
-			tc->writeBuf.assign(tmpn);
-			tc->writeBuf.append("Content-Type: ");
-			tc->writeBuf.append(contentType);
-			Utils::snprintf(tmpn,sizeof(tmpn),"\r\nContent-Length: %lu\r\n",(unsigned long)data.length());
-			tc->writeBuf.append(tmpn);
-			if (!tc->shouldKeepAlive)
-				tc->writeBuf.append("Connection: close\r\n");
-			tc->writeBuf.append("\r\n");
-			if (tc->parser.method != HTTP_HEAD)
-				tc->writeBuf.append(data);
+			Mutex::Lock _l(_httpResponses_m);
+			done.swap(_httpResponses);
+		}
+		for(std::vector<HttpRequest *>::const_iterator r(done.begin());r!=done.end();++r) {
+			TcpConnection *const tc = (*r)->tc;
+			--tc->pendingRequests;
+			if (tc->closed) {
+				if (!tc->pendingRequests)
+					delete tc;
+			} else {
+				{
+					Mutex::Lock _l(tc->writeBuf_m);
+					tc->writeBuf.append((*r)->response);
+				}
+				tc->lastActivity = OSUtils::now();
+				_phy.setNotifyWritable(tc->sock,true);
+			}
+			delete *r;
 		}
-
-		_phy.setNotifyWritable(tc->sock,true);
 	}
 
 	inline void onHttpResponseFromClient(TcpConnection *tc)
@@ -2398,6 +2870,22 @@ public:
 		return true;
 	}
 
+	// True if name is iddb.d/<10-digit hex address>, in which case address is set
+	static inline bool _identityStoreAddress(const char *name,uint64_t &address)
+	{
+		if (strncmp(name,"iddb.d/",7) != 0)
+			return false;
+		name += 7;
+		for(unsigned int i=0;i<ZT_ADDRESS_LENGTH_HEX;++i) {
+			if (!(((name[i] >= '0')&&(name[i] <= '9'))||((name[i] >= 'a')&&(name[i] <= 'f'))||((name[i] >= 'A')&&(name[i] <= 'F'))))
+				return false;
+		}
+		if (name[ZT_ADDRESS_LENGTH_HEX])
+			return false;
+		address = Utils::hexStrToU64(name);
+		return true;
+	}
+
 	std::string _dataStorePrepPath(const char *name) const
 	{
 		std::string p(_homePath);
@@ -2455,12 +2943,18 @@ static int SnodeVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeVirtualNetworkConfigFunction(nwid,nuptr,op,nwconf); }
 static void SnodeEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData)
 { reinterpret_cast<OneServiceImpl *>(uptr)->nodeEventCallback(event,metaData); }
+void DataStoreWriter::threadMain()
+	throw()
+{ parent->dataStoreWriterMain(); }
+
 static long SnodeDataStoreGetFunction(ZT_Node *node,void *uptr,void *tptr,const char *name,void *buf,unsigned long bufSize,unsigned long readIndex,unsigned long *totalSize)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeDataStoreGetFunction(name,buf,bufSize,readIndex,totalSize); }
 static int SnodeDataStorePutFunction(ZT_Node *node,void *uptr,void *tptr,const char *name,const void *data,unsigned long len,int secure)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeDataStorePutFunction(name,data,len,secure); }
 static int SnodeWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
-{ return reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketSendFunction(localAddr,addr,data,len,ttl); }
+{ return reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketSendFunction(localAddr,addr,data,len,ttl,0); }
+static int SnodeWirePacketSendDontFragmentFunction(ZT_Node *node,void *uptr,void *tptr,const struct sockaddr_storage *localAddr,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+{ return reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketSendFunction(localAddr,addr,data,len,ttl,1); }
 static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 { reinterpret_cast<OneServiceImpl *>(uptr)->nodeVirtualNetworkFrameFunction(nwid,nuptr,sourceMac,destMac,etherType,vlanId,data,len); }
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,const struct sockaddr_storage *localAddr,const struct sockaddr_storage *remoteAddr)
@@ -2565,8 +3059,9 @@ static int ShttpOnBody(http_parser *parser,const char *ptr,size_t length)
 static int ShttpOnMessageComplete(http_parser *parser)
 {
 	TcpConnection *tc = reinterpret_cast<TcpConnection *>(parser->data);
-	tc->shouldKeepAlive = (http_should_keep_alive(parser) != 0);
 	tc->lastActivity = OSUtils::now();
+	if (tc->type != TcpConnection::TCP_HTTP_INCOMING)
+		tc->shouldKeepAlive = (http_should_keep_alive(parser) != 0);
 	if (tc->type == TcpConnection::TCP_HTTP_INCOMING) {
 		tc->parent->onHttpRequestToServer(tc);
 	} else {
@@ -136,6 +136,14 @@ public:
 	 */
 	virtual void terminate() = 0;
 
+	/**
+	 * Write the packet trace ring to trace.json in the home path
+	 *
+	 * The dump is done by the main I/O loop, so this only sets a flag and
+	 * may be called from a signal handler.
+	 */
+	virtual void dumpTrace() = 0;
+
 	/**
 	 * Get local settings for a network
 	 *